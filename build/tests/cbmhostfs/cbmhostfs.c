@@ -103,11 +103,43 @@ static int hostfs_write ( BYTE channel, void *buffer_spec, int num )
 }
 
 
+/* Bulk transfer between an already open channel and the memory, with a single command.
+   to_channel: 0 = read from the channel into memory, 1 = write memory into the channel
+   Memory address is the linear address of the emulated RAM, for a C64 mode program it's simply the pointer.
+   Return value: number of bytes actually moved, or -1 on error (it's not an error if less bytes could be read!) */
+static int hostfs_bulk ( BYTE channel, void *buffer, unsigned int num, BYTE to_channel )
+{
+	unsigned int addr = (unsigned int)buffer;
+	BYTE status;
+	POKE(HOSTFSR0, 0x40 | (channel & 0xF));	// set channel (already open channel) number for communication
+	POKE(HOSTFSR0, 0x5C);			// reset the transferred bytes counter
+	POKE(HOSTFSR0, 0x60);			// start bulk transfer parameters
+	POKE(HOSTFSR1, addr & 0xFF);
+	POKE(HOSTFSR1, addr >> 8);
+	POKE(HOSTFSR1, 0);			// bank 0
+	POKE(HOSTFSR1, num & 0xFF);
+	POKE(HOSTFSR1, num >> 8);
+	POKE(HOSTFSR0, 0x70 | (to_channel & 1));	// do the transfer
+	status = PEEK(HOSTFSR0);
+	if (status & 128)
+		return -1;
+	if ((status & 64) && to_channel)
+		return -1;	// for write, the whole block must be written
+	POKE(HOSTFSR0, 0x58);			// query transferred bytes, low byte
+	addr = PEEK(HOSTFSR0);
+	POKE(HOSTFSR0, 0x59);			// ... high byte
+	return addr | (PEEK(HOSTFSR0) << 8);
+}
+
+
+
+
 
 
 static const char *TEST_FILE_NAME = "testfile"; // filename. BEWARE! currently emulator does not do conversion PETSII<->ASCII etc ......
 
 static BYTE buffer[256];
+static BYTE bulk_buffer[1000];
 
 
 
@@ -176,6 +208,42 @@ test2:
 	hostfs_close(3);
 	hostfs_close(4);
 
+	/* test-3: write a block with a single bulk transfer, then read it back the same way */
+
+	printf("Test#3: bulk write and read\n");
+	for (n = 0; n < sizeof bulk_buffer; n++)
+		bulk_buffer[n] = n * 7;
+	if (hostfs_open(5, "bulkfile", HOSTFS_OVERWRITE)) {
+		printf("Cannot create file bulkfile\n");
+		return 1;
+	}
+	ret = hostfs_bulk(5, bulk_buffer, sizeof bulk_buffer, 1);
+	hostfs_close(5);
+	printf("Bulk write retval: %d\n", ret);
+	if (ret != sizeof bulk_buffer) {
+		printf("Error writing file bulkfile\n");
+		return 1;
+	}
+	for (n = 0; n < sizeof bulk_buffer; n++)
+		bulk_buffer[n] = 0;
+	if (hostfs_open(5, "bulkfile", HOSTFS_READ)) {
+		printf("Cannot open file bulkfile\n");
+		return 1;
+	}
+	ret = hostfs_bulk(5, bulk_buffer, sizeof bulk_buffer, 0);
+	hostfs_close(5);
+	printf("Bulk read retval: %d\n", ret);
+	if (ret != sizeof bulk_buffer) {
+		printf("Error reading file bulkfile\n");
+		return 1;
+	}
+	for (n = 0; n < sizeof bulk_buffer; n++)
+		if (bulk_buffer[n] != (BYTE)(n * 7)) {
+			printf("Data mismatch at offset %d\n", n);
+			return 1;
+		}
+	printf("Bulk data is OK\n");
+
 	printf("END :-)\n");
 	return 0;
 }
@@ -1,5 +1,6 @@
 ; Test program for Xemu/CBMhostFS, easily can be compiled with cl65 -t none
-; This porgram only hooks on the LOAD kernal vector!
+; This porgram only hooks on the LOAD and SAVE kernal vectors!
+; The file data itself is moved with the bulk transfer commands (6 and 7) of hostFS.
 ;
 ;   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
 ;
@@ -58,8 +59,9 @@ RELOCATED_FROM:
 ; SETLFS stores: $B8 = logical number, $BA = device number, $B9 = secondary address
 
 ; !!! TODO FIXME TODO FIXME TODO FIXME TODO FIXME !!!!
-; This is a naive implementation! Only LOAD is implemented in "once".
-; Buggy :( I couldn't load programs (at least not always ...) via HostFS to really work for some reason ...
+; This is a naive implementation! Only LOAD and SAVE are implemented in "once".
+; The bulk transfer writes the emulated RAM directly, so loading into $D000-$DFFF
+; goes into the RAM under the I/O area, not into the I/O registers.
 ; There is not even the usual SEARCHING FOR and LOADING messages that is (maybe this is a problem), since I don't call such a things.
 ; The code is not even optimal, and should use 65CE02 opcodes as well.
 ; Also, using $C000 memory area maybe is not the best idea.
@@ -126,21 +128,43 @@ end_of_file_name:
 use_file_load_spec:
 	STX	$AE		; store our pointer finally ...
 	STY	$AF
-	; Now the loader loop is here!!!!
+	; Reset the transferred bytes counter, so it won't count the load address
+	LDA	#$5C		; cmd-5: transferred bytes, reset after the query
+	STA	$D0FE
+	LDA	$D0FE		; the answer is not needed, just clear the status
+	; Now the whole file is loaded by a single bulk transfer, no loader loop!
 	; Since now we only support LOAD (not VERIFY), I even not care
-	; about ROM/RAM switching, as writing memory would "write through
-	; ROM to RAM".
-	LDY	#0
-loader_loop:
-	LDA	$D0FF		; read file
-	LDX	$D0FE		; check status (currently in Xemu, you MUST check this *AFTER* trying to read, if EOF, the read byte is invalid!)
-	BNE	end_of_loop	; break loop if status is not zero (let's check the status outside of the loop, EOF or error)
-	STA	($AE), Y	; write byte into memory
-	INC	$AE		; using "Y" and then adding after the loop would be faster, but who cares now
-	BNE	loader_loop
-	INC	$AF
-	BNE	loader_loop
-end_of_loop:
+	; about ROM/RAM switching, as bulk transfer writes the RAM anyway.
+	LDA	#$60		; cmd-6: bulk transfer parameters
+	STA	$D0FE
+	STX	$D0FF		; memory address, low byte
+	STY	$D0FF		; memory address, middle byte
+	LDA	#0
+	STA	$D0FF		; memory address, high byte (bank 0)
+	TXA			; length: till the end of the 64K, that is $10000 - address
+	EOR	#$FF
+	CLC
+	ADC	#1
+	STA	$D0FF		; length, low byte
+	TYA
+	EOR	#$FF
+	ADC	#0
+	STA	$D0FF		; length, high byte (zero means 64K)
+	LDA	#$70		; cmd-7: bulk read from the channel into memory
+	STA	$D0FE
+	LDX	$D0FE		; check status (EOF is normal here: the file is shorter than the rest of the memory)
+	; Advance the pointer with the number of bytes actually loaded
+	LDA	#$58		; cmd-5: transferred bytes, low byte
+	STA	$D0FE
+	LDA	$D0FE
+	CLC
+	ADC	$AE
+	STA	$AE
+	LDA	#$59		; cmd-5: transferred bytes, high byte
+	STA	$D0FE
+	LDA	$D0FE
+	ADC	$AF
+	STA	$AF
 	; Close Xemu HostFS channel
 	LDA	$B9
 	AND	#15
@@ -170,6 +194,92 @@ nodechi:
 .ENDPROC
 
 
+; SAVE. Save file. (Must call SETLFS and SETNAM beforehands.)
+; Real address: $F5DD (this uses vector $332 to jump to $F5ED by default after storing the
+; start address to $C1/$C2 and the end address, the first byte NOT to be saved, to $AE/$AF)
+
+.PROC xemu_save_routine
+	LDA	$BA		; device number set
+	CMP	#DEVICE		; compare with our "custom" device number
+	BEQ	new_save
+old_routine_address = * + 1
+	JMP	$FFFF
+the_error:
+	LDA	#4		; file not found (sorry, the wedge does not know better ...)
+	STA	$D02F		; disable VIC-III I/O mode (any byte will do)
+	SEC
+	RTS
+new_save:
+	LDA	#0
+	STA	$90		; I/O status byte zeroed
+	; Enable VIC-III I/O mode
+	LDA	#$A5
+	STA	$D02F
+	LDA	#$96
+	STA	$D02F
+	; Send file name was set by SETLFS before SAVE, with overwrite and write access
+	LDY	#0		; Sets Xemu hostFS to name specification mode
+	STY	$D0FE
+	LDA	#'@'
+	STA	$D0FF
+send_file_name:
+	CPY	$B7		; filename length
+	BEQ	end_of_file_name
+	LDA	($BB), Y
+	STA	$D0FF
+	INY
+	BNE	send_file_name
+end_of_file_name:
+	LDX	#0
+send_mode:
+	LDA	mode, X
+	BEQ	end_of_mode
+	STA	$D0FF
+	INX
+	BNE	send_mode
+end_of_mode:
+	LDA	#$11		; Send Xemu open request on channel 1 (the "prg writing" channel)
+	STA	$D0FE
+	LDX	$D0FE		; check Xemu status
+	BNE	the_error
+	LDA	#$41
+	STA	$D0FE		; Sets Xemu to "use channel" request mode
+	; Write the load address of the file
+	LDA	$C1
+	STA	$D0FF
+	LDA	$C2
+	STA	$D0FF
+	; Write the data with a single bulk transfer
+	LDA	#$60		; cmd-6: bulk transfer parameters
+	STA	$D0FE
+	LDA	$C1
+	STA	$D0FF		; memory address, low byte
+	LDA	$C2
+	STA	$D0FF		; memory address, middle byte
+	LDA	#0
+	STA	$D0FF		; memory address, high byte (bank 0)
+	SEC			; length: end - start
+	LDA	$AE
+	SBC	$C1
+	STA	$D0FF		; length, low byte
+	LDA	$AF
+	SBC	$C2
+	STA	$D0FF		; length, high byte
+	LDA	#$71		; cmd-7: bulk write from memory into the channel
+	STA	$D0FE
+	LDX	$D0FE		; check Xemu status
+	LDA	#$31
+	STA	$D0FE		; Xemu to close its channel
+	TXA
+	BNE	the_error
+	STA	$D02F		; turn VIC-III mode off (any byte will do it)
+	CLC			; no error
+	RTS
+mode:
+	.BYTE	",P,W",0
+.ENDPROC
+
+
 ; ****************************************************************************
 ;                                 L O A D E R
 ; ****************************************************************************
@@ -201,6 +311,14 @@ copy_sys:
 	STA	$330
 	LDA	#.HIBYTE(xemu_load_routine)
 	STA	$331
+	LDA	$332
+	STA	xemu_save_routine::old_routine_address
+	LDA	$333
+	STA	xemu_save_routine::old_routine_address + 1
+	LDA	#.LOBYTE(xemu_save_routine)
+	STA	$332
+	LDA	#.HIBYTE(xemu_save_routine)
+	STA	$333
 	CLI
 	STX	53281
 eol:
@@ -212,5 +330,5 @@ eol:
 eos:
 	RTS
 msg:
-	.BYTE	"WEDGE FOR LOAD INSTALLED",0
+	.BYTE	"WEDGE FOR LOAD AND SAVE INSTALLED",0
 .ENDPROC
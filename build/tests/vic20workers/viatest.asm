@@ -0,0 +1,126 @@
+; Test program for xvic20workers, easily can be compiled with cl65 -t none
+; See README.md about the way tests are run.
+;
+;   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+;
+; This program is free software; you can redistribute it and/or modify
+; it under the terms of the GNU General Public License as published by
+; the Free Software Foundation; either version 2 of the License, or
+; (at your option) any later version.
+;
+; This program is distributed in the hope that it will be useful,
+; but WITHOUT ANY WARRANTY; without even the implied warranty of
+; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+; GNU General Public License for more details.
+;
+; You should have received a copy of the GNU General Public License
+; along with this program; if not, write to the Free Software
+; Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+VIA1	= $9110		; its interrupt is wired to NMI
+VIA2	= $9120		; its interrupt is wired to IRQ
+T1CL	= 4
+T1CH	= 5
+T2CL	= 8
+T2CH	= 9
+ACR	= $B
+IFR	= $D
+IER	= $E
+
+TRAP	= $FC		; ends the test, A is the result
+
+.ORG $0FFE
+	.WORD start
+start:
+	SEI
+	CLD
+	LDX #$FF
+	TXS
+	LDA #<irq
+	STA $FFFE
+	LDA #>irq
+	STA $FFFF
+	LDA #<nmi
+	STA $FFFA
+	LDA #>nmi
+	STA $FFFB
+	LDA #0
+	STA irqs
+	STA nmis
+	; VIA-2 timer 1 in free running mode, with IRQ
+	LDA #$40
+	STA VIA2+ACR
+	LDA #<5000
+	STA VIA2+T1CL
+	LDA #>5000
+	STA VIA2+T1CH
+	LDA #$C0
+	STA VIA2+IER
+	; VIA-1 timer 2 in one-shot mode, with NMI
+	LDA #$A0
+	STA VIA1+IER
+	LDA #<20000
+	STA VIA1+T2CL
+	LDA #>20000
+	STA VIA1+T2CH
+	CLI
+wait:	LDA irqs	; idle loop: fast-forwarded till the next timer underflow
+	CMP #10
+	BNE wait
+	SEI
+	; check 1: exactly one NMI
+	LDA nmis
+	CMP #1
+	BEQ crunch_start
+	LDA #1
+	BNE exit
+	; check 2: sum of 0...255 is $7F80, calculated many times to give work to the CPU
+crunch_start:
+	LDY #200
+crunch:
+	LDA #0
+	STA sum
+	STA sum+1
+	TAX
+add:	TXA
+	CLC
+	ADC sum
+	STA sum
+	BCC no_carry
+	INC sum+1
+no_carry:
+	INX
+	BNE add
+	LDA sum
+	CMP #$80
+	BNE crunch_fail
+	LDA sum+1
+	CMP #$7F
+	BNE crunch_fail
+	DEY
+	BNE crunch
+	LDA #0
+	BEQ exit
+crunch_fail:
+	LDA #2
+exit:
+	.BYTE TRAP
+
+irq:
+	PHA
+	LDA VIA2+T1CL	; acknowledge the timer 1 interrupt
+	INC irqs
+	PLA
+	RTI
+
+nmi:
+	PHA
+	LDA #$20	; acknowledge the timer 2 interrupt
+	STA VIA1+IFR
+	INC nmis
+	PLA
+	RTI
+
+irqs:	.BYTE 0
+nmis:	.BYTE 0
+sum:	.WORD 0
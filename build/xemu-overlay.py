@@ -0,0 +1,57 @@
+#!/usr/bin/env python
+# -*- coding: UTF-8 -*-
+
+# Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+# Utility for the copy-on-write overlay (delta) files of disk images
+# created by Xemu (see xemu/disk_overlay.h for the format).
+# Usage:
+#	xemu-overlay.py info    DELTA-FILE
+#	xemu-overlay.py commit  DELTA-FILE IMAGE-FILE
+#	xemu-overlay.py discard DELTA-FILE
+
+from sys import argv, stderr, exit
+from os import remove
+import struct
+
+MAGIC = b"XEMU-OVL"
+VERSION = 1
+SECTOR_SIZE = 512
+
+
+def open_delta(fn):
+	f = open(fn, "rb")
+	header = f.read(SECTOR_SIZE)
+	if len(header) != SECTOR_SIZE or header[:8] != MAGIC or bytearray(header)[8] != VERSION:
+		raise IOError("not a valid Xemu overlay file: " + fn)
+	image_size, data_offset = struct.unpack(">QQ", header[16:32])
+	bitmap = bytearray(f.read(data_offset - SECTOR_SIZE))
+	sectors = [n for n in range(image_size // SECTOR_SIZE) if bitmap[n >> 3] & (1 << (n & 7))]
+	return f, image_size, data_offset, sectors
+
+
+if __name__ == "__main__":
+	if len(argv) < 3 or argv[1] not in ("info", "commit", "discard") or len(argv) != (4 if argv[1] == "commit" else 3):
+		stderr.write("Bad usage.\n")
+		exit(1)
+	try:
+		f, image_size, data_offset, sectors = open_delta(argv[2])
+		if argv[1] == "info":
+			print("Image size: {} bytes, {} sectors are modified".format(image_size, len(sectors)))
+		elif argv[1] == "commit":
+			with open(argv[3], "r+b") as img:
+				img.seek(0, 2)
+				if img.tell() != image_size:
+					raise IOError("image size does not match the overlay: " + argv[3])
+				for n in sectors:
+					f.seek(data_offset + n * SECTOR_SIZE)
+					img.seek(n * SECTOR_SIZE)
+					img.write(f.read(SECTOR_SIZE))
+			print("{} sectors have been committed into {}".format(len(sectors), argv[3]))
+		f.close()
+		if argv[1] in ("commit", "discard"):
+			remove(argv[2])
+	except (IOError, OSError) as a:
+		stderr.write("Error: " + str(a) + "\n")
+		exit(1)
+	exit(0)
@@ -20,6 +20,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "xemu/emutools.h"
 #include "xemu/f011_core.h"
 #include "c65_d81_image.h"
+#include "xemu/disk_overlay.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -29,24 +30,29 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 
 static int disk_fd = -1, disk_inserted = 0, read_only = 1;
+static struct disk_overlay_st overlay = { .fd = -1 };	// copy-on-write overlay of the image, if fd is not -1
+
+
+/* The whole image is kept in memory, so sector access is only a memory copy. Written
+   sectors are written back to the image (or to the overlay file) by the shared delayed
+   write-back of xemu/disk_overlay.c: periodically (by c65_d81_update() called on every
+   rendered frame), when the image is replaced and at exit. */
+#define D81_SECTORS		(D81_SIZE / 512)
+#define D81_FLUSH_FRAMES	25
+
+static Uint8 disk_image[D81_SIZE];
+static struct disk_writeback_st writeback = { .dirty_frames = -1 };
 
 
 int fdc_cb_rd_sec ( Uint8 *buffer, int offset )
 {
-	int ret;
 	if (offset < 0 || offset > D81_SIZE - 512 || (offset & 511))
 		FATAL("D81: invalid read offset: %d", offset);
 	if (disk_fd < 0)
 		FATAL("D81: not open");
 	if (!disk_inserted)
 		FATAL("D81: not inserted");
-	if (lseek(disk_fd, offset, SEEK_SET) != offset)
-		FATAL("D81: host-OS seek failure to %d: %s", offset, strerror(errno));
-	ret = read(disk_fd, buffer, 512);
-	if (ret < 0)
-		FATAL("D81: host-OS read failure: %s", strerror(errno));
-	if (ret != 512)
-		FATAL("D81: host-OS didn't read 512 bytes but %d", ret);
+	memcpy(buffer, disk_image + offset, 512);
 	return 0;
 }
 
@@ -55,7 +61,6 @@ int fdc_cb_rd_sec ( Uint8 *buffer, int offset )
 
 int fdc_cb_wr_sec ( Uint8 *buffer, int offset )
 {
-	int ret;
 	if (offset < 0 || offset > D81_SIZE - 512 || (offset & 511))
 		FATAL("D81: invalid read offset: %d", offset);
 	if (disk_fd < 0)
@@ -64,13 +69,38 @@ int fdc_cb_wr_sec ( Uint8 *buffer, int offset )
 		FATAL("D81: not inserted");
 	if (read_only)
 		FATAL("D81: read-only disk");
-	if (lseek(disk_fd, offset, SEEK_SET) != offset)
-		FATAL("D81: host-OS seek failure to %d: %s", offset, strerror(errno));
-	ret = write(disk_fd, buffer, 512);
-	if (ret < 0)
-		FATAL("D81: host-OS write failure: %s", strerror(errno));
-	if (ret != 512)
-		FATAL("D81: host-OS didn't write 512 bytes but %d", ret);
+	memcpy(disk_image + offset, buffer, 512);
+	disk_writeback_mark(&writeback, offset >> 9);
+	return 0;
+}
+
+
+
+void c65_d81_flush ( void )
+{
+	if (disk_writeback_flush(&writeback))
+		ERROR_WINDOW("D81: cannot write back modified sectors: %s\nWill retry silently.", strerror(errno));
+}
+
+
+
+void c65_d81_update ( void )
+{
+	if (disk_writeback_update(&writeback))
+		ERROR_WINDOW("D81: cannot write back modified sectors: %s\nWill retry silently.", strerror(errno));
+}
+
+
+
+static int load_image ( void )
+{
+	int sector;
+	if (lseek(disk_fd, 0, SEEK_SET) != 0 || read(disk_fd, disk_image, D81_SIZE) != D81_SIZE)
+		return -1;
+	if (overlay.fd >= 0)
+		for (sector = 0; sector < D81_SECTORS; sector++)
+			if (disk_overlay_has_sector(&overlay, sector << 9) && disk_overlay_read(&overlay, disk_fd, sector << 9, disk_image + (sector << 9)))
+				return -1;
 	return 0;
 }
 
@@ -78,6 +108,10 @@ int fdc_cb_wr_sec ( Uint8 *buffer, int offset )
 
 static void c65_d81_shutdown ( void )
 {
+	if (disk_fd >= 0)
+		c65_d81_flush();
+	disk_writeback_free(&writeback);
+	disk_overlay_close(&overlay);
 	if (disk_fd >= 0) {
 		printf("D81: disk image has been closed." NL);
 		close(disk_fd);
@@ -87,16 +121,31 @@ static void c65_d81_shutdown ( void )
 
 
 
-void c65_d81_init ( const char *dfn )
+void c65_d81_init ( const char *dfn, const char *ovlfn )
 {
 	atexit(c65_d81_shutdown);
 	fdc_init();
+	if (disk_fd >= 0) {
+		c65_d81_flush();
+		close(disk_fd);
+	}
 	disk_inserted = 0;
 	read_only = 1;
-	if (disk_fd >= 0)
-		close(disk_fd);
+	disk_writeback_free(&writeback);
 	disk_fd = -1;
-	if (dfn) {
+	disk_overlay_close(&overlay);
+	if (dfn && ovlfn) {
+		// with overlay, the image itself is only read, writes go into the overlay file
+		disk_fd = open(dfn, O_RDONLY|O_BINARY);
+		if (disk_fd >= 0) {
+			disk_inserted = 1;
+			if (disk_overlay_open(&overlay, ovlfn, D81_SIZE))
+				ERROR_WINDOW("Cannot use overlay file \"%s\", disk image is used in read-only mode", ovlfn);
+			else
+				read_only = 0;
+		} else
+			ERROR_WINDOW("Couldn't open disk image \"%s\": %s", dfn, strerror(errno));
+	} else if (dfn) {
 		// Note about O_BINARY: it's a windows stuff, it won't work without that.
 		// HOWEVER, O_BINARY defined as zero on non-win archs in one of my include headers, thus it won't bother us with the good OSes :)
 		disk_fd = open(dfn, O_RDWR|O_BINARY);	// First, try to open D81 file in read-write mode
@@ -120,6 +169,11 @@ void c65_d81_init ( const char *dfn )
 		if (size != D81_SIZE) {
 			ERROR_WINDOW("Image size is wrong, got %d, should be %d", (int)size, D81_SIZE);
 			disk_inserted = 0;
+			disk_overlay_close(&overlay);
+		} else if (load_image() || disk_writeback_init(&writeback, "D81", disk_image, D81_SECTORS, D81_FLUSH_FRAMES, disk_fd, &overlay)) {
+			ERROR_WINDOW("Cannot load disk image: %s", strerror(errno));
+			disk_inserted = 0;
+			disk_overlay_close(&overlay);
 		}
 	}
 	if (!disk_inserted) {
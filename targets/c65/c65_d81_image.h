@@ -18,6 +18,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #ifndef __XEMU_C65_D81_IMAGE_H_INCLUDED
 #define __XEMU_C65_D81_IMAGE_H_INCLUDED
 
-extern void c65_d81_init ( const char *dfn );
+extern void c65_d81_init   ( const char *dfn, const char *ovlfn );
+extern void c65_d81_flush  ( void );
+extern void c65_d81_update ( void );
 
 #endif
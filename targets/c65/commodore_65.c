@@ -23,6 +23,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "c65_d81_image.h"
 #include "xemu/f018_core.h"
 #include "xemu/emutools_hid.h"
+#include "xemu/input_record.h"
 #include "vic3.h"
 #include "xemu/uart_monitor.h"
 #include "xemu/sid.h"
@@ -30,6 +31,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "xemu/c64_kbd_mapping.h"
 #include "xemu/emutools_config.h"
 #include "c65_snapshot.h"
+#include "xemu/emutools_audiopace.h"
 
 
 
@@ -232,6 +234,7 @@ static void audio_callback(void *userdata, Uint8 *stream, int len)
 	// to get a stereo stream, wanted by SDL.
 	sid_render(&sids[1], ((short *)(stream)) + 0, len >> 1, 2);	// SID @ left
 	sid_render(&sids[0], ((short *)(stream)) + 1, len >> 1, 2);	// SID @ right
+	audiopace_consumed_samples(len >> 2);				// 2 channels * 16 bit samples
 }
 
 
@@ -258,6 +261,10 @@ static void c65_init ( int sid_cycles_per_sec, int sound_mix_freq )
 		VIRTUAL_SHIFT_POS,
 		SDL_ENABLE		// joy HID events enabled
 	);
+	if (inputrec_init(emucfg_get_str("inputrec"), emucfg_get_str("inputplay")))
+		FATAL("Cannot start input recording or replay, see the debug log");
+	if (emu_metrics_init(emucfg_get_bool("metrics"), emucfg_get_str("metricsfile"), emucfg_get_bool("metricsosd")))
+		FATAL("Cannot create the metrics stream file, see the debug log");
 	joystick_emu = 1;
 	nmi_level = 0;
 	// *** host-FS
@@ -266,6 +273,7 @@ static void c65_init ( int sid_cycles_per_sec, int sound_mix_freq )
 		hostfs_init(p, NULL);
 	else
 		hostfs_init(sdl_pref_dir, "hostfs");
+	hostfs_set_bulk_memory(memory, 0x20000);	// bulk transfers can access the 128K RAM only
 	// *** Init memory space
 	memset(memory, 0xFF, sizeof memory);
 	// *** Load ROM image
@@ -320,7 +328,7 @@ static void c65_init ( int sid_cycles_per_sec, int sound_mix_freq )
 	dma_set_phys_io_offset(0);
 	// Initialize FDC
 	fdc_init();
-	c65_d81_init(emucfg_get_str("8"));
+	c65_d81_init(emucfg_get_str("8"), emucfg_get_str("8ovl"));
 	// SIDs, plus SDL audio
 	sid_init(&sids[0], sid_cycles_per_sec, sound_mix_freq);
 	sid_init(&sids[1], sid_cycles_per_sec, sound_mix_freq);
@@ -343,6 +351,8 @@ static void c65_init ( int sid_cycles_per_sec, int sound_mix_freq )
 			ERROR_WINDOW("Audio parameter mismatches.");
 		}
 		DEBUG("AUDIO: initialized (#%d), %d Hz, %d channels, %d buffer sample size." NL, audio, audio_got.freq, audio_got.channels, audio_got.samples);
+		if (audio)
+			audiopace_init(audio, audio_got.freq, audio_got.samples, emucfg_get_num("audiopace"), NULL);
 	} else
 		ERROR_WINDOW("Cannot open audio device!");
 	// *** RESET CPU, also fetches the RESET vector into PC
@@ -637,6 +647,27 @@ Uint8 cpu_read ( Uint16 addr )
 
 
 
+#ifdef CPU_IDLE_LOOP_DETECTION
+// This function is called by the 65CE02 emulator to check if an idle loop can read the given address.
+// Memory and the VIC-III registers and the colour SRAM are allowed only: these have no side effects
+// on read, and the VIC registers can only change at scanline boundaries. CIA (timers, ICR), the F011
+// buffer port and the others are not.
+int cpu_idle_safe_read ( Uint16 addr )
+{
+	int phys_addr = addr_trans_rd[addr >> 12] + addr;
+	if (phys_addr < 0x10FF00)
+		return 1;
+	if (phys_addr < IO_REMAP_VIRTUAL)
+		return 0;
+	addr &= 0xFFF;
+	if (addr >= 0x800 && addr < ((vic3_registers[0x30] & 1) ? 0x1000 : 0xC00))
+		return 1;	// colour SRAM
+	return vic_new_mode ? addr < 0x80 : addr < 0x400;	// VIC-III registers (with mirrors in the old I/O mode)
+}
+#endif
+
+
+
 // This function is called by the 65CE02 emulator in case of writing a byte
 void cpu_write ( Uint16 addr, Uint8 data )
 {
@@ -725,6 +756,10 @@ int emu_callback_key ( int pos, SDL_Scancode key, int pressed, int handled )
 
 void update_emulator ( void )
 {
+	EMU_BENCH_SECTION(EMU_BENCH_IO);
+#ifdef UARTMON_SOCKET
+	inputrec_hold = paused;		// the monitor calls us while the emulation is paused, but no emulated frame passes
+#endif
 	hid_handle_all_sdl_events();
 	nmi_set(IS_RESTORE_PRESSED(), 2); // Custom handling of the restore key ...
 	emu_timekeeping_delay(40000);
@@ -737,6 +772,7 @@ void update_emulator ( void )
 #ifdef UARTMON_SOCKET
         uartmon_update();
 #endif
+	EMU_BENCH_SECTION(EMU_BENCH_CPU);
 }
 
 
@@ -752,10 +788,20 @@ int main ( int argc, char **argv )
         xemu_dump_version(stdout, "The Unusable Commodore 65 emulator from LGB");
        
 	emucfg_define_str_option("8", NULL, "Path of the D81 disk image to be attached");
+	emucfg_define_str_option("8ovl", NULL, "Use D81 image read-only, with writes going into this (created if needed) overlay file");
+	emucfg_define_num_option("audiopace", 0, "Use audio as master clock with this target latency in msecs (0=off)");
+	emucfg_define_num_option("bench", 0, "Benchmark: run headless and unthrottled for N frames, then print the results as JSON");
 	emucfg_define_num_option("dmarev", 0, "Revision of the DMAgic chip (0=F018A, other=F018B)");
 	emucfg_define_switch_option("fullscreen", "Start in fullscreen mode");
 	emucfg_define_str_option("hostfsdir", NULL, "Path of the directory to be used as Host-FS base");
 	//emucfg_define_switch_option("noaudio", "Disable audio");
+	emucfg_define_str_option("inputplay", NULL, "Replay input recorded by -inputrec from the given file (live input is ignored meanwhile)");
+	emucfg_define_str_option("inputrec", NULL, "Record input with emulated frame stamps into the given file");
+	emucfg_define_switch_option("metrics", "Collect per-frame performance metrics (see the 'p' command of the UART monitor)");
+	emucfg_define_str_option("metricsfile", NULL, "Stream per-frame performance metrics into this file (CSV, or JSON lines if the name ends with .json)");
+	emucfg_define_switch_option("metricsosd", "Show performance metrics (share of host time, rolling average) on the OSD");
+	emucfg_define_switch_option("noidleskip", "Disable detection and fast-forward of idle CPU loops");
+	emucfg_define_switch_option("precise", "Use high precision (sleep + spin) frame pacing");
 	emucfg_define_str_option("rom", "c65-system.rom", "Override system ROM path to be loaded");
         emucfg_define_str_option("exram","expansion-ram.dat", "Override system path and name for expansion-ram to be loaded");
 #ifdef XEMU_SNAPSHOT_SUPPORT
@@ -764,6 +810,7 @@ int main ( int argc, char **argv )
 #endif
 	if (emucfg_parse_commandline(argc, argv, NULL))
 		return 1;
+	emu_bench_init(emucfg_get_num("bench"), FAST_CPU_CYCLES_PER_SCANLINE * 312 * 50);	// must be before SDL init (headless mode)
 	/* Initiailize SDL - note, it must be before loading ROMs, as it depends on path info from SDL! */
         if (emu_init_sdl(
 		TARGET_DESC APP_DESC_APPEND,	// window title
@@ -792,6 +839,8 @@ int main ( int argc, char **argv )
 		SDL_PauseAudioDevice(audio, 0);
 	emu_set_full_screen(emucfg_get_bool("fullscreen"));
 	vic3_open_frame_access();
+	cpu_idle_detection = !emucfg_get_bool("noidleskip");
+	emu_set_precise_timing(emucfg_get_bool("precise"));
 	emu_timekeeping_start();
 	for (;;) {
 #ifdef UARTMON_SOCKET
@@ -806,14 +855,25 @@ int main ( int argc, char **argv )
                 }while (paused);
 #endif
 		cycles += cpu_step();
+		EMU_METRICS_COUNT(EMU_METRICS_INSNS, 1);
+		if (unlikely(cpu_idle_loop_cycles))	// idle loop: nothing can happen till the end of the scanline
+			cycles += cpu_idle_fast_forward(cpu_cycles_per_scanline - cycles);
 		if (cycles >= cpu_cycles_per_scanline) {
+			cpu_idle_reset();
+#ifdef UARTMON_SOCKET
+			if (unlikely(umon_bin_mode))	// binary transfer on the monitor: serve it faster than once per frame
+				uartmon_update();
+#endif
 			cia_tick(&cia1, 64);
 			cia_tick(&cia2, 64);
 			cycles -= cpu_cycles_per_scanline;
+			EMU_BENCH_SECTION(EMU_BENCH_VIDEO);
 			if (vic3_render_scanline()) {
 				if (frameskip) {
 					frameskip = 0;
+					EMU_BENCH_SECTION(EMU_BENCH_IO);
 					hostfs_flush_all();
+					c65_d81_update();
 				} else {
 					frameskip = 1;
 					emu_update_screen();
@@ -824,6 +884,7 @@ int main ( int argc, char **argv )
 				sids[0].sFrameCount++;
 				sids[1].sFrameCount++;
 			}
+			EMU_BENCH_SECTION(EMU_BENCH_CPU);
 			vic3_check_raster_interrupt();
 		}
 	}
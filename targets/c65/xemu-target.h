@@ -2,3 +2,4 @@
 #define TARGET_DESC "Commodore 65"
 #define CPU_65CE02
 #define XEMU_SNAPSHOT_SUPPORT "Commodore-65"
+#define CPU_IDLE_LOOP_DETECTION
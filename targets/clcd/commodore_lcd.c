@@ -30,6 +30,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 #include "xemu/emutools.h"
 #include "xemu/emutools_hid.h"
+#include "xemu/input_record.h"
 #include "xemu/emutools_config.h"
 #include "xemu/cpu65c02.h"
 #include "xemu/via65c22.h"
@@ -360,11 +361,14 @@ static void update_rtc ( void )
 
 static void update_emulator ( void )
 {
+	EMU_BENCH_SECTION(EMU_BENCH_VIDEO);
 	render_screen();
+	EMU_BENCH_SECTION(EMU_BENCH_IO);
 	hid_handle_all_sdl_events();
 	emu_timekeeping_delay(40000);	// 40000 microseconds would be the real time for a full TV frame (see main() for more info: CLCD is not TV based for real ...)
 	if (seconds_timer_trigger)
 		update_rtc();
+	EMU_BENCH_SECTION(EMU_BENCH_CPU);
 }
 
 
@@ -374,7 +378,13 @@ int main ( int argc, char **argv )
 {
 	int cycles;
 	xemu_dump_version(stdout, "The world's first Commodore LCD emulator from LGB");
+	emucfg_define_num_option("bench", 0, "Benchmark: run headless and unthrottled for N frames, then print the results as JSON");
 	emucfg_define_switch_option("fullscreen", "Start in fullscreen mode");
+	emucfg_define_str_option("inputplay", NULL, "Replay input recorded by -inputrec from the given file (live input is ignored meanwhile)");
+	emucfg_define_str_option("inputrec", NULL, "Record input with emulated frame stamps into the given file");
+	emucfg_define_str_option("metricsfile", NULL, "Stream per-frame performance metrics into this file (CSV, or JSON lines if the name ends with .json)");
+	emucfg_define_switch_option("metricsosd", "Show performance metrics (share of host time, rolling average) on the OSD");
+	emucfg_define_switch_option("precise", "Use high precision (sleep + spin) frame pacing");
 	emucfg_define_num_option("ram", 128, "Sets RAM size in KBytes.");
 	if (emucfg_parse_commandline(argc, argv, NULL))
 		return 1;
@@ -383,6 +393,7 @@ int main ( int argc, char **argv )
 		FATAL("Bad ram size is defined, must be 32...128");
 	ram_size <<= 10;
 	DEBUGPRINT("CFG: ram size is %d bytes." NL, ram_size);
+	emu_bench_init(emucfg_get_num("bench"), CPU_CLOCK);	// must be before SDL init (headless mode)
 	if (emu_init_sdl(
 		TARGET_DESC APP_DESC_APPEND,	// window title
 		APP_ORG, TARGET_NAME,		// app organization and name, used with SDL pref dir formation
@@ -404,6 +415,10 @@ int main ( int argc, char **argv )
 		VIRTUAL_SHIFT_POS,
 		SDL_DISABLE	// no joystick HID events enabled
 	);
+	if (inputrec_init(emucfg_get_str("inputrec"), emucfg_get_str("inputplay")))
+		FATAL("Cannot start input recording or replay, see the debug log");
+	if (emu_metrics_init(0, emucfg_get_str("metricsfile"), emucfg_get_bool("metricsosd")))
+		FATAL("Cannot create the metrics stream file, see the debug log");
 	memset(memory, 0xFF, sizeof memory);
 	memset(charrom, 0xFF, sizeof charrom);
 	if (
@@ -448,6 +463,7 @@ int main ( int argc, char **argv )
 	/* --- START EMULATION --- */
 	cycles = 0;
 	emu_set_full_screen(emucfg_get_bool("fullscreen"));
+	emu_set_precise_timing(emucfg_get_bool("precise"));
 	emu_timekeeping_start();	// we must call this once, right before the start of the emulation
 	update_rtc();			// this will use time-keeping stuff as well, so initially let's do after the function call above
 	for (;;) {
@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 #include "xemu/emutools.h"
 #include "xemu/emutools_hid.h"
+#include "xemu/input_record.h"
 #include "commodore_vic20.h"
 #include "xemu/cpu65c02.h"
 #include "xemu/via65c22.h"
@@ -55,6 +56,7 @@ static int emurom_policy;
 static char *emufile_p;
 static int emufile_size;
 static int frameskip = 0;
+static int render_every_frame = 0;		// render all frames, not only every second one (see the note about frameskip in main())
 static int nmi_level = 0;			// level of NMI (note: 6502 is _edge_ triggered on NMI, this is only used to check edges ...)
 static struct Via65c22 via1, via2;		// VIA-1 and VIA-2 emulation structures
 
@@ -356,6 +358,17 @@ Uint8 cpu_read ( Uint16 addr )
 }
 
 
+// Called by CPU emulation code to check if an idle loop can read the given address: memory, VIC-I registers
+// (they only change at scanline boundaries) and the VIA registers which are neither counters nor clear
+// interrupt flags on read (the state of those only changes at VIA events, see via_cycles_to_next_event()).
+int cpu_idle_safe_read ( Uint16 addr )
+{
+	if ((addr & 0xFFF0) == 0x9110 || (addr & 0xFFF0) == 0x9120)
+		return via_read_is_idle_safe(addr);
+	return 1;	// memory, colour SRAM, VIC-I registers, or undecoded area
+}
+
+
 // HID needs this to be defined, it's up to the emulator if it uses or not ...
 int emu_callback_key ( int pos, SDL_Scancode key, int pressed, int handled )
 {
@@ -367,11 +380,15 @@ static void update_emulator ( void )
 {
 	if (!frameskip) {
 		// First: render VIC-20 screen ...
+		EMU_BENCH_SECTION(EMU_BENCH_VIDEO);
 		emu_update_screen();
 		// Second: we must handle SDL events waiting for us in the event queue ...
+		EMU_BENCH_SECTION(EMU_BENCH_IO);
 		hid_handle_all_sdl_events();
 		// Third: Sleep ... Please read emutools.c source about this madness ... 40000 is (PAL) microseconds for a full frame to be produced
-		emu_timekeeping_delay(FULL_FRAME_USECS);
+		// (FULL_FRAME_USECS is the time of two frames, as we update the screen in every second frame only, by default)
+		emu_timekeeping_delay(render_every_frame ? FULL_FRAME_USECS / 2 : FULL_FRAME_USECS);
+		EMU_BENCH_SECTION(EMU_BENCH_CPU);
 	}
 	vic_vsync(!frameskip);	// prepare for the next frame!
 }
@@ -445,8 +462,21 @@ static Uint8 via2_inb ( Uint8 mask )
 
 
 
+// Benchmark mode must be known before SDL initialization (headless mode), but
+// parse_command_line() can be called only after that (path info from SDL)
+static int bench_command_line ( int argc, char **argv )
+{
+	int a;
+	for (a = 1; a < argc - 1; a++)
+		if (!strcmp(argv[a], "-bench"))
+			return atoi(argv[a + 1]);
+	return 0;
+}
+
+
 static void parse_command_line ( int argc, char **argv )
 {
+	const char *inputrec_fn = NULL, *inputplay_fn = NULL;
 	int a;
 	emurom_policy = 0;	// normally: "boot" into BASIC
 	emufile_p = NULL;
@@ -469,6 +499,14 @@ static void parse_command_line ( int argc, char **argv )
 		} else if (argv[a][0] == '-') {
 			if (argv[a][1] == 0) {	// a single '-' option is interpreted, as monitor should be run
 				emurom_policy = 1;	// will cause to "boot" into monitor
+			} else if (!strcmp(argv[a], "-bench") && a < argc - 1) {
+				a++;		// already handled by bench_command_line() before SDL initialization
+			} else if (!strcmp(argv[a], "-everyframe")) {
+				render_every_frame = 1;
+			} else if (!strcmp(argv[a], "-inputplay") && a < argc - 1) {
+				inputplay_fn = argv[++a];
+			} else if (!strcmp(argv[a], "-inputrec") && a < argc - 1) {
+				inputrec_fn = argv[++a];
 			} else
 				FATAL("Unknown command line '-' option: %s", argv[a]);
 		} else {
@@ -488,6 +526,8 @@ static void parse_command_line ( int argc, char **argv )
 			}
 		}
 	}
+	if (inputrec_init(inputrec_fn, inputplay_fn))
+		FATAL("Cannot start input recording or replay, see the debug log");
 }
 
 
@@ -526,6 +566,7 @@ int main ( int argc, char **argv )
 		SCREEN_FIRST_VISIBLE_DOTPOS, SCREEN_FIRST_VISIBLE_SCANLINE,
 		SCREEN_LAST_VISIBLE_DOTPOS,  SCREEN_LAST_VISIBLE_SCANLINE
 	);
+	emu_bench_init(bench_command_line(argc, argv), (int)((LAST_SCANLINE + 1) * CYCLES_PER_SCANLINE * (1000000.0 / (double)FULL_FRAME_USECS) * 2));
 	/* Initiailize SDL - note, it must be before loading ROMs, as it depends on path info from SDL! */
 	if (emu_init_sdl(
 		TARGET_DESC APP_DESC_APPEND,	// window title
@@ -550,6 +591,7 @@ int main ( int argc, char **argv )
 	);
 	/* Parse command line */
 	parse_command_line(argc, argv);
+	emu_bench_set_frames_per_delay(render_every_frame ? 1 : 2);	// benchmark counts emulated frames, not the timekeeping calls
 	/* Intialize memory and load ROMs */
 	memset(memory, 0xFF, sizeof memory);
 	memset(dummy_vic_access, 0xFF, sizeof dummy_vic_access);	// define 1K of "nothing" for VIC-I memory regions what it can't access by hardware constraints
@@ -599,18 +641,25 @@ int main ( int argc, char **argv )
 	for (;;) { // our emulation loop ...
 		int opcyc;
 		opcyc = cpu_step();	// execute one opcode (or accept IRQ, etc), return value is the used clock cycles
+		if (unlikely(cpu_idle_loop_cycles))	// idle loop: skip whole iterations till the end of scanline or the next VIA event
+			opcyc += cpu_idle_fast_forward(via_cycles_to_next_event(&via2, via_cycles_to_next_event(&via1, CYCLES_PER_SCANLINE - cycles)) - opcyc);
 		via_tick(&via1, opcyc);	// run VIA-1 tasks for the same amount of cycles as the CPU
 		via_tick(&via2, opcyc);	// -- "" -- the same for VIA-2
 		cycles += opcyc;
 		if (cycles >= CYCLES_PER_SCANLINE) {	// if [at least!] 71 (on PAL) CPU cycles passed then render a VIC-I scanline, and maintain scanline value + texture/SDL update (at the end of a frame)
+			cpu_idle_reset();
 			// render one (scan)line. Note: this is INACCURATE, we should do rendering per dot clock/cycle or something,
 			// but for a simple emulator like this, it's already acceptable solultion, I think!
 			// Note about frameskip: we render only every second (half) frame, no interlace (PAL VIC), not so correct, but we also save some resources this way
-			if (!frameskip)
+			// (unless -everyframe is given in the command line)
+			if (!frameskip) {
+				EMU_BENCH_SECTION(EMU_BENCH_VIDEO);
 				vic_render_line();
+				EMU_BENCH_SECTION(EMU_BENCH_CPU);
+			}
 			if (scanline == LAST_SCANLINE) {
 				update_emulator();
-				frameskip = !frameskip;
+				frameskip = !frameskip && !render_every_frame;
 			} else
 				scanline++;
 			cycles -= CYCLES_PER_SCANLINE;
@@ -0,0 +1,261 @@
+/* Test-case for a very simple and inaccurate Commodore VIC-20 emulator using SDL2 library
+   within the Xemu project.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+   This is a headless test runner: it runs many VIA-only VIC-20 machines (CPU, RAM and the
+   two VIAs, no VIC-I, no ROMs) on worker threads in one process, to run machine code tests
+   on all the cores. It uses the reentrant mode of the CPU core (CPU65_CONTEXT), every machine
+   has its own CPU context, memory and VIAs. See build/tests/vic20workers for a test program.
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include "xemu/emutools_basicdefs.h"
+#include "xemu/cpu65c02.h"
+#include "xemu/via65c22.h"
+#include "vic6561.h"
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifndef CPU65_CONTEXT
+#	error "CPU65_CONTEXT must be defined for the worker threads test runner."
+#endif
+
+#define MAX_THREADS		256
+#define DEFAULT_MAX_CYCLES	100000000
+
+/* A test program is a PRG file, loaded to its load address, and the execution starts there
+   (the reset vector is set to it). Everything is RAM except the I/O area at $9000-$93FF,
+   where only the VIAs are decoded, the rest of it reads $FF and ignores writes.
+   The test ends when the CPU executes the trap opcode ($FC), the A register is the result
+   then: zero means passed, otherwise it's the number of the failed check. */
+struct vic20_machine {
+	struct cpu65_st cpu;
+	struct Via65c22 via1, via2;
+	Uint8  memory[0x10000];
+	int    nmi_level;
+	const char *fn;
+	int    done;		// the test has executed the trap opcode
+	Uint64 cycles;		// emulated CPU cycles since reset
+	Uint32 checksum;	// of the memory, at the end of the test
+};
+
+FILE *debug_fp = NULL;	// there is no debug log, emutools.c is not used here
+
+static struct vic20_machine *machines;
+static int machines_num;
+static SDL_atomic_t next_machine;
+static Uint64 max_cycles = DEFAULT_MAX_CYCLES;
+
+#define MACHINE	((struct vic20_machine*)cpu65->user)
+
+
+
+static Uint8 machine_read ( struct cpu65_st *cpu, Uint16 addr )
+{
+	struct vic20_machine *m = cpu->user;
+	if ((addr & 0xFC00) != 0x9000)
+		return m->memory[addr];
+	if ((addr & 0xFFF0) == 0x9110)
+		return via_read(&m->via1, addr & 0xF);
+	if ((addr & 0xFFF0) == 0x9120)
+		return via_read(&m->via2, addr & 0xF);
+	return 0xFF;
+}
+
+
+static void machine_write ( struct cpu65_st *cpu, Uint16 addr, Uint8 data )
+{
+	struct vic20_machine *m = cpu->user;
+	if ((addr & 0xFC00) != 0x9000)
+		m->memory[addr] = data;
+	else if ((addr & 0xFFF0) == 0x9110)
+		via_write(&m->via1, addr & 0xF, data);
+	else if ((addr & 0xFFF0) == 0x9120)
+		via_write(&m->via2, addr & 0xF, data);
+}
+
+
+// The same rule as with the VIC-20 emulator: memory, or the VIA registers without read side effects
+static int machine_idle_safe_read ( struct cpu65_st *cpu, Uint16 addr )
+{
+	if ((addr & 0xFFF0) == 0x9110 || (addr & 0xFFF0) == 0x9120)
+		return via_read_is_idle_safe(addr);
+	return 1;
+}
+
+
+static int machine_trap ( struct cpu65_st *cpu, Uint8 opcode )
+{
+	((struct vic20_machine*)cpu->user)->done = 1;
+	return 1;
+}
+
+
+/* VIA callbacks don't get the VIA, but they are called on the thread running the machine,
+   so the current CPU context of the thread tells the machine. */
+
+// VIA-1 generates NMI on VIC-20, on the edge when its interrupt output becomes active
+static void via1_setint ( int level )
+{
+	if (level && !MACHINE->nmi_level)
+		cpu_nmiEdge = 1;
+	MACHINE->nmi_level = level;
+}
+
+
+// VIA-2 is used to generate IRQ on VIC-20
+static void via2_setint ( int level )
+{
+	cpu_irqLevel = level;
+}
+
+
+
+static int machine_init ( struct vic20_machine *m, const char *fn )
+{
+	FILE *fp = fopen(fn, "rb");
+	int addr, size;
+	memset(m, 0, sizeof(struct vic20_machine));
+	memset(m->memory, 0xFF, sizeof m->memory);
+	m->fn = fn;
+	if (!fp) {
+		fprintf(stderr, "Cannot open test program %s: %s" NL, fn, strerror(errno));
+		return -1;
+	}
+	addr = fgetc(fp);
+	addr |= fgetc(fp) << 8;
+	size = (addr >= 0 && addr < 0x9000) ? fread(m->memory + addr, 1, 0x9000 - addr, fp) : 0;
+	fclose(fp);
+	if (size <= 0) {
+		fprintf(stderr, "Invalid test program %s" NL, fn);
+		return -1;
+	}
+	m->memory[0xFFFC] = addr & 0xFF;
+	m->memory[0xFFFD] = addr >> 8;
+	cpu65_init_context(&m->cpu);
+	m->cpu.read = machine_read;
+	m->cpu.write = machine_write;
+	m->cpu.trap = machine_trap;
+	m->cpu.idle_safe_read = machine_idle_safe_read;
+	m->cpu.user = m;
+	cpu65 = &m->cpu;	// VIA reset calls the setint callbacks
+	via_init(&m->via1, "VIA-1", NULL, NULL, NULL, NULL, NULL, NULL, via1_setint);
+	via_init(&m->via2, "VIA-2", NULL, NULL, NULL, NULL, NULL, NULL, via2_setint);
+	return 0;
+}
+
+
+// Runs the machine (on the calling thread) till the end of its test, or till max_cycles
+static void machine_run ( struct vic20_machine *m )
+{
+	int a;
+	cpu65 = &m->cpu;
+	cpu_reset();
+	while (!m->done && m->cycles < max_cycles) {
+		int cycles = 0;
+		while (cycles < CYCLES_PER_SCANLINE && !m->done) {
+			int opcyc = cpu_step();
+			if (unlikely(cpu_idle_loop_cycles))	// idle loop: skip whole iterations till the end of the "scanline" or the next VIA event
+				opcyc += cpu_idle_fast_forward(via_cycles_to_next_event(&m->via2, via_cycles_to_next_event(&m->via1, CYCLES_PER_SCANLINE - cycles)) - opcyc);
+			via_tick(&m->via1, opcyc);
+			via_tick(&m->via2, opcyc);
+			cycles += opcyc;
+		}
+		cpu_idle_reset();
+		m->cycles += cycles;
+	}
+	for (a = 0, m->checksum = 0; a < 0x10000; a++)
+		m->checksum = (m->checksum << 1 | m->checksum >> 31) ^ m->memory[a];
+}
+
+
+static int worker_thread ( void *unused )
+{
+	int i;
+	while ((i = SDL_AtomicAdd(&next_machine, 1)) < machines_num)
+		machine_run(&machines[i]);
+	return 0;
+}
+
+
+
+int main ( int argc, char **argv )
+{
+	SDL_Thread *threads[MAX_THREADS];
+	int threads_num = SDL_GetCPUCount(), instances = 1, failed = 0, a, i;
+	xemu_dump_version(stdout, "VIA-only VIC-20 machines on worker threads from LGB");
+	for (a = 1; a < argc - 1 && argv[a][0] == '-'; a += 2) {
+		if (!strcmp(argv[a], "-threads"))
+			threads_num = atoi(argv[a + 1]);
+		else if (!strcmp(argv[a], "-instances"))
+			instances = atoi(argv[a + 1]);
+		else if (!strcmp(argv[a], "-cycles"))
+			max_cycles = strtoull(argv[a + 1], NULL, 10);
+		else
+			break;
+	}
+	if (a >= argc || argv[a][0] == '-' || threads_num < 1 || instances < 1 || !max_cycles) {
+		fprintf(stderr, "Usage: %s [-threads N] [-instances N] [-cycles N] test.prg ..." NL
+			"Runs every test program in N instances (results must match), on N worker threads, at most for N cycles." NL, argv[0]);
+		return 1;
+	}
+	machines_num = (argc - a) * instances;
+	machines = malloc(machines_num * sizeof(struct vic20_machine));
+	if (!machines) {
+		fprintf(stderr, "Not enough memory for %d machines" NL, machines_num);
+		return 1;
+	}
+	for (i = 0; i < machines_num; i++)
+		if (machine_init(&machines[i], argv[a + i / instances]))
+			return 1;
+	if (threads_num > MAX_THREADS)
+		threads_num = MAX_THREADS;
+	if (threads_num > machines_num)
+		threads_num = machines_num;
+	printf("Running %d machine(s) on %d worker thread(s)" NL, machines_num, threads_num);
+	SDL_AtomicSet(&next_machine, 0);
+	for (i = 0; i < threads_num; i++) {
+		threads[i] = SDL_CreateThread(worker_thread, "Xemu VIC-20 worker", NULL);
+		if (!threads[i]) {
+			fprintf(stderr, "Cannot create worker thread: %s" NL, SDL_GetError());
+			return 1;
+		}
+	}
+	for (i = 0; i < threads_num; i++)
+		SDL_WaitThread(threads[i], NULL);
+	for (i = 0; i < machines_num; i++) {
+		struct vic20_machine *m = &machines[i], *first = &machines[i - i % instances];
+		const char *result;
+		if (!m->done)
+			result = "TIMEOUT";
+		else if (m->cpu.a)
+			result = "FAILED";
+		else if (m->cycles != first->cycles || m->checksum != first->checksum)
+			result = "MISMATCH";	// all instances of the same test program must do exactly the same
+		else
+			result = "PASSED";
+		if (strcmp(result, "PASSED"))
+			failed++;
+		printf("%s #%d: %s (A=$%02X, PC=$%04X, " PRINTF_LLU " cycles, checksum=$%08X)" NL,
+			m->fn, i % instances, result, m->cpu.a, m->cpu.pc, (unsigned long long)m->cycles, m->checksum
+		);
+	}
+	printf("%d of %d machine(s) failed" NL, failed, machines_num);
+	free(machines);
+	return failed ? 1 : 0;
+}
@@ -23,6 +23,7 @@ along with this program; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 #include <stdio.h>
+#include <string.h>
 
 #include <SDL.h>
 
@@ -72,6 +73,15 @@ static int vic_chr_addr;			// memory address of characer data (lo8 bus bits only
 static int vic_vid_counter;			// video address counter (from zero) relative to the given video address (vic_vid_addr)
 static int vic_row_counter;			// counts the displayed (text) rows of VIC-I, if it's equal to text_rows it means end of actual active display, and start of the bottom border
 
+/* Dot expansion tables: the 8 pixels of a character byte, indexed by the text colour (lower 3 bits of the colour SRAM) and the
+   byte itself. The tables depend on the colour registers (and reverse mode), so they are built lazily, for a given text colour
+   only when it's first needed after a colour register write which changed something (see vic_colours_changed()). This way
+   even programs changing colours on every scanline cost only a table rebuild or two per scanline. */
+static Uint32 vic_hires_tab[8][256][8];
+static Uint32 vic_mcm_tab[8][256][8];		// multicolour: four "double width" pixels per byte
+static Uint8 vic_hires_tab_ok[8];
+static Uint8 vic_mcm_tab_ok[8];
+
 
 /* Check constraints of the given parameters from some header file */
 
@@ -103,6 +113,46 @@ Uint8 cpu_vic_reg_read ( int addr )
 
 
 
+static void vic_build_tab ( int colour, int mcm )
+{
+	Uint32 cpal[4];
+	int b, x;
+	memcpy(cpal, vic_cpal, sizeof cpal);
+	cpal[sram_colour_index] = vic_palette[colour];	// text colour goes into the right place (depends on reverse mode)
+	for (b = 0; b < 256; b++) {
+		if (mcm) {
+			Uint32 *d = vic_mcm_tab[colour][b];
+			for (x = 0; x < 8; x += 2)
+				d[x] = d[x + 1] = cpal[(b >> (6 - x)) & 3];
+		} else {
+			Uint32 *d = vic_hires_tab[colour][b];
+			for (x = 0; x < 8; x++)
+				d[x] = (b & (128 >> x)) ? cpal[2] : cpal[0];
+		}
+	}
+	if (mcm)
+		vic_mcm_tab_ok[colour] = 1;
+	else
+		vic_hires_tab_ok[colour] = 1;
+}
+
+
+
+// Invalidates the expansion tables if any colour (or reverse mode) has been really changed since the last call
+static void vic_colours_changed ( void )
+{
+	static Uint32 old_cpal[4];
+	static int old_sram_colour_index = -1;
+	if (sram_colour_index != old_sram_colour_index || memcmp(old_cpal, vic_cpal, sizeof old_cpal)) {
+		memcpy(old_cpal, vic_cpal, sizeof old_cpal);
+		old_sram_colour_index = sram_colour_index;
+		memset(vic_hires_tab_ok, 0, sizeof vic_hires_tab_ok);
+		memset(vic_mcm_tab_ok, 0, sizeof vic_mcm_tab_ok);
+	}
+}
+
+
+
 // Write VIC-I register by the CPU. "addr" must be 0 ... 15!
 void cpu_vic_reg_write ( int addr, Uint8 data )
 {
@@ -135,6 +185,7 @@ void cpu_vic_reg_write ( int addr, Uint8 data )
 			break;
 		case 14:
 			AUX_COLOUR = vic_palette[data >> 4];
+			vic_colours_changed();
 			break;
 		case 15:
 			BORDER_COLOUR = vic_palette[data & 7];
@@ -145,6 +196,7 @@ void cpu_vic_reg_write ( int addr, Uint8 data )
 				SRAM_COLOUR = vic_palette[data >> 4];
 				sram_colour_index = 0;
 			}
+			vic_colours_changed();	// border colour matters too: it's colour 1 of the multicolour mode
 			break;
 	}
 	//DEBUG("VIC-I: %02X -> [%01X]" NL, data, addr);
@@ -199,68 +251,61 @@ static inline Uint8 vic_read_mem_hi4 ( Uint16 addr )
 // It's not a correct solution to render a line in once, however it's only a sily emulator try from me, not an accurate one :-D
 void vic_render_line ( void )
 {
-	int v_columns, v_vid, dotpos, visible_scanline, mcm, bitp, chr;
+	int v_columns, v_vid, dotpos, chrpos;
 	// Check for start the active display (end of top border) and end of active display (start of bottom border)
 	if (vic_row_counter >= text_rows && vic_vertical_area == 0)	// FIXME: the exact condition! Maybe not ">" like relation but equality is checked by VIC-I only?
 		vic_vertical_area = 2;	// this will be the first scanline of bottom border
 	else if (scanline == first_active_scanline && vic_vertical_area == 1)
 		vic_vertical_area = 0;	// this scanline will be the first non-border scanline
 	// Check if we're inside the top or bottom area, so full border colour lines should be rendered
-	visible_scanline = (scanline >= SCREEN_FIRST_VISIBLE_SCANLINE && scanline <= SCREEN_LAST_VISIBLE_SCANLINE);
-	if (vic_vertical_area) {
-		if (visible_scanline) {
+	if (scanline >= SCREEN_FIRST_VISIBLE_SCANLINE && scanline <= SCREEN_LAST_VISIBLE_SCANLINE) {
+		if (vic_vertical_area) {
 			v_columns = SCREEN_LAST_VISIBLE_DOTPOS - SCREEN_FIRST_VISIBLE_DOTPOS + 1;
 			while (v_columns--)
 				*(pixels++) = BORDER_COLOUR;
 			pixels += pixels_tail;		// add texture "tail" (that is, pitch - text_width, in 4 bytes uints, ie Uint32 pointer ...)
+			return;
 		}
-		return;
-	}
-	// So, we are at the "active" display area. But still, there are left and right borders ...
-	bitp = 128;
-	v_columns = text_columns;
-	v_vid = vic_vid_counter;
-	for (dotpos = 0; dotpos < CYCLES_PER_SCANLINE * 4; dotpos++) {
-		int visible_dotpos = (dotpos >= SCREEN_FIRST_VISIBLE_DOTPOS && dotpos <= SCREEN_LAST_VISIBLE_DOTPOS && visible_scanline);
-		if (dotpos < first_active_dotpos) {
-			if (visible_dotpos)
-				*(pixels++) = BORDER_COLOUR;
-		} else {
-			if (v_columns) {
-				if (bitp == 128) {
-					// NOTE! *AFAIK* VIC-I fetches colour info from the *VERY SAME* address as the video data! It's just matter of usage in VIC-20
-					// that only 1K of SRAM is connected for the upper 4 bits of the 12 bit wide data bus of VIC-I, but it can be otherwise too!
-					chr = vic_read_mem_lo8((vic_read_mem_lo8(vic_vid_addr + v_vid) << char_height_shift) + vic_chr_addr + charline);
-					mcm = vic_read_mem_hi4(vic_vid_addr + v_vid);	// mcm here is simply the fetched colour SRAM byte (only lower 4 bits will be used)
-					v_vid++;	// increment video address
-					vic_cpal[sram_colour_index] = vic_palette[mcm & 7];	// set text colour with the lower 3 bits fetched on the right place (depends on reverse mode: sram_colour_index)
-					mcm &= 8;	// mcm: multi colour mode flag, bit 3 - so the true meaning of "mcm" ;-)
-					if (mcm)
-						bitp = 6;	// in case of mcm, bitp is a shift counter needed to move bits to bitpos 1,0, otherwise bitp is a bit mask in hires mode
-				}
-				if (visible_dotpos) {
-					if (mcm) {
-						// Ugly enough! I have the assumption that visible dotpos condition only changes on even number in dotpos only ... :-/
-						// That is, you MUST define texture dimensions for width of even number!!
-						*pixels = *(pixels + 1) = vic_cpal[(chr >> bitp) & 3]; // "double width" pixel ...
-						pixels += 2;
-						dotpos++;	// trick our "for" loop a bit here ...
-					} else
-						*(pixels++) = (chr & bitp) ? SRAM_COLOUR : SCREEN_COLOUR;
-				}
-				if (bitp <= 1) {	// last pixel? handle both situation with "dual" meaning of bitp for multicolour and hires mode
-					v_columns--;
-					bitp = 128;	// prepare for next byte fetch (video + colour)
-				} else {
-					if (mcm)
-						bitp -= 2;
-					else
-						bitp >>= 1;
-				}
-			} else if (visible_dotpos)
-				*(pixels++) = BORDER_COLOUR;
+		// So, we are at the "active" display area. But still, there are left and right borders ...
+		for (dotpos = SCREEN_FIRST_VISIBLE_DOTPOS; dotpos < first_active_dotpos && dotpos <= SCREEN_LAST_VISIBLE_DOTPOS; dotpos++)
+			*(pixels++) = BORDER_COLOUR;
+		v_vid = vic_vid_counter;
+		for (v_columns = text_columns, chrpos = first_active_dotpos; v_columns && chrpos <= SCREEN_LAST_VISIBLE_DOTPOS; v_columns--, chrpos += 8, v_vid++) {
+			const Uint32 *src;
+			int chr, col, from, to;
+			if (chrpos + 8 <= SCREEN_FIRST_VISIBLE_DOTPOS)
+				continue;	// fully invisible character, we don't even need to fetch it
+			// NOTE! *AFAIK* VIC-I fetches colour info from the *VERY SAME* address as the video data! It's just matter of usage in VIC-20
+			// that only 1K of SRAM is connected for the upper 4 bits of the 12 bit wide data bus of VIC-I, but it can be otherwise too!
+			chr = vic_read_mem_lo8((vic_read_mem_lo8(vic_vid_addr + v_vid) << char_height_shift) + vic_chr_addr + charline);
+			col = vic_read_mem_hi4(vic_vid_addr + v_vid);	// bit 3: multicolour mode, bits 2-0: text colour
+			if (col & 8) {
+				if (unlikely(!vic_mcm_tab_ok[col & 7]))
+					vic_build_tab(col & 7, 1);
+				src = vic_mcm_tab[col & 7][chr];
+			} else {
+				if (unlikely(!vic_hires_tab_ok[col & 7]))
+					vic_build_tab(col & 7, 0);
+				src = vic_hires_tab[col & 7][chr];
+			}
+			from = dotpos - chrpos;	// non-zero only if the character is partially hidden on the left side
+			to = SCREEN_LAST_VISIBLE_DOTPOS + 1 - chrpos;
+			if (likely(from == 0 && to >= 8)) {
+				memcpy(pixels, src, 8 * sizeof(Uint32));
+				pixels += 8;
+				dotpos += 8;
+			} else {
+				if (to > 8)
+					to = 8;
+				for (; from < to; from++, dotpos++)
+					*(pixels++) = src[from];
+			}
 		}
-	}
+		for (; dotpos <= SCREEN_LAST_VISIBLE_DOTPOS; dotpos++)
+			*(pixels++) = BORDER_COLOUR;
+		pixels += pixels_tail;		// add texture "tail" (that is, pitch - text_width, in 4 bytes uints, ie Uint32 pointer ...)
+	} else if (vic_vertical_area)
+		return;
 	if (charline >= char_height_minus_one) {
 		charline = 0;
 		vic_vid_counter += text_columns;	// FIXME: does VIC-I always use the text columns setting, even if picture wouldn't fit into the TV screen at all?!
@@ -268,5 +313,4 @@ void vic_render_line ( void )
 	} else {
 		charline++;
 	}
-	pixels += pixels_tail;		// add texture "tail" (that is, pitch - text_width, in 4 bytes uints, ie Uint32 pointer ...)
 }
@@ -1,3 +1,4 @@
 #define TARGET_NAME "cvic20"
 #define TARGET_DESC "Commodore VIC-20"
 #define CPU_TRAP 0xFC
+#define CPU_IDLE_LOOP_DETECTION
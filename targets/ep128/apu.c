@@ -585,3 +585,39 @@ void apu_write_command ( Uint8 cmd )
 	clocks *= CPU_CLOCK;
 	z80ex_w_states((clocks % APU_CLOCK) ? ((clocks / APU_CLOCK) + 1) : (clocks / APU_CLOCK));
 }
+
+/* --- SNAPSHOT RELATED --- */
+
+#ifdef XEMU_SNAPSHOT_SUPPORT
+
+#define SNAPSHOT_APU_BLOCK_VERSION	0
+#define SNAPSHOT_APU_BLOCK_SIZE		32
+
+int apu_snapshot_load_state ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block )
+{
+	Uint8 buffer[SNAPSHOT_APU_BLOCK_SIZE];
+	int a;
+	if (block->block_version != SNAPSHOT_APU_BLOCK_VERSION || block->sub_counter || block->sub_size != sizeof buffer)
+		RETURN_XSNAPERR_USER("Bad APU block syntax");
+	a = xemusnap_read_file(buffer, sizeof buffer);
+	if (a) return a;
+	memcpy(_apu_stack, buffer, sizeof _apu_stack);
+	_apu_tos = buffer[16] & 15;
+	_apu_status = buffer[17];
+	return 0;
+}
+
+
+int apu_snapshot_save_state ( const struct xemu_snapshot_definition_st *def )
+{
+	Uint8 buffer[SNAPSHOT_APU_BLOCK_SIZE];
+	int a = xemusnap_write_block_header(def->idstr, SNAPSHOT_APU_BLOCK_VERSION);
+	if (a) return a;
+	memset(buffer, 0xFF, sizeof buffer);
+	memcpy(buffer, _apu_stack, sizeof _apu_stack);
+	buffer[16] = _apu_tos;
+	buffer[17] = _apu_status;
+	return xemusnap_write_sub_block(buffer, sizeof buffer);
+}
+
+#endif
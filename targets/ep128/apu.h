@@ -27,4 +27,10 @@ extern void  apu_write_data ( Uint8 value );
 extern void  apu_write_command ( Uint8 value );
 extern void  apu_reset ( void );
 
+#ifdef XEMU_SNAPSHOT_SUPPORT
+#include "xemu/emutools_snapshot.h"
+extern int apu_snapshot_load_state ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block );
+extern int apu_snapshot_save_state ( const struct xemu_snapshot_definition_st *def );
+#endif
+
 #endif
@@ -57,21 +57,32 @@ struct configSetting_st {
 /* Default keyboard mapping can be found in keyboard_mapping.c */
 static const struct configOption_st configOptions[] = {
 	{ "audio",	CONFITEM_BOOL,	"0",		0, "Enable audio output"	},
+	{ "audiopace",	CONFITEM_INT,	"0",		0, "Use audio as master clock with this target latency in msecs (0 = off, needs audio enabled)" },
+	{ "bench",	CONFITEM_INT,	"0",		0, "Benchmark: run headless and unthrottled for N frames, then print the results as JSON" },
 	{ "console",	CONFITEM_BOOL,	"0",		0, "Keep (1) console window open (or give console prompt on STDIN on Linux by default)" },
 	{ DEBUGFILE_OPT,CONFITEM_STR,	"none",		0, "Enable debug messages written to a specified file" },
 	{ "ddn",	CONFITEM_STR,	"none",		0, "Default device name (none = not to set)" },
 	{ "filedir",	CONFITEM_STR,	"@files",	0, "Default directory for FILE: device" },
 	{ "fullscreen",	CONFITEM_BOOL,	"0",		0, "Start in full screen"	},
+	{ "inputplay",	CONFITEM_STR,	"none",		0, "Replay input recorded by -inputrec from the given file (live input is ignored meanwhile)" },
+	{ "inputrec",	CONFITEM_STR,	"none",		0, "Record input with emulated frame stamps into the given file" },
+	{ "metrics",	CONFITEM_BOOL,	"0",		0, "Collect per-frame performance metrics (see the PERF monitor command)" },
+	{ "metricsfile",CONFITEM_STR,	"none",		0, "Stream per-frame performance metrics into this file (CSV, or JSON lines if the name ends with .json)" },
+	{ "metricsosd",	CONFITEM_BOOL,	"0",		0, "Show performance metrics (share of host time, rolling average) on the OSD" },
 	{ "mousemode",	CONFITEM_INT,	"1",		0, "Set mouse mode, 1-3 = J-column 2,4,8 bytes and 4-6 the same for K-column" },
 	{ "primo",	CONFITEM_STR,	"none",		0, "Start in Primo emulator mode (if not \"none\")" },
 	{ "printfile",	CONFITEM_STR,	PRINT_OUT_FN,	0, "Printing into this file"	},
 	{ "ram",	CONFITEM_STR,	"128",		0, "RAM size in Kbytes (decimal) or segment specification(s) prefixed with @ in hex (VRAM is always assumed), like: @C0-CF,E0,E3-E7" 	},
 	{ "rom",	CONFITEM_STR,	NULL,		1, "ROM image, format is \"rom@xx=filename\" (xx=start segment in hex), use rom@00 for EXOS or combined ROM set" },
+	{ "sdbulk",	CONFITEM_BOOL,	"0",		0, "Fast SD-card sector reads: LDIR loops of the SDEXT ROM are served at once, not byte-by-byte" },
 	{ "sdimg",	CONFITEM_STR,	SDCARD_IMG_FN,	0, "SD-card disk image (VHD) file name/path" },
 	{ "sdl",	CONFITEM_STR,	"auto",		0, "Sets SDL specific option(s) including rendering related stuffs" },
 	{ "skiplogo",	CONFITEM_INT,	"0",		0, "Disables (1) Enterprise logo on start-up via XEP ROM" },
+	{ "snapload",	CONFITEM_STR,	"none",		0, "Load (fast-resume) a Xep128 snapshot after start-up" },
+	{ "snapsave",	CONFITEM_STR,	"none",		0, "Save a Xep128 snapshot into the given file on exit" },
 	{ "snapshot",	CONFITEM_STR,	"none",		0, "Load and use ep128emu snapshot" },
 	{ "wdimg",	CONFITEM_STR,	"none",		0, "EXDOS WD disk image file name/path" },
+	{ "wdovl",	CONFITEM_STR,	"none",		0, "Overlay file for EXDOS WD disk image, the image itself is used read-only then" },
 	{ "xeprom",	CONFITEM_INT,	"1",		0, "Enables XEP internal ROM (non-zero value), otherwise disable" },
 	/* should be the last on the list, as this is handled specially not in the config storage for real */
 	{ "epkey",	CONFITEM_STR,	NULL,		1, "Define a given EP/emu key, format epkey@xy=SDLname, where x/y are row/col in hex or spec code (ie screenshot, etc)." },
@@ -695,8 +706,10 @@ int config_init ( int argc, char **argv )
 		if (!debug_fp)
                 	ERROR_WINDOW("Cannot open debug messages log file requested: %s", config_getopt_str(DEBUGFILE_OPT));
 	}
-	if (debug_fp)
+	if (debug_fp) {
+		xemu_log_start();
 		INFO_WINDOW("DEBUG: Debug messages logging is active");
+	}
 	else
 		printf("DEBUG: No debug messages logging is active." NL);
 	/* test parsing mode? */
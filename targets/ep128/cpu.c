@@ -267,6 +267,38 @@ void write_cpu_byte_by_segmap ( Uint16 addr, Uint8 *segmap, Uint8 data )
 }
 
 
+/* Block variants of the above: the 64K address space is walked in runs within a segment,
+   so each run is a single memcpy (address wraps around at 64K, like the byte-by-byte loop would do) */
+void read_cpu_block_by_segmap ( Uint16 addr, Uint8 *segmap, Uint8 *data, int len )
+{
+	while (len > 0) {
+		int run = 0x4000 - (addr & 0x3FFF);
+		if (run > len)
+			run = len;
+		memcpy(data, memory + ((segmap[addr >> 14] << 14) | (addr & 0x3FFF)), run);
+		data += run;
+		addr += run;
+		len -= run;
+	}
+}
+
+
+void write_cpu_block_by_segmap ( Uint16 addr, Uint8 *segmap, const Uint8 *data, int len )
+{
+	while (len > 0) {
+		int seg = segmap[addr >> 14];
+		int run = 0x4000 - (addr & 0x3FFF);
+		if (run > len)
+			run = len;
+		if (is_ram_seg[seg])
+			memcpy(memory + ((seg << 14) | (addr & 0x3FFF)), data, run);
+		data += run;
+		addr += run;
+		len -= run;
+	}
+}
+
+
 void z80ex_mwrite_cb(Z80EX_WORD addr, Z80EX_BYTE value) {
 	register int phys = memsegs[addr >> 14] + addr;
 	if (phys >= 0x3F0000) { // VRAM access, no "$BF port" wait states ever, BUT TODO: Nick CPU clock strechting ...
@@ -600,3 +632,206 @@ void ep_reset ( void )
 	nmi_pending = 0;
 }
 
+
+/* --- SNAPSHOT RELATED --- */
+
+#ifdef XEMU_SNAPSHOT_SUPPORT
+
+#define SNAPSHOT_Z80_BLOCK_VERSION	0
+#define SNAPSHOT_Z80_BLOCK_SIZE		64
+#define SNAPSHOT_MEM_BLOCK_VERSION	0
+#define SNAPSHOT_IO_BLOCK_VERSION	0
+
+// Segment types are stored by their index in this table, 0 = unused
+static const char *snapshot_segment_types[] = { UNUSED_SEGMENT, ROM_SEGMENT, XEPROM_SEGMENT, RAM_SEGMENT, VRAM_SEGMENT, SRAM_SEGMENT };
+#define SNAPSHOT_SEGMENT_TYPES	(sizeof(snapshot_segment_types) / sizeof(const char *))
+
+
+int ep_snapshot_load_z80 ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block )
+{
+	Uint8 buffer[SNAPSHOT_Z80_BLOCK_SIZE];
+	int a;
+	if (block->block_version != SNAPSHOT_Z80_BLOCK_VERSION || block->sub_counter || block->sub_size != sizeof buffer)
+		RETURN_XSNAPERR_USER("Bad Z80 block syntax");
+	a = xemusnap_read_file(buffer, sizeof buffer);
+	if (a) return a;
+	/* loading state ... */
+#ifdef CONFIG_Z180
+	set_ep_cpu(buffer[38] ? CPU_Z180 : (buffer[37] ? CPU_Z80 : CPU_Z80C));
+	z80ex.internal_int_disable = buffer[39];
+#else
+	set_ep_cpu(buffer[37] ? CPU_Z80 : CPU_Z80C);
+#endif
+	Z80_AF  = P_AS_BE16(buffer +  0);
+	Z80_BC  = P_AS_BE16(buffer +  2);
+	Z80_DE  = P_AS_BE16(buffer +  4);
+	Z80_HL  = P_AS_BE16(buffer +  6);
+	Z80_AF_ = P_AS_BE16(buffer +  8);
+	Z80_BC_ = P_AS_BE16(buffer + 10);
+	Z80_DE_ = P_AS_BE16(buffer + 12);
+	Z80_HL_ = P_AS_BE16(buffer + 14);
+	Z80_IX  = P_AS_BE16(buffer + 16);
+	Z80_IY  = P_AS_BE16(buffer + 18);
+	Z80_SP  = P_AS_BE16(buffer + 20);
+	Z80_PC  = P_AS_BE16(buffer + 22);
+	z80ex.memptr.w = P_AS_BE16(buffer + 24);
+	Z80_I   = buffer[26];
+	Z80_R7  = buffer[27];
+	Z80_R   = P_AS_BE16(buffer + 28);
+	Z80_IFF1 = buffer[30];
+	Z80_IFF2 = buffer[31];
+	Z80_IM  = buffer[32];
+	z80ex.halted = buffer[33];
+	z80ex.noint_once = buffer[34];
+	z80ex.reset_PV_on_int = buffer[35];
+	z80ex.prefix = buffer[36];
+	CPU_CLOCK = (int)P_AS_BE32(buffer + 40);
+	nmi_pending = buffer[44];
+	return 0;
+}
+
+
+int ep_snapshot_save_z80 ( const struct xemu_snapshot_definition_st *def )
+{
+	Uint8 buffer[SNAPSHOT_Z80_BLOCK_SIZE];
+	int a = xemusnap_write_block_header(def->idstr, SNAPSHOT_Z80_BLOCK_VERSION);
+	if (a) return a;
+	memset(buffer, 0xFF, sizeof buffer);
+	/* saving state ... */
+	U16_AS_BE(buffer +  0, Z80_AF);
+	U16_AS_BE(buffer +  2, Z80_BC);
+	U16_AS_BE(buffer +  4, Z80_DE);
+	U16_AS_BE(buffer +  6, Z80_HL);
+	U16_AS_BE(buffer +  8, Z80_AF_);
+	U16_AS_BE(buffer + 10, Z80_BC_);
+	U16_AS_BE(buffer + 12, Z80_DE_);
+	U16_AS_BE(buffer + 14, Z80_HL_);
+	U16_AS_BE(buffer + 16, Z80_IX);
+	U16_AS_BE(buffer + 18, Z80_IY);
+	U16_AS_BE(buffer + 20, Z80_SP);
+	U16_AS_BE(buffer + 22, Z80_PC);
+	U16_AS_BE(buffer + 24, z80ex.memptr.w);
+	buffer[26] = Z80_I;
+	buffer[27] = Z80_R7;
+	U16_AS_BE(buffer + 28, Z80_R);
+	buffer[30] = Z80_IFF1;
+	buffer[31] = Z80_IFF2;
+	buffer[32] = Z80_IM;
+	buffer[33] = z80ex.halted;
+	buffer[34] = z80ex.noint_once;
+	buffer[35] = z80ex.reset_PV_on_int;
+	buffer[36] = z80ex.prefix;
+	buffer[37] = z80ex.nmos;
+#ifdef CONFIG_Z180
+	buffer[38] = z80ex.z180;
+	buffer[39] = z80ex.internal_int_disable;
+#else
+	buffer[38] = 0;
+	buffer[39] = 0;
+#endif
+	U32_AS_BE(buffer + 40, CPU_CLOCK);
+	buffer[44] = nmi_pending;
+	return xemusnap_write_sub_block(buffer, sizeof buffer);
+}
+
+
+/* Memory block: sub-block 0 is the segment map (type index for each segment) and the XEP ROM segment,
+   sub-block 1 is the content of all the non-unused segments, in segment order. */
+int ep_snapshot_load_memory ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block )
+{
+	Uint8 buffer[0x104];
+	int a, segs;
+	if (block->block_version != SNAPSHOT_MEM_BLOCK_VERSION || block->sub_counter > 1)
+		RETURN_XSNAPERR_USER("Bad memory block syntax");
+	if (block->sub_counter == 1) {
+		for (a = segs = 0; a < 0x100; a++)
+			if (memory_segment_map[a] != UNUSED_SEGMENT)
+				segs++;
+		if (block->sub_size != (Uint32)segs << 14)
+			RETURN_XSNAPERR_USER("Memory dump size does not match the segment map");
+		for (a = 0; a < 0x100; a++)
+			if (memory_segment_map[a] != UNUSED_SEGMENT) {
+				int ret = xemusnap_read_file(memory + (a << 14), 0x4000);
+				if (ret) return ret;
+			} else
+				memset(memory + (a << 14), 0xFF, 0x4000);
+		return 0;
+	}
+	if (block->sub_size != sizeof buffer)
+		RETURN_XSNAPERR_USER("Bad memory block syntax");
+	a = xemusnap_read_file(buffer, sizeof buffer);
+	if (a) return a;
+	for (a = 0; a < 0x100; a++) {
+		if (buffer[a] >= SNAPSHOT_SEGMENT_TYPES)
+			RETURN_XSNAPERR_USER("Bad segment type %d for segment %02Xh", buffer[a], a);
+		if (snapshot_segment_types[buffer[a]] != memory_segment_map[a] || memory_segment_map[a] != ROM_SEGMENT)
+			rom_name_tab[a] = NULL;
+		memory_segment_map[a] = snapshot_segment_types[buffer[a]];
+	}
+	xep_rom_seg = (int)P_AS_BE32(buffer + 0x100);
+	ep_init_ram();
+	return 0;
+}
+
+
+int ep_snapshot_save_memory ( const struct xemu_snapshot_definition_st *def )
+{
+	Uint8 buffer[0x104];
+	int a = xemusnap_write_block_header(def->idstr, SNAPSHOT_MEM_BLOCK_VERSION);
+	Uint8 *data, *p;
+	if (a) return a;
+	for (a = 0; a < 0x100; a++) {
+		int t = 0;
+		while (snapshot_segment_types[t] != memory_segment_map[a])
+			if (++t == SNAPSHOT_SEGMENT_TYPES)
+				RETURN_XSNAPERR_USER("Unknown type of segment %02Xh", a);
+		buffer[a] = t;
+	}
+	U32_AS_BE(buffer + 0x100, xep_rom_seg);
+	a = xemusnap_write_sub_block(buffer, sizeof buffer);
+	if (a) return a;
+	p = data = malloc(0x400000);
+	CHECK_MALLOC(data);
+	for (a = 0; a < 0x100; a++)
+		if (memory_segment_map[a] != UNUSED_SEGMENT) {
+			memcpy(p, memory + (a << 14), 0x4000);
+			p += 0x4000;
+		}
+	a = xemusnap_write_sub_block(data, p - data);
+	free(data);
+	return a;
+}
+
+
+int ep_snapshot_load_io ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block )
+{
+	Uint8 buffer[0x100];
+	int a;
+	if (block->block_version != SNAPSHOT_IO_BLOCK_VERSION || block->sub_counter || block->sub_size != sizeof buffer)
+		RETURN_XSNAPERR_USER("Bad I/O block syntax");
+	a = xemusnap_read_file(buffer, sizeof buffer);
+	if (a) return a;
+	/* Replay the port writes with side effects, the same way as ep128emu snapshot loading does. Dave's internal
+	   state is loaded by its own block (which must come after this one), as replaying the ports resets some */
+	memcpy(ports, buffer, sizeof ports);
+	for (a = 0xA0; a <= 0xBF; a++)
+		if (a != 0xB5 && a != 0xB6)	// do not trigger printer output by these
+			z80ex_pwrite_cb(a, buffer[a]);
+	kbd_selector = ((buffer[0xB5] & 15) < 10) ? (buffer[0xB5] & 15) : -1;
+	for (a = 0x80; a <= 0x82; a++)
+		z80ex_pwrite_cb(a, buffer[a]);
+	z80ex_pwrite_cb(0x83, buffer[0x83] & 127);
+	z80ex_pwrite_cb(0x83, buffer[0x83] | 128 | 64);
+	memcpy(ports, buffer, sizeof ports);
+	return 0;
+}
+
+
+int ep_snapshot_save_io ( const struct xemu_snapshot_definition_st *def )
+{
+	int a = xemusnap_write_block_header(def->idstr, SNAPSHOT_IO_BLOCK_VERSION);
+	if (a) return a;
+	return xemusnap_write_sub_block(ports, sizeof ports);
+}
+
+#endif
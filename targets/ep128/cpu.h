@@ -34,6 +34,8 @@ extern int   ep_init_ram ( void );
 extern Uint8 read_cpu_byte ( Uint16 addr );
 extern Uint8 read_cpu_byte_by_segmap ( Uint16 addr, Uint8 *segmap );
 extern void  write_cpu_byte_by_segmap ( Uint16 addr, Uint8 *segmap, Uint8 data );
+extern void  read_cpu_block_by_segmap ( Uint16 addr, Uint8 *segmap, Uint8 *data, int len );
+extern void  write_cpu_block_by_segmap ( Uint16 addr, Uint8 *segmap, const Uint8 *data, int len );
 extern void  z80_reset ( void );
 extern void  ep_reset ( void );
 
@@ -54,4 +56,14 @@ extern const char VRAM_SEGMENT[];
 extern const char SRAM_SEGMENT[];
 extern const char UNUSED_SEGMENT[];
 
+#ifdef XEMU_SNAPSHOT_SUPPORT
+#include "xemu/emutools_snapshot.h"
+extern int ep_snapshot_load_z80 ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block );
+extern int ep_snapshot_save_z80 ( const struct xemu_snapshot_definition_st *def );
+extern int ep_snapshot_load_memory ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block );
+extern int ep_snapshot_save_memory ( const struct xemu_snapshot_definition_st *def );
+extern int ep_snapshot_load_io ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block );
+extern int ep_snapshot_save_io ( const struct xemu_snapshot_definition_st *def );
+#endif
+
 #endif
@@ -22,6 +22,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "primoemu.h"
 #include "cpu.h"
 #include "printer.h"
+#include "configuration.h"
+#include "xemu/emutools_audiopace.h"
 
 #include <SDL.h>
 
@@ -99,6 +101,7 @@ static void audio_fill_stereo ( Uint16 stereo_sample )
 
 static void audio_callback(void *userdata, Uint8 *stream, int len)
 {
+	int len0 = len;
 	while (len--) {
 		if (audio_buffer_r == audio_buffer_w) {
 			//*(stream++) = 0;
@@ -110,6 +113,15 @@ static void audio_callback(void *userdata, Uint8 *stream, int len)
 				audio_buffer_r = audio_buffer;
 		}
 	}
+	audiopace_consumed_samples(len0 >> 1);	// 2 channels * 8 bit samples
+}
+
+
+
+// Number of stereo samples in our buffer not yet given to the audio device, used for audio clock pacing
+static int audio_fill_level ( void )
+{
+	return (int)((audio_buffer_w - audio_buffer_r) & (AUDIO_BUFFER_SIZE - 1)) >> 1;
 }
 
 
@@ -159,8 +171,16 @@ void audio_init ( int enable )
 		ERROR_WINDOW("Bad audio parameters (w/h freq=%d/%d, fmt=%d/%d, chans=%d/%d, smpls=%d/%d, cannot use sound",
 			want.freq, audio_spec.freq, want.format, audio_spec.format, want.channels, audio_spec.channels, want.samples, audio_spec.samples
 		);
-	} else
+	} else {
 		audio_stop();	// still stopped ... must be audio_start()'ed by the caller
+		int latency = config_getopt_int("audiopace");
+		int latency_max = (AUDIO_BUFFER_SIZE / 2 - audio_spec.samples) * 1000 / audio_spec.freq;	// our buffer would overflow with higher latency
+		if (latency > latency_max) {
+			DEBUGPRINT("AUDIO: pacing latency %d msecs is too high for the audio buffer, using %d msecs instead." NL, latency, latency_max);
+			latency = latency_max;
+		}
+		audiopace_init(audio, audio_spec.freq, audio_spec.samples, latency, audio_fill_level);
+	}
 }
 
 
@@ -359,3 +379,70 @@ void dave_write_audio_register ( Uint8 port, Uint8 value )
 			break;
 	}
 }
+
+/* --- SNAPSHOT RELATED --- */
+
+#ifdef XEMU_SNAPSHOT_SUPPORT
+
+#define SNAPSHOT_DAVE_BLOCK_VERSION	0
+#define SNAPSHOT_DAVE_BLOCK_SIZE	64
+
+int dave_snapshot_load_state ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block )
+{
+	Uint8 buffer[SNAPSHOT_DAVE_BLOCK_SIZE];
+	int a;
+	if (block->block_version != SNAPSHOT_DAVE_BLOCK_VERSION || block->sub_counter || block->sub_size != sizeof buffer)
+		RETURN_XSNAPERR_USER("Bad Dave block syntax");
+	a = xemusnap_read_file(buffer, sizeof buffer);
+	if (a) return a;
+	/* loading state ... */
+	dave_int_read = buffer[0];
+	dave_int_write = buffer[1];
+	kbd_selector = (signed char)buffer[2];
+	audio_source = buffer[3];
+	cnt_1hz = (int)P_AS_BE32(buffer + 4);
+	cnt_50hz = (int)P_AS_BE32(buffer + 8);
+	cnt_31khz = (int)P_AS_BE32(buffer + 12);
+	cnt_1khz = (int)P_AS_BE32(buffer + 16);
+	cnt_tg0 = (int)P_AS_BE32(buffer + 20);
+	cnt_tg1 = (int)P_AS_BE32(buffer + 24);
+	cnt_tg2 = (int)P_AS_BE32(buffer + 28);
+	cnt_load_tg0 = (int)P_AS_BE32(buffer + 32);
+	cnt_load_tg1 = (int)P_AS_BE32(buffer + 36);
+	cnt_load_tg2 = (int)P_AS_BE32(buffer + 40);
+	tg0_ff = buffer[44];
+	tg1_ff = buffer[45];
+	tg2_ff = buffer[46];
+	dave_set_clock();
+	return 0;
+}
+
+
+int dave_snapshot_save_state ( const struct xemu_snapshot_definition_st *def )
+{
+	Uint8 buffer[SNAPSHOT_DAVE_BLOCK_SIZE];
+	int a = xemusnap_write_block_header(def->idstr, SNAPSHOT_DAVE_BLOCK_VERSION);
+	if (a) return a;
+	memset(buffer, 0xFF, sizeof buffer);
+	/* saving state ... */
+	buffer[0] = dave_int_read;
+	buffer[1] = dave_int_write;
+	buffer[2] = kbd_selector;
+	buffer[3] = audio_source;
+	U32_AS_BE(buffer +  4, cnt_1hz);
+	U32_AS_BE(buffer +  8, cnt_50hz);
+	U32_AS_BE(buffer + 12, cnt_31khz);
+	U32_AS_BE(buffer + 16, cnt_1khz);
+	U32_AS_BE(buffer + 20, cnt_tg0);
+	U32_AS_BE(buffer + 24, cnt_tg1);
+	U32_AS_BE(buffer + 28, cnt_tg2);
+	U32_AS_BE(buffer + 32, cnt_load_tg0);
+	U32_AS_BE(buffer + 36, cnt_load_tg1);
+	U32_AS_BE(buffer + 40, cnt_load_tg2);
+	buffer[44] = tg0_ff;
+	buffer[45] = tg1_ff;
+	buffer[46] = tg2_ff;
+	return xemusnap_write_sub_block(buffer, sizeof buffer);
+}
+
+#endif
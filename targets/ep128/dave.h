@@ -41,4 +41,10 @@ extern void dave_tick ( void );
 extern void dave_configure_interrupts ( Uint8 n );
 extern void dave_write_audio_register ( Uint8 port, Uint8 value );
 
+#ifdef XEMU_SNAPSHOT_SUPPORT
+#include "xemu/emutools_snapshot.h"
+extern int dave_snapshot_load_state ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block );
+extern int dave_snapshot_save_state ( const struct xemu_snapshot_definition_st *def );
+#endif
+
 #endif
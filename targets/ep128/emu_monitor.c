@@ -36,6 +36,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "sdext.h"
 
 #include "main.h"
+#include "snapshot.h"
+#include "xemu/emutools_metrics.h"
 
 #include <SDL.h>
 #include <SDL_syswm.h>
@@ -525,6 +527,32 @@ static void cmd_pause ( void )
 }
 
 
+#ifdef XEMU_SNAPSHOT_SUPPORT
+static void cmd_snapload ( void )
+{
+	char *arg = get_mon_arg(ARG_SPACE);
+	if (!arg)
+		MPRINTF("*** Snapshot file name is needed\n");
+	else if (xemusnap_load(arg))
+		MPRINTF("*** Cannot load snapshot: %s\n", xemusnap_error_buffer);
+	else
+		MPRINTF("Snapshot has been loaded from %s\n", arg);
+}
+
+
+static void cmd_snapsave ( void )
+{
+	char *arg = get_mon_arg(ARG_SPACE);
+	if (!arg)
+		MPRINTF("*** Snapshot file name is needed\n");
+	else if (xemusnap_save(arg))
+		MPRINTF("*** Cannot save snapshot: %s\n", xemusnap_error_buffer);
+	else
+		MPRINTF("Snapshot has been saved to %s\n", arg);
+}
+#endif
+
+
 static void cmd_sdl ( void )
 {
 	SDL_RendererInfo info;
@@ -582,6 +610,15 @@ static void cmd_sdl ( void )
 
 
 
+static void cmd_perf ( void )
+{
+	char buf[1024];
+	emu_metrics_report(buf, sizeof buf, "\n");
+	MPRINTF("%s", buf);
+}
+
+
+
 static void cmd_ports ( void )
 {
 	int a;
@@ -680,6 +717,7 @@ static const struct commands_st commands[] = {
 	{ "MEMDUMP",	"M", 3, "Memory dump", cmd_memdump },
 	{ "MOUSE",	"", 3, "Configure or query mouse mode", cmd_mouse },
 	{ "PAUSE",	"", 2, "Pause/resume emulation", cmd_pause },
+	{ "PERF",	"", 3, "Performance metrics (average of the last frames)", cmd_perf },
 	{ "PORTS",	"", 3, "I/O port values (written)", cmd_ports },
 	{ "PRIMO",	"", 3, "Primo emulation", cmd_primo },
 	{ "RAM",	"", 3, "Set RAM size/report", cmd_ram },
@@ -688,6 +726,10 @@ static const struct commands_st commands[] = {
 	{ "SDL",        "", 3,  "Get SDL related info", cmd_sdl },
 	{ "SETDATE",	"", 1, "Set EXOS time/date by emulator" , cmd_setdate },
 	{ "SHOWKEYS",	"", 3, "Show/hide PC/SDL key symbols", cmd_showkeys },
+#ifdef XEMU_SNAPSHOT_SUPPORT
+	{ "SNAPLOAD",	"", 2, "Load Xep128 snapshot", cmd_snapload },
+	{ "SNAPSAVE",	"", 2, "Save Xep128 snapshot", cmd_snapsave },
+#endif
 	{ "TESTARGS",   "", 3, "Just for testing monitor statement parsing, not so useful for others", cmd_testargs },
 	{ NULL,		NULL, 0, NULL, NULL }
 };
@@ -23,6 +23,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 #include "exdos_wd.h"
 #include "configuration.h"
+#include "xemu/disk_overlay.h"
 #include <unistd.h>
 #include <sys/types.h>
 
@@ -34,6 +35,14 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 static FILE *disk_fp = NULL;
 static int   disk_fd = -1;
 static Uint8 disk_buffer[512];
+static struct disk_overlay_st overlay = { .fd = -1 };	// copy-on-write overlay of the image, if fd is not -1
+// The whole disk image is held in memory (it's only some Mbytes at most), written sectors are
+// marked for the shared delayed write-back, and written back periodically and on detach.
+static Uint8 *disk_image = NULL;
+static struct disk_writeback_st writeback = { .dirty_frames = -1 };
+static int   write_pending = 0;	// write sector command is waiting for data bytes
+static off_t write_offset;
+#define WD_FLUSH_FRAMES	50
 char wd_img_path[PATH_MAX + 1];
 int wd_max_tracks, wd_max_sectors, wd_image_size;
 
@@ -107,14 +116,54 @@ static int guess_geometry ( void )
 }
 
 
+void wd_flush_disk_image ( void )
+{
+	if (disk_writeback_flush(&writeback))
+		ERROR_WINDOW("WD/EXDOS disk image write error: %s\nWill retry silently.", ERRSTR());
+}
+
+
+
+void wd_update ( void )
+{
+	if (disk_writeback_update(&writeback))
+		ERROR_WINDOW("WD/EXDOS disk image write error: %s\nWill retry silently.", ERRSTR());
+}
+
+
+
+static int load_disk_image ( void )
+{
+	int sector;
+	disk_image = malloc(wd_image_size);
+	if (!disk_image || disk_writeback_init(&writeback, "WD", disk_image, wd_image_size >> 9, WD_FLUSH_FRAMES, disk_fd, &overlay))
+		return -1;
+	if (lseek(disk_fd, 0, SEEK_SET) != 0 || read(disk_fd, disk_image, wd_image_size) != wd_image_size)
+		return -1;
+	if (overlay.fd >= 0)
+		for (sector = 0; sector < wd_image_size >> 9; sector++)
+			if (disk_overlay_has_sector(&overlay, (off_t)sector << 9) && disk_overlay_read(&overlay, disk_fd, (off_t)sector << 9, disk_image + (sector << 9)))
+				return -1;
+	return 0;
+}
+
+
+
 void wd_detach_disk_image ( void )
 {
+	if (disk_image && disk_fd > -1)
+		wd_flush_disk_image();
+	free(disk_image);
+	disk_image = NULL;
+	disk_writeback_free(&writeback);
+	write_pending = 0;
 	if (disk_fp)
 		fclose(disk_fp);
 	if (disk_fd > -1)
 		close(disk_fd);
 	disk_fp = NULL;
 	disk_fd = -1;
+	disk_overlay_close(&overlay);
 	*wd_img_path = 0;
 	readOnly = 0;
 	diskInserted = 1; // no disk inserted by default (1 means NOT)
@@ -122,7 +171,7 @@ void wd_detach_disk_image ( void )
 
 
 
-int wd_attach_disk_image ( const char *fn )
+int wd_attach_disk_image ( const char *fn, const char *ovlfn )
 {
 	wd_detach_disk_image();
 	if (!strcasecmp(fn, "none")) {
@@ -133,6 +182,9 @@ int wd_attach_disk_image ( const char *fn )
 	if (!disk_fp) {
 		ERROR_WINDOW("No EXDOS image found with name '%s'.", fn);
 		return 1;
+	} else if (strcasecmp(ovlfn, "none")) {
+		// with overlay, the image is only read, and written sectors go into the overlay file
+		DEBUGPRINT("WD: disk image opened in R/O mode with overlay %s: %s" NL, ovlfn, wd_img_path);
 	} else {
 		// R/O was ok, try R/W
 		FILE *fp2 = fopen(wd_img_path, "r+b");
@@ -151,6 +203,16 @@ int wd_attach_disk_image ( const char *fn )
 		wd_detach_disk_image();
 		return 1;
 	}
+	if (strcasecmp(ovlfn, "none") && disk_overlay_open(&overlay, ovlfn, wd_image_size)) {
+		ERROR_WINDOW("Cannot use overlay file %s for the EXDOS disk image", ovlfn);
+		wd_detach_disk_image();
+		return 1;
+	}
+	if (load_disk_image()) {
+		ERROR_WINDOW("Cannot load EXDOS disk image: %s", ERRSTR());
+		wd_detach_disk_image();
+		return 1;
+	}
 	diskInserted = 0;	// disk OK, use inserted status
 	return 1;
 }
@@ -161,7 +223,7 @@ void wd_exdos_reset ( void )
 {
 	if (!disk_fp)
 		wd_detach_disk_image();
-	readOnly = 0;
+	write_pending = 0;
 	wd_track = 0;
 	wd_sector = 0;
 	wd_status = 4; // track 0 flag is on at initialization
@@ -176,10 +238,25 @@ void wd_exdos_reset ( void )
 }
 
 
+// Returns the offset of the sector addressed by the WD registers in the disk image, or -1 if it's invalid.
+static off_t sector_offset ( const char *op )
+{
+	if (wd_sector < 1 || wd_sector > wd_max_sectors) {
+		DEBUGEXDOS("WD: %s sector refused: invalid sector number %d (valid = %d...%d)" NL, op, wd_sector, 1, wd_max_sectors);
+		return -1;
+	}
+	if (wd_track < 0 || wd_track >= wd_max_tracks) {
+		DEBUGEXDOS("WD: %s sector refused: invalid track number %d (valid = %d...%d)" NL, op, wd_track, 0, wd_max_tracks - 1);
+		return -1;
+	}
+	return (off_t)(wd_track * wd_max_sectors * 2 + wd_sector - 1 + wd_max_sectors * diskSide) << 9;
+}
+
+
+
 static int read_sector ( void )
 {
 	off_t ofs;
-	int ret;
 	buffer_pos = 0;
 	buffer_size = 512;
 	if (!driveSel) {
@@ -188,37 +265,25 @@ static int read_sector ( void )
 		memset(disk_buffer, 0, 512); // fake empty
 		return 0;
 	}
-	if (wd_sector < 1 || wd_sector > wd_max_sectors) {
-		DEBUGEXDOS("WD: read sector refused: invalid sector number %d (valid = %d...%d)" NL, wd_sector, 1, wd_max_sectors);
-		return 1;
-	}
-	if (wd_track < 0 || wd_track >= wd_max_tracks) {
-		DEBUGEXDOS("WD: read sector refused: invalid track number %d (valid = %d...%d)" NL, wd_track, 0, wd_max_tracks - 1);
-		return 1;
-	}
-	ofs = (wd_track * wd_max_sectors * 2 + wd_sector - 1 + wd_max_sectors * diskSide) << 9;
-	DEBUGEXDOS("WD: Seeking to: offset %d (track=%d, sector=%d, side=%d)" NL, (int)ofs, wd_track, wd_sector, diskSide);
-	if (lseek(disk_fd, ofs, SEEK_SET) != ofs) {
-		ERROR_WINDOW("WD/EXDOS disk image seek error: %s", ERRSTR());
+	ofs = sector_offset("read");
+	if (ofs < 0)
 		return 1;
-	}
-	ret = read(disk_fd, disk_buffer, 512);
-	DEBUGEXDOS("WD: read() for 512 bytes data to read, retval=%d" NL, ret);
-	switch (ret) {
-		case   0:
-			ERROR_WINDOW("WD/EXDOS disk image read error: NO DATA READ");
-			return 1;
-		case 512:
-			break;
-		default:
-			ERROR_WINDOW("WD/EXDOS disk image read error: %s", ERRSTR());
-			return 1;
-	}
+	DEBUGEXDOS("WD: reading sector at offset %d (track=%d, sector=%d, side=%d)" NL, (int)ofs, wd_track, wd_sector, diskSide);
+	memcpy(disk_buffer, disk_image + ofs, 512);
 	return 0;
 }
 
 
 
+static void write_sector ( void )
+{
+	DEBUGEXDOS("WD: writing sector at offset %d" NL, (int)write_offset);
+	memcpy(disk_image + write_offset, disk_buffer, 512);
+	disk_writeback_mark(&writeback, write_offset >> 9);
+}
+
+
+
 Uint8 wd_read_status ( void )
 {
 	wd_interrupt = WDINT_OFF; // on reading WD status, interrupt is reset!
@@ -229,7 +294,7 @@ Uint8 wd_read_status ( void )
 
 Uint8 wd_read_data ( void )
 {
-	if (wd_DRQ) {
+	if (wd_DRQ && !write_pending) {
 		wd_data = disk_buffer[buffer_pos++];
 		if (buffer_pos >= buffer_size)
 			wd_DRQ = 0; // end of data, switch DRQ off!
@@ -250,6 +315,7 @@ void wd_send_command ( Uint8 value )
 {
 	wd_command = value;
 	wd_DRQ = 0;	// reset DRQ
+	write_pending = 0;
 	wd_interrupt = WDINT_OFF;	// reset INTERRUPT
 	DEBUGEXDOS("WD: command received: 0x%02X driveSel=%d distInserted=%d hasImage=%d" NL, value, driveSel, diskInserted, disk_fp != NULL);
 	switch (value >> 4) {
@@ -279,6 +345,22 @@ void wd_send_command ( Uint8 value )
 			}
 			wd_interrupt = WDINT_ON;
 			break;
+		case 10: // write sector, single (type II)
+			if (!driveSel || (write_offset = sector_offset("write")) < 0) {
+				wd_status = 16; // record not found
+				wd_interrupt = WDINT_ON;
+			} else if (readOnly) {
+				wd_status = 64;	// write protected
+				wd_interrupt = WDINT_ON;
+			} else {
+				// wait for the data bytes, see wd_write_data()
+				write_pending = 1;
+				buffer_pos = 0;
+				buffer_size = 512;
+				wd_status = 0;
+				wd_DRQ = WDDRQ;
+			}
+			break;
 		case 12: // read address (type III)
 			if (driveSel) {
 				int i;
@@ -315,6 +397,15 @@ void wd_send_command ( Uint8 value )
 void wd_write_data ( Uint8 value )
 {
 	wd_data = value;
+	if (wd_DRQ && write_pending) {
+		disk_buffer[buffer_pos++] = value;
+		if (buffer_pos >= buffer_size) {
+			wd_DRQ = 0;
+			write_pending = 0;
+			write_sector();
+			wd_interrupt = WDINT_ON;
+		}
+	}
 }
 
 
@@ -327,6 +418,73 @@ void wd_set_exdos_control ( Uint8 value )
 }
 
 
+/* --- SNAPSHOT RELATED --- */
+
+#ifdef XEMU_SNAPSHOT_SUPPORT
+
+#define SNAPSHOT_WD_BLOCK_VERSION	0
+#define SNAPSHOT_WD_BLOCK_SIZE		(32 + 512)
+
+/* Only the controller state is stored, the disk image itself is the one given by the configuration */
+int wd_snapshot_load_state ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block )
+{
+	Uint8 buffer[SNAPSHOT_WD_BLOCK_SIZE];
+	int a;
+	if (block->block_version != SNAPSHOT_WD_BLOCK_VERSION || block->sub_counter || block->sub_size != sizeof buffer)
+		RETURN_XSNAPERR_USER("Bad EXDOS block syntax");
+	a = xemusnap_read_file(buffer, sizeof buffer);
+	if (a) return a;
+	/* loading state ... */
+	wd_sector = buffer[0];
+	wd_track = buffer[1];
+	wd_status = buffer[2];
+	wd_data = buffer[3];
+	wd_command = buffer[4];
+	wd_interrupt = buffer[5];
+	wd_DRQ = buffer[6];
+	diskSide = buffer[7];
+	driveSel = (disk_fp != NULL) && buffer[8];
+	diskInserted = driveSel ? 0 : 1;
+	diskChanged = buffer[9];
+	write_pending = driveSel && buffer[10];
+	buffer_pos = P_AS_BE16(buffer + 12);
+	buffer_size = P_AS_BE16(buffer + 14);
+	write_offset = (off_t)P_AS_BE64(buffer + 16);
+	if (buffer_size > 512 || buffer_pos > buffer_size || (write_pending && (write_offset < 0 || write_offset + 512 > wd_image_size)))
+		RETURN_XSNAPERR_USER("Bad EXDOS controller state");
+	memcpy(disk_buffer, buffer + 32, 512);
+	return 0;
+}
+
+
+int wd_snapshot_save_state ( const struct xemu_snapshot_definition_st *def )
+{
+	Uint8 buffer[SNAPSHOT_WD_BLOCK_SIZE];
+	int a = xemusnap_write_block_header(def->idstr, SNAPSHOT_WD_BLOCK_VERSION);
+	if (a) return a;
+	memset(buffer, 0xFF, sizeof buffer);
+	/* saving state ... */
+	buffer[0] = wd_sector;
+	buffer[1] = wd_track;
+	buffer[2] = wd_status;
+	buffer[3] = wd_data;
+	buffer[4] = wd_command;
+	buffer[5] = wd_interrupt;
+	buffer[6] = wd_DRQ;
+	buffer[7] = diskSide;
+	buffer[8] = driveSel;
+	buffer[9] = diskChanged;
+	buffer[10] = write_pending;
+	U16_AS_BE(buffer + 12, buffer_pos);
+	U16_AS_BE(buffer + 14, buffer_size);
+	U64_AS_BE(buffer + 16, (Uint64)write_offset);
+	memcpy(buffer + 32, disk_buffer, 512);
+	return xemusnap_write_sub_block(buffer, sizeof buffer);
+}
+
+#endif
+
+
 #else
 #warning "EXDOS/WD support is not compiled in / not ready"
 #endif
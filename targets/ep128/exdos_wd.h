@@ -33,8 +33,16 @@ extern void  wd_send_command      ( Uint8 value );
 extern void  wd_write_data        ( Uint8 value );
 extern void  wd_set_exdos_control ( Uint8 value );
 extern void  wd_exdos_reset       ( void );
-extern int   wd_attach_disk_image ( const char *fn );
+extern int   wd_attach_disk_image ( const char *fn, const char *ovlfn );
 extern void  wd_detach_disk_image ( void );
+extern void  wd_flush_disk_image  ( void );
+extern void  wd_update            ( void );
+
+#ifdef XEMU_SNAPSHOT_SUPPORT
+#include "xemu/emutools_snapshot.h"
+extern int wd_snapshot_load_state ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block );
+extern int wd_snapshot_save_state ( const struct xemu_snapshot_definition_st *def );
+#endif
 
 #endif
 #endif
@@ -48,6 +48,17 @@ static char *fio_name[0x100];
 static int   fio_size[0x100];
 static Uint8 fio_prot[0x100];
 
+/* Every open channel has a buffer for read-ahead and write-behind. It holds "len" bytes of the
+   file from file offset "base". If it's dirty, these bytes must be written to the host file yet,
+   it's done on close, or when the buffer is needed for another part of the file. */
+#define FIO_BUFFER_SIZE	0x4000
+static struct {
+	Uint8 *data;
+	int   base;
+	int   len;
+	int   dirty;
+} fio_buf[0x100];
+
 
 
 void fileio_init ( const char *dir, const char *subdir )
@@ -216,11 +227,21 @@ void fileio_func_open_or_create_channel ( int create )
 	r = open_host_file(fileio_cwd, fnbuf, create, &fio_name[channel], &fio_size[channel]);
 	//xep_set_error(ERRSTR());
 	DEBUGPRINT("FILEIO: %s channel #%d result = %d filename = \"%s\" as %s with size of %d" NL, create ? "create" : "open", channel, r, fnbuf, fio_name[channel], fio_size[channel]);
+	if (r >= 0 && !(fio_buf[channel].data = malloc(FIO_BUFFER_SIZE))) {
+		xep_set_error(HOST_OS_STR "Cannot allocate memory");
+		close(r);
+		free(fio_name[channel]);
+		fio_name[channel] = NULL;
+		r = -1;
+	}
 	if (r < 0) {
 		// open_host_file() already issued the xep_set_error() call to set a message up ...
 		Z80_A = XEP_ERROR_CODE;
 	} else {
 		fio_fd[channel] = r;
+		fio_buf[channel].base = 0;
+		fio_buf[channel].len = 0;
+		fio_buf[channel].dirty = 0;
 		fio_off[channel] = 0;	// file offset
 		fio_prot[channel] = 0;	// protection byte not so much used by EXOS, but anyway ...
 		Z80_A = 0;
@@ -228,6 +249,22 @@ void fileio_func_open_or_create_channel ( int create )
 }
 
 
+static int buffer_flush ( void );
+
+
+static int close_channel ( void )
+{
+	int ret = buffer_flush();	// this may set error str and Z80_A!
+	close(fio_fd[channel]);
+	fio_fd[channel] = -1;
+	free(fio_name[channel]);
+	fio_name[channel] = NULL;
+	free(fio_buf[channel].data);
+	fio_buf[channel].data = NULL;
+	return ret;
+}
+
+
 void fileio_func_close_channel ( void )
 {
 	SET_CHANNEL(Z80_A);
@@ -236,11 +273,8 @@ void fileio_func_close_channel ( void )
 		Z80_A = 0xFB;	// invalid channel
 	} else {
 		DEBUGPRINT("FILEIO: close, closing channel %d (fd = %d)" NL, channel, fio_fd[channel]);
-		close(fio_fd[channel]);
-		fio_fd[channel] = -1;
-		free(fio_name[channel]);
-		fio_name[channel] = NULL;
 		Z80_A = 0;
+		close_channel();	// this may set error str and Z80_A!
 	}
 }
 
@@ -260,10 +294,10 @@ static int increment_offset ( int inc /*, int is_write */ )
 }
 
 
-static int host_reseek ( void )
+static int host_seek ( int offset )
 {
-	off_t ret = lseek(fio_fd[channel], fio_off[channel], SEEK_SET);
-	if (ret != fio_off[channel]) {
+	off_t ret = lseek(fio_fd[channel], offset, SEEK_SET);
+	if (ret != offset) {
 		Z80_A = XEP_ERROR_CODE;
 		if (ret)
 			fileio_host_errstr();
@@ -271,20 +305,92 @@ static int host_reseek ( void )
 			xep_set_error(HOST_OS_STR "Invalid seek retval");
 		return -1;
 	}
-	if (fio_off[channel] > FILEIO_MAX_FILE_SIZE) {
+	if (offset > FILEIO_MAX_FILE_SIZE) {
 		Z80_A = XEP_ERROR_CODE;
 		xep_set_error(HOST_OS_STR FILE_TOO_LARGE);
 		return -1;
 	}
-	DEBUG("FILEIO: internal host seek %d for channel %d" NL, fio_off[channel], channel);
+	DEBUG("FILEIO: internal host seek %d for channel %d" NL, offset, channel);
+	return 0;
+}
+
+
+static int buffer_flush ( void )
+{
+	int done = 0;
+	if (!fio_buf[channel].dirty)
+		return 0;
+	fio_buf[channel].dirty = 0;
+	if (host_seek(fio_buf[channel].base)) {	// this may set error str and Z80_A!
+		fio_buf[channel].len = 0;
+		return -1;
+	}
+	while (done < fio_buf[channel].len) {
+		int r = write(fio_fd[channel], fio_buf[channel].data + done, fio_buf[channel].len - done);
+		if (r <= 0) {
+			if (r)
+				fileio_host_errstr();
+			else
+				xep_set_error(HOST_OS_STR "Cannot write block");
+			Z80_A = XEP_ERROR_CODE;
+			fio_buf[channel].len = 0;
+			return -1;
+		}
+		done += r;
+	}
+	DEBUG("FILEIO: written %d bytes at offset %d for channel %d" NL, done, fio_buf[channel].base, channel);
 	return 0;
 }
 
 
+/* Makes the buffer to hold the file data at the current file offset, reading ahead if needed.
+   Returns the number of bytes available in the buffer from the current offset, zero at EOF,
+   or -1 on error (error str and Z80_A is set up then). */
+static int buffer_fill ( void )
+{
+	int r, ofs = fio_off[channel] - fio_buf[channel].base;
+	if (ofs >= 0 && ofs < fio_buf[channel].len)
+		return fio_buf[channel].len - ofs;
+	if (buffer_flush() || host_seek(fio_off[channel]))
+		return -1;
+	fio_buf[channel].base = fio_off[channel];
+	fio_buf[channel].len = 0;
+	r = read(fio_fd[channel], fio_buf[channel].data, FIO_BUFFER_SIZE);
+	DEBUG("FILEIO: read-ahead on channel %d at offset %d, result is %d" NL, channel, fio_off[channel], r);
+	if (r < 0) {
+		fileio_host_errstr();
+		Z80_A = XEP_ERROR_CODE;
+		return -1;
+	}
+	fio_buf[channel].len = r;
+	return r;
+}
+
+
+/* Gives the place in the buffer to store data to be written at the current file offset.
+   *len is decreased if the buffer has not enough space for that much.
+   Returns NULL on error (error str and Z80_A is set up then). */
+static Uint8 *buffer_for_write ( int *len )
+{
+	int ofs = fio_off[channel] - fio_buf[channel].base;
+	if (ofs < 0 || ofs > fio_buf[channel].len || ofs >= FIO_BUFFER_SIZE) {
+		if (buffer_flush())
+			return NULL;
+		fio_buf[channel].base = fio_off[channel];
+		fio_buf[channel].len = 0;
+		ofs = 0;
+	}
+	if (*len > FIO_BUFFER_SIZE - ofs)
+		*len = FIO_BUFFER_SIZE - ofs;
+	if (ofs + *len > fio_buf[channel].len)
+		fio_buf[channel].len = ofs + *len;
+	fio_buf[channel].dirty = 1;
+	return fio_buf[channel].data + ofs;
+}
+
+
 void fileio_func_read_block ( void )
 {
-	int rb;
-	Uint8 buffer[0xFFFF], *p;
 	SET_CHANNEL(Z80_A);
 	DEBUGPRINT("FILEIO: read block on channel %d (fd = %d) BC=%04Xh DE=%04Xh" NL, channel, fio_fd[channel], Z80_BC, Z80_DE);
 	if (fio_fd[channel] < 0) {
@@ -292,35 +398,22 @@ void fileio_func_read_block ( void )
 		Z80_A = 0xFB;	// invalid channel
 		return;
 	}
-	if (host_reseek())	// this may set error str and Z80_A!
-		return;
 	Z80_A = 0;
-	rb = 0;
 	while (Z80_BC) {
-		int r;
-		r = read(fio_fd[channel], buffer + rb, Z80_BC);
-		DEBUGPRINT("FILEIO: read block on channel %d (fd = %d), %d byte(s) requested at offset %d (file size = %d), result is %d (got so far: %d)" NL,
-			channel, fio_fd[channel], Z80_BC,
-			fio_off[channel], fio_size[channel],
-			r, rb
-		);
-		if (r > 0) {
-			rb += r;
-			Z80_BC -= r;
-			if (increment_offset(r))	// this may set error str and Z80_A!
-				break;
-		} else if (!r) {
-			Z80_A = 0xE4;	// attempt to read after end of file
-			break;
-		} else {
-			fileio_host_errstr();
-			Z80_A = XEP_ERROR_CODE;
+		int r = buffer_fill();	// this may set error str and Z80_A!
+		if (r <= 0) {
+			if (!r)
+				Z80_A = 0xE4;	// attempt to read after end of file
 			break;
 		}
+		if (r > Z80_BC)
+			r = Z80_BC;
+		write_cpu_block_by_segmap(Z80_DE, EXOS_USER_SEGMAP_P, fio_buf[channel].data + fio_off[channel] - fio_buf[channel].base, r);
+		Z80_DE += r;
+		Z80_BC -= r;
+		if (increment_offset(r))	// this may set error str and Z80_A!
+			break;
 	}
-	p = buffer;
-	while (rb--)
-		write_cpu_byte_by_segmap(Z80_DE++, EXOS_USER_SEGMAP_P, *(p++));
 }
 
 
@@ -331,19 +424,13 @@ void fileio_func_read_character ( void )
 		DEBUGPRINT("FILEIO: read character, invalid channel for %d, fd is %d" NL, channel, fio_fd[channel]);
 		Z80_A = 0xFB;	// invalid channel
 	} else {
-		int r;
-		if (host_reseek())	// this may set error str and Z80_A!
-			return;
-		r = read(fio_fd[channel], &Z80_B, 1);
-		if (r == 1) {
+		int r = buffer_fill();	// this may set error str and Z80_A!
+		if (r > 0) {
+			Z80_B = fio_buf[channel].data[fio_off[channel] - fio_buf[channel].base];
 			Z80_A = 0;
 			increment_offset(1); // this may set error str and Z80_A!
 		} else if (!r)
 			Z80_A = 0xE4;	// attempt to read after end of file
-		else {
-			fileio_host_errstr();
-			Z80_A = XEP_ERROR_CODE;
-		}
 	}
 }
 
@@ -351,38 +438,22 @@ void fileio_func_read_character ( void )
 
 void fileio_func_write_block ( void )
 {
-	int wb, de;
-	Uint8 buffer[0xFFFF], *p;
 	SET_CHANNEL(Z80_A);
 	if (fio_fd[channel] < 0) {
 		Z80_A = 0xFB;	// invalid channel
 		return;
 	}
-	if (host_reseek())	// this may set error str and Z80_A!
-		return;
-	wb = Z80_BC;
-	p = buffer;
-	de = Z80_DE;
 	Z80_A = 0;
-	while (wb--)
-		*(p++) = read_cpu_byte_by_segmap(de++, EXOS_USER_SEGMAP_P);
-	p = buffer;
 	while (Z80_BC) {
-		int r = write(fio_fd[channel], p, Z80_BC);
-		if (r > 0) {
-			Z80_BC -= r;
-			Z80_DE += r;
-			if (increment_offset(r))	// this may set error str and Z80_A!
-				break;
-		} else if (!r) {
-			xep_set_error(HOST_OS_STR "Cannot write block");
-			Z80_A = XEP_ERROR_CODE;
+		int len = Z80_BC;
+		Uint8 *p = buffer_for_write(&len);	// this may set error str and Z80_A!
+		if (!p)
 			break;
-		} else {
-			fileio_host_errstr();
-			Z80_A = XEP_ERROR_CODE;
+		read_cpu_block_by_segmap(Z80_DE, EXOS_USER_SEGMAP_P, p, len);
+		Z80_BC -= len;
+		Z80_DE += len;
+		if (increment_offset(len))	// this may set error str and Z80_A!
 			break;
-		}
 	}
 }
 
@@ -393,19 +464,12 @@ void fileio_func_write_character ( void )
 	if (fio_fd[channel] < 0)
 		Z80_A = 0xFB;	// invalid channel
 	else {
-		int r;
-		if (host_reseek())	// this may set error str and Z80_A!
-			return;
-		r = write(fio_fd[channel], &Z80_B, 1);
-		if (r == 1) {
+		int len = 1;
+		Uint8 *p = buffer_for_write(&len);	// this may set error str and Z80_A!
+		if (p) {
+			*p = Z80_B;
 			Z80_A = 0;
 			increment_offset(1); // this may set error str and Z80_A!
-		} else if (!r) {
-			xep_set_error(HOST_OS_STR "Cannot write character");
-			Z80_A = XEP_ERROR_CODE;
-		} else {
-			fileio_host_errstr();
-			Z80_A = XEP_ERROR_CODE;
 		}
 	}
 }
@@ -463,14 +527,21 @@ void fileio_func_special_function ( void )
 
 void fileio_func_init ( void )
 {
-	int a;
-	for (a = 0; a < 0x100; a++)
-		if (fio_fd[a] != -1) {
-			close(fio_fd[a]);
-			fio_fd[a] = -1;
-			free(fio_name[a]);
-			fio_name[a] = NULL;
-		}
+	for (channel = 0; channel < 0x100; channel++)
+		if (fio_fd[channel] != -1)
+			close_channel();
+	channel = 0;
+}
+
+
+/* Writes out the pending write-behind data of all channels, used on exit of the emulator. */
+void fileio_flush_all ( void )
+{
+	int saved_channel = channel;
+	for (channel = 0; channel < 0x100; channel++)
+		if (fio_fd[channel] != -1 && buffer_flush())
+			DEBUGPRINT("FILEIO: cannot flush channel %d on exit: %s" NL, channel, ERRSTR());
+	channel = saved_channel;
 }
 
 
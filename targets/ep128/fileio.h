@@ -22,6 +22,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 extern char  fileio_cwd[PATH_MAX + 1];
 
 extern void fileio_init ( const char *dir, const char *subdir );
+extern void fileio_flush_all ( void );
 
 /* Internal functions between emu ROM interface and fileio: */
 extern void fileio_func_not_used_call( void );
@@ -41,6 +41,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "xemu/z80.h"
 #include "gui.h"
 #include "snapshot.h"
+#include "xemu/emutools_audiopace.h"
+#include "xemu/emutools_metrics.h"
+#include "xemu/input_record.h"
 
 #include <string.h>
 #include <stdlib.h>
@@ -49,6 +52,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include <time.h>
 #include <unistd.h>
 
+/* Xep128 has its own timekeeping, not the one in emutools.c, so we need the audio clock pacing, metrics and benchmark implementation here */
+#include "xemu/emutools_audiopace.c"
+#include "xemu/emutools_metrics.c"
+#include "xemu/emutools_bench.c"
+
 
 static Uint32 *ep_pixels;
 static const int _cpu_speeds[4] = { 4000000, 6000000, 7120000, 10000000 };
@@ -87,14 +95,20 @@ void *alloc_xep_aligned_mem ( size_t size )
 void shutdown_sdl(void)
 {
 	if (guarded_exit) {
+#ifdef XEMU_SNAPSHOT_SUPPORT
+		if (sram_ready && strcmp(config_getopt_str("snapsave"), "none"))
+			xepsnap_save(config_getopt_str("snapsave"));
+#endif
 		audio_close();
 		printer_close();
+		emu_metrics_close();
 #ifdef CONFIG_W5300_SUPPORT
 		w5300_shutdown();
 #endif
 #ifdef CONFIG_EXDOS_SUPPORT
 		wd_detach_disk_image();
 #endif
+		fileio_flush_all();
 		if (sram_ready)
 			sram_save_all_segments();
 		DEBUGPRINT("Shutdown callback, return." NL);
@@ -110,6 +124,7 @@ void shutdown_sdl(void)
 	/* last stuff! */
 	if (debug_fp) {
 		DEBUGPRINT("Closing debug messages log file on exit." NL);
+		xemu_log_stop();
 		fclose(debug_fp);
 		debug_fp = NULL;
 	}
@@ -183,7 +198,10 @@ static void emu_timekeeping_check ( void )
 {
 	// check how much time we slept, initiated by last call of emu_timekeeping_delay()
 	// we also store current UT in "unix_time" to be used by emulator (ie, RTC emulation)
-	int td = get_elapsed_time(et_end, &et_start, &unix_time);
+	int td;
+	if (unlikely(emu_bench_active))	// benchmark mode: unix_time is driven by the emulated time, see emu_timekeeping_delay()
+		return;
+	td = get_elapsed_time(et_end, &et_start, unlikely(inputrec_mode) ? NULL : &unix_time);
 	if (td >= 0)			// td should be greater than zero or sleep was about for _minus_ time? eh, give me that time machine, dude! :)
 		td_balancer -= td;	// time-difference balancer, decrease with time slept
 	else
@@ -200,7 +218,16 @@ static void emu_timekeeping_check ( void )
  * This function also does the sleep itself */
 static void emu_timekeeping_delay ( int td_em )
 {
-	int td, td_pc = get_elapsed_time(et_start, &et_end, NULL);	// the time was needed for our emulation loop
+	int td, td_pc;
+	if (unlikely(emu_bench_active)) {	// no sleeping, and the host clock is driven by the emulated time
+		if (emu_bench_frame(td_em)) {
+			unix_time++;
+			rtc_update_trigger = 1;
+		}
+		EMU_METRICS_FRAME(td_em);
+		return;
+	}
+	td_pc = get_elapsed_time(et_start, &et_end, NULL);	// the time was needed for our emulation loop
 	if (td_pc < 0) {
 		DEBUG("TIMING: negative amount of time spent for an emulation loop?!" NL);
 		td = 0;
@@ -230,8 +257,14 @@ static void emu_timekeeping_delay ( int td_em )
 	if (td_balancer >  1000000 || td_balancer < -1000000)
 		td_balancer = 0;
 	DEBUG("Balancer = %d" NL, td_balancer);
-	// Should be the last, as with Emscripten, it's not a real sleep, but the settimeout JS stuff ...
-	emu_sleep(td_balancer);
+	EMU_BENCH_SECTION(EMU_BENCH_SLEEP);
+	if (audiopace_enabled && !audiopace_wait(td_em))
+		td_balancer = 0;	// paced by the audio clock, no wall-clock sleeping and balancing is needed
+	else
+		emu_sleep(td_balancer);	// with Emscripten, it's not a real sleep, but the settimeout JS stuff ...
+	if (unlikely(inputrec_mode))
+		inputrec_clock(td_em, &unix_time);	// RTC is driven by the emulated time, so it's the same on replay
+	EMU_METRICS_FRAME(td_em);
 }
 
 
@@ -241,7 +274,9 @@ static void emu_timekeeping_delay ( int td_em )
  * You DO NOT need this during the active emulation loop! */
 void emu_timekeeping_start ( void )
 {
-	(void)get_elapsed_time(0, &et_start, &unix_time);
+	(void)get_elapsed_time(0, &et_start, unlikely(inputrec_mode) ? NULL : &unix_time);
+	if (unlikely(inputrec_mode))
+		inputrec_clock(0, &unix_time);
 	et_end = et_start;
 	td_balancer = 0;
 	rtc_update_trigger = 1;
@@ -285,7 +320,15 @@ void emu_one_frame(int rasters, int frameskip)
 static void __emu_one_frame(int rasters, int frameskip)
 {
 	SDL_Event e;
-	while (SDL_PollEvent(&e) != 0)
+	EMU_BENCH_SECTION(EMU_BENCH_IO);
+	inputrec_hold = paused;		// paused emulation still calls us, but no emulated frame passes
+	for (;;) {
+		if (!SDL_PollEvent(&e)) {
+			// no more SDL events, but in replay mode, recorded input events of this frame are injected here
+			if (likely(!inputrec_mode) || !inputrec_replay(&e))
+				break;
+		} else if (unlikely(inputrec_mode) && inputrec_event(&e))
+			continue;	// live input is ignored in replay mode
 		switch (e.type) {
 			case SDL_WINDOWEVENT:
 				if (!is_fullscreen && e.window.event == SDL_WINDOWEVENT_RESIZED) {
@@ -363,11 +406,21 @@ static void __emu_one_frame(int rasters, int frameskip)
 				joy_sdl_event(&e);
 				break;
 		}
-	if (!frameskip)
+	}
+	if (unlikely(inputrec_mode))
+		inputrec_frame_done();
+	if (!frameskip) {
+		EMU_BENCH_SECTION(EMU_BENCH_PRESENT);
 		screen_present_frame(ep_pixels);	// this should be after the event handler, as eg screenshot function needs locked texture state if this feature is used at all
+		EMU_BENCH_SECTION(EMU_BENCH_IO);
+	}
 	xepgui_iteration();
 	monitor_process_queued();
+#ifdef CONFIG_EXDOS_SUPPORT
+	wd_update();
+#endif
 	emu_timekeeping_delay((1000000.0 * rasters * 57.0) / (double)NICK_SLOTS_PER_SEC);
+	EMU_BENCH_SECTION(EMU_BENCH_CPU);
 }
 
 
@@ -398,8 +451,10 @@ static void xep128_emulation ( void )
 				DEBUG("CPU: int and accepted = %d" NL, t);
 		} else
 			t = 0;
-		if (likely(!t))
+		if (likely(!t)) {
 			t = z80ex_step();
+			EMU_METRICS_COUNT(EMU_METRICS_INSNS, 1);
+		}
 		cpu_cycles_for_dave_sync += t;
 		//DEBUG("DAVE: SYNC: CPU cycles = %d, Dave sync val = %d, limit = %d" NL, t, cpu_cycles_for_dave_sync, cpu_cycles_per_dave_tick);
 		while (cpu_cycles_for_dave_sync >= cpu_cycles_per_dave_tick) {
@@ -449,6 +504,30 @@ int main (int argc, char *argv[])
 #endif
 		return 1;
 	}
+	if (config_getopt_int("bench") > 0) {
+		// SDL is already initialized at this point, re-initialize video and audio to get the dummy (headless) drivers
+		emu_bench_init(config_getopt_int("bench"), DEFAULT_CPU_CLOCK);
+		SDL_QuitSubSystem(SDL_INIT_VIDEO | SDL_INIT_AUDIO);
+		if (SDL_InitSubSystem(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
+			ERROR_WINDOW("Cannot re-initialize SDL for benchmark mode: %s", SDL_GetError());
+			return 1;
+		}
+	}
+	if (inputrec_init(
+		strcmp(config_getopt_str("inputrec"),  "none") ? config_getopt_str("inputrec")  : NULL,
+		strcmp(config_getopt_str("inputplay"), "none") ? config_getopt_str("inputplay") : NULL
+	)) {
+		ERROR_WINDOW("Cannot start input recording or replay, see the debug log");
+		return 1;
+	}
+	if (emu_metrics_init(
+		config_getopt_int("metrics"),
+		strcmp(config_getopt_str("metricsfile"), "none") ? config_getopt_str("metricsfile") : NULL,
+		config_getopt_int("metricsosd")
+	)) {
+		ERROR_WINDOW("Cannot create the metrics stream file, see the debug log");
+		return 1;
+	}
 	guarded_exit = 1;	// turn on guarded exit, with custom de-init stuffs
 	DEBUGPRINT("EMU: sleeping = \"%s\", timing = \"%s\"" NL,
 		__SLEEP_METHOD_DESC, __TIMING_METHOD_DESC
@@ -492,7 +571,7 @@ int main (int argc, char *argv[])
 #endif
 #ifdef CONFIG_EXDOS_SUPPORT
 	wd_exdos_reset();
-	wd_attach_disk_image(config_getopt_str("wdimg"));
+	wd_attach_disk_image(config_getopt_str("wdimg"), config_getopt_str("wdovl"));
 #endif
 #ifdef CONFIG_W5300_SUPPORT
 	w5300_init(NULL);
@@ -513,6 +592,13 @@ int main (int argc, char *argv[])
 	}
 	if (snapshot)
 		ep128snap_set_cpu_and_io();
+#ifdef XEMU_SNAPSHOT_SUPPORT
+	xemusnap_init(ep128_snapshot_definition);
+	if (strcmp(config_getopt_str("snapload"), "none") && xepsnap_load(config_getopt_str("snapload"))) {
+		sram_ready = 0;	// machine state is undefined now, do not save anything on exit
+		return 1;
+	}
+#endif
 	console_monitor_ready();	// OK to run monitor on console now!
 #ifdef __EMSCRIPTEN__
 	emscripten_set_main_loop(xep128_emulation, 50, 1);
@@ -125,3 +125,37 @@ Uint8 rtc_read_reg(void)
 	return cmos_ram[i];
 }
 
+
+/* --- SNAPSHOT RELATED --- */
+
+#ifdef XEMU_SNAPSHOT_SUPPORT
+
+#define SNAPSHOT_RTC_BLOCK_VERSION	0
+#define SNAPSHOT_RTC_BLOCK_SIZE		(0x100 + 4)
+
+int rtc_snapshot_load_state ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block )
+{
+	Uint8 buffer[SNAPSHOT_RTC_BLOCK_SIZE];
+	int a;
+	if (block->block_version != SNAPSHOT_RTC_BLOCK_VERSION || block->sub_counter || block->sub_size != sizeof buffer)
+		RETURN_XSNAPERR_USER("Bad RTC block syntax");
+	a = xemusnap_read_file(buffer, sizeof buffer);
+	if (a) return a;
+	memcpy(cmos_ram, buffer, sizeof cmos_ram);
+	_rtc_register = (int)P_AS_BE32(buffer + 0x100);
+	rtc_update_trigger = 1;	// time/date registers are refreshed from the host anyway
+	return 0;
+}
+
+
+int rtc_snapshot_save_state ( const struct xemu_snapshot_definition_st *def )
+{
+	Uint8 buffer[SNAPSHOT_RTC_BLOCK_SIZE];
+	int a = xemusnap_write_block_header(def->idstr, SNAPSHOT_RTC_BLOCK_VERSION);
+	if (a) return a;
+	memcpy(buffer, cmos_ram, sizeof cmos_ram);
+	U32_AS_BE(buffer + 0x100, _rtc_register);
+	return xemusnap_write_sub_block(buffer, sizeof buffer);
+}
+
+#endif
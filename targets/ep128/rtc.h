@@ -26,4 +26,10 @@ extern Uint8 rtc_read_reg ( void );
 
 extern int rtc_update_trigger;
 
+#ifdef XEMU_SNAPSHOT_SUPPORT
+#include "xemu/emutools_snapshot.h"
+extern int rtc_snapshot_load_state ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block );
+extern int rtc_snapshot_save_state ( const struct xemu_snapshot_definition_st *def );
+#endif
+
 #endif
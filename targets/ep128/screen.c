@@ -50,8 +50,11 @@ Uint32 sdl_winid;
 static int win_xsize, win_ysize, resize_counter = 0, win_size_changed = 0;
 static int screenshot_index = 0;
 static Uint32 *osd_pixels = NULL;
-static int osd_on = 0, osd_fade = 0;
+static int osd_on = 0, osd_fade = 0, osd_alpha = 0xFF;
 static Uint32 osd_fg_colour, osd_bg_colour;
+// Row ranges (y0 inclusive, y1 exclusive, empty if y0 >= y1) of the OSD pixel buffer: "dirty" is
+// not uploaded into the texture yet, "ink" may have non-zero pixels (all at start: uninitialized buffer)
+static int osd_dirty_y0 = SCREEN_HEIGHT, osd_dirty_y1 = 0, osd_ink_y0 = 0, osd_ink_y1 = SCREEN_HEIGHT;
 
 
 
@@ -59,26 +62,47 @@ static void _osd_set_alpha ( int alpha )
 {
 	if (alpha > 0xFF)
 		alpha = 0xFF;
+	osd_alpha = alpha;
 	SDL_SetTextureAlphaMod(sdl_osdtex, alpha);
 }
 
 
+static void _osd_mark_dirty ( int y0, int y1 )
+{
+	if (y0 < osd_dirty_y0)
+		osd_dirty_y0 = y0 < 0 ? 0 : y0;
+	if (y1 > osd_dirty_y1)
+		osd_dirty_y1 = y1 > SCREEN_HEIGHT ? SCREEN_HEIGHT : y1;
+}
+
+
 void osd_disable ( void )
 {
 	osd_on = 0;
 }
 
 
+// Only the rows written since the last clear are cleared (and uploaded by osd_update() then)
 void osd_clear ( void )
 {
-	memset(osd_pixels, 0, SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+	if (osd_ink_y0 >= osd_ink_y1)
+		return;
+	memset(osd_pixels + osd_ink_y0 * SCREEN_WIDTH, 0, (osd_ink_y1 - osd_ink_y0) * SCREEN_WIDTH * 4);
+	_osd_mark_dirty(osd_ink_y0, osd_ink_y1);
+	osd_ink_y0 = SCREEN_HEIGHT;
+	osd_ink_y1 = 0;
 }
 
 
+// Uploads only the changed rows into the texture
 void osd_update ( void )
 {
-	if (osd_pixels)
-		SDL_UpdateTexture(sdl_osdtex, NULL, osd_pixels, SCREEN_WIDTH * sizeof (Uint32));
+	if (osd_pixels && osd_dirty_y0 < osd_dirty_y1) {
+		SDL_Rect rect = { 0, osd_dirty_y0, SCREEN_WIDTH, osd_dirty_y1 - osd_dirty_y0 };
+		SDL_UpdateTexture(sdl_osdtex, &rect, osd_pixels + osd_dirty_y0 * SCREEN_WIDTH, SCREEN_WIDTH * sizeof (Uint32));
+		osd_dirty_y0 = SCREEN_HEIGHT;
+		osd_dirty_y1 = 0;
+	}
 }
 
 
@@ -94,6 +118,11 @@ void osd_write_char ( int x, int y, char ch )
 	int row;
 	const Uint16 *s = font_16x16 + ((ch - 32) << 4);
 	Uint32 *d = osd_pixels + y * SCREEN_WIDTH + x;
+	_osd_mark_dirty(y, y + 16);
+	if (y < osd_ink_y0)
+		osd_ink_y0 = y;
+	if (y + 16 > osd_ink_y1)
+		osd_ink_y1 = y + 16;
 	for (row = 0; row < 16; row++) {
 		Uint16 mask = 0x8000;
 		do {
@@ -242,9 +271,10 @@ void screen_present_frame (Uint32 *ep_pixels)
 	SDL_UpdateTexture(sdl_tex, NULL, ep_pixels, SCREEN_WIDTH * sizeof (Uint32));
 	SDL_RenderClear(sdl_ren);
 	SDL_RenderCopy(sdl_ren, sdl_tex, NULL, NULL);
-	if (osd_on && sdl_osdtex != NULL)
-		SDL_RenderCopy(sdl_ren, sdl_osdtex, NULL, NULL);
-	else
+	if (osd_on && sdl_osdtex != NULL) {
+		if (osd_alpha && osd_ink_y0 < osd_ink_y1)	// fully transparent or empty OSD: no need to blend the whole texture
+			SDL_RenderCopy(sdl_ren, sdl_osdtex, NULL, NULL);
+	} else
 		osd_fade = 0;
 	SDL_RenderPresent(sdl_ren);
 	if (osd_fade > OSD_FADE_STOP) {	// OSD / fade mode
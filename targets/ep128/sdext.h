@@ -32,5 +32,11 @@ extern int   sdext_cart_enabler;
 extern char  sdimg_path[PATH_MAX + 1];
 extern off_t sd_card_size;
 
+#ifdef XEMU_SNAPSHOT_SUPPORT
+#include "xemu/emutools_snapshot.h"
+extern int sdext_snapshot_load_state ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block );
+extern int sdext_snapshot_save_state ( const struct xemu_snapshot_definition_st *def );
+#endif
+
 #endif
 #endif
@@ -230,3 +230,88 @@ void ep128snap_set_cpu_and_io ( void )
 	free(snap);
 	snap = NULL;
 }
+
+
+
+/* --- Xemu native snapshot (xemusnap) support --- */
+
+#ifdef XEMU_SNAPSHOT_SUPPORT
+
+#include "main.h"
+#include "dave.h"
+#include "rtc.h"
+#include "apu.h"
+#include "sdext.h"
+#include "exdos_wd.h"
+
+/* Xep128 does not use xemu/emutools.c, but the common snapshot framework needs these */
+void *emu_malloc ( size_t size )
+{
+	void *p = malloc(size);
+	CHECK_MALLOC(p);
+	return p;
+}
+
+void *emu_realloc ( void *p, size_t size )
+{
+	p = realloc(p, size);
+	CHECK_MALLOC(p);
+	return p;
+}
+
+char *emu_strdup ( const char *s )
+{
+	char *p = strdup(s);
+	CHECK_MALLOC(p);
+	return p;
+}
+
+
+static int ep_snapshot_loading_finalize ( const struct xemu_snapshot_definition_st *def, struct xemu_snapshot_block_st *block )
+{
+	set_cpu_clock(CPU_CLOCK);
+	DEBUGPRINT("SNAPSHOT: loaded, Z80 PC is %04Xh" NL, Z80_PC);
+	return 0;
+}
+
+
+/* Memory must be the first, as it defines the segment map the I/O port replay (paging, Nick) relies on */
+const struct xemu_snapshot_definition_st ep128_snapshot_definition[] = {
+	{ "Memory",   NULL, ep_snapshot_load_memory, ep_snapshot_save_memory },
+	{ "Z80",      NULL, ep_snapshot_load_z80,    ep_snapshot_save_z80    },
+	{ "IO",       NULL, ep_snapshot_load_io,     ep_snapshot_save_io     },
+	{ "Dave",     NULL, dave_snapshot_load_state, dave_snapshot_save_state },
+	{ "RTC",      NULL, rtc_snapshot_load_state,  rtc_snapshot_save_state  },
+	{ "APU",      NULL, apu_snapshot_load_state,  apu_snapshot_save_state  },
+#ifdef CONFIG_EXDOS_SUPPORT
+	{ "EXDOS-WD", NULL, wd_snapshot_load_state,   wd_snapshot_save_state   },
+#endif
+#ifdef CONFIG_SDEXT_SUPPORT
+	{ "SDEXT",    NULL, sdext_snapshot_load_state, sdext_snapshot_save_state },
+#endif
+	{ NULL, NULL, ep_snapshot_loading_finalize, NULL }
+};
+
+
+int xepsnap_load ( const char *fn )
+{
+	if (xemusnap_load(fn)) {
+		ERROR_WINDOW("Couldn't load snapshot \"%s\": %s", fn, xemusnap_error_buffer);
+		return 1;
+	}
+	OSD("Snapshot loaded");
+	return 0;
+}
+
+
+int xepsnap_save ( const char *fn )
+{
+	if (xemusnap_save(fn)) {
+		ERROR_WINDOW("Couldn't save snapshot \"%s\": %s", fn, xemusnap_error_buffer);
+		return 1;
+	}
+	DEBUGPRINT("SNAPSHOT: saved to \"%s\"" NL, fn);
+	return 0;
+}
+
+#endif
@@ -22,4 +22,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 extern int  ep128snap_load ( const char *fn );
 extern void ep128snap_set_cpu_and_io ( void );
 
+#ifdef XEMU_SNAPSHOT_SUPPORT
+#include "xemu/emutools_snapshot.h"
+extern const struct xemu_snapshot_definition_st ep128_snapshot_definition[];
+extern int  xepsnap_load ( const char *fn );
+extern int  xepsnap_save ( const char *fn );
+#endif
+
 #endif
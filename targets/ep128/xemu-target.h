@@ -1,5 +1,6 @@
 #define TARGET_NAME "ep128"
 #define TARGET_DESC "Enterprise 128"
+#define XEMU_SNAPSHOT_SUPPORT "Enterprise-128"
 #define CONFIG_Z180
 #if defined(XEMU_ARCH_NATIVE) && !defined(__arm__)
 #define XEP128_GTK
@@ -21,19 +21,17 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "xemu/cpu65c02.h"
 #include "vic3.h"
 #include "xemu/f018_core.h"
+#include "m65_symbols.h"
 
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
 
 
-#define INFO_MAX_SIZE	32
-
 
 int in_hypervisor;			// mega65 hypervisor mode
 Uint8 hypervisor_memory[0x4001];	// 16K+1 byte, 1 byte is just used for length check on loading, ugly enough, indeed.
 
-static char debug_lines[0x4000][2][INFO_MAX_SIZE];		// I know. UGLY! and wasting memory. But this is only a HACK :)
 static int resolver_ok = 0;
 
 static char  hypervisor_monout[0x10000];
@@ -45,61 +43,20 @@ static int debug_on = 0;
 
 int hypervisor_debug_init ( const char *fn, int hypervisor_debug )
 {
-	char buffer[1024];
-	FILE *fp;
-	int fd;
+	int ret;
 	if (!fn || !*fn) {
 		DEBUG("MEGADEBUG: feature is not enabled, null file name for list file" NL);
 		return 1;
 	}
-	for (fd = 0; fd < 0x4000; fd++) {
-		debug_lines[fd][0][0] = 0;
-	}
-	fd = emu_load_file(fn, NULL, -1);
-	if (fd < 0) {
+	ret = m65sym_load(fn, 0x8000, 0xBFFF);
+	if (ret < 0) {
 		INFO_WINDOW("Cannot open %s, no resolved symbols will be used.", fn);
 		return 1;
 	}
-	fp = fdopen(fd, "rb");
-	while (fgets(buffer, sizeof buffer, fp)) {
-		int addr = 0xFFFF;
-		char *p, *p1, *p2;
-		if (sscanf(buffer, "%04X", &addr) != 1) continue;
-		if (addr < 0x8000 || addr >= 0xC000) continue;
-		p2  = strchr(buffer, '|');
-		if (!p2) continue;			// no '|' pipe in the line, skip
-		if (strchr(p2 + 1, '|')) continue;	// more than one '|' pipes, it's a hex dump, skip
-		*(p2++) = 0;
-		p = strrchr(p2, '/');
-		if (p)
-			p2 = p + 1;
-		else {
-			p = strrchr(p2, '\\');
-			if (p)
-				p2 = p + 1;
-		}
-		while (*p2 <= 32 && *p2)
-			p2++;
-		p = p2 + strlen(p2) - 1;
-		while (p > p2 && *p <= 32)
-			*(p--) = 0;
-		if (strlen(p2) >= 32)
-			FATAL("Bad list file, too long file reference part");
-		// that was awful. Now the first part
-		p1 = buffer + 5;
-		while (*p1 && *p1 <= 32)
-			p1++;
-		p = p1 + strlen(p1) - 1;
-		while (p > p1 && *p <= 32)
-			*(p--) = 0;
-		if (strlen(p2) >= 32)
-			FATAL("Bad list file, too long assembly part");
-		// And finally, copy line to its well deserved place(s)
-		snprintf(debug_lines[addr - 0x8000][0], INFO_MAX_SIZE, "%s", p1);
-		snprintf(debug_lines[addr - 0x8000][1], INFO_MAX_SIZE, "%s", p2);
+	if (ret) {
+		INFO_WINDOW("No hypervisor lines found in %s, no resolved symbols will be used.", fn);
+		return 1;
 	}
-	fclose(fp);
-	close(fd);
 	resolver_ok = 1;
 	debug_on = hypervisor_debug;
 	return 0;
@@ -233,6 +190,7 @@ void hypervisor_debug_invalidate ( const char *reason )
 
 void hypervisor_debug ( void )
 {
+	const char *line, *file;
 	if (!in_hypervisor)
 		return;
 	// TODO: better hypervisor upgrade check, maybe with checking the exact range kickstart uses for upgrade outside of the "normal" hypervisor mem range
@@ -248,30 +206,30 @@ void hypervisor_debug ( void )
 	if (!resolver_ok) {
 		return;	// no debug info loaded from kickstart.list ...
 	}
-	if (unlikely(!debug_lines[cpu_pc - 0x8000][0][0])) {
+	if (unlikely(m65sym_lookup(cpu_pc, &line, &file))) {
 		DEBUG("HYPERVISOR-DEBUG: execution address not found in list file (out-of-bound code?), PC = $%04X" NL, cpu_pc);
 		FATAL("Hypervisor fatal error: execution address not found in list file (out-of-bound code?), PC = $%04X", cpu_pc);
 		return;
 	}
 	// WARNING: as it turned out, using stdio I/O to log every opcodes even "only" at ~3.5MHz rate makes emulation _VERY_ slow ...
+	// (with the async log writer it's only the formatting now, but the log ring can still overflow and drop messages)
 	if (unlikely(debug_on)) {
-		if (debug_fp)
-			fprintf(
-				debug_fp,
-				"HYPERVISOR-DEBUG: %-32s PC=%04X SP=%04X B=%02X A=%02X X=%02X Y=%02X Z=%02X P=%c%c%c%c%c%c%c%c IO=%d OPC=%02X @ %s" NL,
-				debug_lines[cpu_pc - 0x8000][0],
-				cpu_pc, cpu_sphi | cpu_sp, cpu_bphi >> 8, cpu_a, cpu_x, cpu_y, cpu_z,
-				cpu_pfn ? 'N' : 'n',
-				cpu_pfv ? 'V' : 'v',
-				cpu_pfe ? 'E' : 'e',
-				'-',
-				cpu_pfd ? 'D' : 'd',
-				cpu_pfi ? 'I' : 'i',
-				cpu_pfz ? 'Z' : 'z',
-				cpu_pfc ? 'C' : 'c',
-				vic_iomode,
-				cpu_read(cpu_pc),
-				debug_lines[cpu_pc - 0x8000][1]
-			);
+		DEBUGCAT(
+			XLOG_CPU,
+			"HYPERVISOR-DEBUG: %-32s PC=%04X SP=%04X B=%02X A=%02X X=%02X Y=%02X Z=%02X P=%c%c%c%c%c%c%c%c IO=%d OPC=%02X @ %s" NL,
+			line,
+			cpu_pc, cpu_sphi | cpu_sp, cpu_bphi >> 8, cpu_a, cpu_x, cpu_y, cpu_z,
+			cpu_pfn ? 'N' : 'n',
+			cpu_pfv ? 'V' : 'v',
+			cpu_pfe ? 'E' : 'e',
+			'-',
+			cpu_pfd ? 'D' : 'd',
+			cpu_pfi ? 'I' : 'i',
+			cpu_pfz ? 'Z' : 'z',
+			cpu_pfc ? 'C' : 'c',
+			vic_iomode,
+			cpu_read(cpu_pc),
+			file
+		);
 	}
 }
@@ -0,0 +1,231 @@
+/* Test-case for a very simple, inaccurate, work-in-progress Commodore 65 emulator.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifdef XEMU_SNAPSHOT_SUPPORT
+
+#include "xemu/emutools.h"
+#include "xemu/emutools_snapshot.h"
+#include "mega65.h"
+#include "hypervisor.h"
+#include "m65_snapshot.h"
+#include "m65_rewind.h"
+#include <string.h>
+#include <stdlib.h>
+
+/* In-memory rewind ring. At every N frames a rewind point is captured: the non-memory state blocks
+   as an in-memory snapshot, and the memory as a delta against the previous point. Only pages marked
+   dirty by the write path are compared at all. The delta is the XOR of the old and new page content,
+   so the same delta moves the "shadow" copy (the page space at the newest point) one point backwards.
+   Delta format, for each changed page: BE16 page number, then codes till 256 bytes are covered:
+	$00-$7F: 1-128 unchanged bytes (XOR is zero), nothing follows
+	$80-$FF: 1-128 changed bytes, XOR values follow */
+
+// A point younger than this is skipped over on stepping back, so hitting the hot-key again goes further back
+#define REWIND_GRACE_FRAMES	25
+#define REWIND_MAX_PAGE_DELTA	(2 + 0x100 + 2)
+
+struct rewind_point_st {
+	Uint8  *state;		// in-memory snapshot of the non-memory blocks (CPU, CIAs, VIC-4, ...)
+	size_t state_size;
+	Uint8  *delta;		// XOR+RLE delta of the pages changed since the previous point
+	size_t delta_size;
+};
+
+Uint8 rewind_dirty[REWIND_PAGES];
+
+static struct rewind_point_st ring[REWIND_RING_SIZE];
+static int ring_head, ring_used;	// ring_head: index of the slot for the next point
+static Uint8 *page_ptrs[REWIND_PAGES];
+static Uint8 *shadow = NULL;		// the whole page space as it was at the newest point
+static Uint8 *delta_buffer;
+static int rewind_frames = 0;		// 0 = rewind is disabled
+static int frames_left, since_point;
+
+
+
+static void free_point ( struct rewind_point_st *pt )
+{
+	free(pt->state);
+	free(pt->delta);
+	pt->state = pt->delta = NULL;
+}
+
+
+
+static Uint8 *encode_page ( Uint8 *o, const Uint8 *cur, const Uint8 *ref )
+{
+	int i = 0;
+	while (i < 0x100) {
+		int n = 0;
+		while (i + n < 0x100 && n < 0x80 && cur[i + n] == ref[i + n])
+			n++;
+		if (n) {
+			*o++ = n - 1;
+			i += n;
+			continue;
+		}
+		while (i + n < 0x100 && n < 0x80 && cur[i + n] != ref[i + n])
+			n++;
+		*o++ = n + 0x7F;
+		while (n--) {
+			*o++ = cur[i] ^ ref[i];
+			i++;
+		}
+	}
+	return o;
+}
+
+
+
+// Applies a delta on the shadow, also marking the affected pages as dirty so they are restored later
+static void apply_delta ( const Uint8 *p, size_t size )
+{
+	const Uint8 *end = p + size;
+	while (p < end) {
+		int page = P_AS_BE16(p), i = 0;
+		Uint8 *d = shadow + (page << 8);
+		p += 2;
+		rewind_dirty[page] = 1;
+		while (i < 0x100) {
+			int n = *p++;
+			if (n < 0x80)
+				i += n + 1;
+			else
+				for (n -= 0x7F; n; n--)
+					d[i++] ^= *p++;
+		}
+	}
+}
+
+
+
+static void capture ( void )
+{
+	struct rewind_point_st *pt = &ring[ring_head];
+	Uint8 *o = delta_buffer;
+	Uint8 *state;
+	size_t state_size;
+	int page;
+	if (xemusnap_save_to_memory(m65_rewind_definition, &state, &state_size)) {
+		DEBUGPRINT("REWIND: cannot save state, rewind is disabled: %s" NL, xemusnap_error_buffer);
+		rewind_frames = 0;
+		return;
+	}
+	for (page = 0; page < REWIND_PAGES; page++)
+		if (rewind_dirty[page]) {
+			Uint8 *ref = shadow + (page << 8);
+			rewind_dirty[page] = 0;
+			if (!memcmp(page_ptrs[page], ref, 0x100))
+				continue;
+			U16_AS_BE(o, page);
+			o = encode_page(o + 2, page_ptrs[page], ref);
+			memcpy(ref, page_ptrs[page], 0x100);
+		}
+	if (ring_used == REWIND_RING_SIZE)
+		free_point(pt);		// ring is full, the oldest point is overwritten
+	else
+		ring_used++;
+	pt->state = state;
+	pt->state_size = state_size;
+	pt->delta_size = o - delta_buffer;
+	if (pt->delta_size) {
+		pt->delta = emu_malloc(pt->delta_size);
+		memcpy(pt->delta, delta_buffer, pt->delta_size);
+	}
+	ring_head = (ring_head + 1) % REWIND_RING_SIZE;
+	since_point = 0;
+}
+
+
+
+void rewind_init ( int frames )
+{
+	int page;
+	if (frames <= 0)
+		return;
+	for (page = 0; page < REWIND_PAGES; page++)
+		if (page < REWIND_PAGE_COLOUR)
+			page_ptrs[page] = memory + (page << 8);
+		else if (page < REWIND_PAGE_CHARWOM)
+			page_ptrs[page] = colour_ram + ((page - REWIND_PAGE_COLOUR) << 8);
+		else if (page < REWIND_PAGE_HYPERVISOR)
+			page_ptrs[page] = character_rom + ((page - REWIND_PAGE_CHARWOM) << 8);
+		else
+			page_ptrs[page] = hypervisor_memory + ((page - REWIND_PAGE_HYPERVISOR) << 8);
+	shadow = emu_malloc(REWIND_PAGES << 8);
+	for (page = 0; page < REWIND_PAGES; page++)
+		memcpy(shadow + (page << 8), page_ptrs[page], 0x100);
+	delta_buffer = emu_malloc(REWIND_PAGES * REWIND_MAX_PAGE_DELTA);
+	memset(rewind_dirty, 0, sizeof rewind_dirty);
+	memset(ring, 0, sizeof ring);
+	ring_head = ring_used = 0;
+	rewind_frames = frames;
+	frames_left = frames;
+	since_point = 0;
+	DEBUGPRINT("REWIND: capturing a rewind point at every %d frames, ring size is %d points (hot-key: %s)" NL,
+		frames, REWIND_RING_SIZE, SDL_GetScancodeName(REWIND_HOTKEY)
+	);
+}
+
+
+
+// Called at the end of every emulated frame
+void rewind_update ( void )
+{
+	if (!rewind_frames)
+		return;
+	since_point++;
+	if (--frames_left)
+		return;
+	frames_left = rewind_frames;
+	capture();
+}
+
+
+
+int rewind_step_back ( void )
+{
+	struct rewind_point_st *pt;
+	int page;
+	if (!ring_used) {
+		DEBUGPRINT("REWIND: there is no rewind point to go back to" NL);
+		return 1;
+	}
+	if (since_point < REWIND_GRACE_FRAMES && ring_used > 1) {
+		// the newest point is too fresh: drop it, and move the shadow back to the previous one
+		ring_head = (ring_head + REWIND_RING_SIZE - 1) % REWIND_RING_SIZE;
+		pt = &ring[ring_head];
+		apply_delta(pt->delta, pt->delta_size);
+		free_point(pt);
+		ring_used--;
+	}
+	// restore the pages changed since the (now) newest point, then the rest of the machine state
+	for (page = 0; page < REWIND_PAGES; page++)
+		if (rewind_dirty[page]) {
+			memcpy(page_ptrs[page], shadow + (page << 8), 0x100);
+			rewind_dirty[page] = 0;
+		}
+	pt = &ring[(ring_head + REWIND_RING_SIZE - 1) % REWIND_RING_SIZE];
+	if (xemusnap_load_from_memory(m65_rewind_definition, pt->state, pt->state_size))
+		FATAL("Couldn't restore rewind point: %s", xemusnap_error_buffer);
+	frames_left = rewind_frames;
+	since_point = 0;
+	DEBUGPRINT("REWIND: stepped back, %d more rewind point(s) in the ring" NL, ring_used - 1);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,61 @@
+/* Test-case for a very simple, inaccurate, work-in-progress Commodore 65 emulator.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __XEMU_M65_REWIND_H_INCLUDED
+#define __XEMU_M65_REWIND_H_INCLUDED
+
+#ifdef XEMU_SNAPSHOT_SUPPORT
+
+/* Rewind works on 256 byte pages. The "page space" is the concatenation of these memory areas:
+   the first 256K of memory[] (RAM + ROM, writes to the rest of the 1Mbyte are ignored), colour RAM,
+   char WOM and hypervisor memory. NOT rewound: the 127Mbyte slow RAM (its shadow copy would double
+   the memory usage, and snapshots don't contain it either), and the SD-card and disk images, the
+   emulated machine keeps what it wrote there. */
+#define REWIND_PAGES_MEMORY	0x400
+#define REWIND_PAGES_COLOUR	0x100
+#define REWIND_PAGES_CHARWOM	0x10
+#define REWIND_PAGES_HYPERVISOR	0x40
+#define REWIND_PAGE_COLOUR	 REWIND_PAGES_MEMORY
+#define REWIND_PAGE_CHARWOM	(REWIND_PAGE_COLOUR  + REWIND_PAGES_COLOUR)
+#define REWIND_PAGE_HYPERVISOR	(REWIND_PAGE_CHARWOM + REWIND_PAGES_CHARWOM)
+#define REWIND_PAGES		(REWIND_PAGE_HYPERVISOR + REWIND_PAGES_HYPERVISOR)
+
+#define REWIND_RING_SIZE	256
+#define REWIND_HOTKEY		SDL_SCANCODE_F9
+
+extern Uint8 rewind_dirty[REWIND_PAGES];
+
+/* Called on the memory write path, it must be as cheap as possible: a single byte store, no checks.
+   Offsets are relative to the given memory area, already masked to its size by the caller. */
+#define REWIND_DIRTY_MEMORY(ofs)	rewind_dirty[(ofs) >> 8] = 1
+#define REWIND_DIRTY_COLOUR(ofs)	rewind_dirty[REWIND_PAGE_COLOUR + ((ofs) >> 8)] = 1
+#define REWIND_DIRTY_CHARWOM(ofs)	rewind_dirty[REWIND_PAGE_CHARWOM + ((ofs) >> 8)] = 1
+#define REWIND_DIRTY_HYPERVISOR(ofs)	rewind_dirty[REWIND_PAGE_HYPERVISOR + ((ofs) >> 8)] = 1
+
+extern void rewind_init ( int frames );
+extern void rewind_update ( void );
+extern int  rewind_step_back ( void );
+
+#else
+
+#define REWIND_DIRTY_MEMORY(ofs)
+#define REWIND_DIRTY_COLOUR(ofs)
+#define REWIND_DIRTY_CHARWOM(ofs)
+#define REWIND_DIRTY_HYPERVISOR(ofs)
+
+#endif
+#endif
@@ -94,4 +94,19 @@ const struct xemu_snapshot_definition_st m65_snapshot_definition[] = {
 	{ NULL, NULL, m65emu_snapshot_loading_finalize, NULL }
 };
 
+// Used by the rewind ring (see m65_rewind.c), which handles memory itself as deltas
+const struct xemu_snapshot_definition_st m65_rewind_definition[] = {
+	{ "CPU",   NULL,  cpu_snapshot_load_state, cpu_snapshot_save_state },
+	{ "CIA#1", &cia1, cia_snapshot_load_state, cia_snapshot_save_state },
+	{ "CIA#2", &cia2, cia_snapshot_load_state, cia_snapshot_save_state },
+	{ "VIC-4", NULL,  vic4_snapshot_load_state, vic4_snapshot_save_state },
+	{ "M65",   NULL,  m65emu_snapshot_load_state, m65emu_snapshot_save_state },
+	{ "SID#1", &sid1, sid_snapshot_load_state, sid_snapshot_save_state },
+	{ "SID#2", &sid2, sid_snapshot_load_state, sid_snapshot_save_state },
+	{ "DMAgic", NULL, dma_snapshot_load_state, dma_snapshot_save_state },
+	{ "SDcard", NULL, sdcard_snapshot_load_state, sdcard_snapshot_save_state },
+	{ "FDC-F011", NULL, fdc_snapshot_load_state, fdc_snapshot_save_state },
+	{ NULL, NULL, m65emu_snapshot_loading_finalize, NULL }
+};
+
 #endif
@@ -30,6 +30,7 @@ extern int m65emu_snapshot_loading_finalize ( const struct xemu_snapshot_definit
 
 // From our .c file
 extern const struct xemu_snapshot_definition_st m65_snapshot_definition[];
+extern const struct xemu_snapshot_definition_st m65_rewind_definition[];
 
 #endif
 #endif
@@ -0,0 +1,372 @@
+/* Test-case for a very simple, inaccurate, work-in-progress Commodore 65 emulator.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#include "xemu/emutools.h"
+#include "m65_symbols.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+/* Cache file: header, then the entries, then the string pool. It's a cache for the same host only,
+   so native byte order is used (a byte order mismatch is detected by the magic, and causes rebuild). */
+
+#define M65SYM_MAGIC	"XemuSym2"
+#define M65SYM_BOM	0x01020304U
+
+struct m65sym_header_st {
+	char	magic[8];
+	Uint32	bom;
+	Uint32	entries;
+	Uint64	list_size;
+	Uint64	list_mtime;
+	Uint32	pool_size;
+	Uint32	range;	// indexed address range, it must match too
+};
+
+struct m65sym_entry_st {
+	Uint32	addr;
+	Uint32	line;	// offset in the string pool
+	Uint32	file;	// offset in the string pool
+	Uint32	seq;	// list file order of the entry, breaks the tie of the same address while sorting
+};
+
+static struct m65sym_entry_st *sym_entries = NULL;
+static char  *sym_pool = NULL;
+static Uint32 sym_entries_num = 0;
+static void  *sym_block = NULL;	// if the index is loaded from the cache, entries and pool live in this single block
+static Uint32 *sym_direct = NULL;	// entry index + 1 (0 = no entry) for each address of the indexed range
+static int    sym_min_addr, sym_max_addr;
+
+// Direct (one table slot per address) lookup is used, if the indexed range is not larger than this
+#define M65SYM_DIRECT_MAX	0x10000
+
+
+void m65sym_free ( void )
+{
+	if (sym_block) {
+		free(sym_block);
+		sym_block = NULL;
+	} else {
+		free(sym_entries);
+		free(sym_pool);
+	}
+	free(sym_direct);
+	sym_direct = NULL;
+	sym_entries = NULL;
+	sym_pool = NULL;
+	sym_entries_num = 0;
+}
+
+
+static void build_direct ( void )
+{
+	Uint32 a;
+	if (sym_max_addr - sym_min_addr >= M65SYM_DIRECT_MAX)
+		return;
+	sym_direct = emu_malloc((sym_max_addr - sym_min_addr + 1) * sizeof(Uint32));
+	memset(sym_direct, 0, (sym_max_addr - sym_min_addr + 1) * sizeof(Uint32));
+	for (a = 0; a < sym_entries_num; a++)
+		sym_direct[sym_entries[a].addr - sym_min_addr] = a + 1;
+}
+
+
+// Direct table lookup for the indexed range (it's called for every executed hypervisor opcode), binary search otherwise
+int m65sym_lookup ( int addr, const char **line, const char **file )
+{
+	int lo = 0, hi = (int)sym_entries_num - 1;
+	if (sym_direct) {
+		Uint32 n;
+		if (addr < sym_min_addr || addr > sym_max_addr || !(n = sym_direct[addr - sym_min_addr]))
+			return 1;
+		if (line)
+			*line = sym_pool + sym_entries[n - 1].line;
+		if (file)
+			*file = sym_pool + sym_entries[n - 1].file;
+		return 0;
+	}
+	while (lo <= hi) {
+		int mid = (lo + hi) >> 1;
+		if (sym_entries[mid].addr == (Uint32)addr) {
+			if (line)
+				*line = sym_pool + sym_entries[mid].line;
+			if (file)
+				*file = sym_pool + sym_entries[mid].file;
+			return 0;
+		}
+		if (sym_entries[mid].addr < (Uint32)addr)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+	return 1;
+}
+
+
+/* --- Building the index from the list file --- */
+
+static struct {
+	Uint32	*hash;		// pool offset + 1 of interned strings, zero: empty
+	Uint32	hash_size, strings;
+	Uint32	pool_size, pool_alloc;
+} build;
+
+
+static Uint32 hash_string ( const char *s )
+{
+	Uint32 h = 5381;
+	while (*s)
+		h = h * 33 + (Uint8)*(s++);
+	return h;
+}
+
+
+static void hash_resize ( Uint32 size )
+{
+	Uint32 *old = build.hash, old_size = build.hash_size, a;
+	build.hash = emu_malloc(size * sizeof(Uint32));
+	memset(build.hash, 0, size * sizeof(Uint32));
+	build.hash_size = size;
+	for (a = 0; a < old_size; a++)
+		if (old[a]) {
+			Uint32 h = hash_string(sym_pool + old[a] - 1) & (size - 1);
+			while (build.hash[h])
+				h = (h + 1) & (size - 1);
+			build.hash[h] = old[a];
+		}
+	free(old);
+}
+
+
+static Uint32 intern_string ( const char *s )
+{
+	Uint32 h, len = strlen(s) + 1;
+	if (build.strings >= build.hash_size / 2)	// keep the load factor low for the linear probing
+		hash_resize(build.hash_size * 2);
+	for (h = hash_string(s) & (build.hash_size - 1); build.hash[h]; h = (h + 1) & (build.hash_size - 1))
+		if (!strcmp(sym_pool + build.hash[h] - 1, s))
+			return build.hash[h] - 1;
+	build.strings++;
+	if (build.pool_size + len > build.pool_alloc) {
+		build.pool_alloc = (build.pool_size + len) * 2;
+		sym_pool = emu_realloc(sym_pool, build.pool_alloc);
+	}
+	memcpy(sym_pool + build.pool_size, s, len);
+	build.hash[h] = build.pool_size + 1;
+	build.pool_size += len;
+	return build.pool_size - len;
+}
+
+
+static int compare_entries ( const void *a, const void *b )
+{
+	const struct m65sym_entry_st *e1 = a, *e2 = b;
+	if (e1->addr != e2->addr)
+		return e1->addr < e2->addr ? -1 : 1;
+	return e1->seq < e2->seq ? -1 : 1;	// keep the list file order for the same address (qsort() is not stable)
+}
+
+
+static int build_index ( FILE *fp, int min_addr, int max_addr )
+{
+	char buffer[1024];
+	Uint32 a, n, alloc = 0;
+	build.hash = NULL;
+	build.hash_size = 0;
+	build.strings = 0;
+	build.pool_size = build.pool_alloc = 0;
+	hash_resize(0x1000);
+	while (fgets(buffer, sizeof buffer, fp)) {
+		int addr = 0xFFFF;
+		char *p, *p1, *p2;
+		if (sscanf(buffer, "%04X", &addr) != 1) continue;
+		if (addr < min_addr || addr > max_addr) continue;
+		p2  = strchr(buffer, '|');
+		if (!p2) continue;			// no '|' pipe in the line, skip
+		if (strchr(p2 + 1, '|')) continue;	// more than one '|' pipes, it's a hex dump, skip
+		*(p2++) = 0;
+		p = strrchr(p2, '/');
+		if (p)
+			p2 = p + 1;
+		else {
+			p = strrchr(p2, '\\');
+			if (p)
+				p2 = p + 1;
+		}
+		while (*p2 <= 32 && *p2)
+			p2++;
+		p = p2 + strlen(p2) - 1;
+		while (p > p2 && *p <= 32)
+			*(p--) = 0;
+		// that was awful. Now the first part
+		p1 = buffer + 5;
+		while (*p1 && *p1 <= 32)
+			p1++;
+		p = p1 + strlen(p1) - 1;
+		while (p > p1 && *p <= 32)
+			*(p--) = 0;
+		if (sym_entries_num == alloc) {
+			alloc = alloc ? alloc * 2 : 0x1000;
+			sym_entries = emu_realloc(sym_entries, alloc * sizeof(struct m65sym_entry_st));
+		}
+		sym_entries[sym_entries_num].addr = addr;
+		sym_entries[sym_entries_num].line = intern_string(p1);
+		sym_entries[sym_entries_num].file = intern_string(p2);
+		sym_entries[sym_entries_num].seq = sym_entries_num;
+		sym_entries_num++;
+	}
+	free(build.hash);
+	build.hash = NULL;
+	if (!sym_entries_num)
+		return 1;
+	// Sort by address, and keep only the last one if an address has more entries (as later list lines overwrote the earlier ones)
+	qsort(sym_entries, sym_entries_num, sizeof(struct m65sym_entry_st), compare_entries);
+	for (a = n = 0; a < sym_entries_num; a++)
+		if (a == sym_entries_num - 1 || sym_entries[a].addr != sym_entries[a + 1].addr)
+			sym_entries[n++] = sym_entries[a];
+	sym_entries_num = n;
+	return 0;
+}
+
+
+/* --- Cache file handling --- */
+
+// Checks everything the lookup relies on: entries are in the range and strictly ascending, the string offsets are inside the pool, and the pool is NUL terminated
+static int check_cache ( const struct m65sym_header_st *hdr, int min_addr, int max_addr )
+{
+	const struct m65sym_entry_st *e = sym_block;
+	const char *pool = (const char*)sym_block + hdr->entries * sizeof(struct m65sym_entry_st);
+	Uint32 a;
+	if (pool[hdr->pool_size - 1])
+		return 1;
+	for (a = 0; a < hdr->entries; a++, e++)
+		if (
+			e->addr < (Uint32)min_addr || e->addr > (Uint32)max_addr || (a && e->addr <= e[-1].addr) ||
+			e->line >= hdr->pool_size || e->file >= hdr->pool_size
+		)
+			return 1;
+	return 0;
+}
+
+
+static int load_cache ( const char *cache_fn, const struct stat *st, int min_addr, int max_addr )
+{
+	struct m65sym_header_st hdr;
+	struct stat cache_st;
+	Uint32 size;
+	int fd = open(cache_fn, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return 1;
+	// list file must match both in size and mtime, and the cache file size must match the header, so the sizes below cannot overflow
+	if (read(fd, &hdr, sizeof hdr) != sizeof hdr ||
+		memcmp(hdr.magic, M65SYM_MAGIC, sizeof hdr.magic) || hdr.bom != M65SYM_BOM ||
+		hdr.list_size != (Uint64)st->st_size || hdr.list_mtime != (Uint64)st->st_mtime ||
+		hdr.range != (((Uint32)min_addr << 16) ^ (Uint32)max_addr) || !hdr.entries || !hdr.pool_size ||
+		hdr.entries > (Uint32)(max_addr - min_addr + 1) || hdr.pool_size > 0x1000000 ||
+		fstat(fd, &cache_st) || (Uint64)cache_st.st_size != sizeof hdr + (Uint64)hdr.entries * sizeof(struct m65sym_entry_st) + hdr.pool_size
+	) {
+		close(fd);
+		return 1;
+	}
+	size = hdr.entries * sizeof(struct m65sym_entry_st) + hdr.pool_size;
+	sym_block = emu_malloc(size);
+	if (read(fd, sym_block, size) != (ssize_t)size || check_cache(&hdr, min_addr, max_addr)) {
+		close(fd);
+		free(sym_block);
+		sym_block = NULL;
+		return 1;
+	}
+	close(fd);
+	sym_entries = sym_block;
+	sym_entries_num = hdr.entries;
+	sym_pool = (char*)sym_block + hdr.entries * sizeof(struct m65sym_entry_st);
+	return 0;
+}
+
+
+static void save_cache ( const char *cache_fn, const struct stat *st, int min_addr, int max_addr )
+{
+	struct m65sym_header_st hdr;
+	int fd = open(cache_fn, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+	if (fd < 0) {
+		DEBUGPRINT("SYMBOLS: cannot create index cache file %s: %s" NL, cache_fn, strerror(errno));
+		return;
+	}
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, M65SYM_MAGIC, sizeof hdr.magic);
+	hdr.bom = M65SYM_BOM;
+	hdr.entries = sym_entries_num;
+	hdr.list_size = st->st_size;
+	hdr.list_mtime = st->st_mtime;
+	hdr.pool_size = build.pool_size;
+	hdr.range = ((Uint32)min_addr << 16) ^ (Uint32)max_addr;
+	if (
+		write(fd, &hdr, sizeof hdr) != sizeof hdr ||
+		write(fd, sym_entries, sym_entries_num * sizeof(struct m65sym_entry_st)) != (ssize_t)(sym_entries_num * sizeof(struct m65sym_entry_st)) ||
+		write(fd, sym_pool, build.pool_size) != (ssize_t)build.pool_size
+	) {
+		DEBUGPRINT("SYMBOLS: cannot write index cache file %s" NL, cache_fn);
+		close(fd);
+		unlink(cache_fn);
+		return;
+	}
+	close(fd);
+}
+
+
+int m65sym_load ( const char *fn, int min_addr, int max_addr )
+{
+	char path[PATH_MAX + 1], cache_fn[PATH_MAX + sizeof(M65SYM_CACHE_SUFFIX) + 1];
+	struct stat st;
+	FILE *fp;
+	int fd, ret;
+	m65sym_free();
+	fd = emu_load_file(fn, path, -1);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	snprintf(cache_fn, sizeof cache_fn, "%s%s", path, M65SYM_CACHE_SUFFIX);
+	sym_min_addr = min_addr;
+	sym_max_addr = max_addr;
+	if (!load_cache(cache_fn, &st, min_addr, max_addr)) {
+		close(fd);
+		build_direct();
+		DEBUGPRINT("SYMBOLS: %u entries loaded from index cache %s" NL, sym_entries_num, cache_fn);
+		return 0;
+	}
+	fp = fdopen(fd, "rb");
+	if (!fp) {
+		close(fd);
+		return -1;
+	}
+	ret = build_index(fp, min_addr, max_addr);
+	fclose(fp);
+	if (ret) {
+		m65sym_free();
+		return 1;
+	}
+	DEBUGPRINT("SYMBOLS: %u entries (%u bytes of strings) indexed from %s" NL, sym_entries_num, build.pool_size, path);
+	save_cache(cache_fn, &st, min_addr, max_addr);
+	build_direct();
+	return 0;
+}
@@ -0,0 +1,32 @@
+/* Test-case for a very simple, inaccurate, work-in-progress Commodore 65 emulator.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __XEMU_M65_SYMBOLS_H_INCLUDED
+#define __XEMU_M65_SYMBOLS_H_INCLUDED
+
+/* Compiled index of an assembler list file (ie kickstart.list): address sorted entries, with the
+   source line and the file reference part of the list line as strings in an interned string pool.
+   The index is cached next to the list file (with M65SYM_CACHE_SUFFIX appended to its name), and
+   only rebuilt if the list file has been modified (size or mtime does not match). */
+
+#define M65SYM_CACHE_SUFFIX	".xsi"
+
+extern int  m65sym_load   ( const char *fn, int min_addr, int max_addr );
+extern void m65sym_free   ( void );
+extern int  m65sym_lookup ( int addr, const char **line, const char **file );
+
+#endif
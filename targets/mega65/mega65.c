@@ -23,6 +23,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "xemu/f011_core.h"
 #include "xemu/f018_core.h"
 #include "xemu/emutools_hid.h"
+#include "xemu/input_record.h"
 #include "vic3.h"
 #include "xemu/sid.h"
 #include "sdcard.h"
@@ -31,6 +32,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "xemu/c64_kbd_mapping.h"
 #include "xemu/emutools_config.h"
 #include "m65_snapshot.h"
+#include "m65_rewind.h"
+#include "xemu/emutools_audiopace.h"
 
 #define kicked_hypervisor gs_regs[0x67E]
 
@@ -71,6 +74,7 @@ static int addr_trans_rd[16];		// address translating offsets for READ operation
 static int addr_trans_wr[16];		// address translating offsets for WRITE operation (it can be added to the CPU address simply, selected by the high 4 bits of the CPU address)
 static int addr_trans_rd_megabyte[16];	// Mega65 extension
 static int addr_trans_wr_megabyte[16];	// Mega65 extension
+static Uint8 *addr_trans_rd_direct[16];	// host pointer for READ operation if the 4K range is plain memory as a whole, otherwise NULL (see update_direct_read_pointers())
 int map_mask;			// MAP mask, should be filled at the MAP opcode, *before* calling apply_memory_config() then
 // WARNING: map_offset_low and map_offset_high must be used FROM bit-8 only, the lower 8 bits must be zero always!
 int map_offset_low;		// MAP low offset, should be filled at the MAP opcode, *before* calling apply_memory_config() then
@@ -104,12 +108,67 @@ static int fpga_switches = 0;		// State of FPGA board switches (bits 0 - 15), se
    * it's only called on mem config change (see above)
    * most of this terrible looking stuff compiles into only some assembly directives to load a register and store at one or more places, etc
 */
+/* Fast path for CPU reads (including opcode and operand fetches): if a 4K range of the
+   CPU address space is translated into a plain memory area (RAM, ROM, slow RAM, colour RAM,
+   hypervisor memory while in hypervisor mode) as a whole, a direct host pointer is stored,
+   so cpu_read() does not need the translation and the decoding of read_phys_mem(). Since the
+   pointer refers to the live memory, no invalidation is needed on writes, only on memory
+   configuration change. Ranges with I/O, unused space or wrapping at the megabyte boundary
+   are left with NULL, those still use read_phys_mem(). */
+static void update_direct_read_pointers ( void )
+{
+	int range4k;
+	for (range4k = 0; range4k < 0x10; range4k++) {
+		int start = ((addr_trans_rd[range4k] + (range4k << 12)) & 0xFFFFF);
+		Uint8 *p = NULL;
+		if (start <= 0xFFFFF - 0xFFF) {	// no wrapping within the megabyte
+			start = (start | addr_trans_rd_megabyte[range4k]) & 0xFFFFFFF;
+			if (start + 0xFFF < 0x040000)
+				p = memory + start;
+			else if (start >= 0x8000000 && start + 0xFFF < 0x8000000 + sizeof(slow_ram))
+				p = slow_ram + start - 0x8000000;
+			else if ((start & 0xFFF0000) == 0xFF80000 && ((start + 0xFFF) & 0xFFF0000) == 0xFF80000)
+				p = colour_ram + (start & 0xFFFF);
+			else if (in_hypervisor && (start & 0xFFFC000) == 0xFFF8000 && ((start + 0xFFF) & 0xFFFC000) == 0xFFF8000)
+				p = hypervisor_memory + (start & 0x3FFF);
+#ifdef UARTMON_SOCKET
+			// read watchpoints are checked in read_phys_mem(), a 4K range can touch two 4K pages
+			if (p && (UMON_BITMAP_TEST(umon_rd_watch_map, start >> 12) || UMON_BITMAP_TEST(umon_rd_watch_map, (start + 0xFFF) >> 12)))
+				p = NULL;
+#endif
+		}
+		addr_trans_rd_direct[range4k] = p;
+	}
+	cpu_block_cache_remap();
+}
+
+
+/* Code address for the pre-decoded block cache of the CPU emulation: only code in the chip RAM/ROM
+   and in the hypervisor memory is cached. Other ranges (slow RAM, colour RAM) have aliases, which
+   would need to be checked on writes as well, and code is rarely executed from there anyway. */
+#define CODE_HYPERVISOR	0x40000
+
+int cpu_code_address ( Uint16 addr )
+{
+	int range4k = addr >> 12;
+	int linear;
+	if (!addr_trans_rd_direct[range4k])
+		return -1;	// I/O, unused space, read watchpoint, etc
+	linear = (addr_trans_rd_megabyte[range4k] | ((addr_trans_rd[range4k] + addr) & 0xFFFFF)) & 0xFFFFFFF;
+	if (linear < 0x040000)
+		return linear;
+	if ((linear & 0xFFFC000) == 0xFFF8000)
+		return CODE_HYPERVISOR + (linear & 0x3FFF);
+	return -1;
+}
+
+
 void apply_memory_config ( void )
 {
 	// FIXME: what happens if VIC-3 reg $30 mapped ROM is tried to be written? Ignored, or RAM is used to write to, as with the CPU port mapping?
 	// About the produced signals on the "CPU port"
 	int cp = (CPU_PORT(1) | (~CPU_PORT(0)));
-	DEBUG("MEGA65: MMU: applying new memory config (PC=$%04X,hyper=%d,CP=%d,ML=$%02X,MH=$%02X,MM=$%02X,MBL=$%02X,MBH=$%02X)" NL,
+	DEBUGCAT(XLOG_MEM, "MEGA65: MMU: applying new memory config (PC=$%04X,hyper=%d,CP=%d,ML=$%02X,MH=$%02X,MM=$%02X,MBL=$%02X,MBH=$%02X)" NL,
 		cpu_pc, in_hypervisor, cp & 7, map_offset_low >> 8, map_offset_high >> 8, map_mask, map_megabyte_low >> 20, map_megabyte_high >> 20
 	);
 	// Simple ones, only CPU MAP may apply not other factors
@@ -208,6 +267,7 @@ void apply_memory_config ( void )
 		addr_trans_rd[0xE] = addr_trans_rd[0xF] = ((cp & 3) > 1) ? ROM_C64_KERNAL_REMAP : 0;
 		addr_trans_wr_megabyte[0xE] = addr_trans_rd_megabyte[0xE] = addr_trans_wr_megabyte[0xF] = addr_trans_rd_megabyte[0xF] = 0;
 	}
+	update_direct_read_pointers();
 }
 
 
@@ -306,6 +366,7 @@ static void audio_callback(void *userdata, Uint8 *stream, int len)
 	// to get a stereo stream, wanted by SDL.
 	sid_render(&sid2, ((short *)(stream)) + 0, len >> 1, 2);	// SID @ left
 	sid_render(&sid1, ((short *)(stream)) + 1, len >> 1, 2);	// SID @ right
+	audiopace_consumed_samples(len >> 2);				// 2 channels * 16 bit samples
 }
 
 
@@ -318,10 +379,43 @@ static const Uint8 initial_kickup[] = {
 
 #ifdef XEMU_SNAPSHOT_SUPPORT
 static const char *m65_snapshot_saver_filename = NULL;
+static int m65_snapshot_auto_frames = 0, m65_snapshot_auto_counter;
+static int m65_snapshot_async_error = 0;
+
+// A failing background save is shown in an error window only once (-snapauto would pop it up at every interval), till a save succeeds again
+static void m65_snapshot_async_report ( int status )
+{
+	if (status == XEMUSNAP_ASYNC_DONE) {
+		DEBUGPRINT("SNAP: background save to \"%s\" is done." NL, m65_snapshot_saver_filename);
+		m65_snapshot_async_error = 0;
+	} else if (status == XEMUSNAP_ASYNC_FAILED) {
+		if (!m65_snapshot_async_error)
+			ERROR_WINDOW("Could not save snapshot \"%s\" in the background: %s\nFurther failures are only logged.", m65_snapshot_saver_filename, xemusnap_error_buffer);
+		else
+			DEBUGPRINT("SNAP: could not save snapshot \"%s\" in the background: %s" NL, m65_snapshot_saver_filename, xemusnap_error_buffer);
+		m65_snapshot_async_error = 1;
+	}
+}
+
+// Called at frame boundaries, see update_emulator()
+static void m65_snapshot_async_update ( void )
+{
+	int status = xemusnap_save_async_poll(0);
+	if (status == XEMUSNAP_ASYNC_RUNNING)
+		return;
+	m65_snapshot_async_report(status);
+	if (!m65_snapshot_auto_frames || --m65_snapshot_auto_counter)
+		return;
+	m65_snapshot_auto_counter = m65_snapshot_auto_frames;
+	if (xemusnap_save_async(m65_snapshot_saver_filename))
+		DEBUGPRINT("SNAP: cannot start background save: %s" NL, xemusnap_error_buffer);
+}
+
 static void m65_snapshot_saver_on_exit_callback ( void )
 {
 	if (!m65_snapshot_saver_filename)
 		return;
+	m65_snapshot_async_report(xemusnap_save_async_poll(1));
 	if (xemusnap_save(m65_snapshot_saver_filename))
 		ERROR_WINDOW("Could not save snapshot \"%s\": %s", m65_snapshot_saver_filename, xemusnap_error_buffer);
 	else
@@ -343,6 +437,10 @@ static void mega65_init ( int sid_cycles_per_sec, int sound_mix_freq )
 		VIRTUAL_SHIFT_POS,
 		SDL_ENABLE		// joy HID events enabled
 	);
+	if (inputrec_init(emucfg_get_str("inputrec"), emucfg_get_str("inputplay")))
+		FATAL("Cannot start input recording or replay, see the debug log");
+	if (emu_metrics_init(emucfg_get_bool("metrics"), emucfg_get_str("metricsfile"), emucfg_get_bool("metricsosd")))
+		FATAL("Cannot create the metrics stream file, see the debug log");
 	joystick_emu = 1;
 	nmi_level = 0;
 	// *** FPGA switches ...
@@ -380,7 +478,7 @@ static void mega65_init ( int sid_cycles_per_sec, int sound_mix_freq )
 		hypervisor_debug_invalidate("no kickup could be loaded, built-in one does not have debug info");
 	}
 	// *** Image file for SDCARD support
-	if (sdcard_init(emucfg_get_str("sdimg"), emucfg_get_str("8")) < 0)
+	if (sdcard_init(emucfg_get_str("sdimg"), emucfg_get_str("8"), emucfg_get_str("sdovl"), emucfg_get_num("sdsync")) < 0)
 		FATAL("Cannot find SD-card image (which is a must for Mega65 emulation): %s", emucfg_get_str("sdimg"));
 	// *** Initialize VIC3
 	vic3_init();
@@ -450,6 +548,8 @@ static void mega65_init ( int sid_cycles_per_sec, int sound_mix_freq )
 			ERROR_WINDOW("Audio parameter mismatches.");
 		}
 		DEBUG("AUDIO: initialized (#%d), %d Hz, %d channels, %d buffer sample size." NL, audio, audio_got.freq, audio_got.channels, audio_got.samples);
+		if (audio)
+			audiopace_init(audio, audio_got.freq, audio_got.samples, emucfg_get_num("audiopace"), NULL);
 	} else
 		ERROR_WINDOW("Cannot open audio device!");
 #endif
@@ -471,7 +571,14 @@ static void mega65_init ( int sid_cycles_per_sec, int sound_mix_freq )
 			FATAL("Couldn't load snapshot \"%s\": %s", p, xemusnap_error_buffer);
 	}
 	m65_snapshot_saver_filename = emucfg_get_str("snapsave");
+	if (emucfg_get_num("snapauto") > 0) {
+		if (m65_snapshot_saver_filename)
+			m65_snapshot_auto_frames = m65_snapshot_auto_counter = emucfg_get_num("snapauto") * 25;
+		else
+			ERROR_WINDOW("Option -snapauto requires -snapsave to be given, ignoring it");
+	}
 	atexit(m65_snapshot_saver_on_exit_callback);
+	rewind_init(emucfg_get_num("rewind"));
 #endif
 }
 
@@ -506,7 +613,7 @@ void cpu_do_aug ( void )
         reg_mb_high <= reg_y;
       end if;*/
 	cpu_inhibit_interrupts = 1;	// disable interrupts till the next "EOM" (ie: NOP) opcode
-	DEBUG("CPU: MAP opcode, input A=$%02X X=$%02X Y=$%02X Z=$%02X" NL, cpu_a, cpu_x, cpu_y, cpu_z);
+	DEBUGCAT(XLOG_CPU, "CPU: MAP opcode, input A=$%02X X=$%02X Y=$%02X Z=$%02X" NL, cpu_a, cpu_x, cpu_y, cpu_z);
 	map_offset_low  = (cpu_a << 8) | ((cpu_x & 15) << 16);	// offset of lower half (blocks 0-3)
 	map_offset_high = (cpu_y << 8) | ((cpu_z & 15) << 16);	// offset of higher half (blocks 4-7)
 	map_mask        = (cpu_z & 0xF0) | (cpu_x >> 4);	// "is mapped" mask for blocks (1 bit for each)
@@ -515,10 +622,10 @@ void cpu_do_aug ( void )
 		map_megabyte_low  = (int)cpu_a << 20;
 	if (cpu_z == 0x0F)
 		map_megabyte_high = (int)cpu_y << 20;
-	DEBUG("MEM: applying new memory configuration because of MAP CPU opcode" NL);
-	DEBUG("LOW -OFFSET = $%03X, MB = $%02X" NL, map_offset_low , map_megabyte_low  >> 20);
-	DEBUG("HIGH-OFFSET = $%03X, MB = $%02X" NL, map_offset_high, map_megabyte_high >> 20);
-	DEBUG("MASK        = $%02X" NL, map_mask);
+	DEBUGCAT(XLOG_MEM, "MEM: applying new memory configuration because of MAP CPU opcode" NL);
+	DEBUGCAT(XLOG_MEM, "LOW -OFFSET = $%03X, MB = $%02X" NL, map_offset_low , map_megabyte_low  >> 20);
+	DEBUGCAT(XLOG_MEM, "HIGH-OFFSET = $%03X, MB = $%02X" NL, map_offset_high, map_megabyte_high >> 20);
+	DEBUGCAT(XLOG_MEM, "MASK        = $%02X" NL, map_mask);
 	apply_memory_config();
 }
 
@@ -529,29 +636,29 @@ void cpu_do_nop ( void )
 {
 	if (cpu_inhibit_interrupts) {
 		cpu_inhibit_interrupts = 0;
-		DEBUG("CPU: EOM, interrupts were disabled because of MAP till the EOM" NL);
+		DEBUGCAT(XLOG_CPU, "CPU: EOM, interrupts were disabled because of MAP till the EOM" NL);
 	} else
-		DEBUG("CPU: NOP not treated as EOM (no MAP before)" NL);
+		DEBUGCAT(XLOG_CPU, "CPU: NOP not treated as EOM (no MAP before)" NL);
 }
 
 
 
 #define RETURN_ON_IO_READ_NOT_IMPLEMENTED(func, fb) \
-	do { DEBUG("IO: NOT IMPLEMENTED read (emulator lacks feature), %s $%04X fallback to answer $%02X" NL, func, addr, fb); \
+	do { DEBUGCAT(XLOG_IO, "IO: NOT IMPLEMENTED read (emulator lacks feature), %s $%04X fallback to answer $%02X" NL, func, addr, fb); \
 	return fb; } while (0)
 #define RETURN_ON_IO_READ_NO_NEW_VIC_MODE(func, fb) \
-	do { DEBUG("IO: ignored read (not new VIC mode), %s $%04X fallback to answer $%02X" NL, func, addr, fb); \
+	do { DEBUGCAT(XLOG_IO, "IO: ignored read (not new VIC mode), %s $%04X fallback to answer $%02X" NL, func, addr, fb); \
 	return fb; } while (0)
 #define RETURN_ON_IO_WRITE_NOT_IMPLEMENTED(func) \
-	do { DEBUG("IO: NOT IMPLEMENTED write (emulator lacks feature), %s $%04X with data $%02X" NL, func, addr, data); \
+	do { DEBUGCAT(XLOG_IO, "IO: NOT IMPLEMENTED write (emulator lacks feature), %s $%04X with data $%02X" NL, func, addr, data); \
 	return; } while(0)
 #define RETURN_ON_IO_WRITE_NO_NEW_VIC_MODE(func) \
-	do { DEBUG("IO: ignored write (not new VIC mode), %s $%04X with data $%02X" NL, func, addr, data); \
+	do { DEBUGCAT(XLOG_IO, "IO: ignored write (not new VIC mode), %s $%04X with data $%02X" NL, func, addr, data); \
 	return; } while(0)
 #define WARN_IO_MODE_WR(func) \
-	DEBUG("IO: write operation defaults (not new VIC mode) to VIC-2 registers, though it would be: \"%s\" (a=$%04X, d=$%02X)" NL, func, addr, data)
+	DEBUGCAT(XLOG_IO, "IO: write operation defaults (not new VIC mode) to VIC-2 registers, though it would be: \"%s\" (a=$%04X, d=$%02X)" NL, func, addr, data)
 #define WARN_IO_MODE_RD(func) \
-	DEBUG("IO: read operation defaults (not new VIC mode) to VIC-2 registers, though it would be: \"%s\" (a=$%04X)" NL, func, addr)
+	DEBUGCAT(XLOG_IO, "IO: read operation defaults (not new VIC mode) to VIC-2 registers, though it would be: \"%s\" (a=$%04X)" NL, func, addr)
 
 
 // Call this ONLY with addresses between $D000-$DFFF
@@ -620,7 +727,7 @@ Uint8 io_read ( int addr )
 				case 0xD6F1:
 					return (fpga_switches >> 8) & 0xFF;
 				default:
-					DEBUG("MEGA65: reading Mega65 specific I/O @ $%04X result is $%02X" NL, addr, gs_regs[addr & 0xFFF]);
+					DEBUGCAT(XLOG_IO, "MEGA65: reading Mega65 specific I/O @ $%04X result is $%02X" NL, addr, gs_regs[addr & 0xFFF]);
 					return gs_regs[addr & 0xFFF];
 			}
 		} else if (vic_iomode)
@@ -635,29 +742,29 @@ Uint8 io_read ( int addr )
 			RETURN_ON_IO_READ_NO_NEW_VIC_MODE("DMA controller", 0xFF);
 	}
 	if (addr < ((vic3_registers[0x30] & 1) ? 0xE000 : 0xDC00)) {	// $D800-$DC00/$E000	COLOUR NIBBLES, mapped to $1F800 in BANK1
-		DEBUG("IO: reading colour RAM at offset $%04X" NL, addr - 0xD800);
+		DEBUGCAT(XLOG_IO, "IO: reading colour RAM at offset $%04X" NL, addr - 0xD800);
 		return colour_ram[addr - 0xD800];
 	}
 	if (addr < 0xDD00) {	// $DC00 - $DCFF	CIA-1
 		Uint8 result = cia_read(&cia1, addr & 0xF);
 		//RETURN_ON_IO_READ_NOT_IMPLEMENTED("CIA-1", 0xFF);
-		DEBUG("%s: reading register $%X result is $%02X" NL, cia1.name, addr & 15, result);
+		DEBUGCAT(XLOG_IO, "%s: reading register $%X result is $%02X" NL, cia1.name, addr & 15, result);
 		return result;
 	}
 	if (addr < 0xDE00) {	// $DD00 - $DDFF	CIA-2
 		Uint8 result = cia_read(&cia2, addr & 0xF);
 		//RETURN_ON_IO_READ_NOT_IMPLEMENTED("CIA-2", 0xFF);
-		DEBUG("%s: reading register $%X result is $%02X" NL, cia2.name, addr & 15, result);
+		DEBUGCAT(XLOG_IO, "%s: reading register $%X result is $%02X" NL, cia2.name, addr & 15, result);
 		return result;
 	}
 	// Only IO-1 and IO-2 areas left, if SD-card buffer is mapped for Mega65, this is our only case left!
 	do {
 		int result = sdcard_read_buffer(addr - 0xDE00);	// try to read SD buffer
 		if (result >= 0) {	// if non-negative number got, answer is really the SD card (mapped buffer)
-			DEBUG("SDCARD: BUFFER: reading SD-card buffer at offset $%03X with result $%02X PC=$%04X" NL, addr - 0xDE00, result, cpu_pc);
+			DEBUGCAT(XLOG_SDCARD, "SDCARD: BUFFER: reading SD-card buffer at offset $%03X with result $%02X PC=$%04X" NL, addr - 0xDE00, result, cpu_pc);
 			return result;
 		} else
-			DEBUG("SDCARD: BUFFER: *NOT* mapped SD-card buffer is read, can it be a bug?? PC=$%04X" NL, cpu_pc);
+			DEBUGCAT(XLOG_SDCARD, "SDCARD: BUFFER: *NOT* mapped SD-card buffer is read, can it be a bug?? PC=$%04X" NL, cpu_pc);
 	} while (0);
 	if (addr < 0xDF00) {	// $DE00 - $DEFF	IO-1 external
 		RETURN_ON_IO_READ_NOT_IMPLEMENTED("IO-1 external select", 0xFF);
@@ -720,7 +827,7 @@ void io_write ( int addr, Uint8 data )
 	if (addr < 0xD700) {	// $D600 - $D6FF	UART (*)
 		if (vic_iomode == VIC4_IOMODE && addr >= 0xD609) {	// D609 - D6FF: Mega65 suffs
 			gs_regs[addr & 0xFFF] = data;
-			DEBUG("MEGA65: writing Mega65 specific I/O range @ $%04X with $%02X" NL, addr, data);
+			DEBUGCAT(XLOG_IO, "MEGA65: writing Mega65 specific I/O range @ $%04X with $%02X" NL, addr, data);
 
 			if (!in_hypervisor && addr >= 0xD640 && addr <= 0xD67F) {
 				// In user mode, writing to $D640-$D67F (in VIC4 iomode) causes to enter hypervisor mode with
@@ -762,7 +869,7 @@ void io_write ( int addr, Uint8 data )
 			RETURN_ON_IO_WRITE_NO_NEW_VIC_MODE("UART");
 	}
 	if (addr < 0xD800) {	// $D700 - $D7FF	DMA (*)
-		DEBUG("DMA: writing register $%04X (data = $%02X)" NL, addr, data);
+		DEBUGCAT(XLOG_DMA, "DMA: writing register $%04X (data = $%02X)" NL, addr, data);
 		if (vic_iomode) {
 			dma_write_reg(addr & 0xF, data);
 			return;
@@ -771,19 +878,22 @@ void io_write ( int addr, Uint8 data )
 	}
 	if (addr < ((vic3_registers[0x30] & 1) ? 0xE000 : 0xDC00)) {	// $D800-$DC00/$E000	COLOUR NIBBLES, mapped to $1F800 in BANK1
 		memory[0x1F800 + addr - 0xD800] = data;
+		CPU_CODE_WRITE(0x1F800 + addr - 0xD800);
 		colour_ram[addr - 0xD800] = data;
-		DEBUG("IO: writing colour RAM at offset $%04X" NL, addr - 0xD800);
+		REWIND_DIRTY_MEMORY(0x1F800 + addr - 0xD800);
+		REWIND_DIRTY_COLOUR(addr - 0xD800);
+		DEBUGCAT(XLOG_IO, "IO: writing colour RAM at offset $%04X" NL, addr - 0xD800);
 		return;
 	}
 	if (addr < 0xDD00) {	// $DC00 - $DCFF	CIA-1
 		//RETURN_ON_IO_WRITE_NOT_IMPLEMENTED("CIA-1");
-		DEBUG("%s: writing register $%X with data $%02X" NL, cia1.name, addr & 15, data);
+		DEBUGCAT(XLOG_IO, "%s: writing register $%X with data $%02X" NL, cia1.name, addr & 15, data);
 		cia_write(&cia1, addr & 0xF, data);
 		return;
 	}
 	if (addr < 0xDE00) {	// $DD00 - $DDFF	CIA-2
 		//RETURN_ON_IO_WRITE_NOT_IMPLEMENTED("CIA-2");
-		DEBUG("%s: writing register $%X with data $%02X" NL, cia2.name, addr & 15, data);
+		DEBUGCAT(XLOG_IO, "%s: writing register $%X with data $%02X" NL, cia2.name, addr & 15, data);
 		cia_write(&cia2, addr & 0xF, data);
 		return;
 	}
@@ -816,7 +926,7 @@ Uint8 cpu_read_linear_opcode ( void )
 {
 	int addr = cpu_get_flat_addressing_mode_address();
 	Uint8  data = read_phys_mem(addr);
-	DEBUG("MEGA65: reading LINEAR memory [PC=$%04X/OPC=$%02X] @ $%X with result $%02X" NL, cpu_old_pc, cpu_op, addr, data);
+	DEBUGCAT(XLOG_MEM, "MEGA65: reading LINEAR memory [PC=$%04X/OPC=$%02X] @ $%X with result $%02X" NL, cpu_old_pc, cpu_op, addr, data);
 	return data;
 }
 
@@ -825,7 +935,7 @@ Uint8 cpu_read_linear_opcode ( void )
 void cpu_write_linear_opcode ( Uint8 data )
 {
 	int addr = cpu_get_flat_addressing_mode_address();
-	DEBUG("MEGA65: writing LINEAR memory [PC=$%04X/OPC=$%02X] @ $%X with data $%02X" NL, cpu_old_pc, cpu_op, addr, data);
+	DEBUGCAT(XLOG_MEM, "MEGA65: writing LINEAR memory [PC=$%04X/OPC=$%02X] @ $%X with data $%02X" NL, cpu_old_pc, cpu_op, addr, data);
 	write_phys_mem(addr, data);
 }
 
@@ -841,10 +951,15 @@ void write_phys_mem ( int addr, Uint8 data )
         //printf ("Write 0x%02x to 0x%06x  %d\n",data,addr,in_hypervisor); //0xfffbf10
 
 	addr &= 0xFFFFFFF;		// warps around at 256Mbyte, for address bus of Mega65
+#ifdef UARTMON_SOCKET
+	UMON_CHECK_WATCH(umon_wr_watch_map, UMON_POINT_WRITE, addr);
+#endif
 	if (addr < 0x000002) {
+		REWIND_DIRTY_MEMORY(0);
+		CPU_CODE_WRITE(addr);
 		if ((CPU_PORT(addr) & 7) != (data & 7)) {
 			CPU_PORT(addr) = data;
-			DEBUG("MEM: applying new memory configuration because of CPU port writing." NL);
+			DEBUGCAT(XLOG_MEM, "MEM: applying new memory configuration because of CPU port writing." NL);
 			apply_memory_config();
 		} else
 			CPU_PORT(addr) = data;
@@ -852,39 +967,55 @@ void write_phys_mem ( int addr, Uint8 data )
 	}
 	if (addr < 0x01F800) {		// accessing RAM @ 2 ... 128-2K.
 		memory[addr] = data;
+		CPU_CODE_WRITE(addr);
+		REWIND_DIRTY_MEMORY(addr);
 		return;
 	}
 	if (addr < 0x020000) {		// the last 2K of the mentioned 128K is the mega65 mapped colour RAM (126K ... 128K)
 		memory[addr] = data; 	// also update the "legacy 2K C65 colour-RAM @ 126K" so read func won't have a different case for this!
+		CPU_CODE_WRITE(addr);
 		colour_ram[addr & 0x7FF] = data;
+		REWIND_DIRTY_MEMORY(addr);
+		REWIND_DIRTY_COLOUR(addr & 0x7FF);
 		return;
 	}
 	if (addr < 0x040000) {		// ROM area (128K ... 256K)
-		if (!rom_protect)
+		if (!rom_protect) {
 			memory[addr] = data;
+			CPU_CODE_WRITE(addr);
+			REWIND_DIRTY_MEMORY(addr);
+		}
 		return;
 	}
 	if (addr < 0x100000)		// unused space (256K ... 1M)
 		return;
 	// No other memory accessible components/space on C65. The following areas on M65 currently decoded with masks:
 	if (addr >= 0x8000000 && addr < 0x8000000 + sizeof(slow_ram)) {
-		DEBUG("MEGA65: writing slow RAM at $%X with value of $%02X" NL, addr, data);
+		DEBUGCAT(XLOG_MEM, "MEGA65: writing slow RAM at $%X with value of $%02X" NL, addr, data);
 		slow_ram[addr - 0x8000000] = data;
 		// FIXME: That would be something I don't understand: shadow of the ROM of C65 or something? Hmmm. But it's the DDR RAM!
 		// $8000000-$FEFFFFF, and also
 		// $0020000-$003FFFF
-		if (addr >= 0x8020000 && addr <= 0x803FFFF)
+		if (addr >= 0x8020000 && addr <= 0x803FFFF) {
 			memory[addr - 0x8000000] = data;
+			CPU_CODE_WRITE(addr - 0x8000000);
+			REWIND_DIRTY_MEMORY(addr - 0x8000000);
+		}
 		return;
 	}
 	if ((addr & 0xFFF0000) == 0xFF80000) {
 		colour_ram[addr & 0xFFFF] = data;
-		if (addr < 0xFF80800)
+		REWIND_DIRTY_COLOUR(addr & 0xFFFF);
+		if (addr < 0xFF80800) {
 			memory[addr - 0xFF60800] = data;
+			CPU_CODE_WRITE(addr - 0xFF60800);
+			REWIND_DIRTY_MEMORY(addr - 0xFF60800);
+		}
 		return;
 	}
 	if ((addr & 0xFFFF000) == 0xFF7E000) {
 		character_rom[addr & 0xFFF] = data;
+		REWIND_DIRTY_CHARWOM(addr & 0xFFF);
 		return;
 	}
 	if ((addr & 0xFFFF000) == IO_REMAPPED) {		// I/O stuffs (remapped from standard $D000 location as found on C64 or C65 too)
@@ -892,9 +1023,12 @@ void write_phys_mem ( int addr, Uint8 data )
 		return;
 	}
 	if ((addr & 0xFFFC000) == 0xFFF8000) {			// accessing of hypervisor memory
-                DEBUG ("Write 0x%02x to 0x%06x  %d" NL,data,addr,in_hypervisor); //0xfffbf10
-		if (in_hypervisor)	// hypervisor memory is unavailable from "user mode", FIXME: do we need to do trap/whatever if someone tries this?
+                DEBUGCAT(XLOG_MEM, "Write 0x%02x to 0x%06x  %d" NL,data,addr,in_hypervisor); //0xfffbf10
+		if (in_hypervisor) {	// hypervisor memory is unavailable from "user mode", FIXME: do we need to do trap/whatever if someone tries this?
 			hypervisor_memory[addr & 0x3FFF] = data;
+			CPU_CODE_WRITE(CODE_HYPERVISOR + (addr & 0x3FFF));
+			REWIND_DIRTY_HYPERVISOR(addr & 0x3FFF);
+		}
 		return;
 	}
 	FATAL("Unhandled memory write operation for linear address $%X data = $%02X (PC=$%04X)" NL, addr, data, cpu_pc);
@@ -905,7 +1039,7 @@ void write_phys_mem ( int addr, Uint8 data )
 	if (addr < 2) {
 		if ((cpu_port[addr] & 7) != (data & 7)) {
 			cpu_port[addr] = data;
-			DEBUG("MEM: applying new memory configuration because of CPU port writing." NL);
+			DEBUGCAT(XLOG_MEM, "MEM: applying new memory configuration because of CPU port writing." NL);
 			apply_memory_config();
 		} else
 			cpu_port[addr] = data;
@@ -932,7 +1066,7 @@ void write_phys_mem ( int addr, Uint8 data )
 		memory[addr] = data;
 		}
 	} else
-		DEBUG("MMU: this _physical_ address is not writable: $%X (data=$%02X)" NL, addr, data);
+		DEBUGCAT(XLOG_MEM, "MMU: this _physical_ address is not writable: $%X (data=$%02X)" NL, addr, data);
 #endif
 }
 
@@ -942,6 +1076,9 @@ Uint8 read_phys_mem ( int addr )
 {
        // printf ("Read from 0x%06x  %d\n",addr,in_hypervisor); //0xfffbf10
 	addr &= 0xFFFFFFF;		// warps around at 256Mbyte, for address bus of Mega65
+#ifdef UARTMON_SOCKET
+	UMON_CHECK_WATCH(umon_rd_watch_map, UMON_POINT_READ, addr);
+#endif
 
 	//Check for < 2 not needed anymore, as CPU port is really the memory, though it can be a problem if DMA sees this issue differently?!
 	//if (addr < 0x000002)
@@ -976,6 +1113,9 @@ Uint8 read_phys_mem ( int addr )
 Uint8 cpu_read ( Uint16 addr )
 {
 	register int range4k = addr >> 12;
+	if (likely(addr_trans_rd_direct[range4k]))
+		return addr_trans_rd_direct[range4k][addr & 0xFFF];
+	EMU_METRICS_COUNT(EMU_METRICS_SLOWPATH, 1);
 	return read_phys_mem(addr_trans_rd_megabyte[range4k] | ((addr_trans_rd[range4k] + addr) & 0xFFFFF));
 #if 0
 	int phys_addr = addr_trans_rd[addr >> 12] + addr;	// translating address with the READ table created by apply_memory_config()
@@ -992,6 +1132,29 @@ Uint8 cpu_read ( Uint16 addr )
 
 
 
+#ifdef CPU_IDLE_LOOP_DETECTION
+// This function is called by the 65CE02 emulator to check if an idle loop can read the given address.
+// Plain memory (see update_direct_read_pointers()), the VIC registers and the colour RAM in the I/O
+// area are allowed only: these have no side effects on read, and the VIC registers can only change
+// at scanline boundaries. CIA (timers, ICR), the F011 buffer port, SD-card etc registers are not.
+int cpu_idle_safe_read ( Uint16 addr )
+{
+	int range4k = addr >> 12;
+	int phys_addr;
+	if (addr_trans_rd_direct[range4k])
+		return 1;
+	phys_addr = (addr_trans_rd_megabyte[range4k] | ((addr_trans_rd[range4k] + addr) & 0xFFFFF)) & 0xFFFFFFF;
+	if ((phys_addr & 0xFFFF000) != IO_REMAPPED)
+		return 0;
+	phys_addr &= 0xFFF;
+	if (phys_addr >= 0x800 && phys_addr < ((vic3_registers[0x30] & 1) ? 0x1000 : 0xC00))
+		return 1;	// colour RAM
+	return phys_addr < 0x80;	// VIC registers
+}
+#endif
+
+
+
 // This function is called by the 65CE02 emulator in case of writing a byte
 void cpu_write ( Uint16 addr, Uint8 data )
 {
@@ -1031,7 +1194,7 @@ void cpu_write_rmw ( Uint16 addr, Uint8 old_data, Uint8 new_data )
 		if ((addr & 0xF000) != 0xD000)
 			FATAL("Internal error: IO is not on the IO space!");
 		if (addr < 0xD800 || addr >= (vic3_registers[0x30] & 1) ? 0xE000 : 0xDC00) {	// though, for only memory areas other than colour RAM (avoids unneeded warnings as well)
-			DEBUG("CPU: RMW opcode is used on I/O area for $%04X" NL, addr);
+			DEBUGCAT(XLOG_IO, "CPU: RMW opcode is used on I/O area for $%04X" NL, addr);
 			io_write(addr, old_data);	// first write back the old data ...
 		}
 		io_write(addr, new_data);	// ... then the new
@@ -1099,6 +1262,11 @@ int emu_callback_key ( int pos, SDL_Scancode key, int pressed, int handled )
                  case SDL_SCANCODE_KP_ENTER:
                         c64_toggle_joy_emu();
                         break;
+#ifdef XEMU_SNAPSHOT_SUPPORT
+                 case REWIND_HOTKEY:
+                        rewind_step_back();
+                        break;
+#endif
                  case SDL_SCANCODE_LALT:
                     io_write(0xD611,io_read(0xD611)|0x10);
                     alt_key_pressed=1;
@@ -1125,15 +1293,26 @@ int emu_callback_key ( int pos, SDL_Scancode key, int pressed, int handled )
 
 void update_emulator ( void )
 {
+	EMU_BENCH_SECTION(EMU_BENCH_IO);
+#ifdef UARTMON_SOCKET
+	inputrec_hold = paused;		// the monitor calls us while the emulation is paused, but no emulated frame passes
+#endif
 	hid_handle_all_sdl_events();
 	nmi_set(IS_RESTORE_PRESSED(), 2);	// Custom handling of the restore key ...
 #ifdef UARTMON_SOCKET
 	uartmon_update();
 #endif
 	// Screen rendering: begin
+	EMU_BENCH_SECTION(EMU_BENCH_VIDEO);
 	vic3_render_screen();
+	EMU_BENCH_SECTION(EMU_BENCH_IO);
 	// Screen rendering: end
+	sdcard_flush();
+#ifdef XEMU_SNAPSHOT_SUPPORT
+	m65_snapshot_async_update();
+#endif
 	emu_timekeeping_delay(40000);
+	EMU_BENCH_SECTION(EMU_BENCH_CPU);
 	// Ugly CIA trick to maintain realtime TOD in CIAs :)
         if (seconds_timer_trigger) {
 		struct tm *t = emu_get_localtime();
@@ -1156,15 +1335,30 @@ int main ( int argc, char **argv )
 
         xemu_dump_version(stdout, "The Incomplete Commodore-65/Mega-65 emulator from LGB");
 	emucfg_define_str_option("8", NULL, "Path of EXTERNAL D81 disk image (not on/the SD-image)");
+	emucfg_define_num_option("audiopace", 0, "Use audio as master clock with this target latency in msecs (0=off)");
+	emucfg_define_num_option("bench", 0, "Benchmark: run headless and unthrottled for N frames, then print the results as JSON");
 	emucfg_define_num_option("dmarev", 0, "Revision of the DMAgic chip  (0=F018A, other=F018B)");
 	emucfg_define_str_option("fpga", NULL, "Comma separated list of FPGA-board switches turned ON");
 	emucfg_define_switch_option("fullscreen", "Start in fullscreen mode");
 	emucfg_define_switch_option("hyperdebug", "Crazy, VERY slow and 'spammy' hypervisor debug mode");
+	emucfg_define_str_option("inputplay", NULL, "Replay input recorded by -inputrec from the given file (live input is ignored meanwhile)");
+	emucfg_define_str_option("inputrec", NULL, "Record input with emulated frame stamps into the given file");
 	emucfg_define_num_option("kicked", 0x0, "Answer to KickStart upgrade (128=ask user in a pop-up window)");
 	emucfg_define_str_option("kickup", KICKSTART_NAME, "Override path of external KickStart to be used");
 	emucfg_define_str_option("kickuplist", NULL, "Set path of symbol list file for external KickStart");
+	emucfg_define_switch_option("metrics", "Collect per-frame performance metrics (see the 'p' command of the UART monitor)");
+	emucfg_define_str_option("metricsfile", NULL, "Stream per-frame performance metrics into this file (CSV, or JSON lines if the name ends with .json)");
+	emucfg_define_switch_option("metricsosd", "Show performance metrics (share of host time, rolling average) on the OSD");
+	emucfg_define_switch_option("noidleskip", "Disable detection and fast-forward of idle CPU loops");
+	emucfg_define_switch_option("precise", "Use high precision (sleep + spin) frame pacing");
+#ifdef XEMU_SNAPSHOT_SUPPORT
+	emucfg_define_num_option("rewind", 0, "Capture an in-memory rewind point at every N frames, 50 = 1 sec (0=off, slow RAM and disk images are not rewound)");
+#endif
 	emucfg_define_str_option("sdimg", SDCARD_NAME, "Override path of SD-image to be used");
+	emucfg_define_str_option("sdovl", NULL, "Use SD-image read-only, with writes going into this (created if needed) overlay file (external D81 given by -8 is not covered)");
+	emucfg_define_num_option("sdsync", SD_SYNC_FRAME, "SD-image write-back policy (0=on exit/by OS, 1=once per frame, 2=on every write)");
 #ifdef XEMU_SNAPSHOT_SUPPORT
+	emucfg_define_num_option("snapauto", 0, "Save snapshot (see -snapsave) in the background at every N seconds (0=off)");
 	emucfg_define_str_option("snapload", NULL, "Load a snapshot from the given file");
 	emucfg_define_str_option("snapsave", NULL, "Save a snapshot into the given file before Xemu would exit");
 #endif
@@ -1172,6 +1366,7 @@ int main ( int argc, char **argv )
 		return 1;
 	if (xemu_byte_order_test())
 		FATAL("Byte order test failed!!");
+	emu_bench_init(emucfg_get_num("bench"), FAST_CPU_CYCLES_PER_SCANLINE * 312 * 50);	// must be before SDL init (headless mode)
 	/* Initiailize SDL - note, it must be before loading ROMs, as it depends on path info from SDL! */
         if (emu_init_sdl(
 		TARGET_DESC APP_DESC_APPEND,	// window title
@@ -1199,6 +1394,8 @@ int main ( int argc, char **argv )
 	frameskip = 0;
 	frame_counter = 0;
 	vic3_blink_phase = 0;
+	cpu_idle_detection = !emucfg_get_bool("noidleskip");
+	emu_set_precise_timing(emucfg_get_bool("precise"));
 	emu_timekeeping_start();
 	if (audio)
 		SDL_PauseAudioDevice(audio, 0);
@@ -1219,7 +1416,15 @@ int main ( int argc, char **argv )
 			hypervisor_debug();
 		}
 		cycles += cpu_step();
+		EMU_METRICS_COUNT(EMU_METRICS_INSNS, 1);
+		if (unlikely(cpu_idle_loop_cycles))	// idle loop: nothing can happen till the end of the scanline
+			cycles += cpu_idle_fast_forward(cpu_cycles_per_scanline - cycles);
 		if (cycles >= cpu_cycles_per_scanline) {
+			cpu_idle_reset();
+#ifdef UARTMON_SOCKET
+			if (unlikely(umon_bin_mode))	// binary transfer on the monitor: serve it faster than once per frame
+				uartmon_update();
+#endif
 			scanline++;
 			//DEBUG("VIC3: new scanline (%d)!" NL, scanline);
 			cycles -= cpu_cycles_per_scanline;
@@ -1234,6 +1439,9 @@ int main ( int argc, char **argv )
 				sid1.sFrameCount++;
 				sid2.sFrameCount++;
 				frame_counter++;
+#ifdef XEMU_SNAPSHOT_SUPPORT
+				rewind_update();
+#endif
 				if (frame_counter == 25) {
 					frame_counter = 0;
 					vic3_blink_phase = !vic3_blink_phase;
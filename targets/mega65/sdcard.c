@@ -21,12 +21,16 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "xemu/f011_core.h"
 #include "mega65.h"
 #include "xemu/cpu65c02.h"
+#include "xemu/disk_overlay.h"
 
 #include <sys/types.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#ifdef SD_USE_MMAP
+#include <sys/mman.h>
+#endif
 
 
 
@@ -42,6 +46,149 @@ static off_t sd_card_size;
 static int   sdcard_bytes_read = 0;
 static int   sd_is_read_only;
 static int   mounted;
+static int   sd_sync_mode;	// SD_SYNC_* policy of writing back the modified sectors to the host OS
+
+/* Images are accessed via mmap() if it's possible, so sector read/write is only a memory copy,
+   and the host OS takes care about writing the pages back (see sdcard_flush() for msync).
+   Otherwise (no mmap on the platform, or it failed, ie too large image on 32 bit host)
+   a write-back sector cache is used with the file descriptor based I/O. */
+struct image_map_st {
+	Uint8 *p;		// the mapped image, or NULL if not mapped
+	off_t  size;
+	int    rw;		// mapped as writable
+	int    dirty;		// modified since the last flush
+};
+static struct image_map_st sd_map, d81_map;
+static struct disk_overlay_st sd_overlay = { .fd = -1 };	// copy-on-write overlay of the SD-card image, if fd is not -1
+
+#define SECTOR_CACHE_SIZE	256	// must be power of two, number of 512 byte sectors cached (non-mmap case only)
+static struct {
+	int   fd;			// file descriptor the sector belongs to, -1 = unused entry
+	off_t offset;
+	int   dirty;
+	Uint8 data[512];
+} sector_cache[SECTOR_CACHE_SIZE];
+static int sector_cache_dirty;
+static int sector_cache_error;	// write-back failed (the user has been warned once), retried only in every SECTOR_CACHE_RETRY frames
+#define SECTOR_CACHE_RETRY	50
+
+
+
+static void image_map ( struct image_map_st *map, int fd, off_t size, int rw )
+{
+	map->p = NULL;
+	map->dirty = 0;
+	map->size = size;
+	map->rw = rw;
+#ifdef SD_USE_MMAP
+	map->p = mmap(NULL, size, rw ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	if (map->p == MAP_FAILED) {
+		DEBUGPRINT("SDCARD: cannot mmap() image, using sector cache instead: %s" NL, strerror(errno));
+		map->p = NULL;
+	} else
+		DEBUGPRINT("SDCARD: image is mmap()'ed (%s mode)" NL, rw ? "R/W" : "R/O");
+#endif
+}
+
+
+
+static void image_unmap ( struct image_map_st *map )
+{
+#ifdef SD_USE_MMAP
+	if (map->p) {
+		if (map->dirty)
+			msync(map->p, map->size, MS_SYNC);
+		munmap(map->p, map->size);
+	}
+#endif
+	map->p = NULL;
+}
+
+
+
+static int sector_cache_write_back ( int n )
+{
+	EMU_METRICS_COUNT(EMU_METRICS_DISK_OPS, 2);
+	if (lseek(sector_cache[n].fd, sector_cache[n].offset, SEEK_SET) != sector_cache[n].offset || write(sector_cache[n].fd, sector_cache[n].data, 512) != 512) {
+		DEBUGPRINT("SDCARD: cannot write back sector at offset " PRINTF_LLD ": %s" NL, (long long)sector_cache[n].offset, strerror(errno));
+		return -1;
+	}
+	sector_cache[n].dirty = 0;
+	return 0;
+}
+
+
+
+// Returns the cache entry for the given sector, the data is loaded into it if "load" is non-zero.
+static int sector_cache_get ( int fd, off_t offset, int load )
+{
+	int n = (offset >> 9) & (SECTOR_CACHE_SIZE - 1);
+	if (sector_cache[n].fd == fd && sector_cache[n].offset == offset)
+		return n;
+	if (sector_cache[n].fd >= 0 && sector_cache[n].dirty && sector_cache_write_back(n))
+		return -1;
+	sector_cache[n].fd = -1;
+	if (load)
+		EMU_METRICS_COUNT(EMU_METRICS_DISK_OPS, 2);
+	if (load && (lseek(fd, offset, SEEK_SET) != offset || read(fd, sector_cache[n].data, 512) != 512)) {
+		DEBUGPRINT("SDCARD: cannot read sector at offset " PRINTF_LLD ": %s" NL, (long long)offset, strerror(errno));
+		return -1;
+	}
+	sector_cache[n].fd = fd;
+	sector_cache[n].offset = offset;
+	sector_cache[n].dirty = 0;
+	return n;
+}
+
+
+
+// Returns the number of sectors could not be written back (those are kept as dirty)
+static int sector_cache_flush ( int fd )
+{
+	int n, failed = 0;
+	for (n = 0; n < SECTOR_CACHE_SIZE; n++)
+		if (sector_cache[n].fd >= 0 && sector_cache[n].dirty && (fd < 0 || sector_cache[n].fd == fd) && sector_cache_write_back(n))
+			failed++;
+	return failed;
+}
+
+
+
+/* Writes back the modified sectors to the host OS according to the sync policy.
+   Called by the emulator once per frame. */
+void sdcard_flush ( void )
+{
+	if (sd_sync_mode != SD_SYNC_FRAME)
+		return;
+#ifdef SD_USE_MMAP
+	if (sd_map.dirty) {
+		EMU_METRICS_COUNT(EMU_METRICS_DISK_OPS, 1);
+		msync(sd_map.p, sd_map.size, MS_ASYNC);
+		sd_map.dirty = 0;
+	}
+	if (d81_map.dirty) {
+		EMU_METRICS_COUNT(EMU_METRICS_DISK_OPS, 1);
+		msync(d81_map.p, d81_map.size, MS_ASYNC);
+		d81_map.dirty = 0;
+	}
+#endif
+	if (sector_cache_dirty) {
+		if (sector_cache_error && --sector_cache_error > 1)
+			return;		// failed before, do not retry in every frame
+		if (sector_cache_flush(-1)) {
+			// keep sector_cache_dirty set, so we will retry later
+			if (!sector_cache_error)
+				ERROR_WINDOW("Cannot write back modified sector(s) to the SD-card or D81 image!\nWill retry silently, see the debug log for details.");
+			sector_cache_error = SECTOR_CACHE_RETRY;
+			sd_status |= SD_ST_ERROR | SD_ST_FSM_ERROR;
+		} else {
+			if (sector_cache_error)
+				DEBUGPRINT("SDCARD: pending modified sectors are written back now" NL);
+			sector_cache_error = 0;
+			sector_cache_dirty = 0;
+		}
+	}
+}
 
 static int open_external_d81 ( const char *fn )
 {
@@ -52,7 +199,7 @@ static int open_external_d81 ( const char *fn )
 	d81fd = emu_load_file(fn, fnbuf, -1);	// get the file descriptor only ...
 	if (d81fd < 0) {
 		ERROR_WINDOW("External D81 image was specified (%s) but it cannot be opened: %s", fn, strerror(errno));
-		DEBUG("SDCARD: cannot open external D81 image %s" NL, fn);
+		DEBUGCAT(XLOG_SDCARD, "SDCARD: cannot open external D81 image %s" NL, fn);
 	} else {
 		off_t d81_size;
 		// try to open in R/W mode
@@ -60,7 +207,7 @@ static int open_external_d81 ( const char *fn )
 		if (tryfd >= 0) {
 			close(d81fd);
 			d81fd = tryfd;
-			DEBUG("SDCARD: exernal D81 image file re-opened in RD/WR mode, good" NL);
+			DEBUGCAT(XLOG_SDCARD, "SDCARD: exernal D81 image file re-opened in RD/WR mode, good" NL);
 			d81_is_read_only = 0;
 		} else {
 			INFO_WINDOW("External D81 image file %s could be open only in R/O mode", fnbuf);
@@ -78,6 +225,7 @@ static int open_external_d81 ( const char *fn )
 			d81fd = -1;
 			return d81fd;
 		}
+		image_map(&d81_map, d81fd, d81_size, !d81_is_read_only);
 	}
 	return d81fd;
 }
@@ -86,6 +234,10 @@ static int open_external_d81 ( const char *fn )
 
 static void sdcard_shutdown ( void )
 {
+	sector_cache_flush(-1);
+	disk_overlay_close(&sd_overlay);
+	image_unmap(&sd_map);
+	image_unmap(&d81_map);
 	if (sdfd >= 0)
 		close(sdfd);
 	if (d81fd >= 0)
@@ -94,10 +246,16 @@ static void sdcard_shutdown ( void )
 
 
 
-int sdcard_init ( const char *fn, const char *extd81fn )
+int sdcard_init ( const char *fn, const char *extd81fn, const char *ovlfn, int sync_mode )
 {
 	char fnbuf[PATH_MAX + 1];
+	int n;
 	atexit(sdcard_shutdown);
+	sd_sync_mode = sync_mode;
+	for (n = 0; n < SECTOR_CACHE_SIZE; n++)
+		sector_cache[n].fd = -1;
+	sector_cache_dirty = 0;
+	sd_map.p = d81_map.p = NULL;
 	sd_status = 0;
 	sd_is_read_only = 1;
 	d81_is_read_only = 1;
@@ -107,20 +265,20 @@ int sdcard_init ( const char *fn, const char *extd81fn )
 	sdfd = emu_load_file(fn, fnbuf, -1);    // get the file descriptor only ...
 	if (sdfd < 0) {
 		ERROR_WINDOW("Cannot open SD-card image %s, SD-card access won't work! ERROR: %s", fn, strerror(errno));
-		DEBUG("SDCARD: cannot open image %s" NL, fn);
+		DEBUGCAT(XLOG_SDCARD, "SDCARD: cannot open image %s" NL, fn);
 	} else {
-		// try to open in R/W mode ...
-		int tryfd = open(fnbuf, O_RDWR | O_BINARY);
+		// try to open in R/W mode (not needed with overlay, the image is only read then) ...
+		int tryfd = ovlfn ? -1 : open(fnbuf, O_RDWR | O_BINARY);
 		if (tryfd >= 0) {
 			// use R/W mode descriptor if it was OK!
 			close(sdfd);
 			sdfd = tryfd;
-			DEBUG("SDCARD: image file re-opened in RD/WR mode, good" NL);
+			DEBUGCAT(XLOG_SDCARD, "SDCARD: image file re-opened in RD/WR mode, good" NL);
 			sd_is_read_only = 0;
-		} else
+		} else if (!ovlfn)
 			INFO_WINDOW("Image file %s could be open only in R/O mode", fnbuf);
 		// Check size!
-		DEBUG("SDCARD: cool, SD-card image %s (as %s) is open" NL, fn, fnbuf);
+		DEBUGCAT(XLOG_SDCARD, "SDCARD: cool, SD-card image %s (as %s) is open" NL, fn, fnbuf);
 		sd_card_size = lseek(sdfd, 0, SEEK_END);
 		if (sd_card_size == (off_t)-1) {
 			ERROR_WINDOW("Cannot query the size of the SD-card image %s, SD-card access won't work! ERROR: %s", fn, strerror(errno));
@@ -140,13 +298,20 @@ int sdcard_init ( const char *fn, const char *extd81fn )
 			sdfd = -1;
 			return sdfd;
 		}
-		DEBUG("SDCARD: detected size in Mbytes: %d" NL, (int)(sd_card_size >> 20));
+		DEBUGCAT(XLOG_SDCARD, "SDCARD: detected size in Mbytes: %d" NL, (int)(sd_card_size >> 20));
 		if (sd_card_size & (off_t)511) {
 			ERROR_WINDOW("SD-card image size is not multiple of 512 bytes!!");
 			close(sdfd);
 			sdfd = -1;
 			return sdfd;
 		}
+		if (ovlfn) {
+			if (disk_overlay_open(&sd_overlay, ovlfn, sd_card_size))
+				ERROR_WINDOW("Cannot use overlay file %s for the SD-card image, it's used in R/O mode!", ovlfn);
+			else
+				sd_is_read_only = 0;
+		}
+		image_map(&sd_map, sdfd, sd_card_size, !sd_is_read_only && sd_overlay.fd < 0);
 	}
 	if (sdfd >= 0)
 		open_external_d81(extd81fn);
@@ -176,52 +341,90 @@ int sdcard_write_buffer ( int addr, Uint8 data )
 
 
 
-static int host_seek_to ( Uint8 *addr_buffer, int addressing_offset, const char *description, off_t size_limit, int fd )
+static off_t host_offset ( Uint8 *addr_buffer, int addressing_offset, const char *description, off_t size_limit )
 {
 	off_t image_offset = (addr_buffer ? (((off_t)addr_buffer[0]) | ((off_t)addr_buffer[1] << 8) | ((off_t)addr_buffer[2] << 16) | ((off_t)addr_buffer[3] << 24)) : 0) ;
 
         image_offset*=512;  // For SDHC we use sector adressing. Sector size is fixed to 512
         image_offset+= (off_t)addressing_offset;
 
-	DEBUG("SDCARD: %s card at position " PRINTF_LLD " (offset=%d) PC=$%04X" NL, description, (long long)image_offset, addressing_offset, cpu_pc);
+	DEBUGCAT(XLOG_SDCARD, "SDCARD: %s card at position " PRINTF_LLD " (offset=%d) PC=$%04X" NL, description, (long long)image_offset, addressing_offset, cpu_pc);
 	if (image_offset < 0 || image_offset > size_limit - 512) {
-		FATAL("SDCARD: SEEK: invalid offset requested for %s with offset " PRINTF_LLD " PC=$%04X", description, (long long)image_offset, cpu_pc);
+		DEBUGPRINT("SDCARD: invalid offset requested for %s with offset " PRINTF_LLD " PC=$%04X" NL, description, (long long)image_offset, cpu_pc);
+		return -1;
 	}
-	if (lseek(fd, image_offset, SEEK_SET) != image_offset)
-		FATAL("SDCARD: SEEK: image seek host-OS failure: %s", strerror(errno));
-	return 0;
+	return image_offset;
 }
 
 
 
-static int diskimage_read_block ( Uint8 *io_buffer, Uint8 *addr_buffer, int addressing_offset, const char *description, off_t size_limit, int fd )
+static int diskimage_read_block ( Uint8 *io_buffer, Uint8 *addr_buffer, int addressing_offset, const char *description, off_t size_limit, int fd, struct image_map_st *map )
 {
-	int ret;
+	off_t offset;
+	int n;
 	if (sdfd < 0)
 		return -1;
-	host_seek_to(addr_buffer, addressing_offset, description, size_limit, fd);
-	ret = read(fd, io_buffer, 512);
-	if (ret != 512)
-		FATAL("SDCARD: %s failure ... ERROR: %s", description, ret >=0 ? "not 512 bytes could be read" : strerror(errno));
-	DEBUG("SDCARD: cool, sector %s was OK (%d bytes read)!" NL, description, ret);
-	return ret;
+	offset = host_offset(addr_buffer, addressing_offset, description, size_limit);
+	if (offset < 0)
+		return -1;
+	if (fd == sdfd && sd_overlay.fd >= 0 && disk_overlay_has_sector(&sd_overlay, offset)) {
+		EMU_METRICS_COUNT(EMU_METRICS_DISK_OPS, 1);
+		if (disk_overlay_read(&sd_overlay, fd, offset, io_buffer))
+			return -1;
+	} else if (map->p) {
+		memcpy(io_buffer, map->p + offset, 512);
+	} else {
+		n = sector_cache_get(fd, offset, 1);
+		if (n < 0)
+			return -1;
+		memcpy(io_buffer, sector_cache[n].data, 512);
+	}
+	DEBUGCAT(XLOG_SDCARD, "SDCARD: cool, sector %s was OK!" NL, description);
+	return 512;
 }
 
 
 
-static int diskimage_write_block ( Uint8 *io_buffer, Uint8 *addr_buffer, int addressing_offset, const char *description, off_t size_limit, int fd )
+static int diskimage_write_block ( Uint8 *io_buffer, Uint8 *addr_buffer, int addressing_offset, const char *description, off_t size_limit, int fd, struct image_map_st *map )
 {
-	int ret;
+	off_t offset;
+	int n;
 	if (sdfd < 0)
 		return -1;
 	if (sd_is_read_only)
 		return -1;
-	host_seek_to(addr_buffer, addressing_offset, description, size_limit, fd);
-	ret = write(fd, io_buffer, 512);
-	if (ret != 512)
-		FATAL("SDCARD: %s failure ... ERROR: %s", description, ret >=0 ? "not 512 bytes could be written" : strerror(errno));
-	DEBUG("SDCARD: cool, sector %s was OK (%d bytes read)!" NL, description, ret);
-	return ret;
+	offset = host_offset(addr_buffer, addressing_offset, description, size_limit);
+	if (offset < 0)
+		return -1;
+	if (fd == sdfd && sd_overlay.fd >= 0) {
+		EMU_METRICS_COUNT(EMU_METRICS_DISK_OPS, 1);
+		if (disk_overlay_write(&sd_overlay, offset, io_buffer))
+			return -1;
+	} else if (map->p && map->rw) {
+		memcpy(map->p + offset, io_buffer, 512);
+#ifdef SD_USE_MMAP
+		if (sd_sync_mode == SD_SYNC_WRITE) {
+			off_t page = offset & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+			EMU_METRICS_COUNT(EMU_METRICS_DISK_OPS, 1);
+			msync(map->p + page, offset + 512 - page, MS_SYNC);
+		} else
+#endif
+			map->dirty = 1;
+	} else {
+		n = sector_cache_get(fd, offset, 0);
+		if (n < 0)
+			return -1;
+		memcpy(sector_cache[n].data, io_buffer, 512);
+		if (sd_sync_mode == SD_SYNC_WRITE) {
+			if (sector_cache_write_back(n)) {
+				sector_cache[n].fd = -1;
+				return -1;
+			}
+		} else
+			sector_cache[n].dirty = sector_cache_dirty = 1;
+	}
+	DEBUGCAT(XLOG_SDCARD, "SDCARD: cool, sector %s was OK!" NL, description);
+	return 512;
 }
 
 
@@ -229,9 +432,9 @@ static int diskimage_write_block ( Uint8 *io_buffer, Uint8 *addr_buffer, int add
 int fdc_cb_rd_sec ( Uint8 *buffer, int d81_offset )
 {
 	if (use_d81)
-		return (diskimage_read_block(buffer, NULL, d81_offset, "reading[D81@HOST]", D81_SIZE, d81fd) != 512);
+		return (diskimage_read_block(buffer, NULL, d81_offset, "reading[D81@HOST]", D81_SIZE, d81fd, &d81_map) != 512);
 	else
-		return (diskimage_read_block(buffer, sd_d81_img1_start, d81_offset, "reading[D81@SD]", sd_card_size, sdfd) != 512);
+		return (diskimage_read_block(buffer, sd_d81_img1_start, d81_offset, "reading[D81@SD]", sd_card_size, sdfd, &sd_map) != 512);
 }
 
 
@@ -239,9 +442,9 @@ int fdc_cb_rd_sec ( Uint8 *buffer, int d81_offset )
 int fdc_cb_wr_sec ( Uint8 *buffer, int d81_offset )
 {
 	if (use_d81)
-		return (diskimage_write_block(buffer, NULL, d81_offset, "writing[D81@HOST]", D81_SIZE, d81fd) != 512);
+		return (diskimage_write_block(buffer, NULL, d81_offset, "writing[D81@HOST]", D81_SIZE, d81fd, &d81_map) != 512);
 	else
-		return (diskimage_write_block(buffer, sd_d81_img1_start, d81_offset, "writing[D81@SD]", sd_card_size, sdfd) != 512);
+		return (diskimage_write_block(buffer, sd_d81_img1_start, d81_offset, "writing[D81@SD]", sd_card_size, sdfd, &sd_map) != 512);
 }
 
 
@@ -251,7 +454,7 @@ int fdc_cb_wr_sec ( Uint8 *buffer, int d81_offset )
 static Uint8 sdcard_read_status ( void )
 {
 	Uint8 ret = sd_status;
-	DEBUG("SDCARD: reading SD status $D680 result is $%02X PC=$%04X" NL, ret, cpu_pc);
+	DEBUGCAT(XLOG_SDCARD, "SDCARD: reading SD status $D680 result is $%02X PC=$%04X" NL, ret, cpu_pc);
 	sd_status &= ~(SD_ST_BUSY1 | SD_ST_BUSY0);
 	return ret;
 }
@@ -261,7 +464,7 @@ static Uint8 sdcard_read_status ( void )
 static void sdcard_command ( Uint8 cmd )
 {
 	int ret;
-	DEBUG("SDCARD: writing command register $D680 with $%02X PC=$%04X" NL, cmd, cpu_pc);
+	DEBUGCAT(XLOG_SDCARD, "SDCARD: writing command register $D680 with $%02X PC=$%04X" NL, cmd, cpu_pc);
 	sd_status &= ~(SD_ST_BUSY1 | SD_ST_BUSY0);	// ugly hack :-@
 	switch (cmd) {
 		case 0x00:	// RESET SD-card
@@ -272,7 +475,7 @@ static void sdcard_command ( Uint8 cmd )
 			sd_status &= ~(SD_ST_RESET | SD_ST_ERROR | SD_ST_FSM_ERROR);
 			break;
 		case 0x02:	// read sector
-			ret = diskimage_read_block(sd_buffer, sd_sector_bytes, 0, "reading[SD]", sd_card_size, sdfd);
+			ret = diskimage_read_block(sd_buffer, sd_sector_bytes, 0, "reading[SD]", sd_card_size, sdfd, &sd_map);
 			if (ret < 0) {
 				sd_status |= SD_ST_ERROR | SD_ST_FSM_ERROR; // | SD_ST_BUSY1 | SD_ST_BUSY0;
 				sdcard_bytes_read = 0;
@@ -302,7 +505,7 @@ static void sdcard_command ( Uint8 cmd )
 			break;
 		default:
 			// FIXME: how to signal this to the user/sys app? error flags, etc?
-			DEBUG("SDCARD: warning, unimplemented SD-card controller command $%02X" NL, cmd);
+			DEBUGCAT(XLOG_SDCARD, "SDCARD: warning, unimplemented SD-card controller command $%02X" NL, cmd);
 			printf("MEGA65: SD: unimplemented command $%02X" NL, cmd);
 			break;
 	}
@@ -351,7 +554,7 @@ void sdcard_write_register ( int reg, Uint8 data )
 		case 3:		// sector address
 		case 4:		// sector address
 			sd_sector_bytes[reg - 1] = data;
-			DEBUG("SDCARD: writing sector number register $%04X with $%02X PC=$%04X" NL, reg + 0xD680, data, cpu_pc);
+			DEBUGCAT(XLOG_SDCARD, "SDCARD: writing sector number register $%04X with $%02X PC=$%04X" NL, reg + 0xD680, data, cpu_pc);
 			break;
 		case 0xB:
 			sdcard_mount_d81(data);
@@ -361,7 +564,7 @@ void sdcard_write_register ( int reg, Uint8 data )
 		case 0xE:
 		case 0xF:
 			sd_d81_img1_start[reg - 0xC] = data;
-			DEBUG("SDCARD: writing D81 #1 sector register $%04X with $%02X PC=$%04X" NL, reg + 0xD680, data, cpu_pc);
+			DEBUGCAT(XLOG_SDCARD, "SDCARD: writing D81 #1 sector register $%04X with $%02X PC=$%04X" NL, reg + 0xD680, data, cpu_pc);
 			break;
 	}
 }
@@ -27,8 +27,18 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #define SD_ST_BUSY1	0x02
 #define SD_ST_BUSY0	0x01
 
+// SD-card image write-back policies (sync_mode parameter of sdcard_init)
+#define SD_SYNC_NONE	0	// leave it to the host OS, and to the exit of the emulator
+#define SD_SYNC_FRAME	1	// write back the modified sectors once per frame
+#define SD_SYNC_WRITE	2	// synchronous write-back on every sector write
 
-extern int   sdcard_init           ( const char *fn, const char *extd81fn );
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define SD_USE_MMAP
+#endif
+
+
+extern int   sdcard_init           ( const char *fn, const char *extd81fn, const char *ovlfn, int sync_mode );
+extern void  sdcard_flush          ( void );
 extern void  sdcard_write_register ( int reg, Uint8 data );
 extern Uint8 sdcard_read_register  ( int reg  );
 extern int   sdcard_read_buffer    ( int addr );
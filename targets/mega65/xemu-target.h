@@ -3,3 +3,6 @@
 #define CPU_65CE02
 #define MEGA65
 #define XEMU_SNAPSHOT_SUPPORT "Mega-65"
+#define CPU_IDLE_LOOP_DETECTION
+#define CPU_BLOCK_CACHE
+#define CPU_CODE_PAGES 0x440
@@ -20,6 +20,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 #include "xemu/emutools.h"
 #include "xemu/emutools_hid.h"
+#include "xemu/input_record.h"
+#include "xemu/emutools_config.h"
 #include "xemu/z80.h"
 #include "primo.h"
 
@@ -215,9 +217,12 @@ int emu_callback_key ( int pos, SDL_Scancode key, int pressed, int handled )
 static void update_emulator ( void )
 {
 	if (!frameskip) {
+		EMU_BENCH_SECTION(EMU_BENCH_VIDEO);
 		render_primo_screen();
+		EMU_BENCH_SECTION(EMU_BENCH_IO);
 		hid_handle_all_sdl_events();
 		emu_timekeeping_delay(40000);
+		EMU_BENCH_SECTION(EMU_BENCH_CPU);
 	}
 }
 
@@ -227,6 +232,14 @@ int main ( int argc, char **argv )
 {
 	int cycles;
 	xemu_dump_version(stdout, "The Unknown Primo emulator from LGB");
+	emucfg_define_num_option("bench", 0, "Benchmark: run headless and unthrottled for N frames, then print the results as JSON");
+	emucfg_define_str_option("inputplay", NULL, "Replay input recorded by -inputrec from the given file (live input is ignored meanwhile)");
+	emucfg_define_str_option("inputrec", NULL, "Record input with emulated frame stamps into the given file");
+	emucfg_define_str_option("metricsfile", NULL, "Stream per-frame performance metrics into this file (CSV, or JSON lines if the name ends with .json)");
+	emucfg_define_switch_option("metricsosd", "Show performance metrics (share of host time, rolling average) on the OSD");
+	if (emucfg_parse_commandline(argc, argv, NULL))
+		return 1;
+	emu_bench_init(emucfg_get_num("bench"), CPU_CLOCK);	// must be before SDL init (headless mode)
 	/* Initiailize SDL - note, it must be before loading ROMs, as it depends on path info from SDL! */
 	if (emu_init_sdl(
 		TARGET_DESC APP_DESC_APPEND,	// window title
@@ -249,6 +262,10 @@ int main ( int argc, char **argv )
 		VIRTUAL_SHIFT_POS,
 		SDL_DISABLE		// no joystick HID events
 	);
+	if (inputrec_init(emucfg_get_str("inputrec"), emucfg_get_str("inputplay")))
+		FATAL("Cannot start input recording or replay, see the debug log");
+	if (emu_metrics_init(0, emucfg_get_str("metricsfile"), emucfg_get_bool("metricsosd")))
+		FATAL("Cannot create the metrics stream file, see the debug log");
 	/* Intialize memory and load ROMs */
 	memset(memory, 0xFF, sizeof memory);
 	if (emu_load_file(ROM_NAME, memory, 0x4001) != 0x4000)
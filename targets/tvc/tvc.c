@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 #include "xemu/emutools.h"
 #include "xemu/emutools_hid.h"
+#include "xemu/input_record.h"
 #include "xemu/emutools_config.h"
 #include "xemu/z80.h"
 #include "tvc.h"
@@ -339,9 +340,12 @@ static void update_emulator ( void )
 	}
 	// Rest of the update stuff, but only at 25Hz rate ...
 	if (!frameskip) {
+		EMU_BENCH_SECTION(EMU_BENCH_VIDEO);
 		render_tvc_screen();
+		EMU_BENCH_SECTION(EMU_BENCH_IO);
 		hid_handle_all_sdl_events();
 		emu_timekeeping_delay(40000);	// number: the time needed (real-time) for a "full frame"
+		EMU_BENCH_SECTION(EMU_BENCH_CPU);
 	}
 }
 
@@ -394,12 +398,20 @@ int main ( int argc, char **argv )
 {
 	int cycles;
 	xemu_dump_version(stdout, "The Careless Videoton TV Computer emulator from LGB");
+	emucfg_define_num_option("bench", 0, "Benchmark: run headless and unthrottled for N frames, then print the results as JSON");
+	emucfg_define_str_option("inputplay", NULL, "Replay input recorded by -inputrec from the given file (live input is ignored meanwhile)");
+	emucfg_define_str_option("inputrec", NULL, "Record input with emulated frame stamps into the given file");
+	emucfg_define_str_option("metricsfile", NULL, "Stream per-frame performance metrics into this file (CSV, or JSON lines if the name ends with .json)");
+	emucfg_define_switch_option("metricsosd", "Show performance metrics (share of host time, rolling average) on the OSD");
+	emucfg_define_switch_option("precise", "Use high precision (sleep + spin) frame pacing");
 #ifdef CONFIG_SDEXT_SUPPORT
+	emucfg_define_switch_option("sdbulk", "Fast SD-card sector reads: LDIR loops of the SD ROM are served at once");
 	emucfg_define_switch_option("sdext", "Enables SD-ext");
 	emucfg_define_str_option("sdimg", SDCARD_IMG_FN, "SD-card image filename / path");
 #endif
 	if (emucfg_parse_commandline(argc, argv, NULL))
 		return 1;
+	emu_bench_init(emucfg_get_num("bench"), CPU_CLOCK);	// must be before SDL init (headless mode)
 	/* Initiailize SDL - note, it must be before loading ROMs, as it depends on path info from SDL! */
 	if (emu_init_sdl(
 		TARGET_DESC APP_DESC_APPEND,	// window title
@@ -422,12 +434,17 @@ int main ( int argc, char **argv )
 		VIRTUAL_SHIFT_POS,
 		SDL_DISABLE		// no joystick HID events
 	);
+	if (inputrec_init(emucfg_get_str("inputrec"), emucfg_get_str("inputplay")))
+		FATAL("Cannot start input recording or replay, see the debug log");
+	if (emu_metrics_init(0, emucfg_get_str("metricsfile"), emucfg_get_bool("metricsosd")))
+		FATAL("Cannot create the metrics stream file, see the debug log");
 	init_tvc();
 	// Continue with initializing ...
 	clear_emu_events();	// also resets the keyboard
 	z80ex_init();
 	cycles = 0;
 	interrupt_active = 0;
+	emu_set_precise_timing(emucfg_get_bool("precise"));
 	emu_timekeeping_start();	// we must call this once, right before the start of the emulation
 	for (;;) { // our emulation loop ...
 		if (interrupt_active) {
@@ -102,6 +102,21 @@ Current quick'n'dirty usage:
 				NOTE: WITHOUT THIS COMMAND, YOU CAN'T WRITE OR READ DATA REGISTER (for other purpose
 				that after cmd-0 for writing, which is valid, of course, but even then read is not supported)
 				You can have more open channel, and use cmd-4 to "switch" between them.
+			5 = get number of bytes info of the channel selected by cmd-4 (answer is in the status register)
+				bit3 of low nibble: 0 = file size, 1 = transferred bytes (since open or the last reset)
+				bit2 of low nibble: reset the transferred bytes counter after the query
+				bit0-1 of low nibble: byte of the 32 bit value to return
+			6 = start bulk transfer specification
+				low nibble has no purpose. Data register must be written with exactly five bytes
+				then: memory address (three bytes, low byte first) and length (two bytes, low byte first,
+				zero means 64K).
+			7 = bulk transfer, on the channel selected by cmd-4, with the parameters given after cmd-6
+				low nibble bit0: 0 = read from the channel into memory, 1 = write memory into the channel
+				The whole block is moved with a single command instead of reading/writing the data
+				register byte by byte. Memory address is the linear address in the emulated RAM (for C65,
+				the 128K RAM at $00000-$1FFFF). The number of actually moved bytes can be queried with
+				cmd-5 as the "transferred bytes", status register has EOF if less bytes could be read
+				than requested. Only valid if the emulator provides the memory for hostFS.
 			Other not implemented command codes result in EOF in status register.
 
 	Currently the implementation is rather primitive. the "specification string" cannot specify commands, just file names.
@@ -132,17 +147,17 @@ Current quick'n'dirty usage:
 */
 
 
-#define WRITE_BUFFER_SIZE	256
-#define READ_BUFFER_SIZE	256
+#define WRITE_BUFFER_SIZE	8192
+#define READ_BUFFER_SIZE	8192	// must be large enough for a whole directory listing (CBM_MAX_DIR_ENTRIES * 30 bytes + head/tail lines)
 #define SPEC_BUFFER_SIZE	4096
 #define CBM_MAX_DIR_ENTRIES	144
+#define BULK_PARAM_SIZE		5
 
 
 struct hostfs_channels_st {
 	Uint8 read_buffer[READ_BUFFER_SIZE];
 	Uint8 write_buffer[WRITE_BUFFER_SIZE];
-	int   read_used, write_used;
-	DIR  *dir;
+	int   read_used, read_pos, write_used;
 	int   fd, id;
 	int   allow_write, allow_read, eof;
 	off_t file_size, trans_bytes;
@@ -156,6 +171,18 @@ static int spec_filling_index;
 static int last_command;
 static struct hostfs_channels_st *use_channel;
 static char hostfs_directory[PATH_MAX];
+static Uint8 bulk_param[BULK_PARAM_SIZE];
+static int bulk_param_index;
+static Uint8 *bulk_memory = NULL;
+static int bulk_memory_size;
+
+/* The directory listing (as a pseudo-BASIC program) is cached, since building it needs to scan the whole
+   host directory with stat()'ing the entries. It's rebuilt if the modification time of the directory changes,
+   or a file was created/written via hostFS. mtime has only one second resolution, so the listing is not
+   trusted either if the directory was modified in the same second as the listing was built. */
+static Uint8  dir_image[READ_BUFFER_SIZE];
+static int    dir_image_size = 0;	// zero means: no valid listing is cached
+static time_t dir_image_mtime, dir_image_built;
 
 
 
@@ -171,6 +198,7 @@ static Uint8 set_error ( int status, int errorcode, int tracknum, int sectnum, c
 			fprintf(stderr, "HOSTFS DOS: error code %02d is not defined, please report this." NL, errorcode);
 			break;
 	}
+	hostfs_channels[15].read_pos = 0;
 	hostfs_channels[15].read_used = sprintf((char*)hostfs_channels[15].read_buffer, "%02d, %s,%02d,%02d", errorcode, p, tracknum, sectnum);
 	DEBUG_HOSTFS("HOSTFS: error (host_status=%d) is set to \"%s\": %s." NL, status, (char*)hostfs_channels[15].read_buffer, description ? description : "-");
 	return 0xFF;
@@ -199,11 +227,11 @@ void hostfs_init ( const char *basedir, const char *subdir )
 	// intialize channels to a known state
 	for (a = 0; a < 16; a++) {
 		hostfs_channels[a].id = a;
-		hostfs_channels[a].dir = NULL;
 		hostfs_channels[a].fd = -1;
 		hostfs_channels[a].allow_write = 0;
 		hostfs_channels[a].allow_read = 0;
 		hostfs_channels[a].read_used = 0;
+		hostfs_channels[a].read_pos = 0;
 		hostfs_channels[a].write_used = 0;
 		hostfs_channels[a].file_size = 0;
 		hostfs_channels[a].trans_bytes = 0;
@@ -211,11 +239,21 @@ void hostfs_init ( const char *basedir, const char *subdir )
 	set_error(0, 73, 0, 0, "init");	// set status reg, and DOS "error" ...
 	last_command = -1;
 	use_channel = NULL;
+	bulk_param_index = 0;
+	dir_image_size = 0;
 	printf("HOSTFS: init @ %s" NL, hostfs_directory);
 	atexit(hostfs_close_all);	// registering function for exit, otherwise un-flushed write buffers may not be written on exit or panic!
 }
 
 
+// Memory used by the bulk transfer commands, "size" is the number of bytes can be accessed, from address zero.
+void hostfs_set_bulk_memory ( Uint8 *memory, int size )
+{
+	bulk_memory = memory;
+	bulk_memory_size = size;
+}
+
+
 static void hostfs_flush ( struct hostfs_channels_st *channel )
 {
 	int pos;
@@ -245,13 +283,12 @@ static void hostfs_close ( struct hostfs_channels_st *channel )
 {
 	if (channel->allow_write || channel->allow_read)
 		DEBUG_HOSTFS("HOSTFS: closing channel #%d" NL, channel->id);
-	if (channel->dir)
-		closedir(channel->dir);
 	if (channel->fd >= 0) {
 		hostfs_flush(channel);
 		close(channel->fd);
+		if (channel->allow_write)
+			dir_image_size = 0;	// file size may have changed, cached directory listing is not valid anymore
 	}
-	channel->dir = NULL;
 	channel->fd = -1;
 	channel->allow_write = 0;
 	channel->allow_read = 0;
@@ -348,76 +385,81 @@ static const Uint8 dirtailline[] = {
 
 
 
-static int cbm_read_directory ( struct hostfs_channels_st *channel )
+// Builds the directory listing into dir_image[], if the cached one is not valid anymore.
+// Returns with a status register value.
+static int cbm_read_directory ( void )
 {
-	// channel->allow_read is also used to track the memory address in the generated BASIC program for directory listing,
-	// since it's basically a boolean value, so any non-zero value has the same "boolean value".
-	if (channel->allow_read == 1) {
-		// first item ... not a real directory entry, but the "header"
-		memcpy(channel->read_buffer, dirheadline, sizeof dirheadline);
-		channel->allow_read = 2;
-		channel->read_used = sizeof dirheadline;
+	DIR *dir;
+	struct stat st;
+	Uint8 *p;
+	int entries;
+	if (stat(hostfs_directory, &st)) {
+		DEBUG_HOSTFS("HOSTFS: cannot stat directory '%s': %s" NL, hostfs_directory, strerror(errno));
+		return 128;
+	}
+	if (dir_image_size && st.st_mtime == dir_image_mtime && st.st_mtime < dir_image_built) {
+		DEBUG_HOSTFS("HOSTFS: using cached directory listing" NL);
 		return 0;
 	}
-	if (!channel->dir) {
-		channel->eof = 1;
-		return 64;
+	dir = opendir(hostfs_directory);
+	if (!dir) {
+		DEBUG_HOSTFS("HOSTFS: cannot open directory '%s': %s" NL, hostfs_directory, strerror(errno));
+		return 128;
 	}
-	for (;;) {
-		struct dirent *entry = readdir(channel->dir);	// read host directory
-		if (entry) {
-			Uint8 *p = channel->read_buffer;
-			Uint8 filename[17];
-			int namelength, i;
-			struct stat st;
-			if (!(namelength = filename_host2cbm((Uint8*)entry->d_name, filename, 16)))
-				continue;	// cannot be represented name, skip it!
-			if (xemu_stat_at(hostfs_directory, entry->d_name, &st))
-				continue;
-			if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
-				continue;
-			if (channel->allow_read - 2 == CBM_MAX_DIR_ENTRIES)
-				goto too_many_entries;
-			channel->allow_read++;
-			// Ok, it seems to be OK, let's present a directory line for the entry!
-			*(p++) = 1;	// link address, lo
-			*(p++) = 1;	// link address, hi
-			st.st_size = (st.st_size + 253) / 254;	// convert size to "blocks"
-			i = st.st_size > 0xFFFF ? 0xFFFF : st.st_size;
-			*(p++) = i & 0xFF;
-			*(p++) = i >> 8;
-			if (i < 10)	*(p++) = ' ';
-			if (i < 100)	*(p++) = ' ';
-			if (i < 1000)	*(p++) = ' ';
-			*(p++) = '"';
-			for (i = 0; i < 16; i++)
-				*(p++) = i < namelength ? filename[i] : (i == namelength ? '"' : ' ');
-			if (S_ISDIR(st.st_mode)) {
-				*(p++) = ' ';
-				*(p++) = 'D';
-				*(p++) = 'I';
-				*(p++) = 'R';
-			} else {
-				*(p++) = st.st_size ? ' ' : '*';
-				*(p++) = 'P';
-				*(p++) = 'R';
-				*(p++) = 'G';
-			}
-			*(p++) = ' ';	// later: read-only files with '<' TODO
-			*(p++) = 0;
-			channel->read_used = p - channel->read_buffer;
+	dir_image_mtime = st.st_mtime;
+	dir_image_built = time(NULL);
+	// first item ... not a real directory entry, but the "header"
+	memcpy(dir_image, dirheadline, sizeof dirheadline);
+	p = dir_image + sizeof dirheadline;
+	entries = 0;
+	while (entries < CBM_MAX_DIR_ENTRIES) {
+		struct dirent *entry = readdir(dir);	// read host directory
+		Uint8 filename[17];
+		int namelength, i;
+		if (!entry)
+			break;
+		if (!(namelength = filename_host2cbm((Uint8*)entry->d_name, filename, 16)))
+			continue;	// cannot be represented name, skip it!
+		if (xemu_stat_at(hostfs_directory, entry->d_name, &st))
+			continue;
+		if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+			continue;
+		entries++;
+		// Ok, it seems to be OK, let's present a directory line for the entry!
+		*(p++) = 1;	// link address, lo
+		*(p++) = 1;	// link address, hi
+		st.st_size = (st.st_size + 253) / 254;	// convert size to "blocks"
+		i = st.st_size > 0xFFFF ? 0xFFFF : st.st_size;
+		*(p++) = i & 0xFF;
+		*(p++) = i >> 8;
+		if (i < 10)	*(p++) = ' ';
+		if (i < 100)	*(p++) = ' ';
+		if (i < 1000)	*(p++) = ' ';
+		*(p++) = '"';
+		for (i = 0; i < 16; i++)
+			*(p++) = i < namelength ? filename[i] : (i == namelength ? '"' : ' ');
+		if (S_ISDIR(st.st_mode)) {
+			*(p++) = ' ';
+			*(p++) = 'D';
+			*(p++) = 'I';
+			*(p++) = 'R';
 		} else {
-		too_many_entries:
-			closedir(channel->dir);
-			channel->dir = NULL;
-			// Put tail basic line ("BLOCKS FREE")!
-			// Note, we always give back 65535 BLOCK FREE, but since about ~16Mbyte is usually have on host-FS nowadays,
-			// I guess it simple does not worth to invoke a statfs() call just for this ...
-			memcpy(channel->read_buffer, dirtailline, sizeof dirtailline);
-			channel->read_used = sizeof dirtailline;
+			*(p++) = st.st_size ? ' ' : '*';
+			*(p++) = 'P';
+			*(p++) = 'R';
+			*(p++) = 'G';
 		}
-		return 0;
+		*(p++) = ' ';	// later: read-only files with '<' TODO
+		*(p++) = 0;
 	}
+	closedir(dir);
+	// Put tail basic line ("BLOCKS FREE")!
+	// Note, we always give back 65535 BLOCK FREE, but since about ~16Mbyte is usually have on host-FS nowadays,
+	// I guess it simple does not worth to invoke a statfs() call just for this ...
+	memcpy(p, dirtailline, sizeof dirtailline);
+	dir_image_size = p + sizeof dirtailline - dir_image;
+	DEBUG_HOSTFS("HOSTFS: directory listing is built with %d entries, %d bytes" NL, entries, dir_image_size);
+	return 0;
 }
 
 
@@ -446,19 +488,19 @@ static void hostfs_open ( struct hostfs_channels_st *channel )
 	}
 	channel->write_used = 0;
 	channel->read_used = 0;
+	channel->read_pos = 0;
 	channel->eof = 0;
 	channel->file_size = 0;
 	channel->trans_bytes = 0;
 	if (spec_used[0] == '$') {
-		channel->dir = opendir(hostfs_directory);
-		if (!channel->dir) {
-			hfs_status = 128;
-			DEBUG_HOSTFS("HOSTFS: cannot open directory '%s': %s" NL, hostfs_directory, strerror(errno));
+		// the whole listing is put into the read buffer, the channel has no file descriptor
+		hfs_status = cbm_read_directory();
+		if (hfs_status)
 			return;
-		}
+		memcpy(channel->read_buffer, dir_image, dir_image_size);
+		channel->read_used = dir_image_size;
 		channel->allow_write = 0;
 		channel->allow_read  = 1;
-		hfs_status = cbm_read_directory(channel);
 	} else {
 		/* normal file must be open ... */
 		int flags, len;
@@ -603,6 +645,7 @@ static void hostfs_open ( struct hostfs_channels_st *channel )
 			} else {
 				DEBUG_HOSTFS("HOSTFS: great, new host file is created as '%s'" NL, filename);
 				hfs_status = 0;
+				dir_image_size = 0;	// new directory entry, cached directory listing is not valid anymore
 			}
 		} else {
 			hfs_status = 128;
@@ -614,6 +657,81 @@ static void hostfs_open ( struct hostfs_channels_st *channel )
 
 
 
+// Refills the read buffer of a channel from its file. Returns non-zero if there is no more data.
+static int hostfs_fill ( struct hostfs_channels_st *channel )
+{
+	if (channel->fd < 0)
+		return 1;	// not open channel, or a directory listing, which is already fully in the buffer since open
+	channel->read_pos = 0;
+	channel->read_used = read(channel->fd, channel->read_buffer, READ_BUFFER_SIZE);
+	if (channel->read_used < 0)
+		FATAL("read error @ hostFS!");
+	if (channel->read_used == 0) {
+		channel->eof = 1;
+		return 1;
+	}
+	return 0;
+}
+
+
+static void hostfs_bulk ( int to_channel )
+{
+	int addr = bulk_param[0] | (bulk_param[1] << 8) | (bulk_param[2] << 16);
+	int len  = bulk_param[3] | (bulk_param[4] << 8);
+	if (!len)
+		len = 0x10000;
+	if (!use_channel || !bulk_memory || bulk_param_index != BULK_PARAM_SIZE || addr + len > bulk_memory_size) {
+		hfs_status = 64;
+		return;
+	}
+	DEBUG_HOSTFS("HOSTFS: bulk %s of %d bytes at $%05X on channel #%d" NL, to_channel ? "write" : "read", len, addr, use_channel->id);
+	if (to_channel) {
+		if (!use_channel->allow_write || use_channel->fd < 0) {
+			hfs_status = 64;
+			return;
+		}
+		while (len) {
+			int n = WRITE_BUFFER_SIZE - use_channel->write_used;
+			if (!n) {
+				hostfs_flush(use_channel);
+				continue;
+			}
+			if (n > len)
+				n = len;
+			memcpy(use_channel->write_buffer + use_channel->write_used, bulk_memory + addr, n);
+			use_channel->write_used += n;
+			use_channel->trans_bytes += n;
+			addr += n;
+			len -= n;
+		}
+	} else {
+		if (!use_channel->allow_read || use_channel->eof) {
+			hfs_status = 64;
+			return;
+		}
+		while (len) {
+			int n = use_channel->read_used - use_channel->read_pos;
+			if (!n) {
+				if (hostfs_fill(use_channel)) {
+					hfs_status = 64;
+					return;
+				}
+				continue;
+			}
+			if (n > len)
+				n = len;
+			memcpy(bulk_memory + addr, use_channel->read_buffer + use_channel->read_pos, n);
+			use_channel->read_pos += n;
+			use_channel->trans_bytes += n;
+			addr += n;
+			len -= n;
+		}
+	}
+	hfs_status = 0;
+}
+
+
+
 Uint8 hostfs_read_reg0 ( void )
 {
 	Uint8 ret = hfs_status;
@@ -651,6 +769,12 @@ void hostfs_write_reg0 ( Uint8 data )
 		case 4: // set channel (in low nibble) to be used for data register R/W
 			use_channel = channel;
 			break;
+		case 6:	// start bulk transfer parameters, low nibble has no meaning
+			bulk_param_index = 0;
+			break;
+		case 7:	// bulk transfer on the used channel, low nibble bit0 is the direction
+			hostfs_bulk(data & 1);
+			break;
 		case 5:	// get number of bytes info [special command, the answer is sent back via the status register!]
 			if (use_channel) {
 				last_command = 4;
@@ -685,32 +809,12 @@ Uint8 hostfs_read_reg1 ( void )
 		hfs_status = 64;
 		return 0xFF;
 	}
-	if (use_channel->read_used)
-		goto ret_one;
 	/* empty buffer, must read more bytes ... */
-	if (use_channel->dir) {
-		hfs_status = cbm_read_directory(use_channel);
-		if (!hfs_status)
-			goto ret_one;
-		return 0xFF;
-	}
-	if (use_channel->fd < 0) {
-		hfs_status = 64;	// not open channel
-		return 0xFF;
-	}
-	use_channel->read_used = read(use_channel->fd, use_channel->read_buffer, READ_BUFFER_SIZE);
-	if (use_channel->read_used == 0) {
-		hfs_status = 64;
-		use_channel->eof = 1;
+	if (use_channel->read_pos >= use_channel->read_used && hostfs_fill(use_channel)) {
+		hfs_status = 64;	// EOF, or not open channel
 		return 0xFF;	// dummy byte!
 	}
-	if (use_channel->read_used < 0) {
-		FATAL("read error @ hostFS!");
-		return 0xFF;
-	}
-ret_one:
-	result = use_channel->read_buffer[0];
-	memmove(use_channel->read_buffer, use_channel->read_buffer + 1, --use_channel->read_used);
+	result = use_channel->read_buffer[use_channel->read_pos++];
 	hfs_status = 0;
 	use_channel->trans_bytes++;
 	return result;
@@ -728,6 +832,15 @@ void hostfs_write_reg1 ( Uint8 data )
 		}
 		return;
 	}
+	if (last_command == 6) {
+		if (bulk_param_index >= BULK_PARAM_SIZE) {
+			hfs_status = 64;
+		} else {
+			bulk_param[bulk_param_index++] = data;
+			hfs_status = 0;
+		}
+		return;
+	}
 	if (!use_channel) {
 		hfs_status = 64;
 		return;
@@ -21,6 +21,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 extern void  hostfs_init       ( const char *basedir, const char *subdir );
 extern void  hostfs_close_all  ( void );
 extern void  hostfs_flush_all  ( void );
+extern void  hostfs_set_bulk_memory ( Uint8 *memory, int size );
 extern Uint8 hostfs_read_reg0  ( void );
 extern Uint8 hostfs_read_reg1  ( void );
 extern void  hostfs_write_reg0 ( Uint8 data );
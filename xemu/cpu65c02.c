@@ -40,6 +40,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 //#define DEBUG_CPU
 
 #include "xemu/emutools_basicdefs.h"
+#include <string.h>
 #ifndef CPU_CUSTOM_INCLUDED
 #include "xemu/cpu65c02.h"
 #endif
@@ -122,17 +123,21 @@ Uint16 print_disass_line(Uint16 disass_pc, Uint8 disass_op){
 #	warning "Incomplete, inaccurate partial emulation of C64-DTV CPU, just the three extra opcodes, but 65C02 otherwise (with the original timings, no burst/skip cycle modes/etc)!"
 #	define A_OP(op,dat) cpu_regs[cpu_a_tind] = cpu_regs[cpu_a_sind] op dat
 #else
+#ifndef CPU65_CONTEXT
 	Uint8 cpu_a, cpu_x, cpu_y;
+#endif
 #ifdef CPU_65CE02
+#ifndef CPU65_CONTEXT
 	//int cpu_last_opcode_cycles;
 	Uint8 cpu_z;
 	Uint16 cpu_bphi;	// NOTE: it must store the value shifted to the high byte!
 	Uint16 cpu_sphi;	// NOTE: it must store the value shifted to the high byte!
 	int cpu_inhibit_interrupts;
+	int cpu_pfe;
+#endif
 #define	SP_HI cpu_sphi
 #define	ZP_HI cpu_bphi
 #define	ZERO_REG	cpu_z
-	int cpu_pfe;
 #	define CPU_TYPE "65CE02"
 #else
 #	define SP_HI	0x100
@@ -148,16 +153,53 @@ Uint16 print_disass_line(Uint16 disass_pc, Uint8 disass_op){
 #endif
 
 
-Uint8 cpu_sp, cpu_op;
 #ifdef MEGA65
 #warning "Compiling for MEGA65, hacky stuff!"
 #define IS_FLAT32_DATA_OP() unlikely(cpu_previous_op == 0xEA && cpu_linear_memory_addressing_is_enabled)
+#endif
+#ifdef CPU65_CONTEXT
+#ifdef DTV_CPU_HACK
+#	error "DTV_CPU_HACK and CPU65_CONTEXT are both defined. This is illegal currently."
+#endif
+#ifdef CPU_BLOCK_CACHE
+#	error "CPU_BLOCK_CACHE and CPU65_CONTEXT are both defined. This is illegal currently (the cache is per process)."
+#endif
+__thread struct cpu65_st *cpu65;	// the current CPU context of the thread, see cpu65c02.h
+#define cpu_cycles		(cpu65->cycles)
+#define last_p			(cpu65->last_p)
+#ifdef MEGA65
+#define cpu_previous_op		(cpu65->previous_op)
+#endif
+#ifdef CPU_IDLE_LOOP_DETECTION
+#define idle_head		(cpu65->loop_head)
+#define idle_branch		(cpu65->loop_branch)
+#define idle_body_cycles	(cpu65->loop_body_cycles)
+#define idle_matches		(cpu65->loop_matches)
+#define idle_sig		(cpu65->loop_sig)
+#endif
+#else
+Uint8 cpu_sp, cpu_op;
+#ifdef MEGA65
 Uint8 cpu_previous_op;
 #endif
 Uint16 cpu_pc, cpu_old_pc;
 int cpu_pfn,cpu_pfv,cpu_pfb,cpu_pfd,cpu_pfi,cpu_pfz,cpu_pfc;
 int cpu_irqLevel = 0, cpu_nmiEdge = 0;
 int cpu_cycles;
+static Uint8 last_p;
+#ifdef CPU_BLOCK_CACHE
+#ifndef CPU_65CE02
+#	error "CPU_BLOCK_CACHE needs CPU_65CE02 currently (instruction lengths are the 65CE02 ones)"
+#endif
+static const struct cpu_decoded_st *cpu_ins = NULL;
+#endif
+#ifdef CPU_IDLE_LOOP_DETECTION
+int cpu_idle_detection = 1;
+int cpu_idle_loop_cycles = 0;
+static int idle_head = -1, idle_branch = -1, idle_body_cycles, idle_matches;
+static Uint64 idle_sig;
+#endif
+#endif
 
 #ifdef CPU_65CE02
 #ifdef DEBUG_CPU
@@ -256,11 +298,61 @@ Uint8 cpu_get_p() {
 	(cpu_pfc ?   1 : 0);
 }
 
+#ifdef CPU65_CONTEXT
+// Like the NMOS 6502: the unmodified value is written back first, then the new one
+static void cpu65_default_write_rmw ( struct cpu65_st *cpu, Uint16 addr, Uint8 old_data, Uint8 new_data )
+{
+	cpu->write(cpu, addr, old_data);
+	cpu->write(cpu, addr, new_data);
+}
+
+#ifdef CPU_IDLE_LOOP_DETECTION
+// Nothing is known to be safe to read, so idle loops are never fast-forwarded
+static int cpu65_default_idle_safe_read ( struct cpu65_st *cpu, Uint16 addr )
+{
+	return 0;
+}
+#endif
+
+#ifdef CPU_TRAP
+// Not handled, the trap opcode is executed as a normal opcode then
+static int cpu65_default_trap ( struct cpu65_st *cpu, Uint8 opcode )
+{
+	return 0;
+}
+#endif
+
+/* Initializes a context with the power-on defaults. The emulator must set the
+   callbacks (at least read and write) afterwards, and select the context by
+   setting "cpu65" before calling cpu_reset(), cpu_step() and so on. */
+void cpu65_init_context ( struct cpu65_st *cpu )
+{
+	memset(cpu, 0, sizeof(struct cpu65_st));
+	cpu->write_rmw = cpu65_default_write_rmw;
+#ifdef CPU_TRAP
+	cpu->trap = cpu65_default_trap;
+#endif
+#ifdef CPU_IDLE_LOOP_DETECTION
+	cpu->idle_safe_read = cpu65_default_idle_safe_read;
+	cpu->idle_detection = 1;
+	cpu->loop_head = -1;
+	cpu->loop_branch = -1;
+#endif
+}
+#endif
+
 void cpu_reset() {
 	cpu_set_p(0x34);
 	cpu_sp = 0xFF;
 	cpu_irqLevel = cpu_nmiEdge = 0;
 	cpu_cycles = 0;
+#ifdef CPU_IDLE_LOOP_DETECTION
+	idle_head = -1;
+	cpu_idle_reset();
+#endif
+#ifdef CPU_BLOCK_CACHE
+	cpu_block_cache_flush();
+#endif
 #ifdef DTV_CPU_HACK
 	cpu_a_sind = 0;
 	cpu_a_tind = 0;
@@ -296,19 +388,184 @@ static inline void setNZ16(Uint16 st) {
 }
 #endif
 
-#define _imm() (cpu_pc++)
+#ifdef CPU_BLOCK_CACHE
+/* Pre-decoded basic-block cache. Instructions are decoded into blocks keyed by the "code address"
+   (given by cpu_code_address() of the emulator, ie the linear address) of the first opcode. An entry
+   holds the opcode, the following bytes, the pre-resolved 16 bit operand and the cycle count. A block
+   ends after a control flow instruction, or before an instruction which would cross a 256 byte page.
+   Blocks are chained: the last instruction of a block remembers the block found after it (both for
+   the fall-through and for the taken case), so no lookup is needed while the mapping is the same.
+   The dispatch is still the big switch of cpu_step(), the opcode is the "handler". Memory writes to
+   a page having cached code must be reported by the emulator with CPU_CODE_WRITE() (code bitmap), memory
+   configuration changes by cpu_block_cache_remap() and any other change of the memory content (ie,
+   loading) by cpu_block_cache_flush(). */
+#define BLOCK_MAX_INS		16
+#define BLOCK_SETS		256	// must be power of 2, blocks of a code page are always in the same set
+#define BLOCK_WAYS		16	// must be power of 2
+#define BLOCK_SLOT(code)	(((((code) >> 8) & (BLOCK_SETS - 1)) * BLOCK_WAYS) + (((code) ^ ((code) >> 4)) & (BLOCK_WAYS - 1)))
+
+struct cpu_decoded_st {
+	Uint16	pc;		// CPU address of the opcode, the entry is only used if PC is the same
+	Uint16	operand;	// pre-resolved operand (the two bytes after the opcode)
+	Uint8	op, cycles;
+	Uint8	bytes[4];	// the opcode and the following bytes
+};
+struct cpu_block_link_st {
+	struct cpu_block_st *blk;
+	int	code;		// code address the linked block had when linked (to detect if it's replaced since then)
+	Uint32	gen;		// memory configuration generation when linked
+};
+struct cpu_block_st {
+	int	code;		// code address of the first opcode, -1 if the slot is unused
+	int	num;		// number of decoded instructions
+	Uint16	end_pc;		// PC after the last instruction (to select the fall-through link)
+	struct cpu_block_link_st link[2];	// [0] = fall-through, [1] = anything else (taken branch, jump, etc)
+	struct cpu_decoded_st ins[BLOCK_MAX_INS];
+};
+
+static const Uint8 oplen[] = {1,2,1,1,2,2,2,2,1,2,1,1,3,3,3,3,2,2,2,3,2,2,2,2,1,3,1,1,3,3,3,3,3,2,3,3,2,2,2,2,1,2,1,1,3,3,3,3,2,2,2,3,2,2,2,2,1,3,1,1,3,3,3,3,1,2,1,1,2,2,2,2,1,2,1,1,3,3,3,3,2,2,2,3,2,2,2,2,1,3,1,1,1,3,3,3,1,2,2,3,2,2,2,2,1,2,1,1,3,3,3,3,2,2,2,3,2,2,2,2,1,3,1,1,3,3,3,3,2,2,2,3,2,2,2,2,1,2,1,3,3,3,3,3,2,2,2,3,2,2,2,2,1,3,1,3,3,3,3,3,2,2,2,2,2,2,2,2,1,2,1,3,3,3,3,3,2,2,2,3,2,2,2,2,1,3,1,3,3,3,3,3,2,2,2,2,2,2,2,2,1,2,1,3,3,3,3,3,2,2,2,3,2,2,2,2,1,3,1,1,3,3,3,3,2,2,2,2,2,2,2,2,1,2,1,3,3,3,3,3,2,2,2,3,3,2,2,2,1,3,1,1,3,3,3,3};
+
+Uint8 cpu_code_pages[(CPU_CODE_PAGES + 7) >> 3];
+static struct cpu_block_st blocks[BLOCK_SETS * BLOCK_WAYS];
+static struct cpu_block_st *cur_blk = NULL;
+static int cur_idx;
+static Uint32 map_gen = 0;
+
+static int block_ends ( Uint8 op )
+{
+	if ((op & 0x0F) == 0x0F || (op & 0x1F) == 0x10 || (op & 0x1F) == 0x13)
+		return 1;	// BBR/BBS, 8 and 16 bit relative branches
+	switch (op) {
+		case 0x00: case 0x20: case 0x22: case 0x23: case 0x40: case 0x4C:	// BRK, JSR, RTI, JMP
+		case 0x60: case 0x62: case 0x63: case 0x6C: case 0x7C: case 0x80:	// RTS, BSR, JMP, BRA
+		case 0x83:
+			return 1;
+	}
+	return 0;
+}
+
+static struct cpu_block_st *block_decode ( struct cpu_block_st *b, int code )
+{
+	Uint16 pc = cpu_pc;
+	b->num = 0;
+	while (b->num < BLOCK_MAX_INS && (pc & 0xFF) <= 0xFC) {	// all the four bytes must be in the same page
+		struct cpu_decoded_st *d = &b->ins[b->num++];
+		int a;
+		for (a = 0; a < 4; a++)
+			d->bytes[a] = cpu_read(pc + a);
+		d->pc = pc;
+		d->op = d->bytes[0];
+		d->cycles = opcycles[d->op];
+		d->operand = d->bytes[1] | (d->bytes[2] << 8);
+		pc += oplen[d->op];
+		if (block_ends(d->op))
+			break;
+	}
+	if (!b->num) {
+		b->code = -1;
+		return NULL;
+	}
+	b->code = code;
+	b->end_pc = pc;
+	b->link[0].blk = b->link[1].blk = NULL;
+	cpu_code_pages[code >> 11] |= 1 << ((code >> 8) & 7);
+	return b;
+}
+
+/* Returns the decoded instruction at the current PC, or NULL if it cannot be served from the cache. */
+static const struct cpu_decoded_st *block_next_ins ( void )
+{
+	struct cpu_block_st *b = cur_blk, *nb;
+	struct cpu_block_link_st *l = NULL;
+	int code;
+	if (likely(b)) {
+		if (cur_idx < b->num) {
+			if (likely(b->ins[cur_idx].pc == cpu_pc))
+				return &b->ins[cur_idx++];
+		} else {
+			l = &b->link[cpu_pc != b->end_pc];
+			nb = l->blk;
+			if (likely(nb && nb->code == l->code && l->gen == map_gen && nb->ins[0].pc == cpu_pc)) {
+				cur_blk = nb;
+				cur_idx = 1;
+				return &nb->ins[0];
+			}
+		}
+	}
+	code = (cpu_pc & 0xFF) <= 0xFC ? cpu_code_address(cpu_pc) : -1;	// see block_decode() about the page end
+	if (code < 0) {
+		cur_blk = NULL;
+		return NULL;
+	}
+	nb = &blocks[BLOCK_SLOT(code)];
+	if ((nb->code != code || nb->ins[0].pc != cpu_pc) && !block_decode(nb, code)) {
+		cur_blk = NULL;
+		return NULL;
+	}
+	if (l) {
+		l->blk = nb;
+		l->code = code;
+		l->gen = map_gen;
+	}
+	cur_blk = nb;
+	cur_idx = 1;
+	return &nb->ins[0];
+}
+
+void cpu_block_cache_invalidate ( int code )
+{
+	struct cpu_block_st *b = &blocks[BLOCK_SLOT(code & ~0xFF)];
+	int a, page = code >> 8;
+	cpu_code_pages[code >> 11] &= ~(1 << ((code >> 8) & 7));
+	for (a = 0; a < BLOCK_WAYS; a++, b++)
+		if (b->code >= 0 && (b->code >> 8) == page)
+			b->code = -1;
+	cur_blk = NULL;
+}
+
+void cpu_block_cache_remap ( void )
+{
+	map_gen++;
+	cur_blk = NULL;
+}
+
+void cpu_block_cache_flush ( void )
+{
+	int a;
+	for (a = 0; a < BLOCK_SETS * BLOCK_WAYS; a++)
+		blocks[a].code = -1;
+	memset(cpu_code_pages, 0, sizeof cpu_code_pages);
+	cpu_block_cache_remap();
+}
+
+// Fetching from the instruction stream (opcode operands), served by the decoded instruction if there is one
+#define CPU_FETCH()	(cpu_ins ? cpu_ins->bytes[(Uint16)(cpu_pc++ - cpu_old_pc) & 3] : cpu_read(cpu_pc++))
+#define CPU_PEEK(n)	(cpu_ins ? cpu_ins->bytes[(Uint16)(cpu_pc + (n) - cpu_old_pc) & 3] : cpu_read(cpu_pc + (n)))
+static inline Uint16 _abs() {
+	Uint16 o;
+	if (cpu_ins && cpu_pc == (Uint16)(cpu_old_pc + 1)) {
+		cpu_pc += 2;
+		return cpu_ins->operand;
+	}
+	o = cpu_read(cpu_pc++);
+	return o | (cpu_read(cpu_pc++) << 8);
+}
+#else
+#define CPU_FETCH()	cpu_read(cpu_pc++)
+#define CPU_PEEK(n)	cpu_read(cpu_pc + (n))
 static inline Uint16 _abs() {
 	Uint16 o = cpu_read(cpu_pc++);
 	return o | (cpu_read(cpu_pc++) << 8);
 }
+#endif
 #define _absx() ((Uint16)(_abs() + cpu_x))
 #define _absy() ((Uint16)(_abs() + cpu_y))
 #define _absi() readWord(_abs())
 #define _absxi() readWord(_absx())
-#define _zp() (cpu_read(cpu_pc++) | ZP_HI)
+#define _zp() (CPU_FETCH() | ZP_HI)
 
 static inline Uint16 _zpi() {
-	Uint8 a = cpu_read(cpu_pc++);
+	Uint8 a = CPU_FETCH();
 #ifdef CPU_65CE02
 	return (cpu_read(a | ZP_HI) | (cpu_read(((a + 1) & 0xFF) | ZP_HI) << 8)) + cpu_z;
 #else
@@ -317,27 +574,154 @@ static inline Uint16 _zpi() {
 }
 
 static inline Uint16 _zpiy() {
-	Uint8 a = cpu_read(cpu_pc++);
+	Uint8 a = CPU_FETCH();
 	return (cpu_read(a | ZP_HI) | (cpu_read(((a + 1) & 0xFF) | ZP_HI) << 8)) + cpu_y;
 }
 
 
-#define _zpx() (((cpu_read(cpu_pc++) + cpu_x) & 0xFF) | ZP_HI)
-#define _zpy() (((cpu_read(cpu_pc++) + cpu_y) & 0xFF) | ZP_HI)
+#define _zpx() (((CPU_FETCH() + cpu_x) & 0xFF) | ZP_HI)
+#define _zpy() (((CPU_FETCH() + cpu_y) & 0xFF) | ZP_HI)
 
 static inline Uint16 _zpxi() {
-	Uint8 a = cpu_read(cpu_pc++) + cpu_x;
+	Uint8 a = CPU_FETCH() + cpu_x;
 	return cpu_read(a | ZP_HI) | (cpu_read(((a + 1) & 0xFF) | ZP_HI) << 8);
 }
 
+#ifdef CPU_IDLE_LOOP_DETECTION
+/* Idle-loop detection. A short backward jumping loop, which only reads memory/IO
+   (no writes, no indexed/indirect addressing, no inner branches) and leaves the CPU
+   registers unchanged after an iteration, cannot do anything else but spinning until
+   an I/O device changes state. This is only true, if all the read addresses are
+   accepted by cpu_idle_safe_read() of the emulator: plain memory, or I/O registers
+   without side effects on read, which can only change at device events (so not, for
+   example, a free running timer counter or a read-to-clear interrupt register). When such a loop is found, cpu_idle_loop_cycles is
+   set to the cycles of one iteration, and the emulator main loop can fast-forward
+   the emulated time with whole iterations till its next device event, with the help
+   of cpu_idle_fast_forward(). The emulator must call cpu_idle_reset() at every point
+   where device state may change (ie, scanline boundaries) as the detection requires
+   IDLE_LOOP_MATCHES identical iterations since then. */
+#define IDLE_LOOP_MAX_SIZE	16
+#define IDLE_LOOP_MATCHES	2
+
+static Uint64 idle_signature ( void )
+{
+	return
+		(Uint64)CPU_A_GET() | ((Uint64)cpu_x << 8) | ((Uint64)cpu_y << 16) | ((Uint64)cpu_sp << 24) | ((Uint64)cpu_get_p() << 32)
+#ifdef CPU_65CE02
+		| ((Uint64)cpu_z << 40) | ((Uint64)(cpu_sphi >> 8) << 48) | ((Uint64)(cpu_bphi >> 8) << 56)
+#endif
+	;
+}
+
+/* Returns the sum of cycles of the loop body between the loop head and the jump,
+   or -1 if the body contains anything else than the allowed (side-effect free) opcodes. */
+static int idle_loop_body_cycles ( void )
+{
+	Uint16 pc = idle_head;
+	int cycles = 0;
+	while (pc != idle_branch) {
+		Uint8 op = cpu_read(pc);
+		int len, addr = -1;
+		switch (op) {
+			case 0xA9: case 0xA2: case 0xA0: case 0xC9: case 0xE0:	// LDA/LDX/LDY/CMP/CPX #imm
+			case 0xC0: case 0x29: case 0x09: case 0x49: case 0x89:	// CPY/AND/ORA/EOR/BIT #imm
+				len = 2;
+				break;
+			case 0xA5: case 0xA6: case 0xA4: case 0xC5: case 0xE4:	// ... and the same with zero page
+			case 0xC4: case 0x25: case 0x05: case 0x45: case 0x24:
+				addr = cpu_read(pc + 1) | ZP_HI;
+				len = 2;
+				break;
+			case 0xAD: case 0xAE: case 0xAC: case 0xCD: case 0xEC:	// ... and the same with absolute
+			case 0xCC: case 0x2D: case 0x0D: case 0x4D: case 0x2C:
+				addr = cpu_read(pc + 1) | (cpu_read(pc + 2) << 8);
+				len = 3;
+				break;
+			case 0xAA: case 0x8A: case 0xA8: case 0x98: case 0x18:	// TAX/TXA/TAY/TYA/CLC/SEC
+			case 0x38:
+				len = 1;
+				break;
+			default:
+				return -1;
+		}
+		if (((idle_branch - pc) & 0xFFFF) < len)
+			return -1;	// opcode would overlap the jump opcode
+		if (addr >= 0 && !cpu_idle_safe_read(addr))
+			return -1;	// reading this address may have side effects, or the value may change any time
+		cycles += opcycles[op];
+		pc += len;
+	}
+	return cycles;
+}
+
+/* Called when a short backward jump is taken: cpu_old_pc is the jump opcode, cpu_pc is the loop head. */
+static void idle_loop_check ( void )
+{
+	Uint64 sig = idle_signature();
+	if (cpu_pc != idle_head || cpu_old_pc != idle_branch) {
+		// new loop candidate
+		idle_head = cpu_pc;
+		idle_branch = cpu_old_pc;
+		idle_body_cycles = idle_loop_body_cycles();
+		idle_sig = sig;
+		idle_matches = 0;
+		return;
+	}
+	if (idle_body_cycles < 0)
+		return;
+	if (sig != idle_sig) {
+		idle_sig = sig;
+		idle_matches = 0;
+		return;
+	}
+	if (++idle_matches < IDLE_LOOP_MATCHES)
+		return;
+	if (cpu_nmiEdge || (cpu_irqLevel && !cpu_pfi)
+#ifdef CPU_65CE02
+		|| cpu_inhibit_interrupts
+#endif
+	)
+		return;
+	// re-check the body, in case of self-modifying code
+	if (idle_loop_body_cycles() != idle_body_cycles) {
+		idle_head = -1;
+		return;
+	}
+	cpu_idle_loop_cycles = idle_body_cycles + cpu_cycles;
+}
+
+#define IDLE_LOOP_CHECK() do { \
+	if (cpu_idle_detection && cpu_pc <= cpu_old_pc && cpu_old_pc - cpu_pc <= IDLE_LOOP_MAX_SIZE) \
+		idle_loop_check(); \
+} while (0)
+
+void cpu_idle_reset ( void )
+{
+	idle_matches = 0;
+	cpu_idle_loop_cycles = 0;
+}
+
+int cpu_idle_fast_forward ( int cycles_left )
+{
+	int loop_cycles = cpu_idle_loop_cycles;
+	cpu_idle_loop_cycles = 0;
+	if (cycles_left < loop_cycles)
+		return 0;
+	return cycles_left - cycles_left % loop_cycles;
+}
+#else
+#define IDLE_LOOP_CHECK()
+#endif
+
 static inline void _BRA(int cond) {
 	 if (cond) {
-		int temp = cpu_read(cpu_pc);
+		int temp = CPU_PEEK(0);
 		if (temp & 128) temp = cpu_pc - (temp ^ 0xFF);
 		else temp = cpu_pc + temp + 1;
 		if ((temp & 0xFF00) != (cpu_pc & 0xFF00)) cpu_cycles++;
 		cpu_pc = temp;
 		cpu_cycles++;
+		IDLE_LOOP_CHECK();
 	} else
 		cpu_pc++;
 }
@@ -352,7 +736,7 @@ static inline void _BRA16(int cond) {
 		if (temp & 0x8000) temp = 1 + cpu_pc - (temp ^ 0xFFFF);
 		else temp = cpu_pc + temp + 2;
 #endif
-		cpu_pc += 1 + (Sint16)(cpu_read(cpu_pc) | (cpu_read(cpu_pc + 1) << 8));
+		cpu_pc += 1 + (Sint16)(CPU_PEEK(0) | (CPU_PEEK(1) << 8));
 
 		//if ((temp & 0xFF00) != (cpu_pc & 0xFF00)) cpu_cycles++; // FIXME: sill applies in 16 bit relative mode as well?!
 		//cpu_pc = temp;
@@ -368,7 +752,7 @@ static inline void _BRA16(int cond) {
 static inline Uint16 _GET_SP_INDIRECT_ADDR ( void )
 {
 	int tmp2;
-	int tmp = cpu_sp + cpu_read(cpu_pc++);
+	int tmp = cpu_sp + CPU_FETCH();
 	if (cpu_pfe)		// FIXME: question #1: is E flag affects this addressing mode this way
 		tmp &= 0xFF;
 	tmp2 = cpu_read((cpu_sphi + tmp) & 0xFFFF);
@@ -491,10 +875,6 @@ static inline void _ROL(int addr) {
 }
 
 
-static Uint8 last_p;
-
-extern int   paused;
-
 int cpu_step () {
     
 	if (cpu_nmiEdge
@@ -538,7 +918,14 @@ int cpu_step () {
 #ifdef MEGA65
 	cpu_previous_op = cpu_op;
 #endif
-	cpu_op = cpu_read(cpu_pc++);
+#ifdef CPU_BLOCK_CACHE
+	cpu_ins = block_next_ins();
+	if (likely(cpu_ins)) {
+		cpu_op = cpu_ins->op;
+		cpu_pc++;
+	} else
+#endif
+		cpu_op = cpu_read(cpu_pc++);
 #ifdef DEBUG_CPU
 #ifdef CPU_65CE02
 	DEBUG("CPU: at $%04X opcode = $%02X %s %s A=%02X X=%02X Y=%02X Z=%02X SP=%02X" NL, (cpu_pc - 1) & 0xFFFF, cpu_op, opcode_names[cpu_op], opcode_adm_names[opcode_adms[cpu_op]],
@@ -560,7 +947,11 @@ int cpu_step () {
 			return ret;
 	}
 #endif
+#ifdef CPU_BLOCK_CACHE
+	cpu_cycles = cpu_ins ? cpu_ins->cycles : opcycles[cpu_op];
+#else
 	cpu_cycles = opcycles[cpu_op];
+#endif
 	switch (cpu_op) {
 	case 0x00:
 #ifdef DEBUG_CPU
@@ -594,7 +985,7 @@ int cpu_step () {
 	case 0x06:	_ASL(_zp()); break; /* 0x6 ASL Zero_Page */
 	case 0x07:	{ int a = _zp(); cpu_write(a, cpu_read(a) & 254);  } break; /* 0x7 RMB Zero_Page */
 	case 0x08:	push(cpu_get_p() | 0x10); break; /* 0x8 PHP Implied */
-	case 0x09:	setNZ(A_OP(|,cpu_read(_imm()))); break; /* 0x9 ORA Immediate */
+	case 0x09:	setNZ(A_OP(|,CPU_FETCH())); break; /* 0x9 ORA Immediate */
 	case 0x0a:	_ASL(-1); break; /* 0xa ASL Accumulator */
 	case 0x0b:
 #ifdef CPU_65CE02
@@ -671,7 +1062,7 @@ int cpu_step () {
 	case 0x28:
 			cpu_set_p(pop() | 0x10);
 			break; /* 0x28 PLP Implied */
-	case 0x29:	setNZ(A_OP(&,cpu_read(_imm()))); break; /* 0x29 AND Immediate */
+	case 0x29:	setNZ(A_OP(&,CPU_FETCH())); break; /* 0x29 AND Immediate */
 	case 0x2a:	_ROL(-1); break; /* 0x2a ROL Accumulator */
 	case 0x2b:
 #ifdef CPU_65CE02
@@ -763,7 +1154,7 @@ int cpu_step () {
 	case 0x46:	_LSR(_zp()); break; /* 0x46 LSR Zero_Page */
 	case 0x47:	{ int a = _zp(); cpu_write(a, cpu_read(a) & 239); } break; /* 0x47 RMB Zero_Page */
 	case 0x48:	push(CPU_A_GET()); break; /* 0x48 PHA Implied */
-	case 0x49:	setNZ(A_OP(^,cpu_read(_imm()))); break; /* 0x49 EOR Immediate */
+	case 0x49:	setNZ(A_OP(^,CPU_FETCH())); break; /* 0x49 EOR Immediate */
 	case 0x4a:	_LSR(-1); break; /* 0x4a LSR Accumulator */
 	case 0x4b:
 #ifdef CPU_65CE02
@@ -771,7 +1162,7 @@ int cpu_step () {
 			setNZ(cpu_z = cpu_a);	// 65CE02: TAZ
 #endif
 			break; /* 0x4b NOP (nonstd loc, implied) */
-	case 0x4c:	cpu_pc = _abs(); break; /* 0x4c JMP Absolute */
+	case 0x4c:	cpu_pc = _abs(); IDLE_LOOP_CHECK(); break; /* 0x4c JMP Absolute */
 	case 0x4d:	setNZ(A_OP(^,cpu_read(_abs()))); break; /* 0x4d EOR Absolute */
 	case 0x4e:	_LSR(_abs()); break; /* 0x4e LSR Absolute */
 	case 0x4f:	_BRA(!(cpu_read(_zp()) & 16)); break; /* 0x4f BBR Relative */
@@ -855,7 +1246,7 @@ int cpu_step () {
 	case 0x66:	_ROR(_zp()); break; /* 0x66 ROR Zero_Page */
 	case 0x67:	{ int a = _zp(); cpu_write(a, cpu_read(a) & 191); } break; /* 0x67 RMB Zero_Page */
 	case 0x68:	setNZ(CPU_A_SET(pop())); break; /* 0x68 PLA Implied */
-	case 0x69:	_ADC(cpu_read(_imm())); break; /* 0x69 ADC Immediate */
+	case 0x69:	_ADC(CPU_FETCH()); break; /* 0x69 ADC Immediate */
 	case 0x6a:	_ROR(-1); break; /* 0x6a ROR Accumulator */
 	case 0x6b:
 #ifdef CPU_65CE02
@@ -921,7 +1312,7 @@ int cpu_step () {
 	case 0x86:	cpu_write(_zp(), cpu_x); break; /* 0x86 STX Zero_Page */
 	case 0x87:	{ int a = _zp(); cpu_write(a, cpu_read(a) | 1); } break; /* 0x87 SMB Zero_Page */
 	case 0x88:	setNZ(--cpu_y); break; /* 0x88 DEY Implied */
-	case 0x89:	cpu_pfz = (!(CPU_A_GET() & cpu_read(_imm()))); break; /* 0x89 BIT+ Immediate */
+	case 0x89:	cpu_pfz = (!(CPU_A_GET() & CPU_FETCH())); break; /* 0x89 BIT+ Immediate */
 	case 0x8a:	setNZ(CPU_A_SET(cpu_x)); break; /* 0x8a TXA Implied */
 	case 0x8b:
 #ifdef CPU_65CE02
@@ -966,13 +1357,13 @@ int cpu_step () {
 	case 0x9d:	cpu_write(_absx(), CPU_A_GET()); break; /* 0x9d STA Absolute,X */
 	case 0x9e:	cpu_write(_absx(), ZERO_REG); break; /* 0x9e STZ Absolute,X */
 	case 0x9f:	_BRA( cpu_read(_zp()) & 2 ); break; /* 0x9f BBS Relative */
-	case 0xa0:	setNZ(cpu_y = cpu_read(_imm())); break; /* 0xa0 LDY Immediate */
+	case 0xa0:	setNZ(cpu_y = CPU_FETCH()); break; /* 0xa0 LDY Immediate */
 	case 0xa1:	setNZ(CPU_A_SET(cpu_read(_zpxi()))); break; /* 0xa1 LDA (Zero_Page,X) */
-	case 0xa2:	setNZ(cpu_x = cpu_read(_imm())); break; /* 0xa2 LDX Immediate */
+	case 0xa2:	setNZ(cpu_x = CPU_FETCH()); break; /* 0xa2 LDX Immediate */
 	case 0xa3:
 #ifdef CPU_65CE02
 			OPC_65CE02("LDZ #nn");
-			setNZ(cpu_z = cpu_read(_imm())); // LDZ #$nn             A3   65CE02
+			setNZ(cpu_z = CPU_FETCH()); // LDZ #$nn             A3   65CE02
 #endif
 			break; /* 0xa3 NOP (nonstd loc, implied) */
 	case 0xa4:	setNZ(cpu_y = cpu_read(_zp())); break; /* 0xa4 LDY Zero_Page */
@@ -980,7 +1371,7 @@ int cpu_step () {
 	case 0xa6:	setNZ(cpu_x = cpu_read(_zp())); break; /* 0xa6 LDX Zero_Page */
 	case 0xa7:	{ int a = _zp(); cpu_write(a, cpu_read(a) | 4); } break; /* 0xa7 SMB Zero_Page */
 	case 0xa8:	setNZ(cpu_y = CPU_A_GET()); break; /* 0xa8 TAY Implied */
-	case 0xa9:	setNZ(CPU_A_SET(cpu_read(_imm()))); break; /* 0xa9 LDA Immediate */
+	case 0xa9:	setNZ(CPU_A_SET(CPU_FETCH())); break; /* 0xa9 LDA Immediate */
 	case 0xaa:	setNZ(cpu_x = CPU_A_GET()); break; /* 0xaa TAX Implied */
 	case 0xab:
 #ifdef CPU_65CE02
@@ -1025,12 +1416,12 @@ int cpu_step () {
 	case 0xbd:	setNZ(CPU_A_SET(cpu_read(_absx()))); break; /* 0xbd LDA Absolute,X */
 	case 0xbe:	setNZ(cpu_x = cpu_read(_absy())); break; /* 0xbe LDX Absolute,Y */
 	case 0xbf:	_BRA( cpu_read(_zp()) & 8 ); break; /* 0xbf BBS Relative */
-	case 0xc0:	_CMP(cpu_y, cpu_read(_imm())); break; /* 0xc0 CPY Immediate */
+	case 0xc0:	_CMP(cpu_y, CPU_FETCH()); break; /* 0xc0 CPY Immediate */
 	case 0xc1:	_CMP(CPU_A_GET(), cpu_read(_zpxi())); break; /* 0xc1 CMP (Zero_Page,X) */
 	case 0xc2:
 #ifdef CPU_65CE02
 			OPC_65CE02("CPZ #nn");
-			_CMP(cpu_z, cpu_read(_imm()));	// 65CE02 CPZ #$nn
+			_CMP(cpu_z, CPU_FETCH());	// 65CE02 CPZ #$nn
 #else
 			cpu_pc++; // imm (non-std NOP with addr mode)
 #endif
@@ -1053,7 +1444,7 @@ int cpu_step () {
 	case 0xc6:	{ int addr = _zp(); Uint8 data = cpu_read(addr) - 1; setNZ(data); cpu_write(addr, data); } break; /* 0xc6 DEC Zero_Page */
 	case 0xc7:	{ int a = _zp(); cpu_write(a, cpu_read(a) | 16); } break; /* 0xc7 SMB Zero_Page */
 	case 0xc8:	setNZ(++cpu_y); break; /* 0xc8 INY Implied */
-	case 0xc9:	_CMP(CPU_A_GET(), cpu_read(_imm())); break; /* 0xc9 CMP Immediate */
+	case 0xc9:	_CMP(CPU_A_GET(), CPU_FETCH()); break; /* 0xc9 CMP Immediate */
 	case 0xca:	setNZ(--cpu_x); break; /* 0xca DEX Implied */
 	case 0xcb:
 #ifdef CPU_65CE02
@@ -1120,7 +1511,7 @@ int cpu_step () {
 	case 0xdd:	_CMP(CPU_A_GET(), cpu_read(_absx())); break; /* 0xdd CMP Absolute,X */
 	case 0xde:	{ int addr = _absx(); Uint8 data = cpu_read(addr) - 1; setNZ(data); cpu_write(addr, data); } break; /* 0xde DEC Absolute,X */
 	case 0xdf:	_BRA( cpu_read(_zp()) & 32 ); break; /* 0xdf BBS Relative */
-	case 0xe0:	_CMP(cpu_x, cpu_read(_imm())); break; /* 0xe0 CPX Immediate */
+	case 0xe0:	_CMP(cpu_x, CPU_FETCH()); break; /* 0xe0 CPX Immediate */
 	case 0xe1:	_SBC(cpu_read(_zpxi())); break; /* 0xe1 SBC (Zero_Page,X) */
 	case 0xe2:
 #ifdef CPU_65CE02
@@ -1152,7 +1543,7 @@ int cpu_step () {
 	case 0xe6:	{ int addr = _zp(); Uint8 data = cpu_read(addr) + 1; setNZ(data); cpu_write(addr, data); } break; /* 0xe6 INC Zero_Page */
 	case 0xe7:	{ int a = _zp(); cpu_write(a, cpu_read(a) | 64); } break; /* 0xe7 SMB Zero_Page */
 	case 0xe8:	setNZ(++cpu_x); break; /* 0xe8 INX Implied */
-	case 0xe9:	_SBC(cpu_read(_imm())); break; /* 0xe9 SBC Immediate */
+	case 0xe9:	_SBC(CPU_FETCH()); break; /* 0xe9 SBC Immediate */
 	case 0xea:
 #ifdef CPU_65CE02
 			// on 65CE02 it's not special, but in C65 (4510) it is (EOM). It's up the emulator though ...
@@ -1278,6 +1669,9 @@ int cpu_snapshot_load_state ( const struct xemu_snapshot_definition_st *def, str
 	if (buffer[0] != SNAPSHOT_CPU_ID)
 		RETURN_XSNAPERR_USER("CPU type mismatch");
 	cpu_pc = P_AS_BE16(buffer + 1);
+#ifdef CPU_BLOCK_CACHE
+	cpu_block_cache_flush();	// memory is (being) loaded as well
+#endif
 	cpu_a = buffer[3];
 	cpu_x = buffer[4];
 	cpu_y = buffer[5];
@@ -20,6 +20,112 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #ifndef __XEMU_COMMON_CPU65C02_H_INCLUDED
 #define __XEMU_COMMON_CPU65C02_H_INCLUDED
 
+#ifdef CPU65_CONTEXT
+/* Reentrant mode (define CPU65_CONTEXT in xemu-target.h or in CFLAGS): all CPU state
+   is in a context structure, and memory access goes through its function pointers, so
+   many CPUs can run in one process (ie: one per worker thread). The current context of
+   a thread is selected by setting "cpu65", the usual cpu_* names refer to the fields
+   of that, so code written for the single-instance mode works as-is.
+   Without CPU65_CONTEXT the state is in plain global variables, as it's faster. */
+struct cpu65_st {
+	Uint8  a, x, y, sp, op;
+	Uint16 pc, old_pc;
+	int    pfn, pfv, pfb, pfd, pfi, pfz, pfc;
+	int    irqLevel, nmiEdge;
+	int    cycles;
+	Uint8  last_p;
+#ifdef CPU_65CE02
+	int    pfe;
+	Uint8  z;
+	int    inhibit_interrupts;
+	Uint16 bphi;	// NOTE: it must store the value shifted to the high byte!
+	Uint16 sphi;	// NOTE: it must store the value shifted to the high byte!
+#endif
+#ifdef MEGA65
+	Uint8  previous_op;
+	int    linear_memory_addressing_is_enabled;
+#endif
+#ifdef CPU_IDLE_LOOP_DETECTION
+	int    idle_detection, idle_loop_cycles;
+	int    loop_head, loop_branch, loop_body_cycles, loop_matches;	// idle-loop detector state
+	Uint64 loop_sig;
+#endif
+	// Callbacks provided by the emulator, the same as the global functions in single-instance mode
+	Uint8 (*read)      ( struct cpu65_st *cpu, Uint16 addr );
+	void  (*write)     ( struct cpu65_st *cpu, Uint16 addr, Uint8 data );
+	void  (*write_rmw) ( struct cpu65_st *cpu, Uint16 addr, Uint8 old_data, Uint8 new_data );
+#ifdef MEGA65
+	Uint8 (*read_linear_opcode)  ( struct cpu65_st *cpu );
+	void  (*write_linear_opcode) ( struct cpu65_st *cpu, Uint8 data );
+#endif
+#ifdef CPU_TRAP
+	int   (*trap)      ( struct cpu65_st *cpu, Uint8 opcode );
+#endif
+#ifdef CPU_65CE02
+	void  (*do_aug)    ( struct cpu65_st *cpu );
+	void  (*do_nop)    ( struct cpu65_st *cpu );
+#endif
+#ifdef CPU_IDLE_LOOP_DETECTION
+	int   (*idle_safe_read) ( struct cpu65_st *cpu, Uint16 addr );
+#endif
+	void  *user;	// free for the emulator, ie to find its own machine instance from the callbacks
+};
+
+extern __thread struct cpu65_st *cpu65;
+
+extern void cpu65_init_context ( struct cpu65_st *cpu );
+
+#define cpu_irqLevel	(cpu65->irqLevel)
+#define cpu_nmiEdge	(cpu65->nmiEdge)
+#define cpu_pc		(cpu65->pc)
+#define cpu_old_pc	(cpu65->old_pc)
+#define cpu_op		(cpu65->op)
+#define cpu_a		(cpu65->a)
+#define cpu_x		(cpu65->x)
+#define cpu_y		(cpu65->y)
+#define cpu_sp		(cpu65->sp)
+#define cpu_pfn		(cpu65->pfn)
+#define cpu_pfv		(cpu65->pfv)
+#define cpu_pfb		(cpu65->pfb)
+#define cpu_pfd		(cpu65->pfd)
+#define cpu_pfi		(cpu65->pfi)
+#define cpu_pfz		(cpu65->pfz)
+#define cpu_pfc		(cpu65->pfc)
+#ifdef CPU_65CE02
+#define cpu_pfe		(cpu65->pfe)
+#define cpu_z		(cpu65->z)
+#define cpu_inhibit_interrupts	(cpu65->inhibit_interrupts)
+#define cpu_bphi	(cpu65->bphi)
+#define cpu_sphi	(cpu65->sphi)
+#endif
+#ifdef MEGA65
+#define cpu_linear_memory_addressing_is_enabled	(cpu65->linear_memory_addressing_is_enabled)
+#endif
+#ifdef CPU_IDLE_LOOP_DETECTION
+#define cpu_idle_detection	(cpu65->idle_detection)
+#define cpu_idle_loop_cycles	(cpu65->idle_loop_cycles)
+#endif
+
+#define cpu_write(addr,data)			cpu65->write(cpu65, addr, data)
+#define cpu_write_rmw(addr,old_data,new_data)	cpu65->write_rmw(cpu65, addr, old_data, new_data)
+#define cpu_read(addr)				cpu65->read(cpu65, addr)
+#ifdef MEGA65
+#define cpu_write_linear_opcode(data)		cpu65->write_linear_opcode(cpu65, data)
+#define cpu_read_linear_opcode()		cpu65->read_linear_opcode(cpu65)
+#endif
+#ifdef CPU_TRAP
+#define cpu_trap(opcode)			cpu65->trap(cpu65, opcode)
+#endif
+#ifdef CPU_65CE02
+#define cpu_do_aug()				cpu65->do_aug(cpu65)
+#define cpu_do_nop()				cpu65->do_nop(cpu65)
+#endif
+#ifdef CPU_IDLE_LOOP_DETECTION
+#define cpu_idle_safe_read(addr)		cpu65->idle_safe_read(cpu65, addr)
+#endif
+
+#else
+
 extern int cpu_irqLevel;
 extern int cpu_nmiEdge;
 
@@ -47,9 +153,6 @@ extern void  cpu_write_linear_opcode ( Uint8 data );
 extern Uint8 cpu_read_linear_opcode  ( void );
 #endif
 
-extern void cpu_reset ( void );
-extern int  cpu_step  ( void );
-
 #ifdef CPU_TRAP
 extern int  cpu_trap ( Uint8 opcode );
 #endif
@@ -57,6 +160,36 @@ extern int  cpu_trap ( Uint8 opcode );
 extern void cpu_do_aug ( void );
 extern void cpu_do_nop ( void );
 #endif
+#ifdef CPU_IDLE_LOOP_DETECTION
+extern int  cpu_idle_detection;
+extern int  cpu_idle_loop_cycles;
+extern int  cpu_idle_safe_read ( Uint16 addr );	// must be provided by the emulator
+#endif
+
+#endif
+
+extern void cpu_reset ( void );
+extern int  cpu_step  ( void );
+
+#ifdef CPU_BLOCK_CACHE
+// The emulator must define CPU_CODE_PAGES (number of 256 byte pages of the code address space), and provide
+// cpu_code_address() which gives the code address for a CPU address, or -1 if the code there cannot be cached.
+extern Uint8 cpu_code_pages[];
+extern int  cpu_code_address ( Uint16 addr );
+extern void cpu_block_cache_invalidate ( int code );
+extern void cpu_block_cache_remap ( void );
+extern void cpu_block_cache_flush ( void );
+// Must be used by the emulator on every memory write, with the code address of the written byte
+#define CPU_CODE_WRITE(code) do { \
+	if (unlikely(cpu_code_pages[(code) >> 11] & (1 << (((code) >> 8) & 7)))) \
+		cpu_block_cache_invalidate(code); \
+} while (0)
+#endif
+
+#ifdef CPU_IDLE_LOOP_DETECTION
+extern void cpu_idle_reset ( void );
+extern int  cpu_idle_fast_forward ( int cycles_left );
+#endif
 
 extern void  cpu_set_p  ( Uint8 st );
 extern Uint8 cpu_get_p ( void );
@@ -0,0 +1,257 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+/* Errors are reported by the return value (and DEBUGPRINT), the caller should
+   notify the user. */
+
+#include "xemu/emutools_basicdefs.h"
+#include "xemu/disk_overlay.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#define fsync _commit
+#endif
+
+#define HEADER_SIZE	DISK_OVERLAY_SECTOR_SIZE
+
+
+static int overlay_io ( int fd, off_t offset, void *buffer, int size, int is_write )
+{
+	int ret;
+	if (lseek(fd, offset, SEEK_SET) != offset)
+		return -1;
+	ret = is_write ? write(fd, buffer, size) : read(fd, buffer, size);
+	return ret == size ? 0 : -1;
+}
+
+
+static void put_be64 ( Uint8 *p, Uint64 v )
+{
+	int a;
+	for (a = 7; a >= 0; a--, v >>= 8)
+		p[a] = v & 0xFF;
+}
+
+
+static Uint64 get_be64 ( const Uint8 *p )
+{
+	Uint64 v = 0;
+	int a;
+	for (a = 0; a < 8; a++)
+		v = (v << 8) | p[a];
+	return v;
+}
+
+
+/* Opens (or creates, if it does not exist yet) the delta file "fn" for a base image
+   of "image_size" bytes. Returns 0 if OK, -1 on error (ov->fd is -1 then). */
+int disk_overlay_open ( struct disk_overlay_st *ov, const char *fn, off_t image_size )
+{
+	Uint8 header[HEADER_SIZE];
+	int bitmap_size = (image_size / DISK_OVERLAY_SECTOR_SIZE + 7) >> 3;
+	bitmap_size = (bitmap_size + DISK_OVERLAY_SECTOR_SIZE - 1) & ~(DISK_OVERLAY_SECTOR_SIZE - 1);
+	ov->fd = -1;
+	ov->bitmap = NULL;
+	ov->image_size = image_size;
+	ov->data_offset = HEADER_SIZE + bitmap_size;
+	if (image_size % DISK_OVERLAY_SECTOR_SIZE) {
+		DEBUGPRINT("OVERLAY: image size is not multiple of %d bytes, cannot use overlay" NL, DISK_OVERLAY_SECTOR_SIZE);
+		return -1;
+	}
+	ov->bitmap = calloc(1, bitmap_size);
+	if (!ov->bitmap) {
+		DEBUGPRINT("OVERLAY: cannot allocate memory for the sector bitmap" NL);
+		return -1;
+	}
+	ov->fd = open(fn, O_RDWR | O_BINARY);
+	if (ov->fd >= 0) {
+		if (overlay_io(ov->fd, 0, header, HEADER_SIZE, 0) || memcmp(header, DISK_OVERLAY_MAGIC, 8) || header[8] != DISK_OVERLAY_VERSION) {
+			DEBUGPRINT("OVERLAY: delta file %s is not valid" NL, fn);
+			goto error;
+		}
+		if ((off_t)get_be64(header + 16) != image_size) {
+			DEBUGPRINT("OVERLAY: delta file %s belongs to an image with different size" NL, fn);
+			goto error;
+		}
+		if (overlay_io(ov->fd, HEADER_SIZE, ov->bitmap, bitmap_size, 0)) {
+			DEBUGPRINT("OVERLAY: cannot read sector bitmap of delta file %s: %s" NL, fn, strerror(errno));
+			goto error;
+		}
+		DEBUGPRINT("OVERLAY: using existing delta file %s" NL, fn);
+		return 0;
+	}
+	ov->fd = open(fn, O_RDWR | O_CREAT | O_EXCL | O_BINARY, 0666);
+	if (ov->fd < 0) {
+		DEBUGPRINT("OVERLAY: cannot create delta file %s: %s" NL, fn, strerror(errno));
+		goto error;
+	}
+	memset(header, 0, sizeof header);
+	memcpy(header, DISK_OVERLAY_MAGIC, 8);
+	header[8] = DISK_OVERLAY_VERSION;
+	header[9] = DISK_OVERLAY_SECTOR_SIZE >> 8;
+	put_be64(header + 16, image_size);
+	put_be64(header + 24, ov->data_offset);
+	if (overlay_io(ov->fd, 0, header, HEADER_SIZE, 1) || overlay_io(ov->fd, HEADER_SIZE, ov->bitmap, bitmap_size, 1)) {
+		DEBUGPRINT("OVERLAY: cannot initialize delta file %s: %s" NL, fn, strerror(errno));
+		goto error;
+	}
+	DEBUGPRINT("OVERLAY: created new delta file %s" NL, fn);
+	return 0;
+error:
+	disk_overlay_close(ov);
+	return -1;
+}
+
+
+void disk_overlay_close ( struct disk_overlay_st *ov )
+{
+	if (ov->fd >= 0)
+		close(ov->fd);
+	ov->fd = -1;
+	free(ov->bitmap);
+	ov->bitmap = NULL;
+}
+
+
+/* Reads a sector at the given image offset, from the delta file if it has the sector,
+   otherwise from base_fd. Returns 0 if OK, -1 on error. */
+int disk_overlay_read ( struct disk_overlay_st *ov, int base_fd, off_t offset, Uint8 *buffer )
+{
+	if (offset < 0 || offset > ov->image_size - DISK_OVERLAY_SECTOR_SIZE || (offset % DISK_OVERLAY_SECTOR_SIZE))
+		return -1;
+	if (disk_overlay_has_sector(ov, offset))
+		return overlay_io(ov->fd, ov->data_offset + offset, buffer, DISK_OVERLAY_SECTOR_SIZE, 0);
+	return overlay_io(base_fd, offset, buffer, DISK_OVERLAY_SECTOR_SIZE, 0);
+}
+
+
+/* Writes a sector at the given image offset into the delta file.
+   For a sector not yet in the delta file, the data is written and fsync()'ed
+   first, and the bitmap is updated only after that, so an interrupted write
+   (even a power loss) cannot make a sector with undefined content visible. */
+int disk_overlay_write ( struct disk_overlay_st *ov, off_t offset, const Uint8 *buffer )
+{
+	int byte;
+	if (offset < 0 || offset > ov->image_size - DISK_OVERLAY_SECTOR_SIZE || (offset % DISK_OVERLAY_SECTOR_SIZE))
+		return -1;
+	if (overlay_io(ov->fd, ov->data_offset + offset, (void*)buffer, DISK_OVERLAY_SECTOR_SIZE, 1)) {
+		DEBUGPRINT("OVERLAY: cannot write delta file: %s" NL, strerror(errno));
+		return -1;
+	}
+	if (disk_overlay_has_sector(ov, offset))
+		return 0;
+	if (fsync(ov->fd)) {
+		DEBUGPRINT("OVERLAY: cannot sync delta file: %s" NL, strerror(errno));
+		return -1;
+	}
+	byte = (offset / DISK_OVERLAY_SECTOR_SIZE) >> 3;
+	ov->bitmap[byte] |= 1 << ((offset / DISK_OVERLAY_SECTOR_SIZE) & 7);
+	if (overlay_io(ov->fd, HEADER_SIZE + byte, ov->bitmap + byte, 1, 1)) {
+		DEBUGPRINT("OVERLAY: cannot update sector bitmap of delta file: %s" NL, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+/* Sets up the delayed write-back of the given image, the dirty bitmap is allocated here.
+   Returns 0 if OK, -1 on error (out of memory). */
+int disk_writeback_init ( struct disk_writeback_st *wb, const char *name, Uint8 *image, int sectors, int flush_frames, int fd, struct disk_overlay_st *ov )
+{
+	wb->image = image;
+	wb->dirty_map = calloc(1, (sectors + 7) >> 3);
+	wb->sectors = wb->dirty_map ? sectors : 0;
+	wb->flush_frames = flush_frames;
+	wb->dirty_frames = -1;
+	wb->write_error = 0;
+	wb->fd = fd;
+	wb->overlay = ov;
+	wb->name = name;
+	return wb->dirty_map ? 0 : -1;
+}
+
+
+/* Forgets the not yet written back sectors, call disk_writeback_flush() first if they're needed. */
+void disk_writeback_free ( struct disk_writeback_st *wb )
+{
+	free(wb->dirty_map);
+	wb->dirty_map = NULL;
+	wb->sectors = 0;
+	wb->dirty_frames = -1;
+	wb->write_error = 0;
+}
+
+
+static int write_back_sectors ( struct disk_writeback_st *wb, int sector, int count )
+{
+	off_t offset = (off_t)sector * DISK_OVERLAY_SECTOR_SIZE;
+	if (wb->overlay && wb->overlay->fd >= 0) {
+		for (; count; count--, offset += DISK_OVERLAY_SECTOR_SIZE)
+			if (disk_overlay_write(wb->overlay, offset, wb->image + offset))
+				return -1;
+		return 0;
+	}
+	if (lseek(wb->fd, offset, SEEK_SET) != offset)
+		return -1;
+	return write(wb->fd, wb->image + offset, count * DISK_OVERLAY_SECTOR_SIZE) == count * DISK_OVERLAY_SECTOR_SIZE ? 0 : -1;
+}
+
+
+/* Writes back the dirty sectors. Returns 1 if it failed for the first time (errno is
+   valid then), so the caller should warn the user, otherwise 0: nothing to do, done,
+   or failed again (write-back is retried after flush_frames frames in these cases). */
+int disk_writeback_flush ( struct disk_writeback_st *wb )
+{
+	int sector = 0;
+	if (wb->dirty_frames < 0)
+		return 0;
+	while (sector < wb->sectors) {
+		int count = 0;
+		while (sector + count < wb->sectors && (wb->dirty_map[(sector + count) >> 3] & (1 << ((sector + count) & 7))))
+			count++;
+		if (count) {
+			if (write_back_sectors(wb, sector, count)) {
+				wb->dirty_frames = 0;	// retry later
+				if (!wb->write_error) {
+					wb->write_error = 1;
+					return 1;
+				}
+				DEBUG("%s: cannot write back modified sectors (still): %s" NL, wb->name, strerror(errno));
+				return 0;
+			}
+			while (count--) {
+				wb->dirty_map[sector >> 3] &= ~(1 << (sector & 7));
+				sector++;
+			}
+		} else
+			sector++;
+	}
+	if (wb->write_error) {
+		DEBUGPRINT("%s: modified sectors could be written back finally" NL, wb->name);
+		wb->write_error = 0;
+	} else
+		DEBUG("%s: modified sectors have been written back" NL, wb->name);
+	wb->dirty_frames = -1;
+	return 0;
+}
@@ -0,0 +1,92 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __XEMU_COMMON_DISK_OVERLAY_H_INCLUDED
+#define __XEMU_COMMON_DISK_OVERLAY_H_INCLUDED
+
+#include <sys/types.h>
+
+/* Copy-on-write overlay for disk images: the base image is only read, written
+   sectors go into a delta file instead, which can be committed into the base
+   image or simply deleted later (see build/xemu-overlay.py).
+   Delta file layout: 512 bytes header, sector bitmap (padded to 512 bytes), then
+   the data area where a sector is stored at the same offset as in the image, so
+   the delta file is sparse on most host file systems. */
+
+#define DISK_OVERLAY_SECTOR_SIZE	512
+#define DISK_OVERLAY_MAGIC		"XEMU-OVL"
+#define DISK_OVERLAY_VERSION		1
+
+struct disk_overlay_st {
+	int    fd;		// file descriptor of the delta file, -1 if there is no overlay in use
+	off_t  image_size;
+	off_t  data_offset;	// offset of the data area in the delta file
+	Uint8 *bitmap;		// one bit per sector, set if the sector is stored in the delta file
+};
+
+extern int  disk_overlay_open  ( struct disk_overlay_st *ov, const char *fn, off_t image_size );
+extern void disk_overlay_close ( struct disk_overlay_st *ov );
+extern int  disk_overlay_read  ( struct disk_overlay_st *ov, int base_fd, off_t offset, Uint8 *buffer );
+extern int  disk_overlay_write ( struct disk_overlay_st *ov, off_t offset, const Uint8 *buffer );
+
+static inline int disk_overlay_has_sector ( struct disk_overlay_st *ov, off_t offset )
+{
+	offset /= DISK_OVERLAY_SECTOR_SIZE;
+	return ov->bitmap[offset >> 3] & (1 << (offset & 7));
+}
+
+/* Delayed write-back of an in-memory disk image: the emulator keeps the whole image
+   in memory, and only marks the written sectors with disk_writeback_mark(). They are
+   written back to the image file (or into the overlay, if it is in use) in runs of
+   consecutive sectors by disk_writeback_flush(), which is called by disk_writeback_update()
+   flush_frames frames after the first unflushed write, and should be called by the
+   emulator too, before the image is closed. A failed write-back is retried later. */
+
+struct disk_writeback_st {
+	Uint8 *image;		// the whole disk image in memory, owned by the caller
+	Uint8 *dirty_map;	// one bit per sector, set if the sector is not yet written back
+	int    sectors;
+	int    flush_frames;
+	int    dirty_frames;	// frames since the first unflushed write, -1 if nothing is dirty
+	int    write_error;	// write-back failed, the user has been warned already, we only retry silently
+	int    fd;		// image file, used if there is no overlay in use
+	struct disk_overlay_st *overlay;
+	const char *name;	// prefix for debug messages
+};
+
+extern int  disk_writeback_init  ( struct disk_writeback_st *wb, const char *name, Uint8 *image, int sectors, int flush_frames, int fd, struct disk_overlay_st *ov );
+extern void disk_writeback_free  ( struct disk_writeback_st *wb );
+extern int  disk_writeback_flush ( struct disk_writeback_st *wb );
+
+static inline void disk_writeback_mark ( struct disk_writeback_st *wb, int sector )
+{
+	wb->dirty_map[sector >> 3] |= 1 << (sector & 7);
+	if (wb->dirty_frames < 0)
+		wb->dirty_frames = 0;
+}
+
+// Call it on every frame. Returns with the same value as disk_writeback_flush()
+static inline int disk_writeback_update ( struct disk_writeback_st *wb )
+{
+	if (wb->dirty_frames >= 0 && ++wb->dirty_frames >= wb->flush_frames)
+		return disk_writeback_flush(wb);
+	return 0;
+}
+
+#endif
@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 
 #include "xemu/emutools.h"
+#include "xemu/input_record.h"
 
 #include <string.h>
 #include <sys/types.h>
@@ -30,8 +31,17 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include <time.h>
 #include <limits.h>
 #include <errno.h>
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#include <sched.h>
+#endif
 
 #include "xemu/osd_font_16x16.c"
+/* The timekeeping helpers below are not compiled on their own, but #include'd
+   here, and also by Xep128 (targets/ep128/main.c), as it has its own
+   timekeeping. Include each of them only once per target! */
+#include "xemu/emutools_audiopace.c"
+#include "xemu/emutools_metrics.c"
+#include "xemu/emutools_bench.c"
 
 
 SDL_Window   *sdl_win = NULL;
@@ -55,10 +65,17 @@ static char *window_title_buffer, *window_title_buffer_end;
 static time_t unix_time;
 static Uint64 et_old;
 static int td_balancer, td_em_ALL, td_pc_ALL;
+static int precise_timing = 0, precise_margin = PRECISE_MARGIN_DEFAULT;
+static Uint64 precise_deadline, perf_freq;
+static int jitter_frames, jitter_sum, jitter_max;
+struct emu_timing_stats_st emu_timing_stats;
 FILE *debug_fp = NULL;
 
 
 static int osd_enabled = 0, osd_status = 0, osd_available = 0, osd_xsize, osd_ysize, osd_fade_dec, osd_fade_end, osd_alpha_last;
+// Row ranges (y0 inclusive, y1 exclusive, empty if y0 >= y1) of the OSD pixel buffer: "dirty" is
+// not uploaded into the texture yet, "ink" may have non-zero pixels since the last osd_clear()
+static int osd_dirty_y0, osd_dirty_y1, osd_ink_y0, osd_ink_y1;
 static Uint32 osd_colours[16], *osd_pixels = NULL, osd_colour_fg, osd_colour_bg;
 static SDL_Texture *sdl_osdtex = NULL;
 
@@ -304,6 +321,69 @@ static inline void do_sleep ( int td )
 
 
 
+/* High precision pacing: we sleep only till "precise_margin" microseconds before
+   the deadline, and do the rest by spinning on the performance counter (with
+   yielding the CPU to other tasks meanwhile). The margin is auto-calibrated by
+   the measured oversleeping of the OS sleep function. Deadlines are absolute
+   ones (accumulated by the emulated time), so no balancer is needed with this
+   method, unlike the default one. */
+static void precise_sleep ( int td_em )
+{
+	Uint64 now = SDL_GetPerformanceCounter();
+	Sint64 remaining;
+	precise_deadline += (Uint64)td_em * perf_freq / 1000000UL;
+	remaining = (Sint64)(precise_deadline - now);
+	if (remaining < -(Sint64)(perf_freq / 10)) {
+		// more than 0.1 sec behind: emulation is too slow or it was stopped for some reason, resync
+		precise_deadline = now;
+		return;
+	}
+	remaining = remaining * 1000000 / (Sint64)perf_freq;	// remaining time in microseconds from now
+	if (remaining > precise_margin) {
+		int want = remaining - precise_margin;
+		int overshoot;
+		do_sleep(want);
+		overshoot = (int)((SDL_GetPerformanceCounter() - now) * 1000000UL / perf_freq) - want;
+		if (overshoot + PRECISE_MARGIN_HEADROOM > precise_margin)
+			precise_margin = overshoot + PRECISE_MARGIN_HEADROOM;	// grow fast
+		else
+			precise_margin -= (precise_margin - overshoot - PRECISE_MARGIN_HEADROOM) >> 4;	// shrink slowly
+		if (precise_margin > PRECISE_MARGIN_MAX)
+			precise_margin = PRECISE_MARGIN_MAX;
+		else if (precise_margin < PRECISE_MARGIN_HEADROOM)
+			precise_margin = PRECISE_MARGIN_HEADROOM;
+	}
+	while ((Sint64)(precise_deadline - SDL_GetPerformanceCounter()) > 0) {
+#ifdef _WIN32
+		SDL_Delay(0);
+#else
+		sched_yield();
+#endif
+	}
+}
+
+
+
+/* Turns high precision pacing on (non-zero) or off (zero). See precise_sleep() above. */
+void emu_set_precise_timing ( int enable )
+{
+#ifdef __EMSCRIPTEN__
+	if (enable)
+		DEBUGPRINT("TIMING: precise timing is not supported on this platform." NL);
+#else
+	enable = !!enable;
+	if (enable == precise_timing)
+		return;
+	precise_timing = enable;
+	precise_margin = PRECISE_MARGIN_DEFAULT;
+	perf_freq = SDL_GetPerformanceFrequency();
+	// no need to reset the deadline: precise_sleep() resyncs itself if it's too much behind
+	DEBUGPRINT("TIMING: precise timing is %s." NL, precise_timing ? "enabled" : "disabled");
+#endif
+}
+
+
+
 /* Should be called regularly (eg on each screen global update), this function
    tries to keep the emulation speed near to real-time of the emulated machine.
    It's assumed that this function is called at least at every 0.1 sec or even
@@ -313,27 +393,74 @@ static inline void do_sleep ( int td )
    machine to do the task, since the last call of this function! */
 void emu_timekeeping_delay ( int td_em )
 {
-	int td, td_pc;
+	int td, td_pc, paced;
 	time_t old_unix_time = unix_time;
 	Uint64 et_new;
+	if (unlikely(emu_bench_active)) {	// no sleeping, and the host clock is driven by the emulated time
+		seconds_timer_trigger = emu_bench_frame(td_em);
+		if (seconds_timer_trigger)
+			unix_time++;
+		EMU_METRICS_FRAME(td_em);
+		return;
+	}
 	td_pc = get_elapsed_time(et_old, &et_new, NULL);	// get realtime since last call in microseconds
-	if (td_pc < 0) return; // time goes backwards? maybe time was modified on the host computer. Skip this delay cycle
-	td = td_em - td_pc; // the time difference (+X = emu is faster (than emulated machine) - real time emulation, -X = emu is slower - real time emulation is not possible)
-	td_balancer += td;
-	if (td_balancer > 0)
-		do_sleep(td_balancer);
+	if (td_pc < 0) { // time goes backwards? maybe time was modified on the host computer. Skip this delay cycle
+		if (unlikely(inputrec_mode)) {	// the emulated clock must go on though
+			inputrec_clock(td_em, &unix_time);
+			seconds_timer_trigger = (unix_time != old_unix_time);
+		}
+		EMU_METRICS_FRAME(td_em);
+		return;
+	}
+	EMU_BENCH_SECTION(EMU_BENCH_SLEEP);
+	paced = audiopace_enabled && !audiopace_wait(td_em);
+	if (paced)
+		td_balancer = 0;	// paced by the audio clock, we don't need wall-clock sleeping and balancing
+	else if (precise_timing)
+		precise_sleep(td_em);
+	else {
+		td = td_em - td_pc; // the time difference (+X = emu is faster (than emulated machine) - real time emulation, -X = emu is slower - real time emulation is not possible)
+		td_balancer += td;
+		if (td_balancer > 0)
+			do_sleep(td_balancer);
+	}
 	/* Purpose:
 	 * get the real time spent sleeping (sleep is not an exact science on a multitask OS)
 	 * also this will get the starter time for the next frame
 	 */
 	// calculate real time slept
-	td = get_elapsed_time(et_new, &et_old, &unix_time);
+	td = get_elapsed_time(et_new, &et_old, unlikely(inputrec_mode) ? NULL : &unix_time);
+	if (unlikely(inputrec_mode))
+		inputrec_clock(td_em, &unix_time);
+	EMU_METRICS_FRAME(td_em);
+	// frame time jitter: the difference of the real frame time (emulation + sleep) and the wanted one
+	if (td >= 0) {
+		int jitter = abs(td_pc + td - td_em);
+		jitter_frames++;
+		jitter_sum += jitter;
+		if (jitter > jitter_max)
+			jitter_max = jitter;
+	}
 	seconds_timer_trigger = (unix_time != old_unix_time);
 	if (seconds_timer_trigger) {
-		snprintf(window_title_buffer_end, 32, "  [%d%%] %s",
-			td_em_ALL ? (td_pc_ALL * 100 / td_em_ALL) : -1,
-			window_title_custom_addon ? window_title_custom_addon : "running"
-		);
+		emu_timing_stats.frames = jitter_frames;
+		emu_timing_stats.jitter_avg = jitter_frames ? jitter_sum / jitter_frames : 0;
+		emu_timing_stats.jitter_max = jitter_max;
+		emu_timing_stats.wakeup_margin = precise_timing ? precise_margin : 0;
+		jitter_frames = 0;
+		jitter_sum = 0;
+		jitter_max = 0;
+		if (precise_timing)
+			snprintf(window_title_buffer_end, 64, "  [%d%%] [jitter %d/%dus] %s",
+				td_em_ALL ? (td_pc_ALL * 100 / td_em_ALL) : -1,
+				emu_timing_stats.jitter_avg, emu_timing_stats.jitter_max,
+				window_title_custom_addon ? window_title_custom_addon : "running"
+			);
+		else
+			snprintf(window_title_buffer_end, 32, "  [%d%%] %s",
+				td_em_ALL ? (td_pc_ALL * 100 / td_em_ALL) : -1,
+				window_title_custom_addon ? window_title_custom_addon : "running"
+			);
 		SDL_SetWindowTitle(sdl_win, window_title_buffer);
 		td_pc_ALL = td_pc;
 		td_em_ALL = td_em;
@@ -341,7 +468,7 @@ void emu_timekeeping_delay ( int td_em )
 		td_pc_ALL += td_pc;
 		td_em_ALL += td_em;
 	}
-	if (td < 0) return; // invalid, sleep was about for _minus_ time? eh, give me that time machine, dude! :)
+	if (td < 0 || precise_timing || paced) return; // invalid, sleep was about for _minus_ time? eh, give me that time machine, dude! :) Or: precise/audio timing does not need the balancer
 	// Balancing real and wanted sleep time on long run
 	// Insane big values are forgotten, maybe emulator was stopped, or something like that
 	td_balancer -= td;
@@ -363,7 +490,9 @@ static void shutdown_emulator ( void )
 	if (sdl_win)
 		SDL_DestroyWindow(sdl_win);
 	SDL_Quit();
+	emu_metrics_close();
 	if (debug_fp) {
+		xemu_log_stop();
 		fclose(debug_fp);
 		debug_fp = NULL;
 	}
@@ -388,6 +517,7 @@ int emu_init_debug ( const char *fn )
 		}
 		DEBUGPRINT("Logging into file: %s (fd=%d)." NL, fn, fileno(debug_fp));
 		xemu_dump_version(debug_fp, NULL);
+		xemu_log_start();
 		return 0;
 	}
 #endif
@@ -542,7 +672,10 @@ int emu_init_sdl (
 // this is just for the time keeping stuff, to avoid very insane values (ie, years since the last update for the first call ...)
 void emu_timekeeping_start ( void )
 {
-	(void)get_elapsed_time(0, &et_old, &unix_time);
+	(void)get_elapsed_time(0, &et_old, unlikely(inputrec_mode) ? NULL : &unix_time);
+	if (unlikely(inputrec_mode))
+		inputrec_clock(0, &unix_time);
+	precise_deadline = SDL_GetPerformanceCounter();
 	td_balancer = 0;
 	td_em_ALL = 0;
 	td_pc_ALL = 0;
@@ -601,6 +734,7 @@ Uint32 *emu_start_pixel_buffer_access ( int *texture_tail )
    texture method! */
 void emu_update_screen ( void )
 {
+	EMU_BENCH_SECTION(EMU_BENCH_PRESENT);
 	if (sdl_pixel_buffer)
 		SDL_UpdateTexture(sdl_tex, NULL, sdl_pixel_buffer, texture_x_size_in_bytes);
 	else
@@ -620,24 +754,44 @@ void emu_update_screen ( void )
 				osd_alpha_last = alpha;
 				SDL_SetTextureAlphaMod(sdl_osdtex, alpha);
 			}
-			SDL_RenderCopy(sdl_ren, sdl_osdtex, NULL, NULL);
+			if (alpha && osd_ink_y0 < osd_ink_y1)	// fully transparent or empty OSD: no need to blend the whole texture
+				SDL_RenderCopy(sdl_ren, sdl_osdtex, NULL, NULL);
 		}
 	}
 	SDL_RenderPresent(sdl_ren);
 }
 
 
+static void osd_mark_dirty ( int y0, int y1 )
+{
+	if (y0 < osd_dirty_y0)
+		osd_dirty_y0 = y0 < 0 ? 0 : y0;
+	if (y1 > osd_dirty_y1)
+		osd_dirty_y1 = y1 > osd_ysize ? osd_ysize : y1;
+}
+
+
+// Only the rows written since the last clear are cleared (and uploaded by osd_update() then)
 void osd_clear ( void )
 {
-	if (osd_enabled)
-		memset(osd_pixels, 0, osd_xsize * osd_ysize * 4);
+	if (osd_enabled && osd_ink_y0 < osd_ink_y1) {
+		memset(osd_pixels + osd_ink_y0 * osd_xsize, 0, (osd_ink_y1 - osd_ink_y0) * osd_xsize * 4);
+		osd_mark_dirty(osd_ink_y0, osd_ink_y1);
+		osd_ink_y0 = osd_ysize;
+		osd_ink_y1 = 0;
+	}
 }
 
 
+// Uploads only the changed rows into the texture
 void osd_update ()
 {
-	if (osd_enabled)
-                SDL_UpdateTexture(sdl_osdtex, NULL, osd_pixels, osd_xsize * sizeof (Uint32));
+	if (osd_enabled && osd_dirty_y0 < osd_dirty_y1) {
+		SDL_Rect rect = { 0, osd_dirty_y0, osd_xsize, osd_dirty_y1 - osd_dirty_y0 };
+		SDL_UpdateTexture(sdl_osdtex, &rect, osd_pixels + osd_dirty_y0 * osd_xsize, osd_xsize * sizeof (Uint32));
+		osd_dirty_y0 = osd_ysize;
+		osd_dirty_y1 = 0;
+	}
 }
 
 
@@ -669,6 +823,10 @@ int osd_init ( int xsize, int ysize, const Uint8 *palette, int palette_entries,
 	}
 	osd_xsize = xsize;
 	osd_ysize = ysize;
+	osd_ink_y0 = 0;		// the whole (uninitialized) buffer is cleared and uploaded below
+	osd_ink_y1 = ysize;
+	osd_dirty_y0 = ysize;
+	osd_dirty_y1 = 0;
 	osd_fade_dec = fade_dec;
 	osd_fade_end = fade_end;
 	for (a = 0; a < palette_entries; a++)
@@ -734,6 +892,11 @@ void osd_write_char ( int x, int y, char ch )
 	int row;
 	const Uint16 *s;
 	Uint32 *d = osd_pixels + y * osd_xsize + x;
+	osd_mark_dirty(y, y + 16);
+	if (y < osd_ink_y0)
+		osd_ink_y0 = y;
+	if (y + 16 > osd_ink_y1)
+		osd_ink_y1 = y + 16;
 	if (ch < 32 || (unsigned char)ch > 128)
 		ch = '?';
 	s = font_16x16 + (((unsigned char)ch - 32) << 4);
@@ -759,6 +922,29 @@ void osd_write_string ( int x, int y, const char *s )
 }
 
 
+/* One line fading message on the OSD. If the target has not initialized the OSD,
+   it's done here with the defaults (only tried once). */
+void osd_notification ( const char *s )
+{
+	static int init_tried = 0;
+	int x;
+	if (!osd_available) {
+		if (init_tried)
+			return;
+		init_tried = 1;
+		if (osd_init_with_defaults())
+			return;
+	}
+	if (!osd_enabled)
+		return;
+	osd_clear();
+	for (x = 0; *s && x <= osd_xsize - 16; x += 16)
+		osd_write_char(x, (osd_ysize - 16) >> 1, *s++);
+	osd_update();
+	osd_on(OSD_NOTIFICATION);
+}
+
+
 int _sdl_emu_secured_modal_box_ ( const char *items_in, const char *msg )
 {
 	char items_buf[512], *items = items_buf;
@@ -25,6 +25,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 #include <SDL.h>
 #include "xemu/emutools_basicdefs.h"
+#include "xemu/emutools_metrics.h"
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten.h>
@@ -49,7 +50,7 @@ extern void emu_drop_events ( void );
 	snprintf(_buf_for_win_msg_, sizeof _buf_for_win_msg_, __VA_ARGS__); \
 	fprintf(stderr, str ": %s" NL, _buf_for_win_msg_); \
 	if (debug_fp)	\
-		fprintf(debug_fp, str ": %s" NL, _buf_for_win_msg_);	\
+		xemu_log_printf(str ": %s" NL, _buf_for_win_msg_);	\
 	MSG_POPUP_WINDOW(sdlflag, sdl_window_title, _buf_for_win_msg_, sdl_win); \
 	clear_emu_events(); \
 	emu_drop_events(); \
@@ -97,6 +98,21 @@ extern char *emu_strdup ( const char *s );
 extern int emu_load_file ( const char *fn, void *buffer, int maxsize );
 extern void emu_set_full_screen ( int setting );
 extern void emu_timekeeping_delay ( int td_em );
+extern void emu_set_precise_timing ( int enable );
+
+// Wake-up margin (in microseconds) before the deadline for precise timing, it's auto-calibrated between PRECISE_MARGIN_HEADROOM and PRECISE_MARGIN_MAX
+#define PRECISE_MARGIN_DEFAULT	2000
+#define PRECISE_MARGIN_HEADROOM	200
+#define PRECISE_MARGIN_MAX	10000
+
+// Frame timing statistics, updated once in every second by emu_timekeeping_delay()
+struct emu_timing_stats_st {
+	int frames;		// number of frames measured in the last period
+	int jitter_avg;		// average of the absolute difference of the real and the wanted frame time, in microseconds
+	int jitter_max;		// maximal absolute difference of the real and the wanted frame time, in microseconds
+	int wakeup_margin;	// current (auto-calibrated) wake-up margin of precise timing, in microseconds, zero if precise timing is not used
+};
+extern struct emu_timing_stats_st emu_timing_stats;
 extern int emu_init_sdl (
         const char *window_title,               // title of our window
         const char *app_organization,           // organization produced the application, used with SDL_GetPrefPath()
@@ -128,7 +144,9 @@ extern void osd_global_enable ( int status );
 extern void osd_set_colours ( int fg_index, int bg_index );
 extern void osd_write_char ( int x, int y, char ch );
 extern void osd_write_string ( int x, int y, const char *s );
+extern void osd_notification ( const char *s );
 
 #define OSD_STATIC 0x1000
+#define OSD_NOTIFICATION 0x1A0	// osd_on() value of osd_notification(), ~4 seconds with the default fading
 
 #endif
@@ -0,0 +1,120 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+/* Audio clock driven pacing of the emulation. Instead of the wall-clock, the
+   audio device is the master clock: after each frame we wait till the fill
+   level of the audio buffer (samples produced by the emulation, but not yet
+   played) drops to the wanted latency. This way audio never drifts away from
+   the emulation. The fill level is either queried from the emulator, if it
+   has its own sample buffer (fill_level callback of audiopace_init()), or, if
+   samples are rendered on demand by the audio callback (ie: SID), it's the
+   emulated time converted into samples minus the samples played. The audio
+   callback must call audiopace_consumed_samples() in both cases. */
+
+#include "xemu/emutools_audiopace.h"
+
+
+int audiopace_enabled = 0;
+static SDL_atomic_t audiopace_consumed;	// updated by the audio thread!
+static Uint32 audiopace_produced, audiopace_stall_mark;
+static int audiopace_rate, audiopace_target, audiopace_remainder, audiopace_stalled;
+static SDL_AudioDeviceID audiopace_dev;
+static int (*audiopace_fill_level)(void);
+
+
+
+/* Enables audio clock pacing, if latency_msecs is not zero. buffer_samples is
+   the sample buffer size of the audio device, latency cannot be smaller.
+   fill_level should return the number of samples buffered by the emulator, or
+   it's NULL if the samples are rendered on demand by the audio callback. */
+void audiopace_init ( SDL_AudioDeviceID dev, int sample_rate, int buffer_samples, int latency_msecs, int (*fill_level)(void) )
+{
+	audiopace_enabled = 0;
+	if (latency_msecs <= 0 || sample_rate <= 0 || !dev)
+		return;
+	audiopace_dev = dev;
+	audiopace_fill_level = fill_level;
+	audiopace_rate = sample_rate;
+	audiopace_target = latency_msecs * sample_rate / 1000;
+	if (audiopace_target < buffer_samples) {
+		DEBUGPRINT("AUDIO: pacing latency %d msecs is lower than the audio buffer, using %d samples instead." NL, latency_msecs, buffer_samples);
+		audiopace_target = buffer_samples;
+	}
+	audiopace_remainder = 0;
+	audiopace_stalled = 0;
+	SDL_AtomicSet(&audiopace_consumed, 0);
+	audiopace_produced = 0;
+	audiopace_enabled = 1;
+	DEBUGPRINT("AUDIO: audio clock pacing is enabled with target latency of %d samples at %d Hz." NL, audiopace_target, sample_rate);
+}
+
+
+
+// Must be called from the audio callback, with the number of samples (not bytes!) given to the audio device
+void audiopace_consumed_samples ( int samples )
+{
+	SDL_AtomicAdd(&audiopace_consumed, samples);
+}
+
+
+
+static inline int audiopace_get_fill ( Uint32 consumed )
+{
+	return audiopace_fill_level ? audiopace_fill_level() : (int)(audiopace_produced - consumed);
+}
+
+
+
+/* Should be called at the end of an emulated frame, td_em is the emulated time
+   of the frame, in microseconds. Returns zero, if the pacing is done, otherwise
+   the caller should do the sleeping with the usual (wall-clock) method, as audio
+   device is paused or it seems to be stopped for some other reason. */
+int audiopace_wait ( int td_em )
+{
+	Uint32 start, consumed;
+	if (SDL_GetAudioDeviceStatus(audiopace_dev) != SDL_AUDIO_PLAYING)
+		return 1;	// paused by the emulator (or by a monitor, etc), do not even try to wait for it
+	consumed = (Uint32)SDL_AtomicGet(&audiopace_consumed);
+	if (audiopace_stalled) {
+		if (consumed == audiopace_stall_mark)
+			return 1;	// audio device is still stopped
+		audiopace_stalled = 0;
+		audiopace_produced = consumed;
+	}
+	if (!audiopace_fill_level) {
+		// convert emulated time to samples, keeping the remainder for the next time to avoid drifting because of rounding
+		Uint64 t = (Uint64)td_em * audiopace_rate + audiopace_remainder;
+		if ((int)(audiopace_produced - consumed) < 0)
+			audiopace_produced = consumed;	// underrun: the device played silence meanwhile, the buffer is simply empty now, no catching up
+		audiopace_produced += t / 1000000;
+		audiopace_remainder = t % 1000000;
+	}
+	start = SDL_GetTicks();
+	while (audiopace_get_fill(consumed) > audiopace_target) {
+		if (SDL_GetTicks() - start > AUDIOPACE_MAX_WAIT_MS) {
+			DEBUG("AUDIO: audio device does not consume samples, suspending audio pacing" NL);
+			audiopace_stalled = 1;
+			audiopace_stall_mark = consumed;
+			return 1;
+		}
+		SDL_Delay(1);
+		consumed = (Uint32)SDL_AtomicGet(&audiopace_consumed);
+	}
+	return 0;
+}
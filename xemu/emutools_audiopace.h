@@ -0,0 +1,32 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __XEMU_COMMON_EMUTOOLS_AUDIOPACE_H_INCLUDED
+#define __XEMU_COMMON_EMUTOOLS_AUDIOPACE_H_INCLUDED
+
+// If the audio device does not consume samples for this amount of time, we give up audio pacing till it starts again
+#define AUDIOPACE_MAX_WAIT_MS	200
+
+extern int  audiopace_enabled;
+
+extern void audiopace_init ( SDL_AudioDeviceID dev, int sample_rate, int buffer_samples, int latency_msecs, int (*fill_level)(void) );
+extern void audiopace_consumed_samples ( int samples );
+extern int  audiopace_wait ( int td_em );
+
+#endif
@@ -131,12 +131,24 @@ extern FILE *debug_fp;
 
 #ifdef DISABLE_DEBUG
 #define DEBUG(...)
+#define DEBUGCAT(cat, ...)
 #define DEBUGPRINT(...) printf(__VA_ARGS__)
 #else
+#ifdef XEMU_DISABLE_SDL
 #define DEBUG(...) do { \
 	if (unlikely(debug_fp))	\
 		fprintf(debug_fp, __VA_ARGS__);	\
 } while (0)
+#define DEBUGCAT(cat, ...) DEBUG(__VA_ARGS__)
+#else
+#include "xemu/emutools_log.h"
+/* DEBUGCAT() of a category not in XEMU_LOG_COMPILED_CATS is eliminated at compile time */
+#define DEBUGCAT(cat, ...) do { \
+	if ((XEMU_LOG_COMPILED_CATS & XLOG_BIT(cat)) && unlikely(debug_fp) && (xemu_log_cats & XLOG_BIT(cat)))	\
+		xemu_log_printf(__VA_ARGS__);	\
+} while (0)
+#define DEBUG(...) DEBUGCAT(XLOG_GENERAL, __VA_ARGS__)
+#endif
 #define DEBUGPRINT(...) do {	\
         printf(__VA_ARGS__);	\
         DEBUG(__VA_ARGS__);	\
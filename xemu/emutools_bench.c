@@ -0,0 +1,120 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+/* Benchmark mode: the emulator runs headless (SDL dummy video and audio drivers,
+   unless the user sets SDL_VIDEODRIVER/SDL_AUDIODRIVER) and unthrottled for the
+   given number of frames, then prints one line of JSON with the results to the
+   stdout, and exits. The workload is what the emulator would do anyway, so it is
+   defined by the ROM/program/snapshot related options given in the command line.
+   The time is attributed to the sections (CPU, video, I/O, presentation)
+   set by the EMU_BENCH_SECTION() calls of the target (and emutools.c), the time
+   not claimed by any of these counts as CPU time. The emulated MHz is the nominal CPU clock given by the
+   target multiplied by the emulated/real time ratio. Measurement starts at the
+   end of the first frame, so the initialization of the emulator is not counted.
+
+   Must be #include'd after emutools_metrics.c, which shares the section time
+   accounting of this file. Timekeeping must call emu_bench_frame() in every
+   frame instead of sleeping, if emu_bench_active is non-zero. */
+
+#include "xemu/emutools_bench.h"
+
+
+int emu_bench_active = 0;
+
+static struct {
+	int	frames, frames_done, frames_per_delay, cpu_hz, section;
+	Uint64	start, last, freq;
+	Uint64	section_time[EMU_BENCH_SECTIONS];
+	Uint64	emulated_usecs, second_usecs;
+} bench = { .frames_per_delay = 1 };
+
+
+void emu_bench_init ( int frames, int cpu_hz )
+{
+	if (frames <= 0)
+		return;
+	bench.frames = frames;
+	bench.cpu_hz = cpu_hz;
+	emu_bench_active = 1;
+	SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+	SDL_setenv("SDL_AUDIODRIVER", "dummy", 0);
+	DEBUGPRINT("BENCH: benchmark mode for %d frames (headless, unthrottled)" NL, frames);
+}
+
+
+void emu_bench_switch_section ( int section )
+{
+	Uint64 now = SDL_GetPerformanceCounter();
+	if (bench.freq)
+		bench.section_time[bench.section] += now - bench.last;
+	if (emu_metrics_active && bench.last)
+		metrics.section_time[bench.section] += now - bench.last;
+	bench.last = now;
+	bench.section = section;
+}
+
+
+static void emu_bench_report ( void )
+{
+	double real = (double)(bench.last - bench.start) / (double)bench.freq;
+	double emulated = bench.emulated_usecs / 1000000.0;
+	int a;
+	if (real <= 0)
+		real = 1.0 / (double)bench.freq;
+	printf("{\"xemu_bench\":1,\"target\":\"%s\",\"frames\":%d,\"emulated_seconds\":%.6f,\"real_seconds\":%.6f,"
+		"\"fps\":%.3f,\"speed_percent\":%.2f,\"nominal_mhz\":%.3f,\"emulated_mhz\":%.3f,\"seconds\":{",
+		TARGET_NAME, bench.frames_done, emulated, real,
+		bench.frames_done / real, emulated * 100.0 / real, bench.cpu_hz / 1000000.0, bench.cpu_hz * emulated / real / 1000000.0
+	);
+	for (a = 0; a < EMU_BENCH_SECTIONS; a++)
+		printf("%s\"%s\":%.6f", a ? "," : "", metrics_section_names[a], (double)bench.section_time[a] / (double)bench.freq);
+	printf("}}" NL);
+	fflush(stdout);
+}
+
+
+// For targets calling the timekeeping delay only after more emulated frames (ie: cvic20, as it renders only every second frame)
+void emu_bench_set_frames_per_delay ( int frames )
+{
+	bench.frames_per_delay = frames;
+}
+
+
+// Called instead of the sleeping part of the timekeeping. Returns non-zero if an emulated second is elapsed,
+// so seconds_timer_trigger like things are deterministic and do not depend on the host speed.
+int emu_bench_frame ( int td_em )
+{
+	emu_bench_switch_section(bench.section);
+	if (!bench.freq) {	// end of the first frame: start of the measurement
+		bench.freq = SDL_GetPerformanceFrequency();
+		bench.start = bench.last;
+		return 0;
+	}
+	bench.frames_done += bench.frames_per_delay;
+	bench.emulated_usecs += td_em;
+	if (bench.frames_done >= bench.frames) {
+		emu_bench_report();
+		XEMUEXIT(0);
+	}
+	bench.second_usecs += td_em;
+	if (bench.second_usecs >= 1000000) {
+		bench.second_usecs -= 1000000;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+#ifndef __XEMU_COMMON_EMUTOOLS_BENCH_H_INCLUDED
+#define __XEMU_COMMON_EMUTOOLS_BENCH_H_INCLUDED
+
+// There is no audio section: audio is rendered by the SDL audio thread, or sample by sample within the CPU emulation
+#define EMU_BENCH_CPU		0
+#define EMU_BENCH_VIDEO		1
+#define EMU_BENCH_IO		2
+#define EMU_BENCH_PRESENT	3
+#define EMU_BENCH_SLEEP		4
+#define EMU_BENCH_SECTIONS	5
+
+// Time accounting: the time from this point on (till the next switch) is spent in the given section.
+// Costs nothing but a test, if neither benchmark mode nor metrics (see emutools_metrics.h) is active.
+#define EMU_BENCH_SECTION(section) do { \
+	if (unlikely(emu_bench_active | emu_metrics_active)) \
+		emu_bench_switch_section(section); \
+} while (0)
+
+extern int  emu_bench_active, emu_metrics_active;
+
+extern void emu_bench_init ( int frames, int cpu_hz );
+extern int  emu_bench_frame ( int td_em );
+extern void emu_bench_set_frames_per_delay ( int frames );
+extern void emu_bench_switch_section ( int section );
+
+#endif
@@ -19,6 +19,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 #include "xemu/emutools.h"
 #include "xemu/emutools_hid.h"
+#include "xemu/input_record.h"
 
 
 /* Note: HID stands for "Human Input Devices" or something like that :)
@@ -327,10 +328,16 @@ int hid_handle_one_sdl_event ( SDL_Event *event )
 
 
 // For simple emulators it's even enough to call regularly this function for all HID stuffs!
+// It must be called once per emulated frame, as input recording/replay counts frames by the calls.
 void hid_handle_all_sdl_events ( void )
 {
 	SDL_Event event;
 	while (SDL_PollEvent(&event) != 0)
-		hid_handle_one_sdl_event(&event);
-
+		if (likely(!inputrec_mode) || !inputrec_event(&event))
+			hid_handle_one_sdl_event(&event);
+	if (unlikely(inputrec_mode)) {
+		while (inputrec_replay(&event))
+			hid_handle_one_sdl_event(&event);
+		inputrec_frame_done();
+	}
 }
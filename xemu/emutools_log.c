@@ -0,0 +1,291 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+/* Each thread writing the log gets its own single producer / single consumer ring
+   from a fixed pool (on the first message of the thread), the only consumer is the
+   writer thread. The producer only advances "head", the consumer only advances
+   "tail", so no locking is needed at all. A message is either fully put into the
+   ring or it's dropped, so the writer never sees partial messages. When a thread
+   exits, its ring goes back to the pool (not freed, the writer may not have written
+   it out yet), and the next thread continues to use it. */
+
+#include "xemu/emutools_basicdefs.h"
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define LOG_RING_SIZE	0x100000	// must be power of 2
+#define LOG_RING_MASK	(LOG_RING_SIZE - 1)
+#define LOG_MSG_MAX	2048		// longer messages are truncated
+#define LOG_FLUSH_MS	10		// writer thread sleeps this much if there was nothing to write
+#define LOG_RINGS	16		// max number of threads logging at the same time, further ones log synchronously
+
+struct log_ring {
+	void		*buf;		// allocated on the first use, then kept
+	SDL_atomic_t	owned;		// ring is used by a thread
+	SDL_atomic_t	head;		// bytes ever written by the producer thread
+	SDL_atomic_t	tail;		// bytes ever written out by the writer thread
+	SDL_atomic_t	dropped;	// messages dropped since the last report
+};
+
+Uint32 xemu_log_cats = XLOG_ALL;
+
+static const char *cat_names[XLOG_CATEGORIES] = {
+	"general", "cpu", "mem", "io", "dma", "disk", "sdcard", "video", "audio", "hid", "snapshot", "monitor"
+};
+
+static __thread struct log_ring *my_ring = NULL;
+static struct log_ring rings[LOG_RINGS];
+static SDL_TLSID ring_tls;		// only for its destructor, which gives back the ring of an exiting thread
+static SDL_atomic_t log_async;
+static SDL_atomic_t log_producers;	// number of threads putting a message into their ring right now
+static SDL_Thread *log_thread = NULL;
+static int dropped_total = 0;
+
+
+
+static void put_ring ( void *r )
+{
+	SDL_AtomicSet(&((struct log_ring*)r)->owned, 0);
+}
+
+
+static struct log_ring *get_ring ( void )
+{
+	int a;
+	for (a = 0; a < LOG_RINGS; a++) {
+		struct log_ring *r = &rings[a];
+		if (!SDL_AtomicCAS(&r->owned, 0, 1))
+			continue;
+		if (!SDL_AtomicGetPtr(&r->buf)) {
+			void *buf = malloc(LOG_RING_SIZE);
+			if (!buf) {
+				put_ring(r);
+				return NULL;
+			}
+			SDL_AtomicSetPtr(&r->buf, buf);
+		}
+		SDL_TLSSet(ring_tls, r, put_ring);
+		my_ring = r;
+		return r;
+	}
+	return NULL;
+}
+
+
+
+void xemu_log_printf ( const char *format, ... )
+{
+	va_list args;
+	struct log_ring *r;
+	Uint32 head, room, pos;
+	int len;
+	char tmp[LOG_MSG_MAX];
+	char *buf;
+	va_start(args, format);
+	// xemu_log_stop() waits for the producers, so a message is never left behind in the ring after it
+	SDL_AtomicAdd(&log_producers, 1);
+	if (!SDL_AtomicGet(&log_async) || (!(r = my_ring) && !(r = get_ring()))) {
+		SDL_AtomicAdd(&log_producers, -1);
+		if (debug_fp)
+			vfprintf(debug_fp, format, args);
+		va_end(args);
+		return;
+	}
+	buf = r->buf;
+	head = (Uint32)SDL_AtomicGet(&r->head);
+	room = LOG_RING_SIZE - (head - (Uint32)SDL_AtomicGet(&r->tail));
+	pos = head & LOG_RING_MASK;
+	if (room >= LOG_MSG_MAX && LOG_RING_SIZE - pos >= LOG_MSG_MAX) {
+		// the common case: enough free space without wrapping, format directly into the ring
+		len = vsnprintf(buf + pos, LOG_MSG_MAX, format, args);
+	} else {
+		len = vsnprintf(tmp, LOG_MSG_MAX, format, args);
+		if (len >= LOG_MSG_MAX)
+			len = LOG_MSG_MAX - 1;
+		if (len > 0 && len <= room) {
+			Uint32 part = LOG_RING_SIZE - pos;
+			if (part >= len)
+				memcpy(buf + pos, tmp, len);
+			else {
+				memcpy(buf + pos, tmp, part);
+				memcpy(buf, tmp + part, len - part);
+			}
+		} else if (len > 0) {
+			SDL_AtomicAdd(&r->dropped, 1);
+			len = 0;
+		}
+	}
+	va_end(args);
+	if (len >= LOG_MSG_MAX)
+		len = LOG_MSG_MAX - 1;
+	if (len > 0)
+		SDL_AtomicAdd(&r->head, len);	// publish the message for the writer thread
+	SDL_AtomicAdd(&log_producers, -1);
+}
+
+
+
+/* Writes out everything found in the rings, returns the number of bytes written. */
+static int log_drain ( void )
+{
+	int a, total = 0;
+	for (a = 0; a < LOG_RINGS; a++) {
+		struct log_ring *r = &rings[a];
+		const char *buf = SDL_AtomicGetPtr(&r->buf);
+		Uint32 tail, len;
+		int dropped;
+		if (!buf)
+			continue;	// never used ring
+		tail = (Uint32)SDL_AtomicGet(&r->tail);
+		len = (Uint32)SDL_AtomicGet(&r->head) - tail;
+		if (len) {
+			Uint32 pos = tail & LOG_RING_MASK;
+			Uint32 part = LOG_RING_SIZE - pos;
+			if (part > len)
+				part = len;
+			fwrite(buf + pos, 1, part, debug_fp);
+			if (len > part)
+				fwrite(buf, 1, len - part, debug_fp);
+			SDL_AtomicAdd(&r->tail, len);
+			total += len;
+		}
+		dropped = SDL_AtomicSet(&r->dropped, 0);
+		if (dropped) {
+			fprintf(debug_fp, "LOG: %d message(s) dropped, log ring buffer was full" NL, dropped);
+			dropped_total += dropped;
+		}
+	}
+	return total;
+}
+
+
+
+static int log_writer_thread ( void *unused )
+{
+	int unflushed = 0;
+	while (SDL_AtomicGet(&log_async)) {
+		if (log_drain())
+			unflushed = 1;
+		else {
+			if (unflushed) {
+				fflush(debug_fp);
+				unflushed = 0;
+			}
+			SDL_Delay(LOG_FLUSH_MS);
+		}
+	}
+	return 0;
+}
+
+
+
+/* Parses a category list (see emutools_log.h) into xemu_log_cats.
+   Returns non-zero on an unknown category name (other names are still applied). */
+int xemu_log_set_categories ( const char *spec )
+{
+	int ret = 0;
+	while (spec && *spec) {
+		const char *end = strchr(spec, ',');
+		int len = end ? end - spec : strlen(spec);
+		int neg = (*spec == '-');
+		Uint32 mask = 0;
+		if (neg) {
+			spec++;
+			len--;
+		}
+		if (len == 3 && !strncasecmp(spec, "all", 3))
+			mask = XLOG_ALL;
+		else if (len == 4 && !strncasecmp(spec, "none", 4)) {
+			xemu_log_cats = 0;
+		} else if (len > 0) {
+			int a;
+			for (a = 0; a < XLOG_CATEGORIES; a++)
+				if (strlen(cat_names[a]) == len && !strncasecmp(spec, cat_names[a], len)) {
+					mask = XLOG_BIT(a);
+					break;
+				}
+			if (a == XLOG_CATEGORIES) {
+				DEBUGPRINT("LOG: unknown log category \"%.*s\" is ignored" NL, len, spec);
+				ret = 1;
+			}
+		}
+		if (neg)
+			xemu_log_cats &= ~mask;
+		else
+			xemu_log_cats |= mask;
+		spec = end ? end + 1 : NULL;
+	}
+	return ret;
+}
+
+
+
+/* Call after debug_fp is opened. Applies XEMU_DEBUG_CATS, and starts the async
+   writer thread, unless XEMU_DEBUG_SYNC is set (useful to get every message into
+   the file before a crash) or threads are not available (ie emscripten). */
+void xemu_log_start ( void )
+{
+	const char *p = getenv("XEMU_DEBUG_CATS");
+	if (p) {
+		xemu_log_cats = 0;
+		xemu_log_set_categories(p);
+	}
+	if (!debug_fp || log_thread || getenv("XEMU_DEBUG_SYNC"))
+		return;
+	ring_tls = SDL_TLSCreate();
+	SDL_AtomicSet(&log_async, 1);
+	log_thread = SDL_CreateThread(log_writer_thread, "Xemu log writer", NULL);
+	if (!log_thread) {
+		SDL_AtomicSet(&log_async, 0);
+		DEBUGPRINT("LOG: cannot create log writer thread, logging is synchronous: %s" NL, SDL_GetError());
+	} else
+		DEBUG("LOG: asynchronous log writer has been started" NL);
+}
+
+
+
+/* In a forked child process only the forking thread exists, the writer thread does not:
+   logging becomes synchronous there, into the given stream (NULL disables logging). */
+void xemu_log_forked_child ( FILE *fp )
+{
+	SDL_AtomicSet(&log_async, 0);
+	log_thread = NULL;
+	debug_fp = fp;
+}
+
+
+
+/* Stops the writer thread and writes out everything pending. Must be called before closing debug_fp. */
+void xemu_log_stop ( void )
+{
+	if (!log_thread)
+		return;
+	SDL_AtomicSet(&log_async, 0);
+	while (SDL_AtomicGet(&log_producers))	// producers which have seen log_async set before, must finish their message
+		SDL_Delay(1);
+	SDL_WaitThread(log_thread, NULL);
+	log_thread = NULL;
+	log_drain();
+	if (dropped_total)
+		fprintf(debug_fp, "LOG: %d message(s) dropped in total, as log ring buffers were full" NL, dropped_total);
+	fflush(debug_fp);
+}
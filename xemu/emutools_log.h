@@ -0,0 +1,65 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __XEMU_COMMON_EMUTOOLS_LOG_H_INCLUDED
+#define __XEMU_COMMON_EMUTOOLS_LOG_H_INCLUDED
+
+/* Debug log backend behind DEBUG(), DEBUGPRINT() and DEBUGCAT(). Once the async
+   writer is started, messages are only formatted on the calling thread into a
+   per-thread lock-free ring buffer, and a background thread writes them into
+   debug_fp, so the emulation thread never waits for stdio/disk I/O. Messages of
+   a thread keep their order, but there is no ordering between threads. If a ring
+   is full, the message is dropped (and the number of dropped messages is logged).
+   Without the async writer (or if XEMU_DEBUG_SYNC is set) logging is synchronous. */
+
+/* Log categories. Runtime filtering: XEMU_DEBUG_CATS environment variable, comma
+   separated list of category names, "all" or "none", a name prefixed with '-'
+   removes the category, eg: "all,-dma,-sdcard". Compile time filtering: define
+   XEMU_LOG_COMPILED_CATS (eg in xemu-target.h) as a mask of XLOG_BIT()'s, the
+   DEBUGCAT() calls of other categories are eliminated by the compiler then. */
+#define XLOG_GENERAL	0
+#define XLOG_CPU	1
+#define XLOG_MEM	2
+#define XLOG_IO		3
+#define XLOG_DMA	4
+#define XLOG_DISK	5
+#define XLOG_SDCARD	6
+#define XLOG_VIDEO	7
+#define XLOG_AUDIO	8
+#define XLOG_HID	9
+#define XLOG_SNAPSHOT	10
+#define XLOG_MONITOR	11
+#define XLOG_CATEGORIES	12
+
+#define XLOG_BIT(cat)	(1U << (cat))
+#define XLOG_ALL	((1U << XLOG_CATEGORIES) - 1)
+
+#ifndef XEMU_LOG_COMPILED_CATS
+#define XEMU_LOG_COMPILED_CATS	XLOG_ALL
+#endif
+
+extern Uint32 xemu_log_cats;
+
+extern void xemu_log_printf          ( const char *format, ... ) __attribute__ ((format (printf, 1, 2)));
+extern int  xemu_log_set_categories  ( const char *spec );
+extern void xemu_log_start           ( void );
+extern void xemu_log_stop            ( void );
+extern void xemu_log_forked_child    ( FILE *fp );
+
+#endif
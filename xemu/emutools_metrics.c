@@ -0,0 +1,202 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+/* Per-frame performance metrics: host time spent in the sections (the very same
+   EMU_BENCH_SECTION() accounting as the benchmark mode uses, plus sleeping and
+   presentation) and some event counters of the target. Every frame can be
+   written into a stream file (CSV, or JSON lines if the file name ends with
+   ".json"), the average of the last EMU_METRICS_WINDOW frames can be shown on
+   the OSD (refreshed in every emulated second) and queried by the monitor of
+   the target (see emu_metrics_report()).
+
+   The target must provide osd_notification() (emutools.c does). */
+
+#include "xemu/emutools_metrics.h"
+#include <string.h>
+#include <errno.h>
+
+
+int    emu_metrics_active = 0;
+Uint32 emu_metrics_counters[EMU_METRICS_COUNTERS];
+
+static const char *metrics_section_names[EMU_BENCH_SECTIONS] = { "cpu", "video", "io", "present", "sleep" };
+static const char *metrics_counter_names[EMU_METRICS_COUNTERS] = { "insns", "slowpath", "dma_bytes", "disk_ops" };
+
+static struct {
+	Uint64	section_time[EMU_BENCH_SECTIONS];	// of the current frame, in performance counter units (see emu_bench_switch_section)
+	Uint64	freq;
+	FILE	*stream;
+	int	json, osd, osd_usecs;
+	Uint32	frames;
+	int	pos, filled;
+	// the rolling window, times are in microseconds
+	Uint32	win_time[EMU_METRICS_WINDOW][EMU_BENCH_SECTIONS];
+	Uint32	win_count[EMU_METRICS_WINDOW][EMU_METRICS_COUNTERS];
+	Uint32	win_emulated[EMU_METRICS_WINDOW];
+	Uint64	sum_time[EMU_BENCH_SECTIONS], sum_count[EMU_METRICS_COUNTERS], sum_emulated;
+} metrics;
+
+
+/* Returns non-zero if the stream file cannot be created. Metrics are collected
+   if any of the parameters asks so (the stream file name can be NULL). */
+int emu_metrics_init ( int enable, const char *stream_fn, int osd )
+{
+	int a;
+	if (stream_fn) {
+		const char *ext = strrchr(stream_fn, '.');
+		metrics.stream = fopen(stream_fn, "w");
+		if (!metrics.stream) {
+			DEBUGPRINT("METRICS: cannot create stream file %s: %s" NL, stream_fn, strerror(errno));
+			return 1;
+		}
+		metrics.json = (ext && !strcasecmp(ext, ".json"));
+		if (!metrics.json) {
+			fprintf(metrics.stream, "frame,emulated_us");
+			for (a = 0; a < EMU_BENCH_SECTIONS; a++)
+				fprintf(metrics.stream, ",%s_us", metrics_section_names[a]);
+			for (a = 0; a < EMU_METRICS_COUNTERS; a++)
+				fprintf(metrics.stream, ",%s", metrics_counter_names[a]);
+			fprintf(metrics.stream, "\n");
+		}
+	}
+	metrics.osd = osd;
+	if (!enable && !stream_fn && !osd)
+		return 0;
+	metrics.freq = SDL_GetPerformanceFrequency();
+	emu_metrics_active = 1;
+	DEBUGPRINT("METRICS: per-frame performance metrics are enabled (stream: %s, OSD: %s)" NL,
+		stream_fn ? stream_fn : "none", osd ? "on" : "off"
+	);
+	return 0;
+}
+
+
+static void metrics_show_osd ( void )
+{
+	char buf[64];
+	Uint64 total = 0;
+	int a;
+	for (a = 0; a < EMU_BENCH_SECTIONS; a++)
+		total += metrics.sum_time[a];
+	if (!total)
+		return;
+	// must fit into the 25 characters of the default OSD of emutools.c
+	snprintf(buf, sizeof buf, "C%d V%d I%d P%d S%d%%",
+		(int)(metrics.sum_time[EMU_BENCH_CPU]     * 100 / total),
+		(int)(metrics.sum_time[EMU_BENCH_VIDEO]   * 100 / total),
+		(int)(metrics.sum_time[EMU_BENCH_IO]      * 100 / total),
+		(int)(metrics.sum_time[EMU_BENCH_PRESENT] * 100 / total),
+		(int)(metrics.sum_time[EMU_BENCH_SLEEP]   * 100 / total)
+	);
+	osd_notification(buf);
+}
+
+
+void emu_metrics_frame ( int td_em )
+{
+	int a, slot = metrics.pos;
+	emu_bench_switch_section(EMU_BENCH_CPU);	// closes the running section (probably sleeping), the next frame starts as CPU time
+	for (a = 0; a < EMU_BENCH_SECTIONS; a++) {
+		Uint32 t = metrics.section_time[a] * 1000000 / metrics.freq;
+		metrics.section_time[a] = 0;
+		metrics.sum_time[a] -= metrics.win_time[slot][a];
+		metrics.sum_time[a] += t;
+		metrics.win_time[slot][a] = t;
+	}
+	for (a = 0; a < EMU_METRICS_COUNTERS; a++) {
+		metrics.sum_count[a] -= metrics.win_count[slot][a];
+		metrics.sum_count[a] += emu_metrics_counters[a];
+		metrics.win_count[slot][a] = emu_metrics_counters[a];
+		emu_metrics_counters[a] = 0;
+	}
+	metrics.sum_emulated -= metrics.win_emulated[slot];
+	metrics.sum_emulated += td_em;
+	metrics.win_emulated[slot] = td_em;
+	metrics.pos = (slot + 1) % EMU_METRICS_WINDOW;
+	if (metrics.filled < EMU_METRICS_WINDOW)
+		metrics.filled++;
+	metrics.frames++;
+	if (metrics.stream) {
+		if (metrics.json) {
+			fprintf(metrics.stream, "{\"frame\":%u,\"emulated_us\":%d", metrics.frames, td_em);
+			for (a = 0; a < EMU_BENCH_SECTIONS; a++)
+				fprintf(metrics.stream, ",\"%s_us\":%u", metrics_section_names[a], metrics.win_time[slot][a]);
+			for (a = 0; a < EMU_METRICS_COUNTERS; a++)
+				fprintf(metrics.stream, ",\"%s\":%u", metrics_counter_names[a], metrics.win_count[slot][a]);
+			fprintf(metrics.stream, "}\n");
+		} else {
+			fprintf(metrics.stream, "%u,%d", metrics.frames, td_em);
+			for (a = 0; a < EMU_BENCH_SECTIONS; a++)
+				fprintf(metrics.stream, ",%u", metrics.win_time[slot][a]);
+			for (a = 0; a < EMU_METRICS_COUNTERS; a++)
+				fprintf(metrics.stream, ",%u", metrics.win_count[slot][a]);
+			fprintf(metrics.stream, "\n");
+		}
+	}
+	if (metrics.osd) {
+		metrics.osd_usecs += td_em;
+		if (metrics.osd_usecs >= 1000000) {
+			metrics.osd_usecs -= 1000000;
+			metrics_show_osd();
+		}
+	}
+}
+
+
+/* Human readable summary of the rolling window into buf (lines are terminated by eol),
+   for the monitor of the target. Returns the length of the text. */
+int emu_metrics_report ( char *buf, int size, const char *eol )
+{
+	Uint64 total = 0;
+	int a, len;
+	if (!emu_metrics_active)
+		return snprintf(buf, size, "Metrics are not enabled (see the metrics related command line options)%s", eol);
+	if (!metrics.filled)
+		return snprintf(buf, size, "No frames yet%s", eol);
+	for (a = 0; a < EMU_BENCH_SECTIONS; a++)
+		total += metrics.sum_time[a];
+	if (!total)
+		total = 1;
+	len = snprintf(buf, size, "Frames: %u, average of the last %d frames (host usecs per frame):%s", metrics.frames, metrics.filled, eol);
+	for (a = 0; a < EMU_BENCH_SECTIONS && len < size; a++)
+		len += snprintf(buf + len, size - len, "  %-10s %9.1f %5.1f%%%s", metrics_section_names[a],
+			(double)metrics.sum_time[a] / metrics.filled, metrics.sum_time[a] * 100.0 / total, eol
+		);
+	if (len < size)
+		len += snprintf(buf + len, size - len, "  %-10s %9.1f (emulated %.1f, host load %d%%)%s", "total",
+			(double)total / metrics.filled, (double)metrics.sum_emulated / metrics.filled,
+			metrics.sum_emulated ? (int)((total - metrics.sum_time[EMU_BENCH_SLEEP]) * 100 / metrics.sum_emulated) : -1, eol
+		);
+	if (len < size)
+		len += snprintf(buf + len, size - len, "Counters (average per frame):%s", eol);
+	for (a = 0; a < EMU_METRICS_COUNTERS && len < size; a++)
+		len += snprintf(buf + len, size - len, "  %-10s %9.1f%s", metrics_counter_names[a],
+			(double)metrics.sum_count[a] / metrics.filled, eol
+		);
+	return len < size ? len : size - 1;
+}
+
+
+void emu_metrics_close ( void )
+{
+	if (metrics.stream) {
+		fclose(metrics.stream);
+		metrics.stream = NULL;
+	}
+	emu_metrics_active = 0;
+}
@@ -0,0 +1,52 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+#ifndef __XEMU_COMMON_EMUTOOLS_METRICS_H_INCLUDED
+#define __XEMU_COMMON_EMUTOOLS_METRICS_H_INCLUDED
+
+#include "xemu/emutools_bench.h"
+
+// Event counters, the target increments them with EMU_METRICS_COUNT()
+#define EMU_METRICS_INSNS	0	// CPU instructions executed
+#define EMU_METRICS_SLOWPATH	1	// memory accesses not served by the fast (direct) path
+#define EMU_METRICS_DMA_BYTES	2	// bytes transferred by DMA
+#define EMU_METRICS_DISK_OPS	3	// disk image related host syscalls
+#define EMU_METRICS_COUNTERS	4
+
+#define EMU_METRICS_WINDOW	50	// the rolling window (OSD, monitor) is this many frames
+
+#define EMU_METRICS_COUNT(counter, n) do { \
+	if (unlikely(emu_metrics_active)) \
+		emu_metrics_counters[counter] += (n); \
+} while (0)
+
+// Should be called by the timekeeping at the end of each frame (after sleeping)
+#define EMU_METRICS_FRAME(td_em) do { \
+	if (unlikely(emu_metrics_active)) \
+		emu_metrics_frame(td_em); \
+} while (0)
+
+extern int    emu_metrics_active;
+extern Uint32 emu_metrics_counters[EMU_METRICS_COUNTERS];
+
+extern int  emu_metrics_init   ( int enable, const char *stream_fn, int osd );
+extern void emu_metrics_frame  ( int td_em );
+extern int  emu_metrics_report ( char *buf, int size, const char *eol );
+extern void emu_metrics_close  ( void );
+
+#endif
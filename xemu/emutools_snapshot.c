@@ -30,6 +30,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include <string.h>
 #include <stdlib.h>
 
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define XEMUSNAP_USE_FORK
+#include <sys/wait.h>
+#endif
+
 
 static int snapfd = -1;
 static const char *framework_ident = "github.com/lgblgblgb/xemu";
@@ -39,6 +44,206 @@ char xemusnap_error_buffer[XEMUSNAP_ERROR_BUFFER_SIZE * 2];
 char xemusnap_user_error_buffer[XEMUSNAP_ERROR_BUFFER_SIZE];
 static char *emu_ident;
 static int last_sub_block_size_written = -1;
+int xemusnap_compression = 1;	// pack sub-blocks on save (if it's worth)
+
+/* State of unpacking the current sub-block on load, if it's a packed one */
+static struct {
+	Uint8  *data;		// packed stream (the whole sub-block is read into memory)
+	Uint32 size, pos;	// size of the packed stream, and the read position in it
+	Uint32 left;		// unpacked bytes are still to be produced
+	Uint32 run;		// bytes are still pending from the current run
+	int    literal;		// current run is literal (copied from the stream), or repeated run_byte
+	Uint8  run_byte;
+	Uint32 adler, checksum;
+} unpack = { .data = NULL };
+
+/* In-memory snapshot (see xemusnap_save_to_memory() and xemusnap_load_from_memory()), used instead of snapfd if data is not NULL */
+static struct {
+	Uint8  *data;
+	size_t size, pos;	// size of the snapshot (or the allocated buffer on save), and the read/write position
+} memsnap = { .data = NULL };
+
+/* State of the background save (see xemusnap_save_async()) */
+static struct {
+	int	running;
+	char	*filename;
+	char	*tmpname;	// the snapshot is written into this, then renamed, so a checkpoint file is never half-written
+	char	error[XEMUSNAP_ERROR_BUFFER_SIZE];
+#ifdef XEMUSNAP_USE_FORK
+	pid_t	pid;
+	int	pipefd;		// child writes its log here, then a NUL byte and the error message (if any)
+	int	error_len;	// -1 = still reading log lines
+	int	line_len;
+	char	line[256];
+#else
+	SDL_Thread	*thread;
+	SDL_atomic_t	finished;
+	Uint8	*data;
+	size_t	size;
+	int	ret;
+#endif
+} async = { .running = 0 };
+
+
+/* Packing format is a simple byte oriented RLE, as memory dumps are mostly zero/$FF filled or repetitive.
+   It's about as fast as a memcpy both ways. Control byte of the stream:
+	$00-$7F: literal run, 1-128 bytes follow to be copied
+	$80-$FE: repeat run, the next byte is repeated 3-129 times
+	$FF:     long repeat run, BE16 length follows, then the byte to repeat */
+static Uint8 *pack_literals ( Uint8 *o, const Uint8 *p, Uint32 len )
+{
+	while (len) {
+		Uint32 n = len > 128 ? 128 : len;
+		*o++ = n - 1;
+		memcpy(o, p, n);
+		o += n;
+		p += n;
+		len -= n;
+	}
+	return o;
+}
+
+
+static Uint32 pack_sub_block ( const Uint8 *in, Uint32 size, Uint8 *out )
+{
+	Uint8 *o = out;
+	Uint32 i = 0, lit_start = 0;
+	while (i < size) {
+		Uint32 run = 1;
+		while (i + run < size && in[i + run] == in[i] && run < 0xFFFF)
+			run++;
+		if (run >= 3) {
+			o = pack_literals(o, in + lit_start, i - lit_start);
+			if (run <= 129) {
+				*o++ = 0x80 + run - 3;
+			} else {
+				*o++ = 0xFF;
+				*o++ = run >> 8;
+				*o++ = run;
+			}
+			*o++ = in[i];
+			i += run;
+			lit_start = i;
+		} else
+			i += run;
+	}
+	return pack_literals(o, in + lit_start, i - lit_start) - out;
+}
+
+
+static Uint32 adler32 ( Uint32 adler, const Uint8 *p, Uint32 n )
+{
+	Uint32 a = adler & 0xFFFF, b = adler >> 16;
+	while (n) {
+		Uint32 k = n < 5552 ? n : 5552;	// the largest n, where b cannot overflow before the modulo
+		n -= k;
+		while (k--) {
+			a += *p++;
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+
+static int unpack_read ( Uint8 *out, Uint32 n )
+{
+	if (n > unpack.left)
+		return XSNAPERR_TRUNCATED;
+	unpack.left -= n;
+	while (n) {
+		Uint32 m;
+		if (!unpack.run) {
+			Uint8 c;
+			if (unpack.pos >= unpack.size)
+				return XSNAPERR_FORMAT;
+			c = unpack.data[unpack.pos++];
+			unpack.literal = c < 0x80;
+			if (unpack.literal) {
+				unpack.run = c + 1;
+			} else if (c < 0xFF) {
+				unpack.run = c - 0x80 + 3;
+			} else {
+				if (unpack.pos + 2 > unpack.size)
+					return XSNAPERR_FORMAT;
+				unpack.run = P_AS_BE16(unpack.data + unpack.pos);
+				unpack.pos += 2;
+			}
+			if (!unpack.literal) {
+				if (unpack.pos >= unpack.size)
+					return XSNAPERR_FORMAT;
+				unpack.run_byte = unpack.data[unpack.pos++];
+			}
+		}
+		m = n < unpack.run ? n : unpack.run;
+		if (unpack.literal) {
+			if (unpack.pos + m > unpack.size)
+				return XSNAPERR_FORMAT;
+			memcpy(out, unpack.data + unpack.pos, m);
+			unpack.pos += m;
+		} else
+			memset(out, unpack.run_byte, m);
+		unpack.adler = adler32(unpack.adler, out, m);
+		unpack.run -= m;
+		out += m;
+		n -= m;
+	}
+	return 0;
+}
+
+
+static void unpack_free ( void )
+{
+	free(unpack.data);
+	unpack.data = NULL;
+}
+
+
+// Reads a packed sub-block (size is the size field of it without the flag), sets *size to the unpacked size
+static int unpack_begin ( Uint32 *size )
+{
+	Uint8 head[8], *data;
+	int ret;
+	if (*size < 8)
+		return XSNAPERR_FORMAT;
+	ret = xemusnap_read_file(head, 8);
+	if (ret)
+		return ret;
+	unpack.size = *size - 8;
+	data = emu_malloc(unpack.size ? unpack.size : 1);
+	ret = xemusnap_read_file(data, unpack.size);
+	if (ret) {
+		free(data);
+		return ret;
+	}
+	unpack.data = data;	// from now, xemusnap_read_file() reads the unpacked data
+	unpack.pos = 0;
+	unpack.run = 0;
+	unpack.left = *size = P_AS_BE32(head);
+	unpack.checksum = P_AS_BE32(head + 4);
+	unpack.adler = 1;
+	return 0;
+}
+
+
+// Unpacks the rest of the sub-block (not read by the loader callback) and checks the checksum
+static int unpack_end ( void )
+{
+	Uint8 buffer[4096];
+	while (unpack.left) {
+		int ret = unpack_read(buffer, unpack.left < sizeof buffer ? unpack.left : sizeof buffer);
+		if (ret)
+			return ret;
+	}
+	if (unpack.pos != unpack.size)
+		return XSNAPERR_FORMAT;
+	if (unpack.adler != unpack.checksum)
+		return XSNAPERR_CHECKSUM;
+	unpack_free();
+	return 0;
+}
 
 
 void xemusnap_close ( void )
@@ -47,6 +252,15 @@ void xemusnap_close ( void )
 		close(snapfd);
 		snapfd = -1;
 	}
+	unpack_free();
+}
+
+
+static void xemusnap_shutdown ( void )
+{
+	if (async.running)
+		xemusnap_save_async_poll(1);	// do not leave a background save behind (or an orphaned process)
+	xemusnap_close();
 }
 
 
@@ -57,13 +271,25 @@ void xemusnap_init ( const struct xemu_snapshot_definition_st *def )
 	snapdef = def;
 	emu_ident = emu_malloc(strlen(XEMU_SNAPSHOT_SUPPORT) + strlen(framework_ident) + 8);
 	sprintf(emu_ident, "Ident:%s:%s", framework_ident, XEMU_SNAPSHOT_SUPPORT);
-	atexit(xemusnap_close);	
+	atexit(xemusnap_shutdown);
 }
 
 
 int xemusnap_read_file ( void *buffer, size_t size )
 {
 	size_t did = 0;
+	if (unpack.data)
+		return unpack_read(buffer, size);
+	if (memsnap.data) {
+		did = memsnap.size - memsnap.pos;
+		if (!did)
+			return XSNAPERR_NODATA;
+		if (did > size)
+			did = size;
+		memcpy(buffer, memsnap.data + memsnap.pos, did);
+		memsnap.pos += did;
+		return did == size ? 0 : XSNAPERR_TRUNCATED;
+	}
 	while (did < size) {
 		ssize_t r = read(snapfd, buffer, size);
 		if (r < 0)
@@ -81,6 +307,12 @@ int xemusnap_read_file ( void *buffer, size_t size )
 
 int xemusnap_skip_file_bytes ( off_t size )
 {
+	if (memsnap.data) {
+		if (size < 0 || (size_t)size > memsnap.size - memsnap.pos)
+			return XSNAPERR_TRUNCATED;
+		memsnap.pos += size;
+		return 0;
+	}
 	return (lseek(snapfd, size, SEEK_CUR) == (off_t)-1) ? XSNAPERR_IO : 0;
 }
 
@@ -88,6 +320,15 @@ int xemusnap_skip_file_bytes ( off_t size )
 int xemusnap_write_file ( const void *buffer, size_t size )
 {
 	size_t did = 0;
+	if (memsnap.data) {
+		if (memsnap.pos + size > memsnap.size) {
+			memsnap.size = (memsnap.pos + size) * 2;
+			memsnap.data = emu_realloc(memsnap.data, memsnap.size);
+		}
+		memcpy(memsnap.data + memsnap.pos, buffer, size);
+		memsnap.pos += size;
+		return 0;
+	}
 	while (did < size) {
 		ssize_t r = write(snapfd, buffer, size);
 		if (r < 0)
@@ -111,7 +352,7 @@ int xemusnap_read_block_header ( struct xemu_snapshot_block_st *block )
 	// Check
 	if (memcmp(buffer, block_framing_id, 8))
 		return XSNAPERR_FORMAT;
-	if (P_AS_BE32(buffer + 8) != XEMUSNAP_FRAMING_VERSION)
+	if (P_AS_BE32(buffer + 8) > XEMUSNAP_FRAMING_VERSION)	// version 0 is the same without packed sub-blocks
 		return XSNAPERR_FORMAT;
 	if (P_AS_BE32(buffer + 12))
 		return XSNAPERR_FORMAT;
@@ -162,7 +403,7 @@ int xemusnap_skip_sub_blocks ( int num )
 			return ret;
 		if (!size)
 			break;
-		ret = xemusnap_skip_file_bytes(size);
+		ret = xemusnap_skip_file_bytes(size & ~XEMUSNAP_SUB_BLOCK_PACKED);
 		if (ret)
 			return ret;
 		num--;
@@ -176,8 +417,23 @@ int xemusnap_write_sub_block ( const Uint8 *buffer, Uint32 size )
 	int ret;
 	Uint8 sizbuf[4];
 	if (!size && !last_sub_block_size_written)
-		FATAL("Xemu internal error while saving snapshot: there can be no two zero length sub-blocks together, as one is already signals end of sub-blocks!");
+		return XSNAPERR_FORMAT;	// there can be no two zero length sub-blocks together, as one is already signals end of sub-blocks!
 	last_sub_block_size_written = size;
+	if (xemusnap_compression && size >= XEMUSNAP_PACK_MIN_SIZE) {
+		Uint8 *packed = emu_malloc(size + size / 128 + 16);	// worst case: all literal runs
+		Uint32 packed_size = pack_sub_block(buffer, size, packed + 8) + 8;
+		if (packed_size < size) {
+			U32_AS_BE(packed, size);
+			U32_AS_BE(packed + 4, adler32(1, buffer, size));
+			U32_AS_BE(sizbuf, packed_size | XEMUSNAP_SUB_BLOCK_PACKED);
+			ret = xemusnap_write_file(sizbuf, 4);
+			if (!ret)
+				ret = xemusnap_write_file(packed, packed_size);
+			free(packed);
+			return ret;
+		}
+		free(packed);
+	}
 	U32_AS_BE(sizbuf, size);
 	ret = xemusnap_write_file(sizbuf, 4);
 	if (ret)
@@ -221,6 +477,8 @@ static int load_from_open_file ( void )
 				RETURN_XSNAPERR("Truncated file, unexpected end of file (~ %d/%d)", block.counter, block.sub_counter);
 			case XSNAPERR_FORMAT:
 				RETURN_XSNAPERR("Snapshot format error, maybe not a snapshot file, or version mismatch");
+			case XSNAPERR_CHECKSUM:
+				RETURN_XSNAPERR("Checksum error in snapshot block \"%s\" (%d/%d), corrupted file", block.idstr, block.counter, block.sub_counter);
 			case XSNAPERR_IO:
 				RETURN_XSNAPERR("File I/O error while reading snapshot: %s", strerror(errno));
 			case 0:
@@ -249,25 +507,31 @@ static int load_from_open_file ( void )
 					if (ret) goto handle_error;
 					if (!block.sub_size)
 						break;
-					if (block.is_ident) {
-						ret = xemusnap_skip_sub_blocks(0);
+					if (block.sub_size & XEMUSNAP_SUB_BLOCK_PACKED) {
+						block.sub_size &= ~XEMUSNAP_SUB_BLOCK_PACKED;
+						ret = unpack_begin(&block.sub_size);
 						if (ret) goto handle_error;
-					} else {
-						// Block can be "save only", ie no LOAD callback
-						if (def->load) {
-							strcpy(xemusnap_user_error_buffer, "?");
-							ret = def->load(def, &block);
-							if (ret) goto handle_error;
-						} else {
-							ret = xemusnap_skip_sub_blocks(0);
+					}
+					if (block.is_ident || !def->load) {
+						// Block can be "save only", ie no LOAD callback, skip its data (if packed, it's already read)
+						if (!unpack.data) {
+							ret = xemusnap_skip_file_bytes(block.sub_size);
 							if (ret) goto handle_error;
 						}
+					} else {
+						strcpy(xemusnap_user_error_buffer, "?");
+						ret = def->load(def, &block);
+						if (ret) goto handle_error;
+					}
+					if (unpack.data) {
+						ret = unpack_end();
+						if (ret) goto handle_error;
 					}
 					block.sub_counter++;
 				}
 				break;
 			default:
-				FATAL("Xemu snapshot load internal error: unknown xemusnap_read_block() answer: %d", ret);
+				RETURN_XSNAPERR("Xemu snapshot load internal error: unknown xemusnap_read_block() answer: %d", ret);
 		}
 		block.counter++;
 	}
@@ -343,7 +607,7 @@ handle_error:
 		case XSNAPERR_CALLBACK:
 			RETURN_XSNAPERR("Error while saving snapshot block \"%s\": %s", def->idstr, xemusnap_user_error_buffer);
 		default:
-			FATAL("Xemu snapshot save internal error: unknown error code: %d", ret);
+			RETURN_XSNAPERR("Xemu snapshot save internal error: unknown error code: %d", ret);
 	}
 }
 
@@ -362,4 +626,271 @@ int xemusnap_save ( const char *filename )
 	xemusnap_close();
 	return 0;
 }
+
+
+/* Snapshot into/from a memory buffer instead of a file, using the given definition table (which can be a subset
+   of the one given to xemusnap_init(), ie the state blocks only, without the big memory dumps).
+   Saved data is allocated by this function, the caller must free() it. */
+int xemusnap_save_to_memory ( const struct xemu_snapshot_definition_st *def, Uint8 **data, size_t *size )
+{
+	const struct xemu_snapshot_definition_st *def_saved = snapdef;
+	int ret;
+	xemusnap_close();
+	memsnap.size = 0x1000;
+	memsnap.pos = 0;
+	memsnap.data = emu_malloc(memsnap.size);
+	snapdef = def;
+	ret = save_to_open_file();
+	snapdef = def_saved;
+	if (ret) {
+		free(memsnap.data);
+		memsnap.data = NULL;
+		return 1;
+	}
+	*data = emu_realloc(memsnap.data, memsnap.pos);
+	*size = memsnap.pos;
+	memsnap.data = NULL;
+	return 0;
+}
+
+
+int xemusnap_load_from_memory ( const struct xemu_snapshot_definition_st *def, const Uint8 *data, size_t size )
+{
+	const struct xemu_snapshot_definition_st *def_saved = snapdef;
+	int ret;
+	xemusnap_close();
+	memsnap.data = (Uint8*)data;
+	memsnap.size = size;
+	memsnap.pos = 0;
+	snapdef = def;
+	ret = load_from_open_file();
+	snapdef = def_saved;
+	memsnap.data = NULL;
+	unpack_free();
+	return ret;
+}
+
+
+/* Background save. On POSIX hosts the process is forked at the point of the call (it should be a frame
+   boundary), and the child writes the snapshot, while copy-on-write keeps its view of the emulator's state
+   consistent. Elsewhere the snapshot is built into memory first (which is fast), and only the file write is
+   done by a thread. Use xemusnap_save_async_poll() to get the result. */
+
+static int async_rename ( void )
+{
+#ifdef _WIN32
+	unlink(async.filename);	// rename() cannot overwrite an existing file on Windows
+#endif
+	return rename(async.tmpname, async.filename);
+}
+
+
+static void async_free ( void )
+{
+	free(async.filename);
+	free(async.tmpname);
+	async.filename = async.tmpname = NULL;
+	async.running = 0;
+}
+
+
+#ifdef XEMUSNAP_USE_FORK
+static void async_flush_line ( void )
+{
+	if (!async.line_len)
+		return;
+	async.line[async.line_len] = 0;
+	async.line_len = 0;
+	DEBUGPRINT("SNAP: [background] %s" NL, async.line);
+}
+
+
+/* Reads what the child process sent through the pipe: log lines are passed into the log of
+   the emulator, the error message is collected into async.error. Returns non-zero on EOF. */
+static int async_read_pipe ( void )
+{
+	char buf[1024];
+	ssize_t r;
+	while ((r = read(async.pipefd, buf, sizeof buf)) > 0) {
+		int i;
+		for (i = 0; i < r; i++) {
+			char c = buf[i];
+			if (async.error_len >= 0) {
+				if (async.error_len < sizeof(async.error) - 1)
+					async.error[async.error_len++] = c;
+			} else if (!c) {
+				async_flush_line();
+				async.error_len = 0;
+			} else if (c == '\n') {
+				async_flush_line();
+			} else if (c != '\r') {
+				if (async.line_len == sizeof(async.line) - 1)
+					async_flush_line();
+				async.line[async.line_len++] = c;
+			}
+		}
+	}
+	return !r || (errno != EAGAIN && errno != EINTR);
+}
+#else
+static int async_writer_thread ( void *unused )
+{
+	int fd = open(async.tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+	async.ret = 1;
+	if (fd < 0)
+		snprintf(async.error, sizeof async.error, "Cannot create file: %s", strerror(errno));
+	else {
+		size_t did = 0;
+		while (did < async.size) {
+			ssize_t r = write(fd, async.data + did, async.size - did);
+			if (r <= 0)
+				break;
+			did += r;
+		}
+		if (close(fd) || did != async.size) {
+			snprintf(async.error, sizeof async.error, "File I/O error while writing snapshot: %s", strerror(errno));
+			unlink(async.tmpname);
+		} else if (async_rename()) {
+			snprintf(async.error, sizeof async.error, "Cannot rename snapshot file: %s", strerror(errno));
+			unlink(async.tmpname);
+		} else
+			async.ret = 0;
+	}
+	SDL_AtomicSet(&async.finished, 1);
+	return async.ret;
+}
+#endif
+
+
+int xemusnap_save_async ( const char *filename )
+{
+	if (async.running)
+		RETURN_XSNAPERR("Another snapshot save is still in progress");
+	async.filename = emu_strdup(filename);
+	async.tmpname = emu_malloc(strlen(filename) + 5);
+	sprintf(async.tmpname, "%s.tmp", filename);
+#ifdef XEMUSNAP_USE_FORK
+	{
+	int pipefds[2];
+	if (pipe(pipefds)) {
+		async_free();
+		RETURN_XSNAPERR("Cannot create pipe: %s", strerror(errno));
+	}
+	async.pid = fork();
+	if (async.pid < 0) {
+		close(pipefds[0]);
+		close(pipefds[1]);
+		async_free();
+		RETURN_XSNAPERR("Cannot fork: %s", strerror(errno));
+	}
+	if (!async.pid) {
+		// The child process. It must leave with _exit(), without calling the atexit() handlers of the emulator!
+		// Its log would be lost (there is no log writer thread in the child), so it goes to the parent through the pipe.
+		FILE *pipe_fp = fdopen(pipefds[1], "w");
+		int ret;
+		close(pipefds[0]);
+#ifndef DISABLE_DEBUG
+		xemu_log_forked_child(pipe_fp);
+#else
+		debug_fp = pipe_fp;
+#endif
+		snapfd = open(async.tmpname, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+		if (snapfd < 0) {
+			snprintf(xemusnap_error_buffer, sizeof xemusnap_error_buffer, "Cannot create file: %s", strerror(errno));
+			ret = 1;
+		} else {
+			ret = save_to_open_file();
+			if (close(snapfd) && !ret) {
+				snprintf(xemusnap_error_buffer, sizeof xemusnap_error_buffer, "File I/O error while writing snapshot: %s", strerror(errno));
+				ret = 1;
+			}
+			if (!ret && async_rename()) {
+				snprintf(xemusnap_error_buffer, sizeof xemusnap_error_buffer, "Cannot rename snapshot file: %s", strerror(errno));
+				ret = 1;
+			}
+			if (ret)
+				unlink(async.tmpname);
+		}
+		if (pipe_fp) {
+			if (ret) {
+				fputc(0, pipe_fp);
+				fputs(xemusnap_error_buffer, pipe_fp);
+			}
+			fclose(pipe_fp);
+		}
+		_exit(ret);
+	}
+	close(pipefds[1]);
+	async.pipefd = pipefds[0];
+	fcntl(async.pipefd, F_SETFL, fcntl(async.pipefd, F_GETFL) | O_NONBLOCK);
+	async.error_len = -1;
+	async.line_len = 0;
+	}
+#else
+	if (xemusnap_save_to_memory(snapdef, &async.data, &async.size)) {
+		async_free();
+		return 1;
+	}
+	SDL_AtomicSet(&async.finished, 0);
+	async.thread = SDL_CreateThread(async_writer_thread, "Xemu snapshot writer", NULL);
+	if (!async.thread)
+		async_writer_thread(NULL);	// no threads (ie emscripten), do it now
+#endif
+	async.running = 1;
+	return 0;
+}
+
+
+/* Returns with XEMUSNAP_ASYNC_* status. DONE and FAILED are reported only once, then status is IDLE again.
+   On failure, the error message is in xemusnap_error_buffer. If "wait" is non-zero, it waits for the end of the save. */
+int xemusnap_save_async_poll ( int wait )
+{
+	int ret;
+	if (!async.running)
+		return XEMUSNAP_ASYNC_IDLE;
+#ifdef XEMUSNAP_USE_FORK
+	{
+	int status;
+	pid_t pid;
+	if (wait) {
+		// the pipe must be drained till EOF, otherwise a child with lots of log to write would never exit
+		fcntl(async.pipefd, F_SETFL, fcntl(async.pipefd, F_GETFL) & ~O_NONBLOCK);
+		while (!async_read_pipe())
+			;
+	} else
+		async_read_pipe();
+	pid = waitpid(async.pid, &status, wait ? 0 : WNOHANG);
+	if (!pid)
+		return XEMUSNAP_ASYNC_RUNNING;
+	async_read_pipe();	// the rest of it, if the child exited since the read above
+	async_flush_line();
+	if (pid < 0) {
+		snprintf(xemusnap_error_buffer, sizeof xemusnap_error_buffer, "Cannot wait for the snapshot save process: %s", strerror(errno));
+		ret = 1;
+	} else if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+		if (async.error_len > 0) {
+			async.error[async.error_len] = 0;
+			strcpy(xemusnap_error_buffer, async.error);
+		} else
+			strcpy(xemusnap_error_buffer, "Snapshot save process has failed");
+		ret = 1;
+	} else
+		ret = 0;
+	close(async.pipefd);
+	}
+#else
+	if (!wait && !SDL_AtomicGet(&async.finished))
+		return XEMUSNAP_ASYNC_RUNNING;
+	if (async.thread)
+		SDL_WaitThread(async.thread, NULL);
+	async.thread = NULL;
+	ret = async.ret;
+	if (ret)
+		strcpy(xemusnap_error_buffer, async.error);
+	free(async.data);
+	async.data = NULL;
+#endif
+	async_free();
+	return ret ? XEMUSNAP_ASYNC_FAILED : XEMUSNAP_ASYNC_DONE;
+}
 #endif
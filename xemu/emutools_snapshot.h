@@ -25,13 +25,26 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #define XEMUSNAP_MAX_IDENT_LENGTH	64
 #define XEMUSNAP_ERROR_BUFFER_SIZE	256
 #define XEMUSNAP_FIXED_HEADER_SIZE	21
-#define XEMUSNAP_FRAMING_VERSION	0
+#define XEMUSNAP_FRAMING_VERSION	1
+
+/* Framing version 1: if this bit is set in the size field of a sub-block, the sub-block is packed.
+   The size (without this bit) is the size of the packed data in the file, which is: BE32 unpacked size,
+   BE32 Adler-32 checksum of the unpacked data, then the packed stream. Loader callbacks always see the
+   unpacked size in sub_size and unpacked data with xemusnap_read_file(), it's handled transparently. */
+#define XEMUSNAP_SUB_BLOCK_PACKED	0x80000000U
+#define XEMUSNAP_PACK_MIN_SIZE		256
 
 #define XSNAPERR_NODATA		1
 #define XSNAPERR_TRUNCATED	2
 #define XSNAPERR_FORMAT		3
 #define XSNAPERR_IO		4
 #define XSNAPERR_CALLBACK	5
+#define XSNAPERR_CHECKSUM	6
+
+#define XEMUSNAP_ASYNC_IDLE	0
+#define XEMUSNAP_ASYNC_RUNNING	1
+#define XEMUSNAP_ASYNC_DONE	2
+#define XEMUSNAP_ASYNC_FAILED	3
 
 #define RETURN_XSNAPERR_USER(...) \
 	do { \
@@ -67,6 +80,7 @@ struct xemu_snapshot_definition_st {
 
 extern char xemusnap_error_buffer[];
 extern char xemusnap_user_error_buffer[];
+extern int  xemusnap_compression;
 
 
 static inline Uint64 P_AS_BE64 ( const Uint8 *p ) {
@@ -99,6 +113,10 @@ extern int  xemusnap_skip_sub_blocks ( int num );
 extern int  xemusnap_write_sub_block ( const Uint8 *buffer, Uint32 size );
 extern int  xemusnap_load ( const char *filename );
 extern int  xemusnap_save ( const char *filename );
+extern int  xemusnap_save_to_memory ( const struct xemu_snapshot_definition_st *def, Uint8 **data, size_t *size );
+extern int  xemusnap_load_from_memory ( const struct xemu_snapshot_definition_st *def, const Uint8 *data, size_t size );
+extern int  xemusnap_save_async ( const char *filename );
+extern int  xemusnap_save_async_poll ( int wait );
 
 #endif
 #endif
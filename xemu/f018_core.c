@@ -214,7 +214,7 @@ void dma_extended_list( void ){
 
             Uint8 list_val;
  
-            DEBUG("DMA: Extendedlist fetching at Listaddres is [MB=$%02X]$%06X \n" NL, list_megabyte >> 20, dma_list_addr);
+            DEBUGCAT(XLOG_DMA, "DMA: Extendedlist fetching at Listaddres is [MB=$%02X]$%06X \n" NL, list_megabyte >> 20, dma_list_addr);
 #if 0
                 // Ugly workaround for outdated kickstart, it still uses d705 for Source Megabyte and d706 for Target Megabyte
             if (dma_list_addr+list_megabyte==0xfff0000){
@@ -244,7 +244,7 @@ void dma_extended_list( void ){
 #endif
             do{
               list_val=read_dma_list_next();
-              DEBUG("DMA: Extendedlist List value is $%02X now\n", list_val);
+              DEBUGCAT(XLOG_DMA, "DMA: Extendedlist List value is $%02X now\n", list_val);
               switch(list_val){
                   case 0x0a:  // Request Format is Revison A
                       dma_chip_revision=0;
@@ -286,7 +286,7 @@ void dma_extended_list( void ){
                   case 0x00:  // This ends Extended-DMA-List
                       break; 
                   case 0x8d:  // Whatever 
-                      DEBUG("DMA reads 8d 0x%02x%02x\n",read_dma_list_next(),read_dma_list_next());
+                      DEBUGCAT(XLOG_DMA, "DMA reads 8d 0x%02x%02x\n",read_dma_list_next(),read_dma_list_next());
                       break;
                   default:
                       /* Something is going wrong here. Either List adress was false, or values are mixed up
@@ -297,7 +297,7 @@ void dma_extended_list( void ){
                       break;
               }
             }while(list_val);   // a 0 will end the list
-        DEBUG("DMA: Extendedlist finished Listaddres is [MB=$%02X]$%06X now" NL, list_megabyte >> 20, dma_list_addr);
+        DEBUGCAT(XLOG_DMA, "DMA: Extendedlist finished Listaddres is [MB=$%02X]$%06X now" NL, list_megabyte >> 20, dma_list_addr);
 
 
 }
@@ -321,7 +321,7 @@ void dma_write_reg ( int addr, Uint8 data )
 	}
 #else
 	if (addr > 3) {	// in case of C65, the extended registers cannot be written
-		DEBUG("DMA: trying to write M65-specific DMA register (%d) with a C65 ..." NL, addr);
+		DEBUGCAT(XLOG_DMA, "DMA: trying to write M65-specific DMA register (%d) with a C65 ..." NL, addr);
 		return;
 	}
 	dma_registers[addr] = data;
@@ -333,7 +333,7 @@ void dma_write_reg ( int addr, Uint8 data )
 #endif
 		return;	// Only writing register 0 starts the DMA operation, otherwise just return from this function (reg write already happened)
 	if (dma_status) {
-		DEBUG("DMA: WARNING: previous operation is in progress, WORKAROUND: finishing first." NL);
+		DEBUGCAT(XLOG_DMA, "DMA: WARNING: previous operation is in progress, WORKAROUND: finishing first." NL);
 		// Ugly hack: it seems even the C65 ROM issues new DMA commands while the previous is in-progress
 		// It's possible the fault of timing of my emulation.
 		// The current workaround: in this situation we run the DMA to finish the previous operation first.
@@ -351,7 +351,7 @@ void dma_write_reg ( int addr, Uint8 data )
             command = -1;           // signal dma_update() that it's needed to fetch the DMA command, no command is fetched yet
             extended_list=0;
             dma_list_addr = dma_registers[0] | (dma_registers[1] << 8) | ((dma_registers[2] & 15) << 16);
-            DEBUG("DMA: Listaddres is [MB=$%02X]$%06X now" NL, list_megabyte >> 20, dma_list_addr);
+            DEBUGCAT(XLOG_DMA, "DMA: Listaddres is [MB=$%02X]$%06X now" NL, list_megabyte >> 20, dma_list_addr);
         }
         if (addr==0x05){ 
             if (data == 0){    // ugly workaround for using d705 as megabyte offset
@@ -360,13 +360,13 @@ void dma_write_reg ( int addr, Uint8 data )
             command = -2;           // signal dma_update() that it's needed to fetch the DMA extended list , no command is fetched yet
             extended_list=1;
             dma_list_addr = dma_registers[5] | (dma_registers[1] << 8) | ((dma_registers[2] & 15) << 16);
-            DEBUG("DMA: Extendedlist Listaddres is [MB=$%02X]$%06X now" NL, list_megabyte >> 20, dma_list_addr);
+            DEBUGCAT(XLOG_DMA, "DMA: Extendedlist Listaddres is [MB=$%02X]$%06X now" NL, list_megabyte >> 20, dma_list_addr);
         }
 #else	
         dma_list_addr = dma_registers[0] | (dma_registers[1] << 8) | ((dma_registers[2] & 15) << 16);
         command = -1;           // signal dma_update() that it's needed to fetch the DMA command, no command is fetched yet
 #endif
-	DEBUG("DMA: list address is [MB=$%02X]$%06X now, just written to register %d value $%02X" NL, list_megabyte >> 20, dma_list_addr, addr, data);
+	DEBUGCAT(XLOG_DMA, "DMA: list address is [MB=$%02X]$%06X now, just written to register %d value $%02X" NL, list_megabyte >> 20, dma_list_addr, addr, data);
 	dma_status = 0x80;	// DMA is busy now, also to signal the emulator core to call dma_update() in its main loop
 	dma_update_all();	// DMA _stops_ CPU, however FIXME: interrupts can (???) occur, so we need to emulate that somehow later?
 }
@@ -434,7 +434,7 @@ void dma_update ( void )
 			subcommand = read_dma_list_next();
 		modulo       = read_dma_list_next()      ;	// modulo is not so much handled yet, maybe it's not even a 16 bit value
 		modulo      |= read_dma_list_next() <<  8;	// ... however since it's currently not used, it does not matter too much
-                DEBUG("DMA: list content, command:0x%02x length:0x%04x source:0x%02x%04x target:0x%02x%04x modulo:0x%02x" NL,command,length,source_megabyte,source_addr,target_megabyte,target_addr,modulo );
+                DEBUGCAT(XLOG_DMA, "DMA: list content, command:0x%02x length:0x%04x source:0x%02x%04x target:0x%02x%04x modulo:0x%02x" NL,command,length,source_megabyte,source_addr,target_megabyte,target_addr,modulo );
 		
 		if (dma_chip_revision) {
 			// F018B ("new") behaviour
@@ -466,13 +466,13 @@ void dma_update ( void )
 			source_writer	= cb_source_iowriter;
 			source_mask	= 0xFFF;	// 4K I/O size
 			source_cur_megabyte	= dma_phys_io_offset;
-                        DEBUG("DMA: source  IO, command:0x%02x length:0x%04x source:0x%06x target:0x%06x modulo:0x%02x" NL,command,length,source_megabyte+source_addr,target_cur_megabyte+target_addr,modulo );
+                        DEBUGCAT(XLOG_DMA, "DMA: source  IO, command:0x%02x length:0x%04x source:0x%06x target:0x%06x modulo:0x%02x" NL,command,length,source_megabyte+source_addr,target_cur_megabyte+target_addr,modulo );
 		} else {
 			source_reader	= cb_source_mreader;
 			source_writer	= cb_source_mwriter;
 			source_mask	= 0xFFFFF;	// 1Mbyte of "Mbyte slice" size
 			source_cur_megabyte = (source_megabyte<<20);
-                        DEBUG("DMA: source  MEM, command:0x%02x length:0x%04x source:0x%06x target:0x%06x modulo:0x%02x" NL,command,length,source_megabyte+source_addr,target_cur_megabyte+target_addr,modulo );
+                        DEBUGCAT(XLOG_DMA, "DMA: source  MEM, command:0x%02x length:0x%04x source:0x%06x target:0x%06x modulo:0x%02x" NL,command,length,source_megabyte+source_addr,target_cur_megabyte+target_addr,modulo );
 		}
 		/* target selection */
 		if (target_is_io) {
@@ -480,17 +480,17 @@ void dma_update ( void )
 			target_writer	= cb_target_iowriter;
 			target_mask	= 0xFFF;	// 4K I/O size
 			target_cur_megabyte	= dma_phys_io_offset;
-                        DEBUG("DMA: target IO, command:0x%02x length:0x%04x source:0x%06x target:0x%06x modulo:0x%02x" NL,command,length,source_megabyte+source_addr,target_cur_megabyte+target_addr,modulo );
+                        DEBUGCAT(XLOG_DMA, "DMA: target IO, command:0x%02x length:0x%04x source:0x%06x target:0x%06x modulo:0x%02x" NL,command,length,source_megabyte+source_addr,target_cur_megabyte+target_addr,modulo );
 		} else {
 			target_reader	= cb_target_mreader;
 			target_writer	= cb_target_mwriter;
 			target_mask	= 0xFFFFF;	// 1Mbyte of "Mbyte slice" size
 			target_cur_megabyte = (target_megabyte<<20);
-                        DEBUG("DMA: target  MEM, command:0x%02x length:0x%04x source:0x%06x target:0x%06x modulo:0x%02x" NL,command,length,source_megabyte+source_addr,target_cur_megabyte+target_addr,modulo );
+                        DEBUGCAT(XLOG_DMA, "DMA: target  MEM, command:0x%02x length:0x%04x source:0x%06x target:0x%06x modulo:0x%02x" NL,command,length,source_megabyte+source_addr,target_cur_megabyte+target_addr,modulo );
 		}
 		/* other stuff */
 		chained = (command & 4);
-		DEBUG("DMA: READ COMMAND: $%05X[%s%s %d] -> $%05X[%s%s %d] (L=$%04X) CMD=%d (%s)" NL,
+		DEBUGCAT(XLOG_DMA, "DMA: READ COMMAND: $%05X[%s%s %d] -> $%05X[%s%s %d] (L=$%04X) CMD=%d (%s)" NL,
 			source_addr, source_is_io ? "I/O" : "MEM", source_uses_modulo ? " MOD" : "", source_step,
 			target_addr, target_is_io ? "I/O" : "MEM", target_uses_modulo ? " MOD" : "", target_step,
 			length, command, chained ? "chain" : "last"
@@ -500,7 +500,7 @@ void dma_update ( void )
 		return;
 	}
 	// We have valid command to be executed, or continue to execute
-	//DEBUG("DMA: EXECUTING: command=%d length=$%04X" NL, command & 3, length);
+	//DEBUGCAT(XLOG_DMA, "DMA: EXECUTING: command=%d length=$%04X" NL, command & 3, length);
 	switch (command & 3) {
 		case 0:			// COPY command
 			write_target_next(read_source_next());
@@ -515,11 +515,12 @@ void dma_update ( void )
 			write_target_next(source_addr & 0xFF);
 			break;
 	}
+	EMU_METRICS_COUNT(EMU_METRICS_DMA_BYTES, 1);
 	// Check the situation of end of the operation
 	length--;
 	if (length <= 0) {
 		if (chained) {			// chained?
-			DEBUG("DMA: end of operation, but chained!" NL);
+			DEBUGCAT(XLOG_DMA, "DMA: end of operation, but chained!" NL);
 			dma_status = 0x81;	// still busy then, with also bit0 set (chained)
 #ifdef MEGA65
 			if (extended_list){ 
@@ -528,7 +529,7 @@ void dma_update ( void )
 #endif
                         command = -1;              // signal for next DMA command fetch
 		} else {
-			DEBUG("DMA: end of operation, no chained next one." NL);
+			DEBUGCAT(XLOG_DMA, "DMA: end of operation, no chained next one." NL);
 			dma_status = 0;		// end of DMA command
 			command = -1;
 #ifdef MEGA65
@@ -597,7 +598,7 @@ void dma_reset ( void )
 Uint8 dma_read_reg ( int addr )
 {
 	// FIXME: status on ALL registers when read?!
-	DEBUG("DMA: register reading at addr of %d" NL, addr);
+	DEBUGCAT(XLOG_DMA, "DMA: register reading at addr of %d" NL, addr);
 #if 0
 	if ((addr & 3) != 3)
 		return 0xFF;	// other registers are (??????) writeonly? FIXME?
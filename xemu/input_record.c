@@ -0,0 +1,285 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+/* Errors are reported by the return value (and DEBUGPRINT), the caller should
+   notify the user. */
+
+#include "xemu/emutools_basicdefs.h"
+#include <SDL.h>
+#include "xemu/input_record.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+// Provided by emutools.c, and by Xep128's screen.c
+extern Uint32 sdl_winid;
+
+int inputrec_mode = INPUTREC_OFF;
+int inputrec_hold = 0;		// set by the emulator while it's paused (ie by a monitor): frames are not counted, clock does not advance
+
+static FILE  *inputrec_fp = NULL;
+static Uint32 inputrec_frame = 0;
+static time_t inputrec_start_time;
+static Uint64 inputrec_usecs;	// emulated time since the start of the recording
+static struct {
+	Uint32	frame;
+	int	type, a, b, c;
+	int	valid;
+} pending;
+
+
+// Reads the next event of the replay file into "pending".
+static void inputrec_read_next ( void )
+{
+	char line[128];
+	pending.valid = 0;
+	while (fgets(line, sizeof line, inputrec_fp)) {
+		char type;
+		if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+			continue;
+		if (sscanf(line, "%u %c %d %d %d", &pending.frame, &type, &pending.a, &pending.b, &pending.c) != 5) {
+			DEBUGPRINT("INPUTREC: bad line in the replay file, replay stops: %s" NL, line);
+			return;
+		}
+		pending.type = type;
+		pending.valid = 1;
+		return;
+	}
+}
+
+
+/* Starts recording into record_fn or replaying from replay_fn (both can be NULL, but
+   only one of them can be used). Returns 0 if OK, -1 on error. */
+int inputrec_init ( const char *record_fn, const char *replay_fn )
+{
+	char line[128], target[64];
+	int version;
+	long long start_time;
+	if (record_fn && replay_fn) {
+		DEBUGPRINT("INPUTREC: recording and replaying input at the same time is not possible" NL);
+		return -1;
+	}
+	if (record_fn) {
+		inputrec_fp = fopen(record_fn, "w");
+		if (!inputrec_fp) {
+			DEBUGPRINT("INPUTREC: cannot create file %s: %s" NL, record_fn, strerror(errno));
+			return -1;
+		}
+		inputrec_start_time = time(NULL);
+		fprintf(inputrec_fp, "%s %d %s %lld\n", INPUTREC_MAGIC, INPUTREC_VERSION, TARGET_NAME, (long long)inputrec_start_time);
+		inputrec_mode = INPUTREC_RECORD;
+		DEBUGPRINT("INPUTREC: recording input into %s" NL, record_fn);
+	} else if (replay_fn) {
+		inputrec_fp = fopen(replay_fn, "r");
+		if (!inputrec_fp) {
+			DEBUGPRINT("INPUTREC: cannot open file %s: %s" NL, replay_fn, strerror(errno));
+			return -1;
+		}
+		if (
+			!fgets(line, sizeof line, inputrec_fp) ||
+			sscanf(line, INPUTREC_MAGIC " %d %63s %lld", &version, target, &start_time) != 3 || version != INPUTREC_VERSION
+		) {
+			DEBUGPRINT("INPUTREC: file %s is not a valid input recording (or made by another version)" NL, replay_fn);
+			fclose(inputrec_fp);
+			inputrec_fp = NULL;
+			return -1;
+		}
+		if (strcmp(target, TARGET_NAME))
+			DEBUGPRINT("INPUTREC: WARNING: input recording was made by another emulator: %s" NL, target);
+		inputrec_start_time = (time_t)start_time;
+		inputrec_mode = INPUTREC_REPLAY;
+		inputrec_read_next();
+		DEBUGPRINT("INPUTREC: replaying input from %s" NL, replay_fn);
+	} else
+		return 0;
+	inputrec_frame = 0;
+	inputrec_usecs = 0;
+	atexit(inputrec_close);
+	return 0;
+}
+
+
+void inputrec_close ( void )
+{
+	if (inputrec_fp) {
+		fclose(inputrec_fp);
+		inputrec_fp = NULL;
+		DEBUGPRINT("INPUTREC: input %s stopped at frame %u" NL, inputrec_mode == INPUTREC_RECORD ? "recording" : "replay", inputrec_frame);
+	}
+	inputrec_mode = INPUTREC_OFF;
+}
+
+
+/* Should be called with every SDL event polled, if inputrec_mode is not INPUTREC_OFF.
+   Returns non-zero, if the event must be ignored by the caller (live input in replay mode). */
+int inputrec_event ( SDL_Event *e )
+{
+	int type, a, b, c;
+	switch (e->type) {
+		case SDL_KEYDOWN:
+		case SDL_KEYUP:
+			if (e->key.repeat || (e->key.windowID && e->key.windowID != sdl_winid))
+				return inputrec_mode == INPUTREC_REPLAY;	// the emulators ignore these anyway
+			type = 'K';
+			a = e->key.keysym.scancode;
+			b = e->key.keysym.mod;
+			c = e->key.state == SDL_PRESSED;
+			break;
+		case SDL_MOUSEMOTION:
+			if (e->motion.windowID != sdl_winid)
+				return inputrec_mode == INPUTREC_REPLAY;
+			type = 'M';
+			a = e->motion.xrel;
+			b = e->motion.yrel;
+			c = 0;
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+		case SDL_MOUSEBUTTONUP:
+			if (e->button.windowID != sdl_winid)
+				return inputrec_mode == INPUTREC_REPLAY;
+			type = 'B';
+			a = e->button.button;
+			b = e->button.state == SDL_PRESSED;
+			c = 0;
+			break;
+		case SDL_MOUSEWHEEL:
+			if (e->wheel.windowID != sdl_winid)
+				return inputrec_mode == INPUTREC_REPLAY;
+			type = 'W';
+			a = e->wheel.x;
+			b = e->wheel.y;
+			c = e->wheel.direction == SDL_MOUSEWHEEL_FLIPPED;
+			break;
+		case SDL_JOYAXISMOTION:
+			type = 'A';
+			a = e->jaxis.which;
+			b = e->jaxis.axis;
+			c = e->jaxis.value;
+			break;
+		case SDL_JOYBUTTONDOWN:
+		case SDL_JOYBUTTONUP:
+			type = 'J';
+			a = e->jbutton.which;
+			b = e->jbutton.button;
+			c = e->jbutton.state == SDL_PRESSED;
+			break;
+		case SDL_JOYHATMOTION:
+			type = 'H';
+			a = e->jhat.which;
+			b = e->jhat.hat;
+			c = e->jhat.value;
+			break;
+		default:
+			return 0;	// not an input event, always handled by the caller
+	}
+	if (inputrec_mode == INPUTREC_REPLAY)
+		return 1;
+	fprintf(inputrec_fp, "%u %c %d %d %d\n", inputrec_frame, type, a, b, c);
+	return 0;
+}
+
+
+/* In replay mode, fills "e" with the next recorded event of the current frame and
+   returns non-zero. Returns zero, if there is no (more) event for this frame. */
+int inputrec_replay ( SDL_Event *e )
+{
+	if (inputrec_mode != INPUTREC_REPLAY || !pending.valid || pending.frame > inputrec_frame)
+		return 0;
+	memset(e, 0, sizeof(SDL_Event));
+	switch (pending.type) {
+		case 'K':
+			e->type = pending.c ? SDL_KEYDOWN : SDL_KEYUP;
+			e->key.state = pending.c ? SDL_PRESSED : SDL_RELEASED;
+			e->key.windowID = sdl_winid;
+			e->key.keysym.scancode = pending.a;
+			e->key.keysym.sym = SDL_GetKeyFromScancode(pending.a);
+			e->key.keysym.mod = pending.b;
+			break;
+		case 'M':
+			e->type = SDL_MOUSEMOTION;
+			e->motion.windowID = sdl_winid;
+			e->motion.xrel = pending.a;
+			e->motion.yrel = pending.b;
+			break;
+		case 'B':
+			e->type = pending.b ? SDL_MOUSEBUTTONDOWN : SDL_MOUSEBUTTONUP;
+			e->button.windowID = sdl_winid;
+			e->button.button = pending.a;
+			e->button.state = pending.b ? SDL_PRESSED : SDL_RELEASED;
+			break;
+		case 'W':
+			e->type = SDL_MOUSEWHEEL;
+			e->wheel.windowID = sdl_winid;
+			e->wheel.x = pending.a;
+			e->wheel.y = pending.b;
+			e->wheel.direction = pending.c ? SDL_MOUSEWHEEL_FLIPPED : SDL_MOUSEWHEEL_NORMAL;
+			break;
+		case 'A':
+			e->type = SDL_JOYAXISMOTION;
+			e->jaxis.which = pending.a;
+			e->jaxis.axis = pending.b;
+			e->jaxis.value = pending.c;
+			break;
+		case 'J':
+			e->type = pending.c ? SDL_JOYBUTTONDOWN : SDL_JOYBUTTONUP;
+			e->jbutton.which = pending.a;
+			e->jbutton.button = pending.b;
+			e->jbutton.state = pending.c ? SDL_PRESSED : SDL_RELEASED;
+			break;
+		case 'H':
+			e->type = SDL_JOYHATMOTION;
+			e->jhat.which = pending.a;
+			e->jhat.hat = pending.b;
+			e->jhat.value = pending.c;
+			break;
+		default:
+			DEBUGPRINT("INPUTREC: unknown event type '%c' at frame %u, replay stops" NL, pending.type, pending.frame);
+			pending.valid = 0;
+			return 0;
+	}
+	inputrec_read_next();
+	return 1;
+}
+
+
+/* Must be called after the events of a frame are handled, if inputrec_mode is not
+   INPUTREC_OFF. At the end of the replay, live input is enabled again. */
+void inputrec_frame_done ( void )
+{
+	if (inputrec_hold)
+		return;
+	inputrec_frame++;
+	if (inputrec_mode == INPUTREC_REPLAY && !pending.valid) {
+		DEBUGPRINT("INPUTREC: end of the input recording, live input is enabled again" NL);
+		inputrec_close();
+	}
+}
+
+
+
+/* Must be called by the timekeeping instead of reading the host clock, if inputrec_mode is
+   not INPUTREC_OFF. td_em is the emulated time (in microseconds) since the last call. */
+void inputrec_clock ( int td_em, time_t *unix_time )
+{
+	if (!inputrec_hold)
+		inputrec_usecs += td_em;
+	*unix_time = inputrec_start_time + (time_t)(inputrec_usecs / 1000000);
+}
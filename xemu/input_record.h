@@ -0,0 +1,50 @@
+/* Xemu - Somewhat lame emulation (running on Linux/Unix/Windows/OSX, utilizing
+   SDL2) of some 8 bit machines, including the Commodore LCD and Commodore 65
+   and some Mega-65 features as well.
+   Copyright (C)2016 LGB (Gábor Lénárt) <lgblgblgb@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
+
+#ifndef __XEMU_COMMON_INPUT_RECORD_H_INCLUDED
+#define __XEMU_COMMON_INPUT_RECORD_H_INCLUDED
+
+/* Deterministic input recording and replay. Input events are applied only once per
+   emulated frame (when the emulator polls SDL events), so an event is fully defined
+   by the frame number of the poll and the event itself. In record mode every input
+   event is logged with its frame number, in replay mode the live SDL input events
+   are ignored and the logged ones are injected at the very same frame instead.
+   The host clock seen by the emulated machine (TOD, RTC) is driven by the emulated
+   time from the start time of the recording meanwhile, so it's the same on replay.
+   The log is a text file: a header line with the start time, then one event per
+   line: frame, type letter, three numbers. */
+
+#define INPUTREC_OFF		0
+#define INPUTREC_RECORD		1
+#define INPUTREC_REPLAY		2
+
+#define INPUTREC_MAGIC		"XEMU-INPUT"
+#define INPUTREC_VERSION	2
+
+extern int  inputrec_mode;
+extern int  inputrec_hold;
+
+extern int  inputrec_init       ( const char *record_fn, const char *replay_fn );
+extern void inputrec_close      ( void );
+extern int  inputrec_event      ( SDL_Event *e );
+extern int  inputrec_replay     ( SDL_Event *e );
+extern void inputrec_frame_done ( void );
+extern void inputrec_clock      ( int td_em, time_t *unix_time );
+
+#endif
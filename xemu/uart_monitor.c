@@ -18,6 +18,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #include "xemu/emutools.h"
 #ifdef MEGA65
 #include "mega65.h"
+#include "m65_rewind.h"
 #else
 #include "commodore_65.h"
 #endif
@@ -26,6 +27,10 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 
 int  umon_write_size;
 int  umon_send_ok;
+int  umon_bin_mode = UMON_BIN_NONE;
+Uint8 umon_pc_points_map[0x10000 >> 3];
+Uint8 umon_rd_watch_map[0x10000 >> 3];
+Uint8 umon_wr_watch_map[0x10000 >> 3];
 char umon_write_buffer[UMON_WRITE_BUFFER_SIZE];
 
 const char emulator_paused_title[] = "TRACE/PAUSE";
@@ -37,6 +42,7 @@ void uartmon_update ( void ) {}
 void uartmon_close  ( void ) {}
 void uartmon_finish_command ( void ) {}
 int  m65mon_update(void){ return 0;}
+void m65mon_watch_hit ( int type, int addr ) {}
 #else
 
 
@@ -55,15 +61,34 @@ static int  sock_server, sock_client;
 static int  umon_write_pos, umon_read_pos;
 static int  umon_echo;
 static char umon_read_buffer [0x1000];
+static char *umon_read_tail;		// bytes received after the end of the command line (payload of binary load)
+static int  umon_read_tail_size;
+
+/* Binary transfer in progress (see commands 'x' and 'l'), data is streamed directly from/to this buffer */
+static struct {
+	Uint8	*data;
+	Uint32	addr, size, pos;
+} umon_bin;
 
 //#include "cpu65ce02_disasm_tables.c"
 
 
 /* Variables controlling behaviourt of EMU main-loop*/
 int   paused = 0, paused_old = 0;
-static int   breakpoint_pc = -1;
 static int   trace_step_trigger = 0;
 static void (*m65mon_callback)(void) = NULL;
+static int   umon_in_monitor = 0;	// memory accessed by the monitor itself does not trigger watchpoints
+
+static struct umon_point_st {
+	int	type;		// UMON_POINT_*, or zero if the slot is free
+	int	start, end;	// PC value for breakpoints (start == end), or linear address range (inclusive) for watchpoints
+	char	cond_reg;	// register name the condition is about ('A', 'X', 'Y', 'Z', 'B', 'S' or 'P'), or zero for no condition
+	int	cond_val;
+	int	legacy;		// breakpoint set by the 'b' command, which is always replaced by the next one
+	int	hits;
+} umon_points[UMON_MAX_POINTS];
+
+static const char *umon_point_names[] = { "free", "exec", "read", "write" };
 
 
 
@@ -122,6 +147,8 @@ static int check_end_of_command ( char *p, int error_out )
 
 
 
+static void m65mon_points_command ( char *cmd );
+
 static void execute_command ( char *cmd )
 {
 	int par1;
@@ -201,6 +228,37 @@ static void execute_command ( char *cmd )
 			if (cmd && check_end_of_command(cmd, 1))
 				m65mon_breakpoint(par1);
 			break;
+		case 'k':
+			m65mon_points_command(cmd);
+			break;
+		case 'p':
+			if (check_end_of_command(cmd, 1))
+				umon_write_size += emu_metrics_report(umon_write_buffer + umon_write_size, UMON_WRITE_BUFFER_SIZE - umon_write_size - 8, "\r\n");
+			break;
+		case 'x':
+			cmd = parse_hex_arg(cmd, &par1, 0, UMON_BIN_MAX_ADDR);
+			if (cmd) {
+				int par2;
+				cmd = parse_hex_arg(cmd, &par2, 1, UMON_BIN_MAX_SIZE);
+				if (cmd && check_end_of_command(cmd, 1))
+					m65mon_dumpmem_binary(par1, par2);
+			}
+			break;
+		case 'l':
+			cmd = parse_hex_arg(cmd, &par1, 0, UMON_BIN_MAX_ADDR);
+			if (cmd) {
+				int par2;
+				cmd = parse_hex_arg(cmd, &par2, 1, UMON_BIN_MAX_SIZE);
+				if (cmd && check_end_of_command(cmd, 1))
+					m65mon_loadmem_binary(par1, par2);
+			}
+			break;
+#if defined(MEGA65) && defined(XEMU_SNAPSHOT_SUPPORT)
+		case 'w':
+			if (check_end_of_command(cmd, 1))
+				m65mon_rewind();
+			break;
+#endif
 		case 0:
 			m65mon_empty_command(); // emulator can use it, if it wants
 			break;
@@ -267,6 +325,71 @@ void m65mon_storemem24 ( Uint32 addr,char * values )
 
         umon_printf("s%08X",addr);  // On real machine some kind of checksum is returned here. Don't know how to calculate ...
 }
+
+/* Binary transfers. The reply of 'x' is a "B<size>" line followed by exactly <size> raw bytes.
+   The command line of 'l' must be terminated by LF (or CRLF in one write), then exactly <size> raw bytes must follow,
+   which are written into the memory at once when all of them has been received. */
+
+static void umon_bin_reset ( void )
+{
+	free(umon_bin.data);
+	umon_bin.data = NULL;
+	umon_bin_mode = UMON_BIN_NONE;
+}
+
+static int umon_bin_start ( int mode, Uint32 addr, Uint32 size )
+{
+	if (addr + size > UMON_BIN_MAX_ADDR + 1) {
+		umon_printf(SYNTAX_ERROR "binary transfer would go beyond the end of the address space");
+		return 1;
+	}
+	umon_bin.data = malloc(size);
+	if (!umon_bin.data) {
+		umon_printf(SYNTAX_ERROR "not enough memory for the binary transfer");
+		return 1;
+	}
+	umon_bin.addr = addr;
+	umon_bin.size = size;
+	umon_bin.pos = 0;
+	umon_bin_mode = mode;
+	umon_send_ok = 0;	// the command is finished by uartmon_update() when the transfer is done
+	return 0;
+}
+
+static void umon_bin_load_done ( void )
+{
+	Uint32 a;
+	for (a = 0; a < umon_bin.size; a++)
+		write_phys_mem(umon_bin.addr + a, umon_bin.data[a]);
+	umon_printf("s%08X", umon_bin.addr + umon_bin.size);
+	DEBUG("UARTMON: binary load of %u bytes to $%X is done" NL, umon_bin.size, umon_bin.addr);
+	umon_bin_reset();
+}
+
+void m65mon_dumpmem_binary ( Uint32 addr, Uint32 size )
+{
+	Uint32 a;
+	if (umon_bin_start(UMON_BIN_DUMP, addr, size))
+		return;
+	for (a = 0; a < size; a++)	// take the copy at once, so it's consistent even if it takes several frames to send
+		umon_bin.data[a] = read_phys_mem(addr + a);
+	umon_printf("B%08X\r\n", size);
+}
+
+void m65mon_loadmem_binary ( Uint32 addr, Uint32 size )
+{
+	if (umon_bin_start(UMON_BIN_LOAD, addr, size))
+		return;
+	if (umon_read_tail_size) {	// some of the payload may have been arrived together with the command line
+		umon_bin.pos = umon_read_tail_size > size ? size : umon_read_tail_size;
+		memcpy(umon_bin.data, umon_read_tail, umon_bin.pos);
+	}
+	if (umon_bin.pos == size) {
+		umon_bin_load_done();
+		umon_send_ok = 1;
+	}
+}
+
 void m65mon_show_regs ( void )
 {
         umon_printf(
@@ -324,11 +447,190 @@ void m65mon_empty_command ( void )
                 m65mon_do_trace();
 }
 
+/* Breakpoints and watchpoints */
+
+static void umon_points_rebuild_maps ( void )
+{
+	int a, n;
+	memset(umon_pc_points_map, 0, sizeof umon_pc_points_map);
+	memset(umon_rd_watch_map, 0, sizeof umon_rd_watch_map);
+	memset(umon_wr_watch_map, 0, sizeof umon_wr_watch_map);
+	for (a = 0; a < UMON_MAX_POINTS; a++) {
+		Uint8 *map;
+		int shift = 12;
+		switch (umon_points[a].type) {
+			case UMON_POINT_PC:	map = umon_pc_points_map; shift = 0; break;
+			case UMON_POINT_READ:	map = umon_rd_watch_map; break;
+			case UMON_POINT_WRITE:	map = umon_wr_watch_map; break;
+			default:		continue;
+		}
+		for (n = umon_points[a].start >> shift; n <= umon_points[a].end >> shift; n++)
+			map[n >> 3] |= 1 << (n & 7);
+	}
+#ifdef UMON_WATCHPOINTS
+	apply_memory_config();	// direct read pointers must not be used for pages with read watchpoints
+#endif
+}
+
+static int umon_point_add ( int type, int start, int end, char cond_reg, int cond_val, int legacy )
+{
+	int a;
+	for (a = 0; a < UMON_MAX_POINTS; a++)
+		if (!umon_points[a].type) {
+			umon_points[a].type = type;
+			umon_points[a].start = start;
+			umon_points[a].end = end;
+			umon_points[a].cond_reg = cond_reg;
+			umon_points[a].cond_val = cond_val;
+			umon_points[a].legacy = legacy;
+			umon_points[a].hits = 0;
+			umon_points_rebuild_maps();
+			return a;
+		}
+	umon_printf(SYNTAX_ERROR "too many breakpoints/watchpoints (max is %d)", UMON_MAX_POINTS);
+	return -1;
+}
+
+static int umon_point_condition ( const struct umon_point_st *p )
+{
+	int val;
+	switch (p->cond_reg) {
+		case 'A':	val = cpu_a; break;
+		case 'X':	val = cpu_x; break;
+		case 'Y':	val = cpu_y; break;
+		case 'Z':	val = cpu_z; break;
+		case 'B':	val = cpu_bphi >> 8; break;
+		case 'S':	val = cpu_sp; break;
+		case 'P':	val = cpu_get_p(); break;
+		default:	return 1;
+	}
+	return val == p->cond_val;
+}
+
+// Slow path only: the bitmap said there is some point around. Returns non-zero, if really a point is hit.
+static int umon_point_hit ( int type, int addr )
+{
+	int a;
+	for (a = 0; a < UMON_MAX_POINTS; a++)
+		if (umon_points[a].type == type && addr >= umon_points[a].start && addr <= umon_points[a].end && umon_point_condition(&umon_points[a])) {
+			umon_points[a].hits++;
+			if (type == UMON_POINT_PC)
+				fprintf(stderr, "Breakpoint #%d @ $%04X hit, Xemu moves to trace mode after the execution of this opcode." NL, a, addr);
+			else
+				fprintf(stderr, "Watchpoint #%d (%s) @ $%07X hit (PC=$%04X), Xemu moves to trace mode after the execution of this opcode." NL, a, umon_point_names[type], addr, cpu_pc);
+			return 1;
+		}
+	return 0;
+}
+
+void m65mon_watch_hit ( int type, int addr )
+{
+	if (!umon_in_monitor && umon_point_hit(type, addr))
+		paused = 1;
+}
+
 void m65mon_breakpoint ( int brk )
 {
-        breakpoint_pc = brk;
+	int a;
+	for (a = 0; a < UMON_MAX_POINTS; a++)
+		if (umon_points[a].legacy)
+			umon_points[a].type = 0;
+	umon_point_add(UMON_POINT_PC, brk, brk, 0, 0, 1);
 }
 
+static char *umon_parse_condition ( char *p, char *reg, int *val )
+{
+	while (*p == 32)
+		p++;
+	*reg = 0;
+	*val = 0;
+	if (!*p)
+		return p;
+	if (*p >= 'a' && *p <= 'z')
+		*p -= 'a' - 'A';
+	if (!strchr("AXYZBSP", *p) || p[1] != 32) {
+		umon_printf(SYNTAX_ERROR "invalid register name in the condition (A, X, Y, Z, B, S or P is expected)");
+		return NULL;
+	}
+	*reg = *p;
+	return parse_hex_arg(p + 1, val, 0, 0xFF);
+}
+
+// k: list, kb<addr> [<reg> <val>]: breakpoint, kr/kw<start> <end> [<reg> <val>]: read/write watchpoint, kd<n>: delete, kx: delete all
+static void m65mon_points_command ( char *cmd )
+{
+	int type, start, end, val;
+	char reg;
+	switch (*cmd) {
+		case 0:
+			for (type = start = 0; start < UMON_MAX_POINTS; start++)
+				if (umon_points[start].type) {
+					const struct umon_point_st *p = &umon_points[start];
+					if (p->type == UMON_POINT_PC)
+						umon_printf("#%d %-5s $%04X", start, umon_point_names[p->type], p->start);
+					else
+						umon_printf("#%d %-5s $%07X-$%07X", start, umon_point_names[p->type], p->start, p->end);
+					if (p->cond_reg)
+						umon_printf(" if %c=$%02X", p->cond_reg, p->cond_val);
+					umon_printf(" hits=%d\r\n", p->hits);
+					type++;
+				}
+			if (!type)
+				umon_printf("No breakpoints/watchpoints are set");
+			return;
+		case 'b':
+			type = UMON_POINT_PC;
+			cmd = parse_hex_arg(cmd + 1, &start, 0, 0xFFFF);
+			end = start;
+			break;
+		case 'r':
+		case 'w':
+#ifdef UMON_WATCHPOINTS
+			type = *cmd == 'r' ? UMON_POINT_READ : UMON_POINT_WRITE;
+			cmd = parse_hex_arg(cmd + 1, &start, 0, 0xFFFFFFF);
+			if (cmd)
+				cmd = parse_hex_arg(cmd, &end, start, 0xFFFFFFF);
+			break;
+#else
+			umon_printf(SYNTAX_ERROR "watchpoints are not supported by this emulator");
+			return;
+#endif
+		case 'd':
+			cmd = parse_hex_arg(cmd + 1, &start, 0, UMON_MAX_POINTS - 1);
+			if (cmd && check_end_of_command(cmd, 1)) {
+				umon_points[start].type = 0;
+				umon_points_rebuild_maps();
+			}
+			return;
+		case 'x':
+			if (check_end_of_command(cmd + 1, 1)) {
+				memset(umon_points, 0, sizeof umon_points);
+				umon_points_rebuild_maps();
+			}
+			return;
+		default:
+			umon_printf(SYNTAX_ERROR "unknown breakpoint/watchpoint sub-command '%c'", *cmd);
+			return;
+	}
+	if (cmd)
+		cmd = umon_parse_condition(cmd, &reg, &val);
+	if (cmd && check_end_of_command(cmd, 1)) {
+		start = umon_point_add(type, start, end, reg, val, 0);
+		if (start >= 0)
+			umon_printf("#%d", start);
+	}
+}
+
+#if defined(MEGA65) && defined(XEMU_SNAPSHOT_SUPPORT)
+void m65mon_rewind ( void )
+{
+	if (rewind_step_back())
+		umon_printf(SYNTAX_ERROR "no rewind point is available (see option -rewind)");
+	else
+		m65mon_show_regs();
+}
+#endif
+
 /**************************************************************************/
 /*       m65mon_update is called from emulator-mainloop returns pause-mode */
 /**************************************************************************/
@@ -337,6 +639,10 @@ int m65mon_update ( void )
 {
 
     if (paused){
+     if (umon_bin_mode) {	// do not wait for the next frame while a binary transfer is in progress
+            uartmon_update();
+            return (paused);
+     }
      if (m65mon_callback) {  // delayed uart monitor command should be finished ...
             m65mon_callback();
             m65mon_callback = NULL;
@@ -362,10 +668,8 @@ int m65mon_update ( void )
              }
      }
     }else{
-      if (breakpoint_pc == cpu_pc) {
-         fprintf(stderr, "Breakpoint @ $%04X hit, Xemu moves to trace mode after the execution of this opcode." NL, cpu_pc);
+      if (unlikely(UMON_BITMAP_TEST(umon_pc_points_map, cpu_pc)) && umon_point_hit(UMON_POINT_PC, cpu_pc))
          paused = 1;
-      }
     }
         
    
@@ -435,6 +739,7 @@ void uartmon_close  ( void )
 			close(sock_client);
 	}
 	sock_server = -1;
+	umon_bin_reset();
 }
 
 
@@ -456,10 +761,30 @@ void uartmon_finish_command ( void )
 
 
 
+static void client_closed ( const char *msg )
+{
+	close(sock_client);
+	sock_client = -1;
+	umon_bin_reset();
+	fprintf(stderr, "UARTMON: connection closed by peer while %s" NL, msg);
+}
+
+
+
 // Non-blocky I/O for UART monitor emulation.
 // Note: you need to call it "quite often" or it will be terrible slow ...
-// From emulator main update, aka etc 25Hz rate should be Okey ...
+// From emulator main update, aka etc 25Hz rate should be Okey, though during binary transfers (umon_bin_mode
+// is non-zero) the emulator should call it more often, ie on every scanline.
+static void uartmon_update_socket ( void );
+
 void uartmon_update ( void )
+{
+	umon_in_monitor = 1;
+	uartmon_update_socket();
+	umon_in_monitor = 0;
+}
+
+static void uartmon_update_socket ( void )
 {
 	int ret;
 	// If there is no server socket, we can't do anything!
@@ -479,10 +804,14 @@ void uartmon_update ( void )
 			if (set_nonblock(ret)) {
 				close(ret);
 			} else {
+				int bufsize = UMON_SOCKET_BUFFER_SIZE;	// larger kernel buffers for binary transfers (failure is not fatal)
+				setsockopt(ret, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof bufsize);
+				setsockopt(ret, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof bufsize);
 				sock_client = ret;	// "publish" new client socket
 				// Reset reading/writing information
 				umon_write_size = 0;
 				umon_read_pos = 0;
+				umon_bin_reset();
 				fprintf(stderr, "UARTMON: new connection established on socket %d" NL, sock_client);
 			}
 		}
@@ -492,7 +821,7 @@ void uartmon_update ( void )
 		return;
 	// If there is data to write, try to write
 	if (umon_write_size) {
-		if (!umon_send_ok)
+		if (!umon_send_ok && !umon_bin_mode)
 			return;
 		ret = write(sock_client, umon_write_buffer + umon_write_pos, umon_write_size);
 		if (ret >=0 || (errno != EAGAIN && errno != EWOULDBLOCK))
@@ -501,9 +830,7 @@ void uartmon_update ( void )
 				ret, ret < 0 ? strerror(errno) : "OK"
 			);
 		if (ret == 0) { // client socket closed
-			close(sock_client);
-			sock_client = -1;
-			fprintf(stderr, "UARTMON: connection closed by peer while writing" NL);
+			client_closed("writing");
 			return;
 		}
 		if (ret > 0) {
@@ -517,6 +844,40 @@ void uartmon_update ( void )
 			return;	// if we still have bytes to write, return and leave the work for the next update
 	}
 	umon_write_pos = 0;
+	// Binary dump in progress: the header line is written by now, send as much as the socket accepts
+	if (umon_bin_mode == UMON_BIN_DUMP) {
+		while (umon_bin.pos < umon_bin.size) {
+			ret = write(sock_client, umon_bin.data + umon_bin.pos, umon_bin.size - umon_bin.pos);
+			if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+				client_closed("writing binary data");
+				return;
+			}
+			if (ret < 0)
+				return;
+			umon_bin.pos += ret;
+		}
+		DEBUG("UARTMON: binary dump of %u bytes from $%X is done" NL, umon_bin.size, umon_bin.addr);
+		umon_bin_reset();
+		umon_printf("\r\n");
+		uartmon_finish_command();
+		return;
+	}
+	// Binary load in progress: read the payload directly into the transfer buffer
+	if (umon_bin_mode == UMON_BIN_LOAD) {
+		while (umon_bin.pos < umon_bin.size) {
+			ret = read(sock_client, umon_bin.data + umon_bin.pos, umon_bin.size - umon_bin.pos);
+			if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+				client_closed("reading binary data");
+				return;
+			}
+			if (ret < 0)
+				return;
+			umon_bin.pos += ret;
+		}
+		umon_bin_load_done();
+		uartmon_finish_command();
+		return;
+	}
 	// Try to read data
 	ret = read(sock_client, umon_read_buffer + umon_read_pos, sizeof(umon_read_buffer) - umon_read_pos - 1);
 	if (ret >=0 || (errno != EAGAIN && errno != EWOULDBLOCK))
@@ -525,13 +886,12 @@ void uartmon_update ( void )
 			ret, ret < 0 ? strerror(errno) : "OK"
 		);
 	if (ret == 0) { // client socket closed
-		close(sock_client);
-		sock_client = -1;
-		fprintf(stderr, "UARTMON: connection closed by peer while reading" NL);
+		client_closed("reading");
 		return;
 	}
 	if (ret > 0) {
 		/* ECHO: provide echo for the client */
+		umon_read_tail_size = 0;
 		if (umon_echo) {
 			char*p = umon_read_buffer + umon_read_pos;
 			int n = ret;
@@ -540,7 +900,13 @@ void uartmon_update ( void )
 					umon_write_buffer[umon_write_size++] = *(p++);
 				} else {
 					umon_echo = 0; // setting to zero avoids more input to echo, and also signs a complete command
+					if (*p == 13 && n && p[1] == 10) {	// CRLF terminated command
+						*(p++) = 0;
+						n--;
+					}
 					*p = 0; // terminate string in read buffer
+					umon_read_tail = p + 1;	// remember what is after the command (can be binary payload)
+					umon_read_tail_size = n;
 					break;
 				}
 		}
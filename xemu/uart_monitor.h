@@ -23,8 +23,37 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA */
 #define UMON_WRITE_BUFFER_SIZE	0x4000
 #define umon_printf(...)	umon_write_size += sprintf(umon_write_buffer + umon_write_size, __VA_ARGS__)
 
+#define UMON_BIN_NONE		0
+#define UMON_BIN_DUMP		1
+#define UMON_BIN_LOAD		2
+#define UMON_BIN_MAX_ADDR	0xFFFFFFF
+#define UMON_BIN_MAX_SIZE	0x1000000
+#define UMON_SOCKET_BUFFER_SIZE	0x100000
+
+#define UMON_MAX_POINTS		16
+#define UMON_POINT_PC		1
+#define UMON_POINT_READ		2
+#define UMON_POINT_WRITE	3
+
+/* Breakpoints and watchpoints: bitmaps of the 64K PC values and of the 4K pages of the 28 bit linear address space
+   have the bit set if there is any point there, so the emulator only needs to test a bit in the common case.
+   Memory watchpoints work only if the emulator calls UMON_CHECK_WATCH() in its linear memory access functions,
+   and avoids other (direct) paths for pages having the bit set (MEGA65 does this, see UMON_WATCHPOINTS). */
+#define UMON_BITMAP_TEST(map,n)	((map)[(n) >> 3] & (1 << ((n) & 7)))
+#define UMON_CHECK_WATCH(map,type,addr) do { \
+	if (unlikely(UMON_BITMAP_TEST(map, (addr) >> 12))) \
+		m65mon_watch_hit(type, addr); \
+} while (0)
+#ifdef MEGA65
+#define UMON_WATCHPOINTS
+#endif
+
 extern int  umon_write_size;
 extern int  umon_send_ok;
+extern int  umon_bin_mode;
+extern Uint8 umon_pc_points_map[0x10000 >> 3];
+extern Uint8 umon_rd_watch_map[0x10000 >> 3];
+extern Uint8 umon_wr_watch_map[0x10000 >> 3];
 extern char umon_write_buffer[UMON_WRITE_BUFFER_SIZE];
 
 
@@ -42,14 +71,21 @@ extern void m65mon_dumpmem16_bulk(Uint16 addr);
 extern void m65mon_dumpmem24 ( Uint32 addr );
 extern void m65mon_dumpmem24_bulk ( Uint32 addr );
 extern void m65mon_storemem24 ( Uint32 addr,char * values );
+extern void m65mon_dumpmem_binary ( Uint32 addr, Uint32 size );
+extern void m65mon_loadmem_binary ( Uint32 addr, Uint32 size );
 extern void m65mon_do_trace(void);
 extern void m65mon_do_trace_c(void);
 extern void m65mon_set_trace(int n);
 extern void m65mon_breakpoint(int brk);
+extern void m65mon_watch_hit ( int type, int addr );
 extern void m65mon_do_reset(void);
+#if defined(MEGA65) && defined(XEMU_SNAPSHOT_SUPPORT)
+extern void m65mon_rewind(void);
+#endif
 extern void m65mon_empty_command(void); // emulator can use it, if it wants
 
 
 extern const char emulator_paused_title[];
+extern int paused;
 
 #endif
@@ -256,3 +256,34 @@ void via_tick(struct Via65c22 *via, int ticks)
 		}
 	}
 }
+
+
+/* Returns the number of cycles till the next change of the VIA state visible to the CPU
+   (interrupt flags by timer underflow or shift register), or "limit" if it's sooner. Used
+   for fast-forwarding idle CPU loops, which are not allowed to read the counters. */
+int via_cycles_to_next_event(struct Via65c22 *via, int limit)
+{
+	if (via->T2run && via->T2C < limit)
+		limit = via->T2C;
+	if (via->T1run && via->T1C < limit)
+		limit = via->T1C;
+	if (via->SRcount && via->SRcount < limit)
+		limit = via->SRcount;
+	return limit;
+}
+
+
+/* Tells if the register can be read by an idle CPU loop: its value only changes at the
+   events reported by via_cycles_to_next_event() and reading it has no side effects. */
+int via_read_is_idle_safe(int addr)
+{
+	switch (addr & 0xF) {
+		case 0x2: case 0x3:	// DDRB, DDRA
+		case 0x6:		// T1 latch low
+		case 0xB: case 0xC:	// ACR, PCR
+		case 0xD: case 0xE:	// IFR, IER
+			return 1;
+		default:		// ports (reading clears CA/CB flags), counters, shift register
+			return 0;
+	}
+}
@@ -48,5 +48,7 @@ extern void  via_reset(struct Via65c22 *via);
 extern void  via_write(struct Via65c22 *via, int addr, Uint8 data);
 extern Uint8 via_read (struct Via65c22 *via, int addr);
 extern void  via_tick (struct Via65c22 *via, int ticks);
+extern int   via_cycles_to_next_event(struct Via65c22 *via, int limit);
+extern int   via_read_is_idle_safe(int addr);
 
 #endif